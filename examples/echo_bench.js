@@ -0,0 +1,132 @@
+/*
+ * Loopback echo benchmark for the os socket functions
+ *
+ * usage: qjs echo_bench.js [-c connections] [-n round_trips] [-s size] [-u path]
+ *
+ * An echo server and the clients run in the same event loop. Each
+ * client sends a 'size' byte message and waits for it to come back
+ * before sending the next one. With -u, a Unix domain socket bound to
+ * 'path' is used instead of TCP on 127.0.0.1.
+ */
+import * as std from "std";
+import * as os from "os";
+
+var conns = 16, count = 10000, size = 64, unix_path = null;
+var i, args = scriptArgs;
+
+for(i = 1; i < args.length; i++) {
+    switch(args[i]) {
+    case "-c": conns = args[++i] | 0; break;
+    case "-n": count = args[++i] | 0; break;
+    case "-s": size = args[++i] | 0; break;
+    case "-u": unix_path = args[++i]; break;
+    default:
+        std.err.puts("usage: echo_bench.js [-c conns] [-n round_trips] [-s size] [-u path]\n");
+        std.exit(1);
+    }
+}
+
+function check(ret, what)
+{
+    if (ret < 0 && ret !== -std.Error.EINPROGRESS)
+        throw new Error(what + ": " + std.strerror(-ret));
+    return ret;
+}
+
+function start_server(domain, addr)
+{
+    var fd = check(os.socket(domain, os.SOCK_STREAM), "socket");
+    if (domain !== os.AF_UNIX)
+        os.setsockopt(fd, os.SOL_SOCKET, os.SO_REUSEADDR, 1);
+    check(os.bind(fd, addr), "bind");
+    check(os.listen(fd), "listen");
+    os.setReadHandler(fd, function () {
+        var c, buf;
+        while ((c = os.accept(fd)) >= 0) {
+            buf = new ArrayBuffer(65536);
+            os.setReadHandler(c, echo.bind(null, c, buf));
+        }
+    });
+    return fd;
+}
+
+function echo(fd, buf)
+{
+    var n = os.recv(fd, buf, 0, buf.byteLength);
+    if (n > 0) {
+        /* small messages always fit in the socket buffer */
+        os.send(fd, buf, 0, n);
+    } else if (n !== -std.Error.EAGAIN) {
+        os.setReadHandler(fd, null);
+        os.close(fd);
+    }
+}
+
+function start_client(domain, addr, on_done)
+{
+    var fd = check(os.socket(domain, os.SOCK_STREAM), "socket");
+    var buf = new ArrayBuffer(size);
+    var left = count, pending = 0;
+
+    if (domain !== os.AF_UNIX)
+        os.setsockopt(fd, os.IPPROTO_TCP, os.TCP_NODELAY, 1);
+    check(os.connect(fd, addr), "connect");
+    os.setWriteHandler(fd, function () {
+        os.setWriteHandler(fd, null);
+        check(-os.getsockopt(fd, os.SOL_SOCKET, os.SO_ERROR)[0], "connect");
+        pending = size;
+        os.send(fd, buf, 0, size);
+    });
+    os.setReadHandler(fd, function () {
+        var n = check(os.recv(fd, buf, size - pending, pending), "recv");
+        pending -= n;
+        if (pending > 0)
+            return;
+        if (--left === 0) {
+            os.setReadHandler(fd, null);
+            os.close(fd);
+            on_done();
+        } else {
+            pending = size;
+            os.send(fd, buf, 0, size);
+        }
+    });
+}
+
+function main()
+{
+    var domain, addr, srv, t0, running;
+
+    if (unix_path) {
+        domain = os.AF_UNIX;
+        addr = { path: unix_path };
+        os.remove(unix_path);
+    } else {
+        domain = os.AF_INET;
+        addr = { addr: "127.0.0.1", port: 0 };
+    }
+    srv = start_server(domain, addr);
+    if (!unix_path)
+        addr = os.getsockname(srv)[0];
+
+    running = conns;
+    t0 = os.now();
+    for(i = 0; i < conns; i++) {
+        start_client(domain, addr, function () {
+            var dt, total;
+            if (--running > 0)
+                return;
+            dt = os.now() - t0;
+            total = conns * count;
+            os.setReadHandler(srv, null);
+            os.close(srv);
+            if (unix_path)
+                os.remove(unix_path);
+            print(`${conns} connections, ${total} round trips of ${size} bytes in ${dt.toFixed(1)} ms`);
+            print(`${(total / dt * 1000).toFixed(0)} round trips/s, ` +
+                  `${(2 * total * size / dt / 1000).toFixed(1)} MB/s`);
+        });
+    }
+}
+
+main();
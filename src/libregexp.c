@@ -28,6 +28,10 @@
 #include <string.h>
 #include <assert.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "cutils.h"
 #include "libregexp.h"
 
@@ -101,8 +105,25 @@ static const REOpCode reopcode_info[REOP_COUNT] = {
 #define RE_HEADER_CAPTURE_COUNT 1
 #define RE_HEADER_STACK_SIZE    2
 #define RE_HEADER_BYTECODE_LEN  3
+#define RE_HEADER_INFO          7 /* RE_INFO_x flags */
+#define RE_HEADER_PREFIX_LEN    8
+#define RE_HEADER_PREFIX        9 /* RE_PREFIX_MAX 16 bit code units */
+
+#define RE_PREFIX_MAX 16
+
+#define RE_INFO_ANCHORED (1 << 0) /* the regexp starts with '^' */
+#define RE_INFO_LINEAR   (1 << 1) /* can be executed by lre_exec_linear() */
+#define RE_INFO_DFA      (1 << 2) /* supported by the lazy DFA (REDFA) */
+
+/* number of backtracking steps allowed per input character before
+   switching to lre_exec_linear() */
+#define RE_BACKTRACK_BUDGET_MIN      10000
+#define RE_BACKTRACK_BUDGET_PER_CHAR 32
 
-#define RE_HEADER_LEN 7
+#define RE_HEADER_LEN (RE_HEADER_PREFIX + 2 * RE_PREFIX_MAX)
+
+/* length of the loop at the start of the non sticky regexps */
+#define RE_LOOP_LEN 11
 
 static inline int is_digit(int c) {
     return c >= '0' && c <= '9';
@@ -1739,6 +1760,90 @@ static int compute_stack_size(const uint8_t *bc_buf, int bc_buf_len)
     return stack_size_max;
 }
 
+/* Return the RE_INFO_LINEAR and RE_INFO_DFA flags of the regexp */
+static int re_compute_info(const uint8_t *bc_buf, int bc_buf_len,
+                           BOOL multi_line)
+{
+    int pos, opcode, len, info;
+
+    bc_buf += RE_HEADER_LEN;
+    bc_buf_len -= RE_HEADER_LEN;
+    info = RE_INFO_LINEAR | RE_INFO_DFA;
+    pos = 0;
+    while (pos < bc_buf_len) {
+        opcode = bc_buf[pos];
+        len = reopcode_info[opcode].size;
+        switch(opcode) {
+        case REOP_back_reference:
+        case REOP_backward_back_reference:
+        case REOP_lookahead:
+        case REOP_negative_lookahead:
+        case REOP_prev:
+            return 0;
+        case REOP_word_boundary:
+        case REOP_not_word_boundary:
+            /* the DFA states do not contain the previous character */
+            info &= ~RE_INFO_DFA;
+            break;
+        case REOP_line_start:
+        case REOP_line_end:
+            if (multi_line)
+                info &= ~RE_INFO_DFA;
+            break;
+        case REOP_range:
+            len += get_u16(bc_buf + pos + 1) * 4;
+            break;
+        case REOP_range32:
+            len += get_u16(bc_buf + pos + 1) * 8;
+            break;
+        }
+        pos += len;
+    }
+    return info;
+}
+
+/* Find the literal prefix which must be present at the start of a
+   match and store it in the header with the anchor flag, so that
+   lre_exec() can skip the positions which cannot match. */
+static void compute_prefix(REParseState *s, BOOL is_sticky)
+{
+    uint8_t *bc_buf = s->byte_code.buf;
+    int pos, len, opcode;
+    uint32_t c;
+
+    pos = RE_HEADER_LEN + (is_sticky ? 0 : RE_LOOP_LEN);
+    len = 0;
+    for(;;) {
+        opcode = bc_buf[pos];
+        switch(opcode) {
+        case REOP_save_start:
+        case REOP_save_end:
+        case REOP_save_reset:
+            break;
+        case REOP_line_start:
+            if (len == 0 && !(s->re_flags & LRE_FLAG_MULTILINE))
+                bc_buf[RE_HEADER_INFO] |= RE_INFO_ANCHORED;
+            goto done;
+        case REOP_char:
+            /* the characters are canonicalized in ignore case mode */
+            if (s->ignore_case)
+                goto done;
+            c = get_u16(bc_buf + pos + 1);
+            if (c >= 0xd800 && c <= 0xdfff)
+                goto done;
+            put_u16(bc_buf + RE_HEADER_PREFIX + 2 * len, c);
+            if (++len == RE_PREFIX_MAX)
+                goto done;
+            break;
+        default:
+            goto done;
+        }
+        pos += reopcode_info[opcode].size;
+    }
+ done:
+    bc_buf[RE_HEADER_PREFIX_LEN] = len;
+}
+
 /* 'buf' must be a zero terminated UTF-8 string of length buf_len.
    Return NULL if error and allocate an error message in *perror_msg,
    otherwise the compiled bytecode and its length in plen.
@@ -1748,7 +1853,7 @@ uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
                      void *opaque)
 {
     REParseState s_s, *s = &s_s;
-    int stack_size;
+    int stack_size, i;
     BOOL is_sticky;
 
     memset(s, 0, sizeof(*s));
@@ -1772,6 +1877,10 @@ uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
     dbuf_putc(&s->byte_code, 0); /* second element is the number of captures */
     dbuf_putc(&s->byte_code, 0); /* stack size */
     dbuf_put_u32(&s->byte_code, 0); /* bytecode length */
+    dbuf_putc(&s->byte_code, 0); /* info */
+    dbuf_putc(&s->byte_code, 0); /* prefix length */
+    for(i = 0; i < RE_PREFIX_MAX; i++)
+        dbuf_put_u16(&s->byte_code, 0); /* prefix */
 
     if (!is_sticky) {
         /* iterate thru all positions (about the same as .*?( ... ) )
@@ -1817,6 +1926,10 @@ uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
     s->byte_code.buf[RE_HEADER_STACK_SIZE] = stack_size;
     put_u32(s->byte_code.buf + RE_HEADER_BYTECODE_LEN,
             s->byte_code.size - RE_HEADER_LEN);
+    compute_prefix(s, is_sticky);
+    s->byte_code.buf[RE_HEADER_INFO] |=
+        re_compute_info(s->byte_code.buf, s->byte_code.size,
+                        (re_flags & LRE_FLAG_MULTILINE) != 0);
 
     /* add the named groups if needed */
     if (s->group_names.size > (s->capture_count - 1)) {
@@ -1959,6 +2072,10 @@ typedef struct {
     BOOL ignore_case;
     BOOL is_unicode;
     void *opaque; /* used for stack overflow check */
+    /* when it becomes negative, the backtracking is stopped and
+       lre_exec_linear() is used instead */
+    int64_t backtrack_budget;
+    BOOL budget_exceeded;
 
     size_t state_size;
     uint8_t *state_stack;
@@ -2032,6 +2149,10 @@ static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
             no_match:
                 if (no_recurse)
                     return 0;
+                if (unlikely(--s->backtrack_budget < 0)) {
+                    s->budget_exceeded = TRUE;
+                    return -1;
+                }
                 ret = 0;
             recurse:
                 for(;;) {
@@ -2410,6 +2531,919 @@ static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
     }
 }
 
+/* Linear time execution (Pike VM). The threads are run in lock step
+   on each character, in priority order. Two threads in the same state
+   (pc, stack and simple quantifier count) at the same position have
+   the same future, so only the first one (the one with the highest
+   priority) is kept. It gives the same result as the backtracking if
+   the regexp has no back reference nor lookaround. The execution time
+   is proportional to the input length times the number of states. */
+
+typedef struct {
+    const uint8_t *pc;
+    const uint8_t *sq_pc; /* current simple_greedy_quant or NULL */
+    uint32_t sq_count; /* its number of iterations */
+    uint32_t stack_len;
+    /* followed by stack[stack_size_max] and capture[2 * capture_count] */
+} REThread;
+
+typedef struct {
+    uint8_t *buf;
+    size_t len; /* number of threads */
+    size_t size; /* number of allocated threads */
+} REThreadList;
+
+typedef struct {
+    void *opaque;
+    void *(*realloc_func)(void *opaque, void *ptr, size_t size);
+    const uint8_t *cbuf;
+    const uint8_t *cbuf_end;
+    int cbuf_type;
+    BOOL multi_line;
+    /* if TRUE, the threads at REOP_line_end before the end of the
+       input are added to the list instead of being dropped */
+    BOOL line_end_pending;
+    int capture_count; /* 0 if the captures are not recorded */
+    int stack_size_max;
+    size_t thread_size;
+    REThreadList lists[2];
+    REThreadList work; /* pending branches of the current closure */
+    REThreadList visited; /* states reached at the current position */
+    uint32_t *hash; /* index in 'visited' + 1 or 0 if free */
+    uint32_t hash_size;
+    REThread *tmp;
+} REPikeVM;
+
+/* value pushed by push_char_pos: the positions are only compared to
+   the current one by check_advance */
+#define RE_CHAR_POS_CUR  ((StackInt)-1)
+#define RE_CHAR_POS_PREV ((StackInt)-2)
+
+static inline StackInt *re_thread_stack(REThread *t)
+{
+    return (StackInt *)(t + 1);
+}
+
+static inline uint8_t **re_thread_capture(REPikeVM *vm, REThread *t)
+{
+    return (uint8_t **)(re_thread_stack(t) + vm->stack_size_max);
+}
+
+static inline REThread *re_thread_get(REPikeVM *vm, REThreadList *l,
+                                      size_t idx)
+{
+    return (REThread *)(l->buf + idx * vm->thread_size);
+}
+
+/* append a copy of 't' to 'l' */
+static int re_thread_push(REPikeVM *vm, REThreadList *l, const REThread *t)
+{
+    uint8_t *new_buf;
+    size_t new_size;
+
+    if (unlikely(l->len >= l->size)) {
+        new_size = max_int(16, l->size * 3 / 2);
+        new_buf = vm->realloc_func(vm->opaque, l->buf,
+                                   new_size * vm->thread_size);
+        if (!new_buf)
+            return -1;
+        l->buf = new_buf;
+        l->size = new_size;
+    }
+    memcpy(l->buf + l->len * vm->thread_size, t, vm->thread_size);
+    l->len++;
+    return 0;
+}
+
+static uint32_t re_thread_hash(const REThread *t)
+{
+    const StackInt *stack = re_thread_stack((REThread *)t);
+    uint32_t h, i;
+
+    h = (uintptr_t)t->pc * 263 + (uintptr_t)t->sq_pc;
+    h = h * 263 + t->sq_count;
+    for(i = 0; i < t->stack_len; i++)
+        h = h * 263 + (uint32_t)stack[i];
+    return h * 0x9e3779b1;
+}
+
+static BOOL re_thread_same_state(REThread *t1, REThread *t2)
+{
+    return t1->pc == t2->pc && t1->sq_pc == t2->sq_pc &&
+        t1->sq_count == t2->sq_count && t1->stack_len == t2->stack_len &&
+        !memcmp(re_thread_stack(t1), re_thread_stack(t2),
+                t1->stack_len * sizeof(StackInt));
+}
+
+static int re_pikevm_resize_hash(REPikeVM *vm)
+{
+    uint32_t *new_hash, new_size, i, h;
+
+    new_size = max_int(64, vm->hash_size * 2);
+    new_hash = vm->realloc_func(vm->opaque, vm->hash,
+                                new_size * sizeof(vm->hash[0]));
+    if (!new_hash)
+        return -1;
+    memset(new_hash, 0, new_size * sizeof(vm->hash[0]));
+    vm->hash = new_hash;
+    vm->hash_size = new_size;
+    for(i = 0; i < vm->visited.len; i++) {
+        h = re_thread_hash(re_thread_get(vm, &vm->visited, i));
+        while (new_hash[h & (new_size - 1)] != 0)
+            h++;
+        new_hash[h & (new_size - 1)] = i + 1;
+    }
+    return 0;
+}
+
+/* Return 1 if the state of 't' was already reached at the current
+   position, 0 if not (it is then marked as reached) or -1 if memory
+   error. */
+static int re_pikevm_visit(REPikeVM *vm, REThread *t)
+{
+    uint32_t h, idx;
+
+    if (unlikely(vm->visited.len * 2 >= vm->hash_size)) {
+        if (re_pikevm_resize_hash(vm))
+            return -1;
+    }
+    h = re_thread_hash(t);
+    for(;;) {
+        idx = vm->hash[h & (vm->hash_size - 1)];
+        if (idx == 0)
+            break;
+        if (re_thread_same_state(re_thread_get(vm, &vm->visited, idx - 1), t))
+            return 1;
+        h++;
+    }
+    if (re_thread_push(vm, &vm->visited, t))
+        return -1;
+    vm->hash[h & (vm->hash_size - 1)] = vm->visited.len;
+    return 0;
+}
+
+static void re_pikevm_new_position(REPikeVM *vm)
+{
+    vm->visited.len = 0;
+    if (vm->hash)
+        memset(vm->hash, 0, vm->hash_size * sizeof(vm->hash[0]));
+}
+
+/* Add to 'l', in priority order, the threads waiting for a character
+   or at the end of the regexp which are reachable from 't0' at
+   position 'cptr'. */
+static int re_pikevm_add(REPikeVM *vm, REThreadList *l, const REThread *t0,
+                         const uint8_t *cptr)
+{
+    REThread *t = vm->tmp;
+    const uint8_t *pc, *pc1;
+    StackInt *stack;
+    uint8_t **capture;
+    uint32_t val, val2, c, quant_min, quant_max;
+    int opcode, cbuf_type = vm->cbuf_type, ret;
+    BOOL v1, v2;
+
+    vm->work.len = 0;
+    if (re_thread_push(vm, &vm->work, t0))
+        return -1;
+    while (vm->work.len > 0) {
+        vm->work.len--;
+        memcpy(t, re_thread_get(vm, &vm->work, vm->work.len), vm->thread_size);
+        stack = re_thread_stack(t);
+        capture = re_thread_capture(vm, t);
+        for(;;) {
+            ret = re_pikevm_visit(vm, t);
+            if (ret < 0)
+                return -1;
+            if (ret)
+                break;
+            pc = t->pc;
+            opcode = *pc;
+            switch(opcode) {
+            case REOP_match:
+                if (t->sq_pc) {
+                    /* end of an iteration of a simple quantifier */
+                    pc1 = t->sq_pc;
+                    quant_min = get_u32(pc1 + 5);
+                    quant_max = get_u32(pc1 + 9);
+                    if (t->sq_count < quant_min || quant_max != INT32_MAX)
+                        t->sq_count++;
+                    if (t->sq_count >= quant_min) {
+                        if (t->sq_count < quant_max) {
+                            /* exit in lower priority */
+                            t->pc = pc1 + 17 + get_u32(pc1 + 1);
+                            t->sq_pc = NULL;
+                            val = t->sq_count;
+                            t->sq_count = 0;
+                            if (re_thread_push(vm, &vm->work, t))
+                                return -1;
+                            t->sq_pc = pc1;
+                            t->sq_count = val;
+                            t->pc = pc1 + 17;
+                        } else {
+                            t->pc = pc1 + 17 + get_u32(pc1 + 1);
+                            t->sq_pc = NULL;
+                            t->sq_count = 0;
+                        }
+                    } else {
+                        t->pc = pc1 + 17;
+                    }
+                    continue;
+                }
+                goto add_thread;
+            case REOP_char:
+            case REOP_char32:
+            case REOP_dot:
+            case REOP_any:
+            case REOP_range:
+            case REOP_range32:
+            add_thread:
+                if (re_thread_push(vm, l, t))
+                    return -1;
+                goto next_thread;
+            case REOP_goto:
+                t->pc = pc + 5 + (int)get_u32(pc + 1);
+                break;
+            case REOP_split_goto_first:
+            case REOP_split_next_first:
+                val = get_u32(pc + 1);
+                if (opcode == REOP_split_next_first) {
+                    t->pc = pc + 5 + (int)val;
+                    pc1 = pc + 5;
+                } else {
+                    t->pc = pc + 5;
+                    pc1 = pc + 5 + (int)val;
+                }
+                /* the lower priority branch is explored later */
+                if (re_thread_push(vm, &vm->work, t))
+                    return -1;
+                t->pc = pc1;
+                break;
+            case REOP_line_start:
+                if (cptr != vm->cbuf) {
+                    if (!vm->multi_line)
+                        goto next_thread;
+                    PEEK_PREV_CHAR(c, cptr, vm->cbuf, cbuf_type);
+                    if (!is_line_terminator(c))
+                        goto next_thread;
+                }
+                t->pc = pc + 1;
+                break;
+            case REOP_line_end:
+                if (cptr != vm->cbuf_end) {
+                    if (vm->line_end_pending)
+                        goto add_thread;
+                    if (!vm->multi_line)
+                        goto next_thread;
+                    PEEK_CHAR(c, cptr, vm->cbuf_end, cbuf_type);
+                    if (!is_line_terminator(c))
+                        goto next_thread;
+                }
+                t->pc = pc + 1;
+                break;
+            case REOP_word_boundary:
+            case REOP_not_word_boundary:
+                if (cptr == vm->cbuf) {
+                    v1 = FALSE;
+                } else {
+                    PEEK_PREV_CHAR(c, cptr, vm->cbuf, cbuf_type);
+                    v1 = is_word_char(c);
+                }
+                if (cptr >= vm->cbuf_end) {
+                    v2 = FALSE;
+                } else {
+                    PEEK_CHAR(c, cptr, vm->cbuf_end, cbuf_type);
+                    v2 = is_word_char(c);
+                }
+                if (v1 ^ v2 ^ (REOP_not_word_boundary - opcode))
+                    goto next_thread;
+                t->pc = pc + 1;
+                break;
+            case REOP_save_start:
+            case REOP_save_end:
+                if (vm->capture_count != 0) {
+                    val = pc[1];
+                    capture[2 * val + opcode - REOP_save_start] =
+                        (uint8_t *)cptr;
+                }
+                t->pc = pc + 2;
+                break;
+            case REOP_save_reset:
+                if (vm->capture_count != 0) {
+                    val = pc[1];
+                    val2 = pc[2];
+                    while (val <= val2) {
+                        capture[2 * val] = NULL;
+                        capture[2 * val + 1] = NULL;
+                        val++;
+                    }
+                }
+                t->pc = pc + 3;
+                break;
+            case REOP_push_i32:
+                stack[t->stack_len++] = get_u32(pc + 1);
+                t->pc = pc + 5;
+                break;
+            case REOP_drop:
+                stack[--t->stack_len] = 0;
+                t->pc = pc + 1;
+                break;
+            case REOP_loop:
+                t->pc = pc + 5;
+                if (--stack[t->stack_len - 1] != 0)
+                    t->pc += (int)get_u32(pc + 1);
+                break;
+            case REOP_push_char_pos:
+                stack[t->stack_len++] = RE_CHAR_POS_CUR;
+                t->pc = pc + 1;
+                break;
+            case REOP_check_advance:
+                t->stack_len--;
+                if (stack[t->stack_len] == RE_CHAR_POS_CUR)
+                    goto next_thread;
+                stack[t->stack_len] = 0;
+                t->pc = pc + 1;
+                break;
+            case REOP_simple_greedy_quant:
+                quant_min = get_u32(pc + 5);
+                t->sq_pc = pc;
+                t->sq_count = 0;
+                t->pc = pc + 17;
+                if (quant_min == 0) {
+                    /* skip the atom in lower priority */
+                    t->pc = pc + 17 + get_u32(pc + 1);
+                    t->sq_pc = NULL;
+                    if (re_thread_push(vm, &vm->work, t))
+                        return -1;
+                    t->sq_pc = pc;
+                    t->pc = pc + 17;
+                }
+                break;
+            default:
+                abort();
+            }
+        }
+    next_thread: ;
+    }
+    return 0;
+}
+
+/* Return TRUE if the character 'c' ('c_canon' in ignore case mode)
+   matches the opcode at 'pc'. 'len' is set to the opcode length. */
+static BOOL re_pikevm_match_char(const uint8_t *pc, uint32_t c,
+                                 uint32_t c_canon, int *plen)
+{
+    uint32_t low, high, idx_min, idx_max, idx, n;
+
+    switch(pc[0]) {
+    case REOP_char:
+        *plen = 3;
+        return get_u16(pc + 1) == c_canon;
+    case REOP_char32:
+        *plen = 5;
+        return get_u32(pc + 1) == c_canon;
+    case REOP_dot:
+        *plen = 1;
+        return !is_line_terminator(c);
+    case REOP_any:
+        *plen = 1;
+        return TRUE;
+    case REOP_range:
+        n = get_u16(pc + 1);
+        *plen = 3 + n * 4;
+        pc += 3;
+        high = get_u16(pc + (n - 1) * 4 + 2);
+        /* 0xffff in for last value means +infinity */
+        if (c_canon >= 0xffff && high == 0xffff)
+            return TRUE;
+        idx_min = 0;
+        idx_max = n - 1;
+        while (idx_min <= idx_max && idx_max != (uint32_t)-1) {
+            idx = (idx_min + idx_max) / 2;
+            low = get_u16(pc + idx * 4);
+            high = get_u16(pc + idx * 4 + 2);
+            if (c_canon < low)
+                idx_max = idx - 1;
+            else if (c_canon > high)
+                idx_min = idx + 1;
+            else
+                return TRUE;
+        }
+        return FALSE;
+    case REOP_range32:
+        n = get_u16(pc + 1);
+        *plen = 3 + n * 8;
+        pc += 3;
+        idx_min = 0;
+        idx_max = n - 1;
+        while (idx_min <= idx_max && idx_max != (uint32_t)-1) {
+            idx = (idx_min + idx_max) / 2;
+            low = get_u32(pc + idx * 8);
+            high = get_u32(pc + idx * 8 + 4);
+            if (c_canon < low)
+                idx_max = idx - 1;
+            else if (c_canon > high)
+                idx_min = idx + 1;
+            else
+                return TRUE;
+        }
+        return FALSE;
+    default:
+        abort();
+    }
+}
+
+/* Return 1 if match, 0 if not match or -1 if error. */
+static int lre_exec_linear(REExecContext *s, uint8_t **capture,
+                           const uint8_t *pc, const uint8_t *cptr)
+{
+    REPikeVM vm_s, *vm = &vm_s;
+    REThreadList *clist, *nlist, *tmp_list;
+    REThread *t, *t1;
+    const uint8_t *cptr1;
+    uint32_t c, c_canon;
+    StackInt *stack;
+    size_t i;
+    int j, len, ret;
+
+    memset(vm, 0, sizeof(*vm));
+    vm->opaque = s->opaque;
+    vm->realloc_func = lre_realloc;
+    vm->cbuf = s->cbuf;
+    vm->cbuf_end = s->cbuf_end;
+    vm->cbuf_type = s->cbuf_type;
+    vm->multi_line = s->multi_line;
+    vm->capture_count = s->capture_count;
+    vm->stack_size_max = s->stack_size_max;
+    vm->thread_size = sizeof(REThread) +
+        s->stack_size_max * sizeof(StackInt) +
+        s->capture_count * 2 * sizeof(capture[0]);
+    ret = -1;
+    vm->tmp = lre_realloc(s->opaque, NULL, vm->thread_size * 2);
+    if (!vm->tmp)
+        goto done;
+    t1 = (REThread *)((uint8_t *)vm->tmp + vm->thread_size);
+    t1->pc = pc;
+    t1->sq_pc = NULL;
+    t1->sq_count = 0;
+    t1->stack_len = 0;
+    for(j = 0; j < s->capture_count * 2; j++)
+        re_thread_capture(vm, t1)[j] = NULL;
+
+    clist = &vm->lists[0];
+    nlist = &vm->lists[1];
+    re_pikevm_new_position(vm);
+    if (re_pikevm_add(vm, clist, t1, cptr))
+        goto done;
+    ret = 0;
+    c = c_canon = 0;
+    while (clist->len != 0) {
+        cptr1 = cptr;
+        if (cptr < s->cbuf_end) {
+            GET_CHAR(c, cptr1, s->cbuf_end, s->cbuf_type);
+            c_canon = c;
+            if (s->ignore_case)
+                c_canon = lre_canonicalize(c, s->is_unicode);
+        }
+        nlist->len = 0;
+        re_pikevm_new_position(vm);
+        for(i = 0; i < clist->len; i++) {
+            t = re_thread_get(vm, clist, i);
+            if (*t->pc == REOP_match) {
+                /* the threads of lower priority are dropped */
+                memcpy(capture, re_thread_capture(vm, t),
+                       s->capture_count * 2 * sizeof(capture[0]));
+                ret = 1;
+                break;
+            }
+            if (cptr >= s->cbuf_end ||
+                !re_pikevm_match_char(t->pc, c, c_canon, &len))
+                continue;
+            memcpy(t1, t, vm->thread_size);
+            t1->pc += len;
+            stack = re_thread_stack(t1);
+            for(j = 0; j < t1->stack_len; j++) {
+                if (stack[j] == RE_CHAR_POS_CUR)
+                    stack[j] = RE_CHAR_POS_PREV;
+            }
+            if (re_pikevm_add(vm, nlist, t1, cptr1)) {
+                ret = -1;
+                goto done;
+            }
+        }
+        if (cptr >= s->cbuf_end)
+            break;
+        tmp_list = clist;
+        clist = nlist;
+        nlist = tmp_list;
+        cptr = cptr1;
+    }
+ done:
+    lre_realloc(s->opaque, vm->lists[0].buf, 0);
+    lre_realloc(s->opaque, vm->lists[1].buf, 0);
+    lre_realloc(s->opaque, vm->work.buf, 0);
+    lre_realloc(s->opaque, vm->visited.buf, 0);
+    lre_realloc(s->opaque, vm->hash, 0);
+    lre_realloc(s->opaque, vm->tmp, 0);
+    return ret;
+}
+
+/* Lazy DFA. Each state is the set of the Pike VM threads (without
+   captures) waiting for a character, at the end of the regexp or at
+   a '$' assertion. The states and their transitions are computed when
+   they are first needed and the transitions on the ASCII characters
+   are cached. It only tells if there is a match, but it does it with
+   one table lookup per character. */
+
+#define RE_DFA_MAX_STATES  256
+#define RE_DFA_MAX_THREADS 8192 /* total number of threads in the states */
+#define RE_DFA_HASH_SIZE   512 /* power of two */
+#define RE_DFA_ASCII       128
+
+#define RE_DFA_STATE_MATCH     (1 << 0) /* a thread is at the end of the regexp */
+#define RE_DFA_STATE_AT_START  (1 << 1) /* start of input */
+#define RE_DFA_STATE_END_DONE  (1 << 2) /* RE_DFA_STATE_END_MATCH is computed */
+#define RE_DFA_STATE_END_MATCH (1 << 3) /* match if at the end of input */
+
+typedef struct {
+    uint32_t hash;
+    uint16_t hash_next; /* next state index + 1 in the hash chain or 0 */
+    uint8_t flags;
+    uint32_t thread_start; /* first thread in dfa->threads */
+    uint32_t thread_count;
+    uint16_t next[RE_DFA_ASCII]; /* next state index + 1 or 0 if not computed */
+} REDFAState;
+
+struct REDFA {
+    REPikeVM vm;
+    const uint8_t *bc_buf;
+    BOOL ignore_case;
+    BOOL is_unicode;
+    BOOL is_failed; /* too many states or memory error */
+    REDFAState *states;
+    int state_count;
+    int state_size;
+    REThreadList threads; /* threads of all the states */
+    uint16_t hash[RE_DFA_HASH_SIZE]; /* state index + 1 or 0 */
+    uint16_t start_state[2]; /* state index + 1 or 0, indexed by 'at_start' */
+};
+
+/* The DFA states do not depend on the input, so the assertions are
+   evaluated on these positions (start of input, inside, end of input) */
+static const uint8_t re_dfa_pos[3];
+
+static int re_thread_cmp(const void *a, const void *b, void *opaque)
+{
+    REThread *t1 = (REThread *)a;
+    REThread *t2 = (REThread *)b;
+
+    if (t1->pc != t2->pc)
+        return t1->pc < t2->pc ? -1 : 1;
+    if (t1->sq_pc != t2->sq_pc)
+        return t1->sq_pc < t2->sq_pc ? -1 : 1;
+    if (t1->sq_count != t2->sq_count)
+        return t1->sq_count < t2->sq_count ? -1 : 1;
+    if (t1->stack_len != t2->stack_len)
+        return t1->stack_len < t2->stack_len ? -1 : 1;
+    return memcmp(re_thread_stack(t1), re_thread_stack(t2),
+                  t1->stack_len * sizeof(StackInt));
+}
+
+/* Return the index of the state containing the threads of 'l' or -1
+   if the DFA is too large or memory error. */
+static int re_dfa_find_state(REDFA *dfa, REThreadList *l, int flags)
+{
+    REPikeVM *vm = &dfa->vm;
+    REDFAState *st, *new_states;
+    REThread *t;
+    uint32_t h, i;
+    int idx, new_size;
+
+    /* the threads are sorted so that the order in which they were
+       reached does not create new states */
+    rqsort(l->buf, l->len, vm->thread_size, re_thread_cmp, NULL);
+    h = flags;
+    for(i = 0; i < l->len; i++)
+        h = h * 31 + re_thread_hash(re_thread_get(vm, l, i));
+
+    for(idx = dfa->hash[h & (RE_DFA_HASH_SIZE - 1)] - 1; idx >= 0;
+        idx = st->hash_next - 1) {
+        st = &dfa->states[idx];
+        if (st->hash != h || st->thread_count != l->len ||
+            (st->flags & RE_DFA_STATE_AT_START) != flags)
+            continue;
+        for(i = 0; i < l->len; i++) {
+            if (!re_thread_same_state(re_thread_get(vm, &dfa->threads,
+                                                    st->thread_start + i),
+                                      re_thread_get(vm, l, i)))
+                break;
+        }
+        if (i == l->len)
+            return idx;
+    }
+
+    if (dfa->state_count >= RE_DFA_MAX_STATES ||
+        dfa->threads.len + l->len > RE_DFA_MAX_THREADS)
+        return -1;
+    if (dfa->state_count >= dfa->state_size) {
+        new_size = max_int(8, dfa->state_size * 2);
+        new_states = vm->realloc_func(vm->opaque, dfa->states,
+                                      new_size * sizeof(dfa->states[0]));
+        if (!new_states)
+            return -1;
+        dfa->states = new_states;
+        dfa->state_size = new_size;
+    }
+    idx = dfa->state_count;
+    st = &dfa->states[idx];
+    memset(st, 0, sizeof(*st));
+    st->hash = h;
+    st->flags = flags;
+    st->thread_start = dfa->threads.len;
+    st->thread_count = l->len;
+    for(i = 0; i < l->len; i++) {
+        t = re_thread_get(vm, l, i);
+        if (*t->pc == REOP_match)
+            st->flags |= RE_DFA_STATE_MATCH;
+        if (re_thread_push(vm, &dfa->threads, t))
+            return -1;
+    }
+    st->hash_next = dfa->hash[h & (RE_DFA_HASH_SIZE - 1)];
+    dfa->hash[h & (RE_DFA_HASH_SIZE - 1)] = idx + 1;
+    dfa->state_count++;
+    return idx;
+}
+
+static int re_dfa_start_state(REDFA *dfa, BOOL at_start)
+{
+    REPikeVM *vm = &dfa->vm;
+    REThread *t = (REThread *)((uint8_t *)vm->tmp + vm->thread_size);
+
+    memset(t, 0, vm->thread_size);
+    t->pc = dfa->bc_buf + RE_HEADER_LEN;
+    vm->lists[0].len = 0;
+    re_pikevm_new_position(vm);
+    if (re_pikevm_add(vm, &vm->lists[0], t, &re_dfa_pos[at_start ? 0 : 1]))
+        return -1;
+    return re_dfa_find_state(dfa, &vm->lists[0],
+                             at_start ? RE_DFA_STATE_AT_START : 0);
+}
+
+/* Return the index of the state reached from state 'idx' after the
+   character 'c' or -1 if error. */
+static int re_dfa_next_state(REDFA *dfa, int idx, uint32_t c)
+{
+    REPikeVM *vm = &dfa->vm;
+    REDFAState *st = &dfa->states[idx];
+    REThread *t, *t1 = (REThread *)((uint8_t *)vm->tmp + vm->thread_size);
+    StackInt *stack;
+    uint32_t c_canon, i, j;
+    int len;
+
+    c_canon = c;
+    if (dfa->ignore_case)
+        c_canon = lre_canonicalize(c, dfa->is_unicode);
+    vm->lists[0].len = 0;
+    re_pikevm_new_position(vm);
+    for(i = 0; i < st->thread_count; i++) {
+        t = re_thread_get(vm, &dfa->threads, st->thread_start + i);
+        if (*t->pc == REOP_match || *t->pc == REOP_line_end ||
+            !re_pikevm_match_char(t->pc, c, c_canon, &len))
+            continue;
+        memcpy(t1, t, vm->thread_size);
+        t1->pc += len;
+        stack = re_thread_stack(t1);
+        for(j = 0; j < t1->stack_len; j++) {
+            if (stack[j] == RE_CHAR_POS_CUR)
+                stack[j] = RE_CHAR_POS_PREV;
+        }
+        if (re_pikevm_add(vm, &vm->lists[0], t1, &re_dfa_pos[1]))
+            return -1;
+    }
+    return re_dfa_find_state(dfa, &vm->lists[0], 0);
+}
+
+/* Return TRUE if the state 'idx' matches at the end of the input or
+   -1 if error. */
+static int re_dfa_end_match(REDFA *dfa, int idx)
+{
+    REPikeVM *vm = &dfa->vm;
+    REDFAState *st = &dfa->states[idx];
+    REThread *t;
+    const uint8_t *cptr;
+    uint32_t i;
+    int ret;
+
+    if (!(st->flags & RE_DFA_STATE_END_DONE)) {
+        /* a start state at the end of input means that the input is
+           empty: the position is both the start and the end */
+        cptr = &re_dfa_pos[2];
+        if (st->flags & RE_DFA_STATE_AT_START)
+            cptr = vm->cbuf_end = &re_dfa_pos[0];
+        vm->lists[0].len = 0;
+        re_pikevm_new_position(vm);
+        ret = 0;
+        for(i = 0; i < st->thread_count; i++) {
+            t = re_thread_get(vm, &dfa->threads, st->thread_start + i);
+            if (*t->pc == REOP_line_end) {
+                ret = re_pikevm_add(vm, &vm->lists[0], t, cptr);
+                if (ret)
+                    break;
+            }
+        }
+        vm->cbuf_end = &re_dfa_pos[2];
+        if (ret)
+            return -1;
+        st->flags |= RE_DFA_STATE_END_DONE;
+        for(i = 0; i < vm->lists[0].len; i++) {
+            t = re_thread_get(vm, &vm->lists[0], i);
+            if (*t->pc == REOP_match) {
+                st->flags |= RE_DFA_STATE_END_MATCH;
+                break;
+            }
+        }
+    }
+    return (st->flags & RE_DFA_STATE_END_MATCH) != 0;
+}
+
+/* Return NULL if the regexp is not supported by the DFA or if memory
+   error. The bytecode must stay valid until lre_dfa_free(). */
+REDFA *lre_dfa_new(const uint8_t *bc_buf, void *opaque,
+                   void *(*realloc_func)(void *opaque, void *ptr, size_t size))
+{
+    REDFA *dfa;
+    REPikeVM *vm;
+    int re_flags;
+
+    if (!(bc_buf[RE_HEADER_INFO] & RE_INFO_DFA))
+        return NULL;
+    re_flags = lre_get_flags(bc_buf);
+    /* the literal prefix search of lre_exec() is faster */
+    if (!(re_flags & LRE_FLAG_STICKY) && bc_buf[RE_HEADER_PREFIX_LEN] != 0)
+        return NULL;
+    dfa = realloc_func(opaque, NULL, sizeof(*dfa));
+    if (!dfa)
+        return NULL;
+    memset(dfa, 0, sizeof(*dfa));
+    dfa->bc_buf = bc_buf;
+    dfa->ignore_case = (re_flags & LRE_FLAG_IGNORECASE) != 0;
+    dfa->is_unicode = (re_flags & LRE_FLAG_UNICODE) != 0;
+    vm = &dfa->vm;
+    vm->opaque = opaque;
+    vm->realloc_func = realloc_func;
+    vm->cbuf = &re_dfa_pos[0];
+    vm->cbuf_end = &re_dfa_pos[2];
+    vm->line_end_pending = TRUE;
+    vm->stack_size_max = bc_buf[RE_HEADER_STACK_SIZE];
+    vm->thread_size = sizeof(REThread) +
+        vm->stack_size_max * sizeof(StackInt);
+    vm->tmp = realloc_func(opaque, NULL, vm->thread_size * 2);
+    if (!vm->tmp) {
+        realloc_func(opaque, dfa, 0);
+        return NULL;
+    }
+    return dfa;
+}
+
+void lre_dfa_free(REDFA *dfa)
+{
+    REPikeVM *vm = &dfa->vm;
+    void *opaque = vm->opaque;
+
+    vm->realloc_func(opaque, vm->lists[0].buf, 0);
+    vm->realloc_func(opaque, vm->lists[1].buf, 0);
+    vm->realloc_func(opaque, vm->work.buf, 0);
+    vm->realloc_func(opaque, vm->visited.buf, 0);
+    vm->realloc_func(opaque, vm->hash, 0);
+    vm->realloc_func(opaque, vm->tmp, 0);
+    vm->realloc_func(opaque, dfa->threads.buf, 0);
+    vm->realloc_func(opaque, dfa->states, 0);
+    vm->realloc_func(opaque, dfa, 0);
+}
+
+/* Return 1 if the regexp matches at or after 'cindex' (only at
+   'cindex' if sticky), 0 if not, or -1 if the DFA cannot tell
+   (too many states or memory error). In the latter case, the DFA
+   always returns -1. */
+int lre_dfa_exec(REDFA *dfa, const uint8_t *cbuf, int cindex, int clen,
+                 int cbuf_type)
+{
+    const uint8_t *cptr, *cbuf_end;
+    REDFAState *st;
+    uint32_t c;
+    int idx, next_idx, at_start, ret;
+
+    if (dfa->is_failed)
+        return -1;
+    cptr = cbuf + (cindex << cbuf_type);
+    cbuf_end = cbuf + (clen << cbuf_type);
+    if (cbuf_type == 1 && dfa->is_unicode)
+        cbuf_type = 2;
+    at_start = (cindex == 0);
+    idx = dfa->start_state[at_start] - 1;
+    if (idx < 0) {
+        idx = re_dfa_start_state(dfa, at_start);
+        if (idx < 0)
+            goto fail;
+        dfa->start_state[at_start] = idx + 1;
+    }
+    for(;;) {
+        st = &dfa->states[idx];
+        if (st->flags & RE_DFA_STATE_MATCH)
+            return 1;
+        if (st->thread_count == 0)
+            return 0;
+        if (cptr >= cbuf_end) {
+            ret = re_dfa_end_match(dfa, idx);
+            if (ret < 0)
+                goto fail;
+            return ret;
+        }
+        GET_CHAR(c, cptr, cbuf_end, cbuf_type);
+        if (c < RE_DFA_ASCII && st->next[c] != 0) {
+            idx = st->next[c] - 1;
+        } else {
+            next_idx = re_dfa_next_state(dfa, idx, c);
+            if (next_idx < 0)
+                goto fail;
+            if (c < RE_DFA_ASCII)
+                dfa->states[idx].next[c] = next_idx + 1;
+            idx = next_idx;
+        }
+    }
+ fail:
+    dfa->is_failed = TRUE;
+    return -1;
+}
+
+static const uint16_t *find_u16(const uint16_t *p, const uint16_t *end,
+                                 uint16_t c)
+{
+#if defined(__SSE2__)
+    const __m128i v_c = _mm_set1_epi16(c);
+    int mask;
+
+    while (end - p >= 8) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)p),
+                                                 v_c));
+        if (mask != 0)
+            return p + (ctz32(mask) >> 1);
+        p += 8;
+    }
+#endif
+    for(; p < end; p++) {
+        if (*p == c)
+            return p;
+    }
+    return NULL;
+}
+
+/* Return the first position >= cindex where the literal prefix of the
+   regexp is present or -1 if none. */
+static int lre_find_prefix(const uint8_t *bc_buf, const uint8_t *cbuf,
+                           int cindex, int clen, int cbuf_type)
+{
+    const uint8_t *prefix = bc_buf + RE_HEADER_PREFIX;
+    int len, last, i;
+
+    len = bc_buf[RE_HEADER_PREFIX_LEN];
+    last = clen - len; /* last possible start position */
+    if (cindex > last)
+        return -1;
+    if (cbuf_type == 0) {
+        const uint8_t *p, *end;
+        uint8_t buf[RE_PREFIX_MAX];
+
+        for(i = 0; i < len; i++) {
+            if (get_u16(prefix + 2 * i) >= 0x100)
+                return -1;
+            buf[i] = get_u16(prefix + 2 * i);
+        }
+        p = cbuf + cindex;
+        end = cbuf + last + 1;
+        while ((p = memchr(p, buf[0], end - p)) != NULL) {
+            if (!memcmp(p + 1, buf + 1, len - 1))
+                return p - cbuf;
+            p++;
+        }
+    } else {
+        const uint16_t *p, *end;
+
+        p = (const uint16_t *)cbuf + cindex;
+        end = (const uint16_t *)cbuf + last + 1;
+        while ((p = find_u16(p, end, get_u16(prefix))) != NULL) {
+            for(i = 1; i < len; i++) {
+                if (p[i] != get_u16(prefix + 2 * i))
+                    break;
+            }
+            if (i == len)
+                return p - (const uint16_t *)cbuf;
+            p++;
+        }
+    }
+    return -1;
+}
+
 /* Return 1 if match, 0 if not match or -1 if error. cindex is the
    starting position of the match and must be such as 0 <= cindex <=
    clen. */
@@ -2418,7 +3452,7 @@ int lre_exec(uint8_t **capture,
              int cbuf_type, void *opaque)
 {
     REExecContext s_s, *s = &s_s;
-    int re_flags, i, alloca_size, ret;
+    int re_flags, i, alloca_size, ret, start_cindex;
     StackInt *stack_buf;
 
     re_flags = lre_get_flags(bc_buf);
@@ -2441,13 +3475,60 @@ int lre_exec(uint8_t **capture,
     s->state_stack_len = 0;
     s->state_stack_size = 0;
 
+    /* a regexp which can be run in linear time falls back to it when
+       the backtracking takes too long */
+    s->budget_exceeded = FALSE;
+    if (bc_buf[RE_HEADER_INFO] & RE_INFO_LINEAR) {
+        s->backtrack_budget = RE_BACKTRACK_BUDGET_MIN +
+            (int64_t)RE_BACKTRACK_BUDGET_PER_CHAR * (clen - cindex + 1);
+    } else {
+        s->backtrack_budget = INT64_MAX;
+    }
+    start_cindex = cindex;
+
     for(i = 0; i < s->capture_count * 2; i++)
         capture[i] = NULL;
     alloca_size = s->stack_size_max * sizeof(stack_buf[0]);
     stack_buf = alloca(alloca_size);
-    ret = lre_exec_backtrack(s, capture, stack_buf, 0, bc_buf + RE_HEADER_LEN,
-                             cbuf + (cindex << cbuf_type), FALSE);
+    if (re_flags & LRE_FLAG_STICKY) {
+        ret = lre_exec_backtrack(s, capture, stack_buf, 0, bc_buf + RE_HEADER_LEN,
+                                 cbuf + (cindex << cbuf_type), FALSE);
+    } else if (bc_buf[RE_HEADER_INFO] & RE_INFO_ANCHORED) {
+        /* can only match at the start of the input: skip the loop */
+        ret = 0;
+        if (cindex == 0) {
+            ret = lre_exec_backtrack(s, capture, stack_buf, 0,
+                                     bc_buf + RE_HEADER_LEN + RE_LOOP_LEN,
+                                     cbuf, FALSE);
+        }
+    } else if (bc_buf[RE_HEADER_PREFIX_LEN] != 0) {
+        /* only try the positions where the literal prefix is present */
+        for(;;) {
+            cindex = lre_find_prefix(bc_buf, cbuf, cindex, clen, cbuf_type);
+            if (cindex < 0) {
+                ret = 0;
+                break;
+            }
+            ret = lre_exec_backtrack(s, capture, stack_buf, 0,
+                                     bc_buf + RE_HEADER_LEN + RE_LOOP_LEN,
+                                     cbuf + (cindex << cbuf_type), FALSE);
+            if (ret != 0)
+                break;
+            for(i = 0; i < s->capture_count * 2; i++)
+                capture[i] = NULL;
+            cindex++;
+        }
+    } else {
+        ret = lre_exec_backtrack(s, capture, stack_buf, 0, bc_buf + RE_HEADER_LEN,
+                                 cbuf + (cindex << cbuf_type), FALSE);
+    }
     lre_realloc(s->opaque, s->state_stack, 0);
+    if (s->budget_exceeded) {
+        for(i = 0; i < s->capture_count * 2; i++)
+            capture[i] = NULL;
+        ret = lre_exec_linear(s, capture, bc_buf + RE_HEADER_LEN,
+                              cbuf + (start_cindex << cbuf_type));
+    }
     return ret;
 }
 
@@ -49,6 +49,13 @@ int lre_exec(uint8_t **capture,
              const uint8_t *bc_buf, const uint8_t *cbuf, int cindex, int clen,
              int cbuf_type, void *opaque);
 
+typedef struct REDFA REDFA;
+REDFA *lre_dfa_new(const uint8_t *bc_buf, void *opaque,
+                   void *(*realloc_func)(void *opaque, void *ptr, size_t size));
+int lre_dfa_exec(REDFA *dfa, const uint8_t *cbuf, int cindex, int clen,
+                 int cbuf_type);
+void lre_dfa_free(REDFA *dfa);
+
 int lre_parse_escape(const uint8_t **pp, int allow_utf16);
 LRE_BOOL lre_is_space(int c);
 
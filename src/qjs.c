@@ -54,6 +54,8 @@ extern const uint8_t qjsc_qjscalc[];
 extern const uint32_t qjsc_qjscalc_size;
 static int bignum_ext;
 #endif
+static int clone_context;
+static const char *clone_template;
 
 static int eval_buf(JSContext *ctx, const void *buf, int buf_len,
                     const char *filename, int eval_flags)
@@ -109,6 +111,71 @@ static int eval_file(JSContext *ctx, const char *filename, int module)
     return ret;
 }
 
+static void add_clone_helpers(JSContext *ctx);
+
+/* cloneContext(script): evaluate 'script' in a new context and clone
+   it. Return [template_global_object, clone_global_object]. */
+static JSValue js_clone_context(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv)
+{
+    JSContext *ctx1, *ctx2;
+    const char *str;
+    size_t len;
+    JSValue ret, val;
+
+    str = JS_ToCStringLen(ctx, &len, argv[0]);
+    if (!str)
+        return JS_EXCEPTION;
+    ctx1 = JS_NewContext(JS_GetRuntime(ctx));
+    if (!ctx1) {
+        JS_FreeCString(ctx, str);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    add_clone_helpers(ctx1);
+    val = JS_Eval(ctx1, str, len, "<template>", JS_EVAL_TYPE_GLOBAL);
+    JS_FreeCString(ctx, str);
+    if (JS_IsException(val))
+        goto exception;
+    JS_FreeValue(ctx1, val);
+    /* the errors are raised in the template context */
+    ctx2 = JS_CloneContext(ctx1);
+    if (!ctx2)
+        goto exception;
+    ret = JS_NewArray(ctx);
+    if (!JS_IsException(ret)) {
+        JS_SetPropertyUint32(ctx, ret, 0, JS_GetGlobalObject(ctx1));
+        JS_SetPropertyUint32(ctx, ret, 1, JS_GetGlobalObject(ctx2));
+    }
+    JS_FreeContext(ctx2);
+    JS_FreeContext(ctx1);
+    return ret;
+ exception:
+    val = JS_GetException(ctx1);
+    JS_FreeContext(ctx1);
+    return JS_Throw(ctx, val);
+}
+
+static JSValue js_detach_array_buffer(JSContext *ctx, JSValueConst this_val,
+                                      int argc, JSValueConst *argv)
+{
+    JS_DetachArrayBuffer(ctx, argv[0]);
+    return JS_UNDEFINED;
+}
+
+static const JSCFunctionListEntry js_clone_helpers_funcs[] = {
+    JS_CFUNC_DEF("cloneContext", 1, js_clone_context ),
+    JS_CFUNC_DEF("detachArrayBuffer", 1, js_detach_array_buffer ),
+};
+
+/* global functions used by tests/test_clone.js */
+static void add_clone_helpers(JSContext *ctx)
+{
+    JSValue global_obj = JS_GetGlobalObject(ctx);
+    JS_SetPropertyFunctionList(ctx, global_obj, js_clone_helpers_funcs,
+                               countof(js_clone_helpers_funcs));
+    JS_FreeValue(ctx, global_obj);
+}
+
 /* also used to initialize the worker context */
 static JSContext *JS_NewCustomContext(JSRuntime *rt)
 {
@@ -116,6 +183,22 @@ static JSContext *JS_NewCustomContext(JSRuntime *rt)
     ctx = JS_NewContext(rt);
     if (!ctx)
         return NULL;
+    if (clone_context) {
+        /* test the context cloning: the first context is the template */
+        JSContext *ctx1;
+        if (clone_template && eval_file(ctx, clone_template, 0)) {
+            JS_FreeContext(ctx);
+            return NULL;
+        }
+        ctx1 = JS_CloneContext(ctx);
+        if (!ctx1)
+            js_std_dump_error(ctx);
+        JS_FreeContext(ctx);
+        if (!ctx1)
+            return NULL;
+        ctx = ctx1;
+        add_clone_helpers(ctx);
+    }
 #ifdef CONFIG_BIGNUM
     if (bignum_ext) {
         JS_AddIntrinsicBigFloat(ctx);
@@ -276,6 +359,28 @@ static const JSMallocFunctions trace_mf = {
 
 #define PROG_NAME "qjs"
 
+static void dump_gc_stats(const JSGCStats *s)
+{
+    int i;
+
+    printf("GC: %" PRId64 " young + %" PRId64 " full collections, "
+           "%" PRId64 " steps, %" PRId64 " full fallbacks, "
+           "total pause=%" PRId64 " us, max pause=%" PRId64 " us\n",
+           s->young_count, s->full_count, s->step_count, s->fallback_count,
+           s->total_pause_us, s->max_pause_us);
+    for(i = 0; i < JS_GC_PAUSE_HISTOGRAM_SIZE; i++) {
+        if (s->pause_histogram[i] == 0)
+            continue;
+        if (i == 0)
+            printf("  %10s", "< 1 us");
+        else if (i == JS_GC_PAUSE_HISTOGRAM_SIZE - 1)
+            printf("  >= %7" PRId64 " us", (int64_t)1 << (i - 1));
+        else
+            printf("  < %8" PRId64 " us", (int64_t)1 << i);
+        printf(" %10" PRId64 "\n", s->pause_histogram[i]);
+    }
+}
+
 void help(void)
 {
     printf("QuickJS version " CONFIG_VERSION "\n"
@@ -296,6 +401,12 @@ void help(void)
            "    --memory-limit n       limit the memory usage to 'n' bytes\n"
            "    --stack-size n         limit the stack size to 'n' bytes\n"
            "    --unhandled-rejection  dump unhandled promise rejections\n"
+           "    --jit                  compile the hot loops to native code (if supported)\n"
+           "    --generational-gc      collect the young objects more often\n"
+           "    --gc-pause-budget n    run the GC in steps of about 'n' us\n"
+           "    --context-arena        allocate the context objects from an arena\n"
+           "    --clone-context        create the contexts by cloning a template\n"
+           "    --clone-template file  same, the template evaluates 'file' first\n"
            "-q  --quit         just instantiate the interpreter and quit\n");
     exit(1);
 }
@@ -321,6 +432,10 @@ int main(int argc, char **argv)
     int load_jscalc;
 #endif
     size_t stack_size = 0;
+    int enable_jit = 0;
+    int generational_gc = 0;
+    int64_t gc_pause_budget = 0;
+    int context_arena = 0;
 
 #ifdef CONFIG_BIGNUM
     /* load jscalc runtime if invoked as 'qjscalc' */
@@ -426,6 +541,39 @@ int main(int argc, char **argv)
                 continue;
             }
 #endif
+            if (!strcmp(longopt, "jit")) {
+                enable_jit = 1;
+                continue;
+            }
+            if (!strcmp(longopt, "generational-gc")) {
+                generational_gc = 1;
+                continue;
+            }
+            if (!strcmp(longopt, "context-arena")) {
+                context_arena = 1;
+                continue;
+            }
+            if (!strcmp(longopt, "clone-context")) {
+                clone_context = 1;
+                continue;
+            }
+            if (!strcmp(longopt, "clone-template")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting template filename");
+                    exit(1);
+                }
+                clone_context = 1;
+                clone_template = argv[optind++];
+                continue;
+            }
+            if (!strcmp(longopt, "gc-pause-budget")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting GC pause budget");
+                    exit(1);
+                }
+                gc_pause_budget = (int64_t)strtod(argv[optind++], NULL);
+                continue;
+            }
             if (opt == 'q' || !strcmp(longopt, "quit")) {
                 empty_run++;
                 continue;
@@ -472,6 +620,14 @@ int main(int argc, char **argv)
         JS_SetMemoryLimit(rt, memory_limit);
     if (stack_size != 0)
         JS_SetMaxStackSize(rt, stack_size);
+    if (enable_jit)
+        JS_EnableJIT(rt, 1);
+    if (generational_gc)
+        JS_EnableGenerationalGC(rt, 1);
+    if (gc_pause_budget != 0)
+        JS_SetGCPauseBudget(rt, gc_pause_budget);
+    if (context_arena)
+        JS_EnableContextArena(rt, 1);
     js_std_set_worker_new_context_func(JS_NewCustomContext);
     js_std_init_handlers(rt);
     ctx = JS_NewCustomContext(rt);
@@ -531,8 +687,11 @@ int main(int argc, char **argv)
 
     if (dump_memory) {
         JSMemoryUsage stats;
+        JSGCStats gc_stats;
         JS_ComputeMemoryUsage(rt, &stats);
         JS_DumpMemoryUsage(stdout, &stats, rt);
+        JS_GetGCStats(rt, &gc_stats);
+        dump_gc_stats(&gc_stats);
     }
     js_std_free_handlers(rt);
     JS_FreeContext(ctx);
@@ -545,6 +704,8 @@ int main(int argc, char **argv)
         for (i = 0; i < 100; i++) {
             t[0] = clock();
             rt = JS_NewRuntime();
+            if (context_arena)
+                JS_EnableContextArena(rt, 1);
             t[1] = clock();
             ctx = JS_NewContext(rt);
             t[2] = clock();
@@ -63,9 +63,26 @@
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include "sock.h"
 #if defined(__APPLE__)
 #include <TargetConditionals.h>
 #endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <stdatomic.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup)
+#define USE_IO_URING
+#endif
+#endif
+#endif
+#endif
 
 #if defined(__FreeBSD__)
 extern char **environ;
@@ -91,6 +108,10 @@ typedef sig_t sighandler_t;
 #ifdef USE_WORKER
 #include <pthread.h>
 #include <stdatomic.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#define USE_EVENTFD
+#endif
 #endif
 
 #ifdef CONFIG_LOADER_SO
@@ -147,31 +168,70 @@ typedef sig_t sighandler_t;
 
 #define OS_FLAG(x) JS_PROP_INT32_DEF(#x, x, JS_PROP_CONFIGURABLE )
 
-/* TODO:
-   - add socket calls
-*/
 
 typedef struct {
     struct list_head link;
     int fd;
     JSValue rw_func[2];
+    /* os.readAsync()/os.writeAsync() requests waiting for the
+       descriptor to be ready (list of JSOSIORequest.link) */
+    struct list_head io_requests[2];
+#ifdef USE_EPOLL
+    /* TRUE if epoll rejected the descriptor (e.g. a regular file): it
+       is then in JSThreadState.os_ready_handlers and always ready */
+    BOOL epoll_rejected;
+    struct list_head ready_link;
+#endif
 } JSOSRWHandler;
 
+typedef struct {
+    struct list_head link;
+    JSContext *ctx;
+    int fd;
+    BOOL is_write;
+    int64_t file_pos; /* -1 to use the current file position */
+    JSValue buffer; /* ArrayBuffer */
+    uint64_t pos, len;
+    JSValue resolving_funcs[2];
+    uint8_t *data; /* private copy of the data used by io_uring */
+} JSOSIORequest;
+
+#ifdef USE_IO_URING
+#define OS_RING_ENTRIES 64
+
+typedef struct {
+    int fd;
+    int event_fd; /* signaled when completions are available */
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned to_submit; /* queued entries not submitted yet */
+    unsigned inflight; /* requests waiting for their completion */
+} JSOSRing;
+#endif
+
 typedef struct {
     struct list_head link;
     int sig_num;
     JSValue func;
 } JSOSSignalHandler;
 
-typedef struct {
-    struct list_head link;
-    int timer_id;
+typedef struct JSOSTimer {
+    struct JSOSTimer *hash_next; /* in JSThreadState.timer_hash */
+    int timer_id; /* -1 if not visible from JS */
+    int heap_idx; /* index in JSThreadState.timer_heap */
     int64_t timeout;
+    uint64_t seq; /* the timers with the same timeout are called in
+                     creation order */
     JSValue func;
 } JSOSTimer;
 
-typedef struct {
-    struct list_head link;
+typedef struct JSWorkerMessage {
+    struct JSWorkerMessage *next; /* next message in the queue */
     uint8_t *data;
     size_t data_len;
     /* list of SharedArrayBuffers, necessary to free the message */
@@ -179,14 +239,17 @@ typedef struct {
     size_t sab_tab_len;
 } JSWorkerMessage;
 
+/* Lock-free multiple producer, single consumer message queue. The
+   consumer is only woken up through 'read_fd' when 'signaled' goes
+   from 0 to 1, so a burst of messages costs a single system call. */
 typedef struct {
     int ref_count;
-#ifdef USE_WORKER
-    pthread_mutex_t mutex;
-#endif
-    struct list_head msg_queue; /* list of JSWorkerMessage.link */
+    JSWorkerMessage *head; /* only accessed by the consumer */
+    JSWorkerMessage *tail; /* last pushed message */
+    JSWorkerMessage stub; /* only the 'next' field is used */
+    int signaled;
     int read_fd;
-    int write_fd;
+    int write_fd; /* same as read_fd if eventfd() is used */
 } JSWorkerMessagePipe;
 
 typedef struct {
@@ -197,9 +260,35 @@ typedef struct {
 
 typedef struct JSThreadState {
     struct list_head os_rw_handlers; /* list of JSOSRWHandler.link */
+    JSOSRWHandler **rh_tab; /* rw handlers indexed by fd */
+    int rh_tab_size;
     struct list_head os_signal_handlers; /* list JSOSSignalHandler.link */
-    struct list_head os_timers; /* list of JSOSTimer.link */
+    /* binary heap of the timers ordered by timeout */
+    JSOSTimer **timer_heap;
+    int timer_count;
+    int timer_size;
+    JSOSTimer **timer_hash; /* setTimeout() timers indexed by id */
+    int timer_hash_size; /* power of two */
+    int timer_hash_count;
+    uint64_t timer_seq;
+#ifdef USE_EPOLL
+    int epoll_fd; /* -1 if select() is used */
+    /* handlers whose descriptor is not supported by epoll (list of
+       JSOSRWHandler.ready_link) */
+    struct list_head os_ready_handlers;
+    /* events returned by the last epoll_wait() not yet handled */
+    int epoll_event_index;
+    int epoll_event_count;
+    struct epoll_event epoll_events[64];
+#endif
     struct list_head port_list; /* list of JSWorkerMessageHandler.link */
+    /* async I/O requests started at the next poll iteration (list of
+       JSOSIORequest.link) */
+    struct list_head os_io_requests;
+#ifdef USE_IO_URING
+    JSOSRing *ring; /* used for the regular files, created on demand */
+    BOOL ring_unavailable;
+#endif
     int eval_script_recurse; /* only used in the main thread */
     int next_timer_id; /* for setTimeout() */
     /* not used in the main thread */
@@ -955,2731 +1044,5050 @@ static JSValue js_std_parseExtJSON(JSContext *ctx, JSValueConst this_val,
     return obj;
 }
 
-static JSValue js_new_std_file(JSContext *ctx, FILE *f,
-                               BOOL close_in_finalizer,
-                               BOOL is_popen)
-{
-    JSSTDFile *s;
-    JSValue obj;
-    obj = JS_NewObjectClass(ctx, js_std_file_class_id);
-    if (JS_IsException(obj))
-        return obj;
-    s = js_mallocz(ctx, sizeof(*s));
-    if (!s) {
-        JS_FreeValue(ctx, obj);
-        return JS_EXCEPTION;
+/* Streaming JSON parser: std.JSONParser(callback, options). The input
+   is fed in chunks with write() and the callback is called for each
+   completed value (or each event if options.events is true). With
+   options.select, only the values at the selected path are built, the
+   rest of the document is only scanned. */
+
+typedef enum {
+    JSON_LEX_NONE,
+    JSON_LEX_STRING,
+    JSON_LEX_NUMBER,
+    JSON_LEX_LITERAL,
+} JSONLexState;
+
+typedef enum {
+    JSON_STATE_TOP, /* between top level values */
+    JSON_STATE_VALUE,
+    JSON_STATE_VALUE_OR_END, /* after '[' */
+    JSON_STATE_KEY,
+    JSON_STATE_KEY_OR_END, /* after '{' */
+    JSON_STATE_COLON,
+    JSON_STATE_NEXT, /* ',' or end of container */
+} JSONParseState;
+
+typedef enum {
+    JSON_MODE_SKIP, /* the value is scanned but not built */
+    JSON_MODE_BUILD, /* the value is added to its container */
+    JSON_MODE_SELECTED, /* the value is passed to the callback */
+} JSONValueMode;
+
+typedef struct {
+    uint8_t is_array;
+    uint8_t mode; /* JSONValueMode of the container */
+    uint8_t match; /* its path matches the beginning of the selection */
+    uint32_t index; /* index of the current element */
+    JSValue obj; /* JS_UNDEFINED if the container is not built */
+    JSAtom key; /* key of the current property if the object is built */
+} JSONStreamLevel;
+
+typedef struct {
+    BOOL any; /* "*" */
+    int64_t index; /* -1 if not an integer */
+    char *name;
+    size_t name_len;
+} JSONSelector;
+
+typedef struct {
+    JSValue callback;
+    BOOL events;
+    BOOL in_callback;
+    BOOL failed; /* a syntax error or an exception occurred */
+    BOOL ended;
+    JSONSelector *sel;
+    int sel_count;
+    JSONStreamLevel *levels;
+    int level_count;
+    int level_size;
+    JSONParseState state;
+    JSONLexState lex;
+    int esc_state; /* 1 after '\', 2 to 5 in \u escape */
+    uint32_t esc_val;
+    uint32_t hi_surrogate; /* pending high surrogate or 0 */
+    const char *lit;
+    int lit_pos;
+    DynBuf tok; /* current string or number */
+    DynBuf key_buf; /* current key of a container which is not built */
+    int64_t offset; /* position of the current chunk in the input */
+    const uint8_t *chunk;
+} JSONStreamParser;
+
+static JSClassID js_json_parser_class_id;
+
+static void js_json_parser_free_levels(JSRuntime *rt, JSONStreamParser *s)
+{
+    int i;
+    for(i = 0; i < s->level_count; i++) {
+        JS_FreeValueRT(rt, s->levels[i].obj);
+        if (s->levels[i].key != JS_ATOM_NULL)
+            JS_FreeAtomRT(rt, s->levels[i].key);
+    }
+    s->level_count = 0;
+}
+
+static void js_json_parser_finalizer(JSRuntime *rt, JSValue val)
+{
+    JSONStreamParser *s = JS_GetOpaque(val, js_json_parser_class_id);
+    int i;
+    if (s) {
+        js_json_parser_free_levels(rt, s);
+        js_free_rt(rt, s->levels);
+        for(i = 0; i < s->sel_count; i++)
+            js_free_rt(rt, s->sel[i].name);
+        js_free_rt(rt, s->sel);
+        dbuf_free(&s->tok);
+        dbuf_free(&s->key_buf);
+        JS_FreeValueRT(rt, s->callback);
+        js_free_rt(rt, s);
     }
-    s->close_in_finalizer = close_in_finalizer;
-    s->is_popen = is_popen;
-    s->f = f;
-    JS_SetOpaque(obj, s);
-    return obj;
 }
 
-static void js_set_error_object(JSContext *ctx, JSValue obj, int err)
+static void js_json_parser_mark(JSRuntime *rt, JSValueConst val,
+                                JS_MarkFunc *mark_func)
 {
-    if (!JS_IsUndefined(obj)) {
-        JS_SetPropertyStr(ctx, obj, "errno", JS_NewInt32(ctx, err));
+    JSONStreamParser *s = JS_GetOpaque(val, js_json_parser_class_id);
+    int i;
+    if (s) {
+        JS_MarkValue(rt, s->callback, mark_func);
+        for(i = 0; i < s->level_count; i++)
+            JS_MarkValue(rt, s->levels[i].obj, mark_func);
     }
 }
 
-static JSValue js_std_open(JSContext *ctx, JSValueConst this_val,
-                           int argc, JSValueConst *argv)
-{
-    const char *filename, *mode = NULL;
-    FILE *f;
-    int err;
-
-    filename = JS_ToCString(ctx, argv[0]);
-    if (!filename)
-        goto fail;
-    mode = JS_ToCString(ctx, argv[1]);
-    if (!mode)
-        goto fail;
-    if (mode[strspn(mode, "rwa+b")] != '\0') {
-        JS_ThrowTypeError(ctx, "invalid file mode");
-        goto fail;
-    }
+static JSClassDef js_json_parser_class = {
+    "JSONParser",
+    .finalizer = js_json_parser_finalizer,
+    .gc_mark = js_json_parser_mark,
+};
 
-    f = fopen(filename, mode);
-    if (!f)
-        err = errno;
-    else
-        err = 0;
-    if (argc >= 3)
-        js_set_error_object(ctx, argv[2], err);
-    JS_FreeCString(ctx, filename);
-    JS_FreeCString(ctx, mode);
-    if (!f)
-        return JS_NULL;
-    return js_new_std_file(ctx, f, TRUE, FALSE);
- fail:
-    JS_FreeCString(ctx, filename);
-    JS_FreeCString(ctx, mode);
-    return JS_EXCEPTION;
+static int js_json_parser_error(JSContext *ctx, JSONStreamParser *s,
+                                const uint8_t *p, const char *msg)
+{
+    int64_t pos = s->offset;
+    if (p)
+        pos += p - s->chunk;
+    s->failed = TRUE;
+    JS_ThrowSyntaxError(ctx, "JSON: %s at position %" PRId64, msg, pos);
+    return -1;
 }
 
-static JSValue js_std_popen(JSContext *ctx, JSValueConst this_val,
-                            int argc, JSValueConst *argv)
+/* call the callback with 'argc' arguments which are freed */
+static int js_json_parser_call(JSContext *ctx, JSONStreamParser *s,
+                               int argc, JSValue *argv)
 {
-    const char *filename, *mode = NULL;
-    FILE *f;
-    int err;
-
-    filename = JS_ToCString(ctx, argv[0]);
-    if (!filename)
-        goto fail;
-    mode = JS_ToCString(ctx, argv[1]);
-    if (!mode)
-        goto fail;
-    if (mode[strspn(mode, "rw")] != '\0') {
-        JS_ThrowTypeError(ctx, "invalid file mode");
-        goto fail;
+    JSValue ret;
+    int i;
+
+    s->in_callback = TRUE;
+    ret = JS_Call(ctx, s->callback, JS_UNDEFINED, argc, (JSValueConst *)argv);
+    s->in_callback = FALSE;
+    for(i = 0; i < argc; i++)
+        JS_FreeValue(ctx, argv[i]);
+    if (JS_IsException(ret)) {
+        s->failed = TRUE;
+        return -1;
     }
-
-    f = popen(filename, mode);
-    if (!f)
-        err = errno;
-    else
-        err = 0;
-    if (argc >= 3)
-        js_set_error_object(ctx, argv[2], err);
-    JS_FreeCString(ctx, filename);
-    JS_FreeCString(ctx, mode);
-    if (!f)
-        return JS_NULL;
-    return js_new_std_file(ctx, f, TRUE, TRUE);
- fail:
-    JS_FreeCString(ctx, filename);
-    JS_FreeCString(ctx, mode);
-    return JS_EXCEPTION;
+    JS_FreeValue(ctx, ret);
+    return 0;
 }
 
-static JSValue js_std_fdopen(JSContext *ctx, JSValueConst this_val,
-                             int argc, JSValueConst *argv)
+static int js_json_parser_event(JSContext *ctx, JSONStreamParser *s,
+                                const char *name, JSValue val)
 {
-    const char *mode;
-    FILE *f;
-    int fd = 0, err = 0;
-
-    if (JS_ToInt32(ctx, &fd, argv[0]))
-        return JS_EXCEPTION;
-    mode = JS_ToCString(ctx, argv[1]);
-    if (!mode)
-        goto fail;
-    if (mode[strspn(mode, "rwa+")] != '\0') {
-        JS_ThrowTypeError(ctx, "invalid file mode");
-        goto fail;
-    }
-
-    f = fdopen(fd, mode);
-    if (!f)
-        err = errno;
-    else
-        err = 0;
-    if (argc >= 3)
-        js_set_error_object(ctx, argv[2], err);
-    JS_FreeCString(ctx, mode);
-    if (!f)
-        return JS_NULL;
-    return js_new_std_file(ctx, f, TRUE, FALSE);
- fail:
-    JS_FreeCString(ctx, mode);
-    return JS_EXCEPTION;
+    JSValue args[2];
+    args[0] = JS_NewString(ctx, name);
+    args[1] = val;
+    return js_json_parser_call(ctx, s, JS_IsUndefined(val) ? 1 : 2, args);
 }
 
-static JSValue js_std_tmpfile(JSContext *ctx, JSValueConst this_val,
-                              int argc, JSValueConst *argv)
+/* TRUE if the key or index of the current element of 'l' matches the
+   selector of its depth */
+static BOOL js_json_parser_sel_match(JSONStreamParser *s, JSONStreamLevel *l)
 {
-    FILE *f;
-    f = tmpfile();
-    if (argc >= 1)
-        js_set_error_object(ctx, argv[0], f ? 0 : errno);
-    if (!f)
-        return JS_NULL;
-    return js_new_std_file(ctx, f, TRUE, FALSE);
+    JSONSelector *sel = &s->sel[s->level_count - 1];
+    if (sel->any)
+        return TRUE;
+    if (l->is_array)
+        return sel->index == l->index;
+    /* key_buf.buf is NULL for an empty key */
+    return sel->name_len == s->key_buf.size &&
+        (sel->name_len == 0 ||
+         !memcmp(sel->name, s->key_buf.buf, sel->name_len));
 }
 
-static JSValue js_std_sprintf(JSContext *ctx, JSValueConst this_val,
-                          int argc, JSValueConst *argv)
+/* TRUE if the path of the value starting at the current position
+   matches the first 'level_count' selectors */
+static BOOL js_json_parser_path_match(JSONStreamParser *s)
 {
-    return js_printf_internal(ctx, argc, argv, NULL);
+    JSONStreamLevel *l;
+    if (s->level_count == 0)
+        return TRUE;
+    l = &s->levels[s->level_count - 1];
+    return l->match && s->level_count <= s->sel_count &&
+        js_json_parser_sel_match(s, l);
 }
 
-static JSValue js_std_printf(JSContext *ctx, JSValueConst this_val,
-                             int argc, JSValueConst *argv)
+static JSONValueMode js_json_parser_value_mode(JSONStreamParser *s)
 {
-    return js_printf_internal(ctx, argc, argv, stdout);
+    if (s->level_count > 0 &&
+        s->levels[s->level_count - 1].mode != JSON_MODE_SKIP)
+        return JSON_MODE_BUILD;
+    if (s->level_count == s->sel_count && js_json_parser_path_match(s))
+        return JSON_MODE_SELECTED;
+    return JSON_MODE_SKIP;
 }
 
-static FILE *js_std_file_get(JSContext *ctx, JSValueConst obj)
+static BOOL js_json_parser_expect_value(JSONStreamParser *s)
 {
-    JSSTDFile *s = JS_GetOpaque2(ctx, obj, js_std_file_class_id);
-    if (!s)
-        return NULL;
-    if (!s->f) {
-        JS_ThrowTypeError(ctx, "invalid file handle");
-        return NULL;
-    }
-    return s->f;
+    return s->state == JSON_STATE_TOP || s->state == JSON_STATE_VALUE ||
+        s->state == JSON_STATE_VALUE_OR_END;
 }
 
-static JSValue js_std_file_puts(JSContext *ctx, JSValueConst this_val,
-                                int argc, JSValueConst *argv, int magic)
+/* store a completed value. 'val' is freed. */
+static int js_json_parser_value_done(JSContext *ctx, JSONStreamParser *s,
+                                     JSONValueMode mode, JSValue val)
 {
-    FILE *f;
-    int i = 0;
-    const char *str;
-    size_t len;
+    JSONStreamLevel *l = NULL;
+    int ret;
 
-    if (magic == 0) {
-        f = stdout;
+    if (s->level_count > 0)
+        l = &s->levels[s->level_count - 1];
+    if (mode == JSON_MODE_BUILD) {
+        if (l->is_array) {
+            ret = JS_DefinePropertyValueUint32(ctx, l->obj, l->index, val,
+                                               JS_PROP_C_W_E);
+        } else {
+            ret = JS_DefinePropertyValue(ctx, l->obj, l->key, val,
+                                         JS_PROP_C_W_E);
+            JS_FreeAtom(ctx, l->key);
+            l->key = JS_ATOM_NULL;
+        }
+        if (ret < 0) {
+            s->failed = TRUE;
+            return -1;
+        }
+    } else if (mode == JSON_MODE_SELECTED) {
+        if (js_json_parser_call(ctx, s, 1, &val))
+            return -1;
     } else {
-        f = js_std_file_get(ctx, this_val);
-        if (!f)
-            return JS_EXCEPTION;
+        JS_FreeValue(ctx, val);
     }
-
-    for(i = 0; i < argc; i++) {
-        str = JS_ToCStringLen(ctx, &len, argv[i]);
-        if (!str)
-            return JS_EXCEPTION;
-        fwrite(str, 1, len, f);
-        JS_FreeCString(ctx, str);
+    if (s->level_count > 0) {
+        s->levels[s->level_count - 1].index++;
+        s->state = JSON_STATE_NEXT;
+    } else {
+        s->state = JSON_STATE_TOP;
     }
-    return JS_UNDEFINED;
+    return 0;
 }
 
-static JSValue js_std_file_close(JSContext *ctx, JSValueConst this_val,
-                                 int argc, JSValueConst *argv)
+/* complete primitive value in 's->tok' or 'val' */
+static int js_json_parser_primitive(JSContext *ctx, JSONStreamParser *s,
+                                    JSValue val)
 {
-    JSSTDFile *s = JS_GetOpaque2(ctx, this_val, js_std_file_class_id);
-    int err = 0;
-    if (!s)
-        return JS_EXCEPTION;
-    if (!s->f)
-        return JS_ThrowTypeError(ctx, "invalid file handle");
-    if (s->is_popen)
-        err = js_get_errno(pclose(s->f));
-    else
-        err = js_get_errno(fclose(s->f));
-    s->f = NULL;
-    return JS_NewInt32(ctx, err);
-}
+    JSONValueMode mode;
 
-static JSValue js_std_file_printf(JSContext *ctx, JSValueConst this_val,
-                                  int argc, JSValueConst *argv)
-{
-    FILE *f = js_std_file_get(ctx, this_val);
-    if (!f)
-        return JS_EXCEPTION;
-    return js_printf_internal(ctx, argc, argv, f);
+    if (s->events) {
+        if (js_json_parser_event(ctx, s, "value", val))
+            return -1;
+        mode = JSON_MODE_SKIP;
+        val = JS_UNDEFINED;
+    } else {
+        mode = js_json_parser_value_mode(s);
+    }
+    return js_json_parser_value_done(ctx, s, mode, val);
 }
 
-static JSValue js_std_file_flush(JSContext *ctx, JSValueConst this_val,
-                                 int argc, JSValueConst *argv)
+static int js_json_parser_string(JSContext *ctx, JSONStreamParser *s,
+                                 const uint8_t *p)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    if (!f)
-        return JS_EXCEPTION;
-    fflush(f);
-    return JS_UNDEFINED;
+    JSONStreamLevel *l;
+    JSValue val;
+    /* tok.buf is NULL if nothing was added to it */
+    const char *str = s->tok.size ? (const char *)s->tok.buf : "";
+
+    if (s->state == JSON_STATE_KEY || s->state == JSON_STATE_KEY_OR_END) {
+        l = &s->levels[s->level_count - 1];
+        if (s->events) {
+            val = JS_NewStringLen(ctx, str, s->tok.size);
+            if (js_json_parser_event(ctx, s, "key", val))
+                return -1;
+        } else if (l->mode != JSON_MODE_SKIP) {
+            l->key = JS_NewAtomLen(ctx, str, s->tok.size);
+            if (l->key == JS_ATOM_NULL) {
+                s->failed = TRUE;
+                return -1;
+            }
+        } else if (l->match) {
+            /* only needed to match the selection */
+            s->key_buf.size = 0;
+            if (dbuf_put(&s->key_buf, (const uint8_t *)str, s->tok.size))
+                goto oom;
+        }
+        s->state = JSON_STATE_COLON;
+        return 0;
+    }
+    if (!s->events && js_json_parser_value_mode(s) == JSON_MODE_SKIP)
+        return js_json_parser_value_done(ctx, s, JSON_MODE_SKIP, JS_UNDEFINED);
+    val = JS_NewStringLen(ctx, str, s->tok.size);
+    if (JS_IsException(val)) {
+        s->failed = TRUE;
+        return -1;
+    }
+    return js_json_parser_primitive(ctx, s, val);
+ oom:
+    s->failed = TRUE;
+    JS_ThrowOutOfMemory(ctx);
+    return -1;
 }
 
-static JSValue js_std_file_tell(JSContext *ctx, JSValueConst this_val,
-                                int argc, JSValueConst *argv, int is_bigint)
+static BOOL js_json_is_number(const uint8_t *p, const uint8_t *end)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    int64_t pos = 0;
-    if (!f)
-        return JS_EXCEPTION;
-#if defined(__linux__)
-    pos = ftello(f);
-#else
-    pos = ftell(f);
-#endif
-    if (is_bigint)
-        return JS_NewBigInt64(ctx, pos);
-    else
-        return JS_NewInt64(ctx, pos);
+    if (p < end && *p == '-')
+        p++;
+    if (p < end && *p == '0') {
+        p++;
+    } else {
+        if (p >= end || !(*p >= '1' && *p <= '9'))
+            return FALSE;
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || !(*p >= '0' && *p <= '9'))
+            return FALSE;
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+            p++;
+        if (p >= end || !(*p >= '0' && *p <= '9'))
+            return FALSE;
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+    }
+    return p == end;
 }
 
-static JSValue js_std_file_seek(JSContext *ctx, JSValueConst this_val,
-                                int argc, JSValueConst *argv)
+static int js_json_parser_number(JSContext *ctx, JSONStreamParser *s,
+                                 const uint8_t *p)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    int64_t pos = 0;
-    int whence = 0, ret = 0;
-    if (!f)
-        return JS_EXCEPTION;
-    if (JS_ToInt64Ext(ctx, &pos, argv[0]))
-        return JS_EXCEPTION;
-    if (JS_ToInt32(ctx, &whence, argv[1]))
-        return JS_EXCEPTION;
-#if defined(__linux__)
-    ret = fseeko(f, pos, whence);
-#else
-    ret = fseek(f, pos, whence);
-#endif
-    if (ret < 0)
-        ret = -errno;
-    return JS_NewInt32(ctx, ret);
+    const uint8_t *q = s->tok.buf, *end = s->tok.buf + s->tok.size;
+    JSValue val;
+    int64_t v;
+    BOOL neg;
+
+    if (!js_json_is_number(q, end))
+        return js_json_parser_error(ctx, s, p, "invalid number");
+    if (!s->events && js_json_parser_value_mode(s) == JSON_MODE_SKIP)
+        return js_json_parser_value_done(ctx, s, JSON_MODE_SKIP, JS_UNDEFINED);
+    neg = (*q == '-');
+    q += neg;
+    if (end - q <= 15 && memchr(q, '.', end - q) == NULL &&
+        memchr(q, 'e', end - q) == NULL && memchr(q, 'E', end - q) == NULL &&
+        !(neg && *q == '0')) {
+        /* small integer */
+        v = 0;
+        while (q < end)
+            v = v * 10 + (*q++ - '0');
+        val = JS_NewInt64(ctx, neg ? -v : v);
+    } else {
+        if (dbuf_putc(&s->tok, '\0')) {
+            s->failed = TRUE;
+            JS_ThrowOutOfMemory(ctx);
+            return -1;
+        }
+        val = JS_NewFloat64(ctx, strtod((char *)s->tok.buf, NULL));
+    }
+    return js_json_parser_primitive(ctx, s, val);
 }
 
-static JSValue js_std_file_eof(JSContext *ctx, JSValueConst this_val,
-                               int argc, JSValueConst *argv)
+static int js_json_parser_open(JSContext *ctx, JSONStreamParser *s,
+                               const uint8_t *p, BOOL is_array)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    if (!f)
-        return JS_EXCEPTION;
-    return JS_NewBool(ctx, feof(f));
-}
+    JSONStreamLevel *l;
+    JSONValueMode mode;
+    BOOL match;
 
-static JSValue js_std_file_error(JSContext *ctx, JSValueConst this_val,
-                               int argc, JSValueConst *argv)
-{
-    FILE *f = js_std_file_get(ctx, this_val);
-    if (!f)
-        return JS_EXCEPTION;
-    return JS_NewBool(ctx, ferror(f));
+    if (!js_json_parser_expect_value(s))
+        return js_json_parser_error(ctx, s, p, "unexpected character");
+    if (s->events) {
+        if (js_json_parser_event(ctx, s, is_array ? "startArray" : "startObject",
+                                 JS_UNDEFINED))
+            return -1;
+        mode = JSON_MODE_SKIP;
+        match = FALSE;
+    } else {
+        mode = js_json_parser_value_mode(s);
+        match = (mode == JSON_MODE_SKIP && js_json_parser_path_match(s) &&
+                 s->level_count < s->sel_count);
+    }
+    if (s->level_count >= s->level_size) {
+        JSONStreamLevel *new_levels;
+        int new_size = max_int(16, s->level_size * 3 / 2);
+        new_levels = js_realloc(ctx, s->levels, sizeof(s->levels[0]) * new_size);
+        if (!new_levels) {
+            s->failed = TRUE;
+            return -1;
+        }
+        s->levels = new_levels;
+        s->level_size = new_size;
+    }
+    l = &s->levels[s->level_count];
+    l->is_array = is_array;
+    l->mode = mode;
+    l->match = match;
+    l->index = 0;
+    l->key = JS_ATOM_NULL;
+    l->obj = JS_UNDEFINED;
+    if (mode != JSON_MODE_SKIP) {
+        l->obj = is_array ? JS_NewArray(ctx) : JS_NewObject(ctx);
+        if (JS_IsException(l->obj)) {
+            s->failed = TRUE;
+            return -1;
+        }
+    }
+    s->level_count++;
+    s->state = is_array ? JSON_STATE_VALUE_OR_END : JSON_STATE_KEY_OR_END;
+    return 0;
 }
 
-static JSValue js_std_file_clearerr(JSContext *ctx, JSValueConst this_val,
-                                    int argc, JSValueConst *argv)
+static int js_json_parser_close(JSContext *ctx, JSONStreamParser *s,
+                                const uint8_t *p, BOOL is_array)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    if (!f)
-        return JS_EXCEPTION;
-    clearerr(f);
-    return JS_UNDEFINED;
+    JSONStreamLevel *l;
+    JSValue val;
+    JSONValueMode mode;
+
+    if (s->level_count == 0)
+        return js_json_parser_error(ctx, s, p, "unexpected character");
+    l = &s->levels[s->level_count - 1];
+    if (l->is_array != is_array ||
+        !(s->state == JSON_STATE_NEXT ||
+          s->state == (is_array ? JSON_STATE_VALUE_OR_END :
+                       JSON_STATE_KEY_OR_END)))
+        return js_json_parser_error(ctx, s, p, "unexpected character");
+    val = l->obj;
+    mode = l->mode;
+    s->level_count--;
+    if (s->events) {
+        if (js_json_parser_event(ctx, s, is_array ? "endArray" : "endObject",
+                                 JS_UNDEFINED))
+            return -1;
+    }
+    return js_json_parser_value_done(ctx, s, mode, val);
 }
 
-static JSValue js_std_file_fileno(JSContext *ctx, JSValueConst this_val,
-                                  int argc, JSValueConst *argv)
+/* flush a pending high surrogate as a lone code point */
+static int js_json_parser_flush_surrogate(JSONStreamParser *s)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    if (!f)
-        return JS_EXCEPTION;
-    return JS_NewInt32(ctx, fileno(f));
+    uint8_t buf[UTF8_CHAR_LEN_MAX];
+    int len;
+    if (!s->hi_surrogate)
+        return 0;
+    len = unicode_to_utf8(buf, s->hi_surrogate);
+    s->hi_surrogate = 0;
+    return dbuf_put(&s->tok, buf, len);
 }
 
-static JSValue js_std_file_read_write(JSContext *ctx, JSValueConst this_val,
-                                      int argc, JSValueConst *argv, int magic)
+/* handle the character 'c' of an escape sequence */
+static int js_json_parser_escape(JSContext *ctx, JSONStreamParser *s,
+                                 const uint8_t *p, int c)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    uint64_t pos = 0, len = 0;
-    size_t size = 0, ret = 0;
-    uint8_t *buf;
+    uint8_t buf[UTF8_CHAR_LEN_MAX];
+    int h;
 
-    if (!f)
-        return JS_EXCEPTION;
-    if (JS_ToIndex(ctx, &pos, argv[1]))
-        return JS_EXCEPTION;
-    if (JS_ToIndex(ctx, &len, argv[2]))
-        return JS_EXCEPTION;
-    buf = JS_GetArrayBuffer(ctx, &size, argv[0]);
-    if (!buf)
-        return JS_EXCEPTION;
-    if (pos + len > size)
-        return JS_ThrowRangeError(ctx, "read/write array buffer overflow");
-    if (magic)
-        ret = fwrite(buf + pos, 1, len, f);
-    else
-        ret = fread(buf + pos, 1, len, f);
-    return JS_NewInt64(ctx, ret);
+    if (s->esc_state == 1) {
+        switch(c) {
+        case '"': case '\\': case '/':
+            break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u':
+            s->esc_state = 2;
+            s->esc_val = 0;
+            return 0;
+        default:
+            return js_json_parser_error(ctx, s, p, "invalid escape sequence");
+        }
+        s->esc_state = 0;
+        if (js_json_parser_flush_surrogate(s) || dbuf_putc(&s->tok, c))
+            goto oom;
+        return 0;
+    }
+    h = from_hex(c);
+    if (h < 0)
+        return js_json_parser_error(ctx, s, p, "invalid escape sequence");
+    s->esc_val = (s->esc_val << 4) | h;
+    if (++s->esc_state < 6)
+        return 0;
+    s->esc_state = 0;
+    c = s->esc_val;
+    if (c >= 0xdc00 && c <= 0xdfff && s->hi_surrogate) {
+        c = 0x10000 + ((s->hi_surrogate - 0xd800) << 10) + (c - 0xdc00);
+        s->hi_surrogate = 0;
+    } else {
+        if (js_json_parser_flush_surrogate(s))
+            goto oom;
+        if (c >= 0xd800 && c <= 0xdbff) {
+            s->hi_surrogate = c;
+            return 0;
+        }
+    }
+    if (dbuf_put(&s->tok, buf, unicode_to_utf8(buf, c)))
+        goto oom;
+    return 0;
+ oom:
+    s->failed = TRUE;
+    JS_ThrowOutOfMemory(ctx);
+    return -1;
 }
 
-/* XXX: could use less memory and go faster */
-static JSValue js_std_file_getline(JSContext *ctx, JSValueConst this_val,
-                                   int argc, JSValueConst *argv)
+static int js_json_parser_feed(JSContext *ctx, JSONStreamParser *s,
+                               const uint8_t *p, size_t len)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    int c = 0;
-    DynBuf dbuf;
-    JSValue obj;
-
-    if (!f)
-        return JS_EXCEPTION;
+    const uint8_t *end = p + len, *start;
+    int c;
 
-    js_std_dbuf_init(ctx, &dbuf);
-    for(;;) {
-        c = fgetc(f);
-        if (c == EOF) {
-            if (dbuf.size == 0) {
-                /* EOF */
-                dbuf_free(&dbuf);
-                return JS_NULL;
+    s->chunk = p;
+    while (p < end) {
+        switch(s->lex) {
+        case JSON_LEX_STRING:
+            if (s->esc_state) {
+                c = *p++;
+                if (js_json_parser_escape(ctx, s, p - 1, c))
+                    return -1;
+                break;
+            }
+            /* copy the unescaped characters at once */
+            start = p;
+            while (p < end && *p != '"' && *p != '\\' && *p >= 0x20)
+                p++;
+            if (p > start) {
+                if (js_json_parser_flush_surrogate(s) ||
+                    dbuf_put(&s->tok, start, p - start))
+                    goto oom;
+            }
+            if (p >= end)
+                break;
+            c = *p++;
+            if (c == '"') {
+                if (js_json_parser_flush_surrogate(s))
+                    goto oom;
+                s->lex = JSON_LEX_NONE;
+                if (js_json_parser_string(ctx, s, p - 1))
+                    return -1;
+            } else if (c == '\\') {
+                s->esc_state = 1;
             } else {
+                return js_json_parser_error(ctx, s, p - 1,
+                                            "control character in string");
+            }
+            break;
+        case JSON_LEX_NUMBER:
+            start = p;
+            while (p < end && ((*p >= '0' && *p <= '9') || *p == '.' ||
+                               *p == 'e' || *p == 'E' || *p == '+' ||
+                               *p == '-'))
+                p++;
+            if (dbuf_put(&s->tok, start, p - start))
+                goto oom;
+            if (p >= end)
                 break;
+            s->lex = JSON_LEX_NONE;
+            if (js_json_parser_number(ctx, s, p))
+                return -1;
+            break;
+        case JSON_LEX_LITERAL:
+            while (p < end && s->lit[s->lit_pos] != '\0') {
+                if (*p != s->lit[s->lit_pos])
+                    return js_json_parser_error(ctx, s, p, "unexpected character");
+                p++;
+                s->lit_pos++;
+            }
+            if (s->lit[s->lit_pos] == '\0') {
+                JSValue val;
+                s->lex = JSON_LEX_NONE;
+                if (s->lit[0] == 't')
+                    val = JS_TRUE;
+                else if (s->lit[0] == 'f')
+                    val = JS_FALSE;
+                else
+                    val = JS_NULL;
+                if (js_json_parser_primitive(ctx, s, val))
+                    return -1;
+            }
+            break;
+        default:
+            c = *p;
+            switch(c) {
+            case ' ': case '\t': case '\n': case '\r':
+                p++;
+                break;
+            case '"':
+                if (!js_json_parser_expect_value(s) &&
+                    s->state != JSON_STATE_KEY &&
+                    s->state != JSON_STATE_KEY_OR_END)
+                    return js_json_parser_error(ctx, s, p, "unexpected character");
+                s->lex = JSON_LEX_STRING;
+                s->tok.size = 0;
+                p++;
+                break;
+            case '{':
+            case '[':
+                if (js_json_parser_open(ctx, s, p, c == '['))
+                    return -1;
+                p++;
+                break;
+            case '}':
+            case ']':
+                if (js_json_parser_close(ctx, s, p, c == ']'))
+                    return -1;
+                p++;
+                break;
+            case ':':
+                if (s->state != JSON_STATE_COLON)
+                    return js_json_parser_error(ctx, s, p, "unexpected character");
+                s->state = JSON_STATE_VALUE;
+                p++;
+                break;
+            case ',':
+                if (s->state != JSON_STATE_NEXT)
+                    return js_json_parser_error(ctx, s, p, "unexpected character");
+                s->state = s->levels[s->level_count - 1].is_array ?
+                    JSON_STATE_VALUE : JSON_STATE_KEY;
+                p++;
+                break;
+            case 't':
+            case 'f':
+            case 'n':
+                if (!js_json_parser_expect_value(s))
+                    return js_json_parser_error(ctx, s, p, "unexpected character");
+                s->lex = JSON_LEX_LITERAL;
+                s->lit = (c == 't') ? "true" : (c == 'f') ? "false" : "null";
+                s->lit_pos = 0;
+                break;
+            default:
+                if ((c >= '0' && c <= '9') || c == '-') {
+                    if (!js_json_parser_expect_value(s))
+                        return js_json_parser_error(ctx, s, p, "unexpected character");
+                    s->lex = JSON_LEX_NUMBER;
+                    s->tok.size = 0;
+                    break;
+                }
+                return js_json_parser_error(ctx, s, p, "unexpected character");
             }
-        }
-        if (c == '\n')
             break;
-        if (dbuf_putc(&dbuf, c)) {
-            dbuf_free(&dbuf);
-            return JS_ThrowOutOfMemory(ctx);
         }
     }
-    obj = JS_NewStringLen(ctx, (const char *)dbuf.buf, dbuf.size);
-    dbuf_free(&dbuf);
-    return obj;
+    s->offset += len;
+    return 0;
+ oom:
+    s->failed = TRUE;
+    JS_ThrowOutOfMemory(ctx);
+    return -1;
 }
 
-/* XXX: could use less memory and go faster */
-static JSValue js_std_file_readAsString(JSContext *ctx, JSValueConst this_val,
-                                        int argc, JSValueConst *argv)
+static JSONStreamParser *js_json_parser_get(JSContext *ctx,
+                                            JSValueConst this_val)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    int c = 0;
-    DynBuf dbuf;
-    JSValue obj;
-    uint64_t max_size64 = 0;
-    size_t max_size;
-    JSValueConst max_size_val;
-
-    if (!f)
-        return JS_EXCEPTION;
-
-    if (argc >= 1)
-        max_size_val = argv[0];
-    else
-        max_size_val = JS_UNDEFINED;
-    max_size = (size_t)-1;
-    if (!JS_IsUndefined(max_size_val)) {
-        if (JS_ToIndex(ctx, &max_size64, max_size_val))
-            return JS_EXCEPTION;
-        if (max_size64 < max_size)
-            max_size = max_size64;
+    JSONStreamParser *s = JS_GetOpaque2(ctx, this_val, js_json_parser_class_id);
+    if (!s)
+        return NULL;
+    if (s->in_callback) {
+        JS_ThrowTypeError(ctx, "JSONParser: cannot be called from its callback");
+        return NULL;
     }
-
-    js_std_dbuf_init(ctx, &dbuf);
-    while (max_size != 0) {
-        c = fgetc(f);
-        if (c == EOF)
-            break;
-        if (dbuf_putc(&dbuf, c)) {
-            dbuf_free(&dbuf);
-            return JS_EXCEPTION;
-        }
-        max_size--;
+    if (s->failed || s->ended) {
+        JS_ThrowTypeError(ctx, "JSONParser: %s",
+                          s->failed ? "parse error" : "input already ended");
+        return NULL;
     }
-    obj = JS_NewStringLen(ctx, (const char *)dbuf.buf, dbuf.size);
-    dbuf_free(&dbuf);
-    return obj;
+    return s;
 }
 
-static JSValue js_std_file_getByte(JSContext *ctx, JSValueConst this_val,
-                                   int argc, JSValueConst *argv)
+/* write(chunk): 'chunk' is a string or an ArrayBuffer or typed array
+   containing UTF-8 text */
+static JSValue js_json_parser_write(JSContext *ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    if (!f)
+    JSONStreamParser *s = js_json_parser_get(ctx, this_val);
+    const char *str;
+    uint8_t *buf, *copy;
+    size_t len, size, offset, bpe;
+    JSValue abuf;
+    int ret;
+
+    if (!s)
         return JS_EXCEPTION;
-    return JS_NewInt32(ctx, fgetc(f));
+    if (JS_IsString(argv[0])) {
+        str = JS_ToCStringLen(ctx, &len, argv[0]);
+        if (!str)
+            return JS_EXCEPTION;
+        ret = js_json_parser_feed(ctx, s, (const uint8_t *)str, len);
+        JS_FreeCString(ctx, str);
+    } else {
+        offset = 0;
+        abuf = JS_GetTypedArrayBuffer(ctx, argv[0], &offset, &len, &bpe);
+        if (JS_IsException(abuf)) {
+            JS_FreeValue(ctx, JS_GetException(ctx));
+            abuf = JS_DupValue(ctx, argv[0]);
+            len = -1;
+        }
+        buf = JS_GetArrayBuffer(ctx, &size, abuf);
+        JS_FreeValue(ctx, abuf);
+        if (!buf)
+            return JS_EXCEPTION;
+        if (len == (size_t)-1)
+            len = size;
+        /* the callback could detach the buffer */
+        copy = js_malloc(ctx, max_int(len, 1));
+        if (!copy)
+            return JS_EXCEPTION;
+        memcpy(copy, buf + offset, len);
+        ret = js_json_parser_feed(ctx, s, copy, len);
+        js_free(ctx, copy);
+    }
+    if (ret)
+        return JS_EXCEPTION;
+    return JS_UNDEFINED;
 }
 
-static JSValue js_std_file_putByte(JSContext *ctx, JSValueConst this_val,
-                                   int argc, JSValueConst *argv)
+/* end(): check that the input is complete */
+static JSValue js_json_parser_end(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv)
 {
-    FILE *f = js_std_file_get(ctx, this_val);
-    int c = 0;
-    if (!f)
+    JSONStreamParser *s = js_json_parser_get(ctx, this_val);
+    if (!s)
         return JS_EXCEPTION;
-    if (JS_ToInt32(ctx, &c, argv[0]))
+    s->chunk = NULL;
+    if (s->lex == JSON_LEX_NUMBER) {
+        s->lex = JSON_LEX_NONE;
+        if (js_json_parser_number(ctx, s, NULL))
+            return JS_EXCEPTION;
+    }
+    if (s->lex != JSON_LEX_NONE || s->state != JSON_STATE_TOP) {
+        js_json_parser_error(ctx, s, NULL, "unexpected end of input");
         return JS_EXCEPTION;
-    c = fputc(c, f);
-    return JS_NewInt32(ctx, c);
+    }
+    s->ended = TRUE;
+    return JS_UNDEFINED;
 }
 
-/* urlGet */
+static int js_json_parser_get_select(JSContext *ctx, JSONStreamParser *s,
+                                     JSValueConst arr)
+{
+    JSValue val;
+    int64_t len, i;
+    JSONSelector *sel;
+    const char *str;
 
-#define URL_GET_PROGRAM "curl -s -i --"
-#define URL_GET_BUF_SIZE 4096
-
-static int http_get_header_line(FILE *f, char *buf, size_t buf_size,
-                                DynBuf *dbuf)
-{
-    int c = 0;
-    char *p;
-
-    p = buf;
-    for(;;) {
-        c = fgetc(f);
-        if (c < 0)
+    val = JS_GetPropertyStr(ctx, arr, "length");
+    if (JS_IsException(val))
+        return -1;
+    if (JS_ToInt64(ctx, &len, val)) {
+        JS_FreeValue(ctx, val);
+        return -1;
+    }
+    JS_FreeValue(ctx, val);
+    if (len < 0 || len > INT32_MAX) {
+        JS_ThrowRangeError(ctx, "invalid selection");
+        return -1;
+    }
+    s->sel = js_mallocz(ctx, sizeof(s->sel[0]) * max_int(len, 1));
+    if (!s->sel)
+        return -1;
+    for(i = 0; i < len; i++) {
+        sel = &s->sel[i];
+        sel->index = -1;
+        s->sel_count = i + 1;
+        val = JS_GetPropertyUint32(ctx, arr, i);
+        if (JS_IsException(val))
             return -1;
-        if ((p - buf) < buf_size - 1)
-            *p++ = c;
-        if (dbuf)
-            dbuf_putc(dbuf, c);
-        if (c == '\n')
-            break;
+        if (JS_IsNumber(val)) {
+            if (JS_ToInt64(ctx, &sel->index, val))
+                return -1;
+            continue;
+        }
+        str = JS_ToCStringLen(ctx, &sel->name_len, val);
+        JS_FreeValue(ctx, val);
+        if (!str)
+            return -1;
+        if (!strcmp(str, "*")) {
+            sel->any = TRUE;
+        } else {
+            sel->name = js_malloc(ctx, max_int(sel->name_len, 1));
+            if (!sel->name) {
+                JS_FreeCString(ctx, str);
+                return -1;
+            }
+            memcpy(sel->name, str, sel->name_len);
+        }
+        JS_FreeCString(ctx, str);
     }
-    *p = '\0';
     return 0;
 }
 
-static int http_get_status(const char *buf)
-{
-    const char *p = buf;
-    while (*p != ' ' && *p != '\0')
-        p++;
-    if (*p != ' ')
-        return 0;
-    while (*p == ' ')
-        p++;
-    return atoi(p);
-}
-
-static JSValue js_std_urlGet(JSContext *ctx, JSValueConst this_val,
-                             int argc, JSValueConst *argv)
+/* JSONParser(callback, options) with options.select (array of property
+   names, indexes or "*") and options.events (boolean) */
+static JSValue js_json_parser_ctor(JSContext *ctx, JSValueConst new_target,
+                                   int argc, JSValueConst *argv)
 {
-    const char *url;
-    DynBuf cmd_buf;
-    DynBuf data_buf_s, *data_buf = &data_buf_s;
-    DynBuf header_buf_s, *header_buf = &header_buf_s;
-    char *buf;
-    size_t i, len;
-    int c = 0, status = 0;
-    JSValue response = JS_UNDEFINED, ret_obj;
-    JSValueConst options_obj;
-    FILE *f;
-    BOOL binary_flag, full_flag;
+    JSONStreamParser *s;
+    JSValue obj, val;
 
-    url = JS_ToCString(ctx, argv[0]);
-    if (!url)
+    if (!JS_IsFunction(ctx, argv[0]))
+        return JS_ThrowTypeError(ctx, "not a function");
+    obj = JS_NewObjectClass(ctx, js_json_parser_class_id);
+    if (JS_IsException(obj))
+        return obj;
+    s = js_mallocz(ctx, sizeof(*s));
+    if (!s) {
+        JS_FreeValue(ctx, obj);
         return JS_EXCEPTION;
-
-    binary_flag = FALSE;
-    full_flag = FALSE;
-
-    if (argc >= 2) {
-        options_obj = argv[1];
-
-        if (get_bool_option(ctx, &binary_flag, options_obj, "binary"))
-            goto fail_obj;
-
-        if (get_bool_option(ctx, &full_flag, options_obj, "full")) {
-        fail_obj:
-            JS_FreeCString(ctx, url);
-            return JS_EXCEPTION;
-        }
     }
-
-    js_std_dbuf_init(ctx, &cmd_buf);
-    dbuf_printf(&cmd_buf, "%s '", URL_GET_PROGRAM);
-    for(i = 0; url[i] != '\0'; i++) {
-        unsigned char c = url[i];
-        switch (c) {
-        case '\'':
-            /* shell single quoted string does not support \' */
-            dbuf_putstr(&cmd_buf, "'\\''");
-            break;
-        case '[': case ']': case '{': case '}': case '\\':
-            /* prevent interpretation by curl as range or set specification */
-            dbuf_putc(&cmd_buf, '\\');
-            /* FALLTHROUGH */
-        default:
-            dbuf_putc(&cmd_buf, c);
-            break;
+    s->callback = JS_DupValue(ctx, argv[0]);
+    s->state = JSON_STATE_TOP;
+    js_std_dbuf_init(ctx, &s->tok);
+    js_std_dbuf_init(ctx, &s->key_buf);
+    JS_SetOpaque(obj, s);
+    if (argc >= 2 && JS_IsObject(argv[1])) {
+        val = JS_GetPropertyStr(ctx, argv[1], "events");
+        if (JS_IsException(val))
+            goto fail;
+        s->events = JS_ToBool(ctx, val);
+        JS_FreeValue(ctx, val);
+        val = JS_GetPropertyStr(ctx, argv[1], "select");
+        if (JS_IsException(val))
+            goto fail;
+        if (!JS_IsUndefined(val)) {
+            if (js_json_parser_get_select(ctx, s, val)) {
+                JS_FreeValue(ctx, val);
+                goto fail;
+            }
         }
+        JS_FreeValue(ctx, val);
     }
-    JS_FreeCString(ctx, url);
-    dbuf_putstr(&cmd_buf, "'");
-    dbuf_putc(&cmd_buf, '\0');
-    if (dbuf_error(&cmd_buf)) {
-        dbuf_free(&cmd_buf);
+    return obj;
+ fail:
+    JS_FreeValue(ctx, obj);
+    return JS_EXCEPTION;
+}
+
+static const JSCFunctionListEntry js_json_parser_proto_funcs[] = {
+    JS_CFUNC_DEF("write", 1, js_json_parser_write ),
+    JS_CFUNC_DEF("end", 0, js_json_parser_end ),
+};
+
+static JSValue js_new_std_file(JSContext *ctx, FILE *f,
+                               BOOL close_in_finalizer,
+                               BOOL is_popen)
+{
+    JSSTDFile *s;
+    JSValue obj;
+    obj = JS_NewObjectClass(ctx, js_std_file_class_id);
+    if (JS_IsException(obj))
+        return obj;
+    s = js_mallocz(ctx, sizeof(*s));
+    if (!s) {
+        JS_FreeValue(ctx, obj);
         return JS_EXCEPTION;
     }
-    //    printf("%s\n", (char *)cmd_buf.buf);
-    f = popen((char *)cmd_buf.buf, "r");
-    dbuf_free(&cmd_buf);
-    if (!f) {
-        return JS_ThrowTypeError(ctx, "could not start curl");
+    s->close_in_finalizer = close_in_finalizer;
+    s->is_popen = is_popen;
+    s->f = f;
+    JS_SetOpaque(obj, s);
+    return obj;
+}
+
+static void js_set_error_object(JSContext *ctx, JSValue obj, int err)
+{
+    if (!JS_IsUndefined(obj)) {
+        JS_SetPropertyStr(ctx, obj, "errno", JS_NewInt32(ctx, err));
     }
+}
 
-    js_std_dbuf_init(ctx, data_buf);
-    js_std_dbuf_init(ctx, header_buf);
+static JSValue js_std_open(JSContext *ctx, JSValueConst this_val,
+                           int argc, JSValueConst *argv)
+{
+    const char *filename, *mode = NULL;
+    FILE *f;
+    int err;
 
-    buf = js_malloc(ctx, URL_GET_BUF_SIZE);
-    if (!buf)
+    filename = JS_ToCString(ctx, argv[0]);
+    if (!filename)
+        goto fail;
+    mode = JS_ToCString(ctx, argv[1]);
+    if (!mode)
+        goto fail;
+    if (mode[strspn(mode, "rwa+b")] != '\0') {
+        JS_ThrowTypeError(ctx, "invalid file mode");
         goto fail;
-
-    /* get the HTTP status */
-    if (http_get_header_line(f, buf, URL_GET_BUF_SIZE, NULL) < 0) {
-        status = 0;
-        goto bad_header;
-    }
-    status = http_get_status(buf);
-    if (!full_flag && !(status >= 200 && status <= 299)) {
-        goto bad_header;
     }
 
-    /* wait until there is an empty line */
-    for(;;) {
-        if (http_get_header_line(f, buf, URL_GET_BUF_SIZE, header_buf) < 0) {
-        bad_header:
-            response = JS_NULL;
-            goto done;
-        }
-        if (!strcmp(buf, "\r\n"))
-            break;
-    }
-    if (dbuf_error(header_buf))
-        goto fail;
-    header_buf->size -= 2; /* remove the trailing CRLF */
+    f = fopen(filename, mode);
+    if (!f)
+        err = errno;
+    else
+        err = 0;
+    if (argc >= 3)
+        js_set_error_object(ctx, argv[2], err);
+    JS_FreeCString(ctx, filename);
+    JS_FreeCString(ctx, mode);
+    if (!f)
+        return JS_NULL;
+    return js_new_std_file(ctx, f, TRUE, FALSE);
+ fail:
+    JS_FreeCString(ctx, filename);
+    JS_FreeCString(ctx, mode);
+    return JS_EXCEPTION;
+}
 
-    /* download the data */
-    for(;;) {
-        len = fread(buf, 1, URL_GET_BUF_SIZE, f);
-        if (len == 0)
-            break;
-        dbuf_put(data_buf, (uint8_t *)buf, len);
-    }
-    if (dbuf_error(data_buf))
+static JSValue js_std_popen(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    const char *filename, *mode = NULL;
+    FILE *f;
+    int err;
+
+    filename = JS_ToCString(ctx, argv[0]);
+    if (!filename)
         goto fail;
-    if (binary_flag) {
-        response = JS_NewArrayBufferCopy(ctx,
-                                         data_buf->buf, data_buf->size);
-    } else {
-        response = JS_NewStringLen(ctx, (char *)data_buf->buf, data_buf->size);
-    }
-    if (JS_IsException(response))
+    mode = JS_ToCString(ctx, argv[1]);
+    if (!mode)
         goto fail;
- done:
-    js_free(ctx, buf);
-    buf = NULL;
-    pclose(f);
-    f = NULL;
-    dbuf_free(data_buf);
-    data_buf = NULL;
+    if (mode[strspn(mode, "rw")] != '\0') {
+        JS_ThrowTypeError(ctx, "invalid file mode");
+        goto fail;
+    }
 
-    if (full_flag) {
-        ret_obj = JS_NewObject(ctx);
-        if (JS_IsException(ret_obj))
-            goto fail;
-        JS_DefinePropertyValueStr(ctx, ret_obj, "response",
-                                  response,
-                                  JS_PROP_C_W_E);
-        if (!JS_IsNull(response)) {
-            JS_DefinePropertyValueStr(ctx, ret_obj, "responseHeaders",
-                                      JS_NewStringLen(ctx, (char *)header_buf->buf,
-                                                      header_buf->size),
-                                      JS_PROP_C_W_E);
-            JS_DefinePropertyValueStr(ctx, ret_obj, "status",
-                                      JS_NewInt32(ctx, status),
-                                      JS_PROP_C_W_E);
-        }
-    } else {
-        ret_obj = response;
-    }
-    dbuf_free(header_buf);
-    return ret_obj;
+    f = popen(filename, mode);
+    if (!f)
+        err = errno;
+    else
+        err = 0;
+    if (argc >= 3)
+        js_set_error_object(ctx, argv[2], err);
+    JS_FreeCString(ctx, filename);
+    JS_FreeCString(ctx, mode);
+    if (!f)
+        return JS_NULL;
+    return js_new_std_file(ctx, f, TRUE, TRUE);
  fail:
-    if (f)
-        pclose(f);
-    js_free(ctx, buf);
-    if (data_buf)
-        dbuf_free(data_buf);
-    if (header_buf)
-        dbuf_free(header_buf);
-    JS_FreeValue(ctx, response);
+    JS_FreeCString(ctx, filename);
+    JS_FreeCString(ctx, mode);
     return JS_EXCEPTION;
 }
 
-static JSClassDef js_std_file_class = {
-    "FILE",
-    .finalizer = js_std_file_finalizer,
-};
-
-static const JSCFunctionListEntry js_std_error_props[] = {
-    /* various errno values */
-#define DEF(x) JS_PROP_INT32_DEF(#x, x, JS_PROP_CONFIGURABLE )
-    DEF(EINVAL),
-    DEF(EIO),
-    DEF(EACCES),
-    DEF(EEXIST),
-    DEF(ENOSPC),
-    DEF(ENOSYS),
-    DEF(EBUSY),
-    DEF(ENOENT),
-    DEF(EPERM),
-    DEF(EPIPE),
-    DEF(EBADF),
-#undef DEF
-};
-
-static const JSCFunctionListEntry js_std_funcs[] = {
-    JS_CFUNC_DEF("exit", 1, js_std_exit ),
-    JS_CFUNC_DEF("gc", 0, js_std_gc ),
-    JS_CFUNC_DEF("evalScript", 1, js_evalScript ),
-    JS_CFUNC_DEF("loadScript", 1, js_loadScript ),
-    JS_CFUNC_DEF("getenv", 1, js_std_getenv ),
-    JS_CFUNC_DEF("setenv", 1, js_std_setenv ),
-    JS_CFUNC_DEF("unsetenv", 1, js_std_unsetenv ),
-    JS_CFUNC_DEF("getenviron", 1, js_std_getenviron ),
-    JS_CFUNC_DEF("urlGet", 1, js_std_urlGet ),
-    JS_CFUNC_DEF("loadFile", 1, js_std_loadFile ),
-    JS_CFUNC_DEF("strerror", 1, js_std_strerror ),
-    JS_CFUNC_DEF("parseExtJSON", 1, js_std_parseExtJSON ),
-
-    /* FILE I/O */
-    JS_CFUNC_DEF("open", 2, js_std_open ),
-    JS_CFUNC_DEF("popen", 2, js_std_popen ),
-    JS_CFUNC_DEF("fdopen", 2, js_std_fdopen ),
-    JS_CFUNC_DEF("tmpfile", 0, js_std_tmpfile ),
-    JS_CFUNC_MAGIC_DEF("puts", 1, js_std_file_puts, 0 ),
-    JS_CFUNC_DEF("printf", 1, js_std_printf ),
-    JS_CFUNC_DEF("sprintf", 1, js_std_sprintf ),
-    JS_PROP_INT32_DEF("SEEK_SET", SEEK_SET, JS_PROP_CONFIGURABLE ),
-    JS_PROP_INT32_DEF("SEEK_CUR", SEEK_CUR, JS_PROP_CONFIGURABLE ),
-    JS_PROP_INT32_DEF("SEEK_END", SEEK_END, JS_PROP_CONFIGURABLE ),
-    JS_OBJECT_DEF("Error", js_std_error_props, countof(js_std_error_props), JS_PROP_CONFIGURABLE),
-};
-
-static const JSCFunctionListEntry js_std_file_proto_funcs[] = {
-    JS_CFUNC_DEF("close", 0, js_std_file_close ),
-    JS_CFUNC_MAGIC_DEF("puts", 1, js_std_file_puts, 1 ),
-    JS_CFUNC_DEF("printf", 1, js_std_file_printf ),
-    JS_CFUNC_DEF("flush", 0, js_std_file_flush ),
-    JS_CFUNC_MAGIC_DEF("tell", 0, js_std_file_tell, 0 ),
-    JS_CFUNC_MAGIC_DEF("tello", 0, js_std_file_tell, 1 ),
-    JS_CFUNC_DEF("seek", 2, js_std_file_seek ),
-    JS_CFUNC_DEF("eof", 0, js_std_file_eof ),
-    JS_CFUNC_DEF("fileno", 0, js_std_file_fileno ),
-    JS_CFUNC_DEF("error", 0, js_std_file_error ),
-    JS_CFUNC_DEF("clearerr", 0, js_std_file_clearerr ),
-    JS_CFUNC_MAGIC_DEF("read", 3, js_std_file_read_write, 0 ),
-    JS_CFUNC_MAGIC_DEF("write", 3, js_std_file_read_write, 1 ),
-    JS_CFUNC_DEF("getline", 0, js_std_file_getline ),
-    JS_CFUNC_DEF("readAsString", 0, js_std_file_readAsString ),
-    JS_CFUNC_DEF("getByte", 0, js_std_file_getByte ),
-    JS_CFUNC_DEF("putByte", 1, js_std_file_putByte ),
-    /* setvbuf, ...  */
-};
-
-static int js_std_init(JSContext *ctx, JSModuleDef *m)
+static JSValue js_std_fdopen(JSContext *ctx, JSValueConst this_val,
+                             int argc, JSValueConst *argv)
 {
-    JSValue proto;
+    const char *mode;
+    FILE *f;
+    int fd = 0, err = 0;
 
-    /* FILE class */
-    /* the class ID is created once */
-    JS_NewClassID(&js_std_file_class_id);
-    /* the class is created once per runtime */
-    JS_NewClass(JS_GetRuntime(ctx), js_std_file_class_id, &js_std_file_class);
-    proto = JS_NewObject(ctx);
-    JS_SetPropertyFunctionList(ctx, proto, js_std_file_proto_funcs,
-                               countof(js_std_file_proto_funcs));
-    JS_SetClassProto(ctx, js_std_file_class_id, proto);
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    mode = JS_ToCString(ctx, argv[1]);
+    if (!mode)
+        goto fail;
+    if (mode[strspn(mode, "rwa+")] != '\0') {
+        JS_ThrowTypeError(ctx, "invalid file mode");
+        goto fail;
+    }
 
-    JS_SetModuleExportList(ctx, m, js_std_funcs,
-                           countof(js_std_funcs));
-    JS_SetModuleExport(ctx, m, "in", js_new_std_file(ctx, stdin, FALSE, FALSE));
-    JS_SetModuleExport(ctx, m, "out", js_new_std_file(ctx, stdout, FALSE, FALSE));
-    JS_SetModuleExport(ctx, m, "err", js_new_std_file(ctx, stderr, FALSE, FALSE));
-    return 0;
+    f = fdopen(fd, mode);
+    if (!f)
+        err = errno;
+    else
+        err = 0;
+    if (argc >= 3)
+        js_set_error_object(ctx, argv[2], err);
+    JS_FreeCString(ctx, mode);
+    if (!f)
+        return JS_NULL;
+    return js_new_std_file(ctx, f, TRUE, FALSE);
+ fail:
+    JS_FreeCString(ctx, mode);
+    return JS_EXCEPTION;
 }
 
-JSModuleDef *js_init_module_std(JSContext *ctx, const char *module_name)
+static JSValue js_std_tmpfile(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv)
 {
-    JSModuleDef *m;
-    m = JS_NewCModule(ctx, module_name, js_std_init);
-    if (!m)
-        return NULL;
-    JS_AddModuleExportList(ctx, m, js_std_funcs, countof(js_std_funcs));
-    JS_AddModuleExport(ctx, m, "in");
-    JS_AddModuleExport(ctx, m, "out");
-    JS_AddModuleExport(ctx, m, "err");
-    return m;
+    FILE *f;
+    f = tmpfile();
+    if (argc >= 1)
+        js_set_error_object(ctx, argv[0], f ? 0 : errno);
+    if (!f)
+        return JS_NULL;
+    return js_new_std_file(ctx, f, TRUE, FALSE);
 }
 
-/**********************************************************/
-/* 'os' object */
-
-static JSValue js_os_open(JSContext *ctx, JSValueConst this_val,
+static JSValue js_std_sprintf(JSContext *ctx, JSValueConst this_val,
                           int argc, JSValueConst *argv)
 {
-    const char *filename = NULL;
-    int flags = 0, mode = 0, ret = 0;
-
-    filename = JS_ToCString(ctx, argv[0]);
-    if (!filename)
-        return JS_EXCEPTION;
-    if (JS_ToInt32(ctx, &flags, argv[1]))
-        goto fail;
-    if (argc >= 3 && !JS_IsUndefined(argv[2])) {
-        if (JS_ToInt32(ctx, &mode, argv[2])) {
-        fail:
-            JS_FreeCString(ctx, filename);
-            return JS_EXCEPTION;
-        }
-    } else {
-        mode = 0666;
-    }
-#if defined(_WIN32)
-    /* force binary mode by default */
-    if (!(flags & O_TEXT))
-        flags |= O_BINARY;
-#endif
-    ret = js_get_errno(open(filename, flags, mode));
-    JS_FreeCString(ctx, filename);
-    return JS_NewInt32(ctx, ret);
+    return js_printf_internal(ctx, argc, argv, NULL);
 }
 
-static JSValue js_os_close(JSContext *ctx, JSValueConst this_val,
-                           int argc, JSValueConst *argv)
+static JSValue js_std_printf(JSContext *ctx, JSValueConst this_val,
+                             int argc, JSValueConst *argv)
 {
-    int fd = 0, ret = 0;
-    if (JS_ToInt32(ctx, &fd, argv[0]))
-        return JS_EXCEPTION;
-    ret = js_get_errno(close(fd));
-    return JS_NewInt32(ctx, ret);
+    return js_printf_internal(ctx, argc, argv, stdout);
 }
 
-static JSValue js_os_seek(JSContext *ctx, JSValueConst this_val,
-                          int argc, JSValueConst *argv)
+static FILE *js_std_file_get(JSContext *ctx, JSValueConst obj)
 {
-    int fd = 0, whence = 0;
-    int64_t pos = 0, ret = 0;
-    BOOL is_bigint = FALSE;
-    
-    if (JS_ToInt32(ctx, &fd, argv[0]))
-        return JS_EXCEPTION;
-    is_bigint = JS_IsBigInt(ctx, argv[1]);
-    if (JS_ToInt64Ext(ctx, &pos, argv[1]))
-        return JS_EXCEPTION;
-    if (JS_ToInt32(ctx, &whence, argv[2]))
-        return JS_EXCEPTION;
-    ret = lseek(fd, pos, whence);
-    if (ret == -1)
-        ret = -errno;
-    if (is_bigint)
-        return JS_NewBigInt64(ctx, ret);
-    else
-        return JS_NewInt64(ctx, ret);
+    JSSTDFile *s = JS_GetOpaque2(ctx, obj, js_std_file_class_id);
+    if (!s)
+        return NULL;
+    if (!s->f) {
+        JS_ThrowTypeError(ctx, "invalid file handle");
+        return NULL;
+    }
+    return s->f;
 }
 
-static JSValue js_os_read_write(JSContext *ctx, JSValueConst this_val,
+static JSValue js_std_file_puts(JSContext *ctx, JSValueConst this_val,
                                 int argc, JSValueConst *argv, int magic)
 {
-    int fd = 0;
-    uint64_t pos = 0, len = 0;
-    size_t size = 0;
-    ssize_t ret = 0;
-    uint8_t *buf = NULL;
-    
-    if (JS_ToInt32(ctx, &fd, argv[0]))
-        return JS_EXCEPTION;
-    if (JS_ToIndex(ctx, &pos, argv[2]))
-        return JS_EXCEPTION;
-    if (JS_ToIndex(ctx, &len, argv[3]))
-        return JS_EXCEPTION;
-    buf = JS_GetArrayBuffer(ctx, &size, argv[1]);
-    if (!buf)
-        return JS_EXCEPTION;
-    if (pos + len > size)
-        return JS_ThrowRangeError(ctx, "read/write array buffer overflow");
-    if (magic)
-        ret = js_get_errno(write(fd, buf + pos, len));
-    else
-        ret = js_get_errno(read(fd, buf + pos, len));
-    return JS_NewInt64(ctx, ret);
+    FILE *f;
+    int i = 0;
+    const char *str;
+    size_t len;
+
+    if (magic == 0) {
+        f = stdout;
+    } else {
+        f = js_std_file_get(ctx, this_val);
+        if (!f)
+            return JS_EXCEPTION;
+    }
+
+    for(i = 0; i < argc; i++) {
+        str = JS_ToCStringLen(ctx, &len, argv[i]);
+        if (!str)
+            return JS_EXCEPTION;
+        fwrite(str, 1, len, f);
+        JS_FreeCString(ctx, str);
+    }
+    return JS_UNDEFINED;
 }
 
-static JSValue js_os_isatty(JSContext *ctx, JSValueConst this_val,
-                            int argc, JSValueConst *argv)
+static JSValue js_std_file_close(JSContext *ctx, JSValueConst this_val,
+                                 int argc, JSValueConst *argv)
 {
-    int fd = 0;
-    if (JS_ToInt32(ctx, &fd, argv[0]))
+    JSSTDFile *s = JS_GetOpaque2(ctx, this_val, js_std_file_class_id);
+    int err = 0;
+    if (!s)
         return JS_EXCEPTION;
-    return JS_NewBool(ctx, isatty(fd));
+    if (!s->f)
+        return JS_ThrowTypeError(ctx, "invalid file handle");
+    if (s->is_popen)
+        err = js_get_errno(pclose(s->f));
+    else
+        err = js_get_errno(fclose(s->f));
+    s->f = NULL;
+    return JS_NewInt32(ctx, err);
 }
 
-#if defined(_WIN32)
-static JSValue js_os_ttyGetWinSize(JSContext *ctx, JSValueConst this_val,
-                                   int argc, JSValueConst *argv)
+static JSValue js_std_file_printf(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv)
 {
-    int fd = 0;
-    HANDLE handle = NULL;
-    CONSOLE_SCREEN_BUFFER_INFO info;
-    JSValue obj;
-
-    if (JS_ToInt32(ctx, &fd, argv[0]))
+    FILE *f = js_std_file_get(ctx, this_val);
+    if (!f)
         return JS_EXCEPTION;
-    handle = (HANDLE)_get_osfhandle(fd);
-
-    if (!GetConsoleScreenBufferInfo(handle, &info))
-        return JS_NULL;
-    obj = JS_NewArray(ctx);
-    if (JS_IsException(obj))
-        return obj;
-    JS_DefinePropertyValueUint32(ctx, obj, 0, JS_NewInt32(ctx, info.dwSize.X), JS_PROP_C_W_E);
-    JS_DefinePropertyValueUint32(ctx, obj, 1, JS_NewInt32(ctx, info.dwSize.Y), JS_PROP_C_W_E);
-    return obj;
+    return js_printf_internal(ctx, argc, argv, f);
 }
 
-/* Windows 10 built-in VT100 emulation */
-#define __ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
-#define __ENABLE_VIRTUAL_TERMINAL_INPUT 0x0200
-
-static JSValue js_os_ttySetRaw(JSContext *ctx, JSValueConst this_val,
-                               int argc, JSValueConst *argv)
+static JSValue js_std_file_flush(JSContext *ctx, JSValueConst this_val,
+                                 int argc, JSValueConst *argv)
 {
-    int fd = 0;
-    HANDLE handle = NULL;
-
-    if (JS_ToInt32(ctx, &fd, argv[0]))
+    FILE *f = js_std_file_get(ctx, this_val);
+    if (!f)
         return JS_EXCEPTION;
-    handle = (HANDLE)_get_osfhandle(fd);
-    SetConsoleMode(handle, ENABLE_WINDOW_INPUT | __ENABLE_VIRTUAL_TERMINAL_INPUT);
-    _setmode(fd, _O_BINARY);
-    if (fd == 0) {
-        handle = (HANDLE)_get_osfhandle(1); /* corresponding output */
-        SetConsoleMode(handle, ENABLE_PROCESSED_OUTPUT | ENABLE_WRAP_AT_EOL_OUTPUT | __ENABLE_VIRTUAL_TERMINAL_PROCESSING);
-    }
+    fflush(f);
     return JS_UNDEFINED;
 }
-#else
-static JSValue js_os_ttyGetWinSize(JSContext *ctx, JSValueConst this_val,
-                                   int argc, JSValueConst *argv)
-{
-    int fd = 0;
-    struct winsize ws;
-    JSValue obj;
 
-    if (JS_ToInt32(ctx, &fd, argv[0]))
+static JSValue js_std_file_tell(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv, int is_bigint)
+{
+    FILE *f = js_std_file_get(ctx, this_val);
+    int64_t pos = 0;
+    if (!f)
         return JS_EXCEPTION;
-    if (ioctl(fd, TIOCGWINSZ, &ws) == 0 &&
-        ws.ws_col >= 4 && ws.ws_row >= 4) {
-        obj = JS_NewArray(ctx);
-        if (JS_IsException(obj))
-            return obj;
-        JS_DefinePropertyValueUint32(ctx, obj, 0, JS_NewInt32(ctx, ws.ws_col), JS_PROP_C_W_E);
-        JS_DefinePropertyValueUint32(ctx, obj, 1, JS_NewInt32(ctx, ws.ws_row), JS_PROP_C_W_E);
-        return obj;
-    } else {
-        return JS_NULL;
-    }
+#if defined(__linux__)
+    pos = ftello(f);
+#else
+    pos = ftell(f);
+#endif
+    if (is_bigint)
+        return JS_NewBigInt64(ctx, pos);
+    else
+        return JS_NewInt64(ctx, pos);
 }
 
-static struct termios oldtty;
-
-static void term_exit(void)
+static JSValue js_std_file_seek(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv)
 {
-    tcsetattr(0, TCSANOW, &oldtty);
+    FILE *f = js_std_file_get(ctx, this_val);
+    int64_t pos = 0;
+    int whence = 0, ret = 0;
+    if (!f)
+        return JS_EXCEPTION;
+    if (JS_ToInt64Ext(ctx, &pos, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &whence, argv[1]))
+        return JS_EXCEPTION;
+#if defined(__linux__)
+    ret = fseeko(f, pos, whence);
+#else
+    ret = fseek(f, pos, whence);
+#endif
+    if (ret < 0)
+        ret = -errno;
+    return JS_NewInt32(ctx, ret);
 }
 
-/* XXX: should add a way to go back to normal mode */
-static JSValue js_os_ttySetRaw(JSContext *ctx, JSValueConst this_val,
+static JSValue js_std_file_eof(JSContext *ctx, JSValueConst this_val,
                                int argc, JSValueConst *argv)
 {
-    struct termios tty;
-    int fd = 0;
-    
-    if (JS_ToInt32(ctx, &fd, argv[0]))
+    FILE *f = js_std_file_get(ctx, this_val);
+    if (!f)
         return JS_EXCEPTION;
-
-    memset(&tty, 0, sizeof(tty));
-    tcgetattr(fd, &tty);
-    oldtty = tty;
-
-    tty.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP
-                          |INLCR|IGNCR|ICRNL|IXON);
-    tty.c_oflag |= OPOST;
-    tty.c_lflag &= ~(ECHO|ECHONL|ICANON|IEXTEN);
-    tty.c_cflag &= ~(CSIZE|PARENB);
-    tty.c_cflag |= CS8;
-    tty.c_cc[VMIN] = 1;
-    tty.c_cc[VTIME] = 0;
-
-    tcsetattr(fd, TCSANOW, &tty);
-
-    atexit(term_exit);
-    return JS_UNDEFINED;
+    return JS_NewBool(ctx, feof(f));
 }
 
-#endif /* !_WIN32 */
-
-static JSValue js_os_remove(JSContext *ctx, JSValueConst this_val,
-                            int argc, JSValueConst *argv)
+static JSValue js_std_file_error(JSContext *ctx, JSValueConst this_val,
+                               int argc, JSValueConst *argv)
 {
-    const char *filename;
-    int ret = 0;
-    
-    filename = JS_ToCString(ctx, argv[0]);
-    if (!filename)
+    FILE *f = js_std_file_get(ctx, this_val);
+    if (!f)
         return JS_EXCEPTION;
-#if defined(_WIN32)
-    {
-        struct stat st;
-        if (stat(filename, &st) == 0 && S_ISDIR(st.st_mode)) {
-            ret = rmdir(filename);
-        } else {
-            ret = unlink(filename);
-        }
-    }
-#else
-    ret = remove(filename);
-#endif
-    ret = js_get_errno(ret);
-    JS_FreeCString(ctx, filename);
-    return JS_NewInt32(ctx, ret);
+    return JS_NewBool(ctx, ferror(f));
 }
 
-static JSValue js_os_rename(JSContext *ctx, JSValueConst this_val,
-                            int argc, JSValueConst *argv)
+static JSValue js_std_file_clearerr(JSContext *ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv)
 {
-    const char *oldpath, *newpath;
-    int ret = 0;
-    
-    oldpath = JS_ToCString(ctx, argv[0]);
-    if (!oldpath)
-        return JS_EXCEPTION;
-    newpath = JS_ToCString(ctx, argv[1]);
-    if (!newpath) {
-        JS_FreeCString(ctx, oldpath);
+    FILE *f = js_std_file_get(ctx, this_val);
+    if (!f)
         return JS_EXCEPTION;
-    }
-    ret = js_get_errno(rename(oldpath, newpath));
-    JS_FreeCString(ctx, oldpath);
-    JS_FreeCString(ctx, newpath);
-    return JS_NewInt32(ctx, ret);
+    clearerr(f);
+    return JS_UNDEFINED;
 }
 
-static BOOL is_main_thread(JSRuntime *rt)
+static JSValue js_std_file_fileno(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv)
 {
-    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
-    return !ts->recv_pipe;
+    FILE *f = js_std_file_get(ctx, this_val);
+    if (!f)
+        return JS_EXCEPTION;
+    return JS_NewInt32(ctx, fileno(f));
 }
 
-static JSOSRWHandler *find_rh(JSThreadState *ts, int fd)
+static JSValue js_std_file_read_write(JSContext *ctx, JSValueConst this_val,
+                                      int argc, JSValueConst *argv, int magic)
 {
-    JSOSRWHandler *rh;
-    struct list_head *el;
+    FILE *f = js_std_file_get(ctx, this_val);
+    uint64_t pos = 0, len = 0;
+    size_t size = 0, ret = 0;
+    uint8_t *buf;
 
-    list_for_each(el, &ts->os_rw_handlers) {
-        rh = list_entry(el, JSOSRWHandler, link);
-        if (rh->fd == fd)
-            return rh;
-    }
-    return NULL;
-}
-
-static void free_rw_handler(JSRuntime *rt, JSOSRWHandler *rh)
-{
-    int i = 0;
-    list_del(&rh->link);
-    for(i = 0; i < 2; i++) {
-        JS_FreeValueRT(rt, rh->rw_func[i]);
-    }
-    js_free_rt(rt, rh);
+    if (!f)
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &pos, argv[1]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &len, argv[2]))
+        return JS_EXCEPTION;
+    buf = JS_GetArrayBuffer(ctx, &size, argv[0]);
+    if (!buf)
+        return JS_EXCEPTION;
+    if (pos + len > size)
+        return JS_ThrowRangeError(ctx, "read/write array buffer overflow");
+    if (magic)
+        ret = fwrite(buf + pos, 1, len, f);
+    else
+        ret = fread(buf + pos, 1, len, f);
+    return JS_NewInt64(ctx, ret);
 }
 
-static JSValue js_os_setReadHandler(JSContext *ctx, JSValueConst this_val,
-                                    int argc, JSValueConst *argv, int magic)
+/* XXX: could use less memory and go faster */
+static JSValue js_std_file_getline(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv)
 {
-    JSRuntime *rt = JS_GetRuntime(ctx);
-    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
-    JSOSRWHandler *rh;
-    int fd = 0;
-    JSValueConst func;
+    FILE *f = js_std_file_get(ctx, this_val);
+    int c = 0;
+    DynBuf dbuf;
+    JSValue obj;
 
-    if (JS_ToInt32(ctx, &fd, argv[0]))
+    if (!f)
         return JS_EXCEPTION;
-    func = argv[1];
-    if (JS_IsNull(func)) {
-        rh = find_rh(ts, fd);
-        if (rh) {
-            JS_FreeValue(ctx, rh->rw_func[magic]);
-            rh->rw_func[magic] = JS_NULL;
-            if (JS_IsNull(rh->rw_func[0]) &&
-                JS_IsNull(rh->rw_func[1])) {
-                /* remove the entry */
-                free_rw_handler(JS_GetRuntime(ctx), rh);
+
+    js_std_dbuf_init(ctx, &dbuf);
+    for(;;) {
+        c = fgetc(f);
+        if (c == EOF) {
+            if (dbuf.size == 0) {
+                /* EOF */
+                dbuf_free(&dbuf);
+                return JS_NULL;
+            } else {
+                break;
             }
         }
-    } else {
-        if (!JS_IsFunction(ctx, func))
-            return JS_ThrowTypeError(ctx, "not a function");
-        rh = find_rh(ts, fd);
-        if (!rh) {
-            rh = js_mallocz(ctx, sizeof(*rh));
-            if (!rh)
-                return JS_EXCEPTION;
-            rh->fd = fd;
-            rh->rw_func[0] = JS_NULL;
-            rh->rw_func[1] = JS_NULL;
-            list_add_tail(&rh->link, &ts->os_rw_handlers);
+        if (c == '\n')
+            break;
+        if (dbuf_putc(&dbuf, c)) {
+            dbuf_free(&dbuf);
+            return JS_ThrowOutOfMemory(ctx);
         }
-        JS_FreeValue(ctx, rh->rw_func[magic]);
-        rh->rw_func[magic] = JS_DupValue(ctx, func);
     }
-    return JS_UNDEFINED;
+    obj = JS_NewStringLen(ctx, (const char *)dbuf.buf, dbuf.size);
+    dbuf_free(&dbuf);
+    return obj;
 }
 
-static JSOSSignalHandler *find_sh(JSThreadState *ts, int sig_num)
+/* XXX: could use less memory and go faster */
+static JSValue js_std_file_readAsString(JSContext *ctx, JSValueConst this_val,
+                                        int argc, JSValueConst *argv)
 {
-    JSOSSignalHandler *sh;
-    struct list_head *el;
-    list_for_each(el, &ts->os_signal_handlers) {
-        sh = list_entry(el, JSOSSignalHandler, link);
-        if (sh->sig_num == sig_num)
-            return sh;
+    FILE *f = js_std_file_get(ctx, this_val);
+    int c = 0;
+    DynBuf dbuf;
+    JSValue obj;
+    uint64_t max_size64 = 0;
+    size_t max_size;
+    JSValueConst max_size_val;
+
+    if (!f)
+        return JS_EXCEPTION;
+
+    if (argc >= 1)
+        max_size_val = argv[0];
+    else
+        max_size_val = JS_UNDEFINED;
+    max_size = (size_t)-1;
+    if (!JS_IsUndefined(max_size_val)) {
+        if (JS_ToIndex(ctx, &max_size64, max_size_val))
+            return JS_EXCEPTION;
+        if (max_size64 < max_size)
+            max_size = max_size64;
     }
-    return NULL;
+
+    js_std_dbuf_init(ctx, &dbuf);
+    while (max_size != 0) {
+        c = fgetc(f);
+        if (c == EOF)
+            break;
+        if (dbuf_putc(&dbuf, c)) {
+            dbuf_free(&dbuf);
+            return JS_EXCEPTION;
+        }
+        max_size--;
+    }
+    obj = JS_NewStringLen(ctx, (const char *)dbuf.buf, dbuf.size);
+    dbuf_free(&dbuf);
+    return obj;
 }
 
-static void free_sh(JSRuntime *rt, JSOSSignalHandler *sh)
+static JSValue js_std_file_getByte(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv)
 {
-    list_del(&sh->link);
-    JS_FreeValueRT(rt, sh->func);
-    js_free_rt(rt, sh);
+    FILE *f = js_std_file_get(ctx, this_val);
+    if (!f)
+        return JS_EXCEPTION;
+    return JS_NewInt32(ctx, fgetc(f));
 }
 
-static void os_signal_handler(int sig_num)
+static JSValue js_std_file_putByte(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv)
 {
-    os_pending_signals |= ((uint64_t)1 << sig_num);
+    FILE *f = js_std_file_get(ctx, this_val);
+    int c = 0;
+    if (!f)
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &c, argv[0]))
+        return JS_EXCEPTION;
+    c = fputc(c, f);
+    return JS_NewInt32(ctx, c);
 }
 
-#if defined(_WIN32)
-typedef void (*sighandler_t)(int sig_num);
-#endif
+/* urlGet */
 
-static JSValue js_os_signal(JSContext *ctx, JSValueConst this_val,
-                            int argc, JSValueConst *argv)
-{
-    JSRuntime *rt = JS_GetRuntime(ctx);
-    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
-    JSOSSignalHandler *sh;
-    uint32_t sig_num = 0;
-    JSValueConst func;
-    sighandler_t handler;
+#define URL_GET_PROGRAM "curl -s -i --"
+#define URL_GET_BUF_SIZE 4096
 
-    if (!is_main_thread(rt))
-        return JS_ThrowTypeError(ctx, "signal handler can only be set in the main thread");
+static int http_get_header_line(FILE *f, char *buf, size_t buf_size,
+                                DynBuf *dbuf)
+{
+    int c = 0;
+    char *p;
 
-    if (JS_ToUint32(ctx, &sig_num, argv[0]))
-        return JS_EXCEPTION;
-    if (sig_num >= 64)
-        return JS_ThrowRangeError(ctx, "invalid signal number");
-    func = argv[1];
-    /* func = null: SIG_DFL, func = undefined, SIG_IGN */
-    if (JS_IsNull(func) || JS_IsUndefined(func)) {
-        sh = find_sh(ts, sig_num);
-        if (sh) {
-            free_sh(JS_GetRuntime(ctx), sh);
-        }
-        if (JS_IsNull(func))
-            handler = SIG_DFL;
-        else
-            handler = SIG_IGN;
-        signal(sig_num, handler);
-    } else {
-        if (!JS_IsFunction(ctx, func))
-            return JS_ThrowTypeError(ctx, "not a function");
-        sh = find_sh(ts, sig_num);
-        if (!sh) {
-            sh = js_mallocz(ctx, sizeof(*sh));
-            if (!sh)
-                return JS_EXCEPTION;
-            sh->sig_num = sig_num;
-            list_add_tail(&sh->link, &ts->os_signal_handlers);
-        }
-        JS_FreeValue(ctx, sh->func);
-        sh->func = JS_DupValue(ctx, func);
-        signal(sig_num, os_signal_handler);
+    p = buf;
+    for(;;) {
+        c = fgetc(f);
+        if (c < 0)
+            return -1;
+        if ((p - buf) < buf_size - 1)
+            *p++ = c;
+        if (dbuf)
+            dbuf_putc(dbuf, c);
+        if (c == '\n')
+            break;
     }
-    return JS_UNDEFINED;
+    *p = '\0';
+    return 0;
 }
 
-#if defined(__linux__) || defined(__APPLE__)
-static int64_t get_time_ms(void)
+static int http_get_status(const char *buf)
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000 + (ts.tv_nsec / 1000000);
+    const char *p = buf;
+    while (*p != ' ' && *p != '\0')
+        p++;
+    if (*p != ' ')
+        return 0;
+    while (*p == ' ')
+        p++;
+    return atoi(p);
 }
 
-static int64_t get_time_ns(void)
-{
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
-}
-#else
-/* more portable, but does not work if the date is updated */
-static int64_t get_time_ms(void)
+static JSValue js_std_urlGet(JSContext *ctx, JSValueConst this_val,
+                             int argc, JSValueConst *argv)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (int64_t)tv.tv_sec * 1000 + (tv.tv_usec / 1000);
-}
+    const char *url;
+    DynBuf cmd_buf;
+    DynBuf data_buf_s, *data_buf = &data_buf_s;
+    DynBuf header_buf_s, *header_buf = &header_buf_s;
+    char *buf;
+    size_t i, len;
+    int c = 0, status = 0;
+    JSValue response = JS_UNDEFINED, ret_obj;
+    JSValueConst options_obj;
+    FILE *f;
+    BOOL binary_flag, full_flag;
 
-static int64_t get_time_ns(void)
-{
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (int64_t)tv.tv_sec * 1000000000 + (tv.tv_usec * 1000);
-}
-#endif
-
-static JSValue js_os_now(JSContext *ctx, JSValue this_val,
-                         int argc, JSValue *argv)
-{
-    return JS_NewFloat64(ctx, (double)get_time_ns() / 1e6);
-}
-
-static void free_timer(JSRuntime *rt, JSOSTimer *th)
-{
-    list_del(&th->link);
-    JS_FreeValueRT(rt, th->func);
-    js_free_rt(rt, th);
-}
-
-static JSValue js_os_setTimeout(JSContext *ctx, JSValueConst this_val,
-                                int argc, JSValueConst *argv)
-{
-    JSRuntime *rt = JS_GetRuntime(ctx);
-    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
-    int64_t delay = 0;
-    JSValueConst func;
-    JSOSTimer *th;
-
-    func = argv[0];
-    if (!JS_IsFunction(ctx, func))
-        return JS_ThrowTypeError(ctx, "not a function");
-    if (JS_ToInt64(ctx, &delay, argv[1]))
-        return JS_EXCEPTION;
-    th = js_mallocz(ctx, sizeof(*th));
-    if (!th)
+    url = JS_ToCString(ctx, argv[0]);
+    if (!url)
         return JS_EXCEPTION;
-    th->timer_id = ts->next_timer_id;
-    if (ts->next_timer_id == INT32_MAX)
-        ts->next_timer_id = 1;
-    else
-        ts->next_timer_id++;
-    th->timeout = get_time_ms() + delay;
-    th->func = JS_DupValue(ctx, func);
-    list_add_tail(&th->link, &ts->os_timers);
-    return JS_NewInt32(ctx, th->timer_id);
-}
-
-static JSOSTimer *find_timer_by_id(JSThreadState *ts, int timer_id)
-{
-    struct list_head *el;
-    if (timer_id <= 0)
-        return NULL;
-    list_for_each(el, &ts->os_timers) {
-        JSOSTimer *th = list_entry(el, JSOSTimer, link);
-        if (th->timer_id == timer_id)
-            return th;
-    }
-    return NULL;
-}
 
-static JSValue js_os_clearTimeout(JSContext *ctx, JSValueConst this_val,
-                                  int argc, JSValueConst *argv)
-{
-    JSRuntime *rt = JS_GetRuntime(ctx);
-    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
-    JSOSTimer *th;
-    int timer_id;
+    binary_flag = FALSE;
+    full_flag = FALSE;
 
-    if (JS_ToInt32(ctx, &timer_id, argv[0]))
-        return JS_EXCEPTION;
-    th = find_timer_by_id(ts, timer_id);
-    if (!th)
-        return JS_UNDEFINED;
-    free_timer(rt, th);
-    return JS_UNDEFINED;
-}
+    if (argc >= 2) {
+        options_obj = argv[1];
 
-/* return a promise */
-static JSValue js_os_sleepAsync(JSContext *ctx, JSValueConst this_val,
-                                int argc, JSValueConst *argv)
-{
-    JSRuntime *rt = JS_GetRuntime(ctx);
-    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
-    int64_t delay;
-    JSOSTimer *th;
-    JSValue promise, resolving_funcs[2];
+        if (get_bool_option(ctx, &binary_flag, options_obj, "binary"))
+            goto fail_obj;
 
-    if (JS_ToInt64(ctx, &delay, argv[0]))
-        return JS_EXCEPTION;
-    promise = JS_NewPromiseCapability(ctx, resolving_funcs);
-    if (JS_IsException(promise))
-        return JS_EXCEPTION;
+        if (get_bool_option(ctx, &full_flag, options_obj, "full")) {
+        fail_obj:
+            JS_FreeCString(ctx, url);
+            return JS_EXCEPTION;
+        }
+    }
 
-    th = js_mallocz(ctx, sizeof(*th));
-    if (!th) {
-        JS_FreeValue(ctx, promise);
-        JS_FreeValue(ctx, resolving_funcs[0]);
-        JS_FreeValue(ctx, resolving_funcs[1]);
+    js_std_dbuf_init(ctx, &cmd_buf);
+    dbuf_printf(&cmd_buf, "%s '", URL_GET_PROGRAM);
+    for(i = 0; url[i] != '\0'; i++) {
+        unsigned char c = url[i];
+        switch (c) {
+        case '\'':
+            /* shell single quoted string does not support \' */
+            dbuf_putstr(&cmd_buf, "'\\''");
+            break;
+        case '[': case ']': case '{': case '}': case '\\':
+            /* prevent interpretation by curl as range or set specification */
+            dbuf_putc(&cmd_buf, '\\');
+            /* FALLTHROUGH */
+        default:
+            dbuf_putc(&cmd_buf, c);
+            break;
+        }
+    }
+    JS_FreeCString(ctx, url);
+    dbuf_putstr(&cmd_buf, "'");
+    dbuf_putc(&cmd_buf, '\0');
+    if (dbuf_error(&cmd_buf)) {
+        dbuf_free(&cmd_buf);
         return JS_EXCEPTION;
     }
-    th->timer_id = -1;
-    th->timeout = get_time_ms() + delay;
-    th->func = JS_DupValue(ctx, resolving_funcs[0]);
-    list_add_tail(&th->link, &ts->os_timers);
-    JS_FreeValue(ctx, resolving_funcs[0]);
-    JS_FreeValue(ctx, resolving_funcs[1]);
-    return promise;
-}
-
-static void call_handler(JSContext *ctx, JSValueConst func)
-{
-    JSValue ret, func1;
-    /* 'func' might be destroyed when calling itself (if it frees the
-       handler), so must take extra care */
-    func1 = JS_DupValue(ctx, func);
-    ret = JS_Call(ctx, func1, JS_UNDEFINED, 0, NULL);
-    JS_FreeValue(ctx, func1);
-    if (JS_IsException(ret))
-        js_std_dump_error(ctx);
-    JS_FreeValue(ctx, ret);
-}
-
-#if defined(_WIN32)
+    //    printf("%s\n", (char *)cmd_buf.buf);
+    f = popen((char *)cmd_buf.buf, "r");
+    dbuf_free(&cmd_buf);
+    if (!f) {
+        return JS_ThrowTypeError(ctx, "could not start curl");
+    }
 
-static int js_os_poll(JSContext *ctx)
-{
-    JSRuntime *rt = JS_GetRuntime(ctx);
-    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
-    int min_delay = 0, console_fd = 0;
-    int64_t cur_time = 0, delay = 0;
-    JSOSRWHandler *rh;
-    struct list_head *el;
+    js_std_dbuf_init(ctx, data_buf);
+    js_std_dbuf_init(ctx, header_buf);
 
-    /* XXX: handle signals if useful */
+    buf = js_malloc(ctx, URL_GET_BUF_SIZE);
+    if (!buf)
+        goto fail;
 
-    if (list_empty(&ts->os_rw_handlers) && list_empty(&ts->os_timers))
-        return -1; /* no more events */
+    /* get the HTTP status */
+    if (http_get_header_line(f, buf, URL_GET_BUF_SIZE, NULL) < 0) {
+        status = 0;
+        goto bad_header;
+    }
+    status = http_get_status(buf);
+    if (!full_flag && !(status >= 200 && status <= 299)) {
+        goto bad_header;
+    }
 
-    /* XXX: only timers and basic console input are supported */
-    if (!list_empty(&ts->os_timers)) {
-        cur_time = get_time_ms();
-        min_delay = 10000;
-        list_for_each(el, &ts->os_timers) {
-            JSOSTimer *th = list_entry(el, JSOSTimer, link);
-            delay = th->timeout - cur_time;
-            if (delay <= 0) {
-                JSValue func;
-                /* the timer expired */
-                func = th->func;
-                th->func = JS_UNDEFINED;
-                free_timer(rt, th);
-                call_handler(ctx, func);
-                JS_FreeValue(ctx, func);
-                return 0;
-            } else if (delay < min_delay) {
-                min_delay = delay;
-            }
+    /* wait until there is an empty line */
+    for(;;) {
+        if (http_get_header_line(f, buf, URL_GET_BUF_SIZE, header_buf) < 0) {
+        bad_header:
+            response = JS_NULL;
+            goto done;
         }
-    } else {
-        min_delay = -1;
+        if (!strcmp(buf, "\r\n"))
+            break;
     }
+    if (dbuf_error(header_buf))
+        goto fail;
+    header_buf->size -= 2; /* remove the trailing CRLF */
 
-    console_fd = -1;
-    list_for_each(el, &ts->os_rw_handlers) {
-        rh = list_entry(el, JSOSRWHandler, link);
-        if (rh->fd == 0 && !JS_IsNull(rh->rw_func[0])) {
-            console_fd = rh->fd;
+    /* download the data */
+    for(;;) {
+        len = fread(buf, 1, URL_GET_BUF_SIZE, f);
+        if (len == 0)
             break;
-        }
+        dbuf_put(data_buf, (uint8_t *)buf, len);
+    }
+    if (dbuf_error(data_buf))
+        goto fail;
+    if (binary_flag) {
+        response = JS_NewArrayBufferCopy(ctx,
+                                         data_buf->buf, data_buf->size);
+    } else {
+        response = JS_NewStringLen(ctx, (char *)data_buf->buf, data_buf->size);
     }
+    if (JS_IsException(response))
+        goto fail;
+ done:
+    js_free(ctx, buf);
+    buf = NULL;
+    pclose(f);
+    f = NULL;
+    dbuf_free(data_buf);
+    data_buf = NULL;
 
-    if (console_fd >= 0) {
-        DWORD ti, ret;
-        HANDLE handle;
-        if (min_delay == -1)
-            ti = INFINITE;
-        else
-            ti = min_delay;
-        handle = (HANDLE)_get_osfhandle(console_fd);
-        ret = WaitForSingleObject(handle, ti);
-        if (ret == WAIT_OBJECT_0) {
-            list_for_each(el, &ts->os_rw_handlers) {
-                rh = list_entry(el, JSOSRWHandler, link);
-                if (rh->fd == console_fd && !JS_IsNull(rh->rw_func[0])) {
-                    call_handler(ctx, rh->rw_func[0]);
-                    /* must stop because the list may have been modified */
-                    break;
-                }
-            }
+    if (full_flag) {
+        ret_obj = JS_NewObject(ctx);
+        if (JS_IsException(ret_obj))
+            goto fail;
+        JS_DefinePropertyValueStr(ctx, ret_obj, "response",
+                                  response,
+                                  JS_PROP_C_W_E);
+        if (!JS_IsNull(response)) {
+            JS_DefinePropertyValueStr(ctx, ret_obj, "responseHeaders",
+                                      JS_NewStringLen(ctx, (char *)header_buf->buf,
+                                                      header_buf->size),
+                                      JS_PROP_C_W_E);
+            JS_DefinePropertyValueStr(ctx, ret_obj, "status",
+                                      JS_NewInt32(ctx, status),
+                                      JS_PROP_C_W_E);
         }
     } else {
-        Sleep(min_delay);
+        ret_obj = response;
     }
-    return 0;
-}
-#else
-
-#ifdef USE_WORKER
-
-static void js_free_message(JSWorkerMessage *msg);
+    dbuf_free(header_buf);
+    return ret_obj;
+ fail:
+    if (f)
+        pclose(f);
+    js_free(ctx, buf);
+    if (data_buf)
+        dbuf_free(data_buf);
+    if (header_buf)
+        dbuf_free(header_buf);
+    JS_FreeValue(ctx, response);
+    return JS_EXCEPTION;
+}
 
-/* return 1 if a message was handled, 0 if no message */
-static int handle_posted_message(JSRuntime *rt, JSContext *ctx,
-                                 JSWorkerMessageHandler *port)
-{
-    JSWorkerMessagePipe *ps = port->recv_pipe;
-    int ret = 0;
-    struct list_head *el;
-    JSWorkerMessage *msg;
-    JSValue obj, data_obj, func, retval;
+static JSClassDef js_std_file_class = {
+    "FILE",
+    .finalizer = js_std_file_finalizer,
+};
 
-    pthread_mutex_lock(&ps->mutex);
-    if (!list_empty(&ps->msg_queue)) {
-        el = ps->msg_queue.next;
-        msg = list_entry(el, JSWorkerMessage, link);
+static const JSCFunctionListEntry js_std_error_props[] = {
+    /* various errno values */
+#define DEF(x) JS_PROP_INT32_DEF(#x, x, JS_PROP_CONFIGURABLE )
+    DEF(EINVAL),
+    DEF(EIO),
+    DEF(EACCES),
+    DEF(EEXIST),
+    DEF(ENOSPC),
+    DEF(ENOSYS),
+    DEF(EBUSY),
+    DEF(ENOENT),
+    DEF(EPERM),
+    DEF(EPIPE),
+    DEF(EBADF),
+    DEF(EAGAIN),
+    DEF(EINTR),
+    DEF(EINPROGRESS),
+    DEF(EADDRINUSE),
+    DEF(ECONNREFUSED),
+    DEF(ECONNRESET),
+#undef DEF
+};
 
-        /* remove the message from the queue */
-        list_del(&msg->link);
+static const JSCFunctionListEntry js_std_funcs[] = {
+    JS_CFUNC_DEF("exit", 1, js_std_exit ),
+    JS_CFUNC_DEF("gc", 0, js_std_gc ),
+    JS_CFUNC_DEF("evalScript", 1, js_evalScript ),
+    JS_CFUNC_DEF("loadScript", 1, js_loadScript ),
+    JS_CFUNC_DEF("getenv", 1, js_std_getenv ),
+    JS_CFUNC_DEF("setenv", 1, js_std_setenv ),
+    JS_CFUNC_DEF("unsetenv", 1, js_std_unsetenv ),
+    JS_CFUNC_DEF("getenviron", 1, js_std_getenviron ),
+    JS_CFUNC_DEF("urlGet", 1, js_std_urlGet ),
+    JS_CFUNC_DEF("loadFile", 1, js_std_loadFile ),
+    JS_CFUNC_DEF("strerror", 1, js_std_strerror ),
+    JS_CFUNC_DEF("parseExtJSON", 1, js_std_parseExtJSON ),
 
-        if (list_empty(&ps->msg_queue)) {
-            uint8_t buf[16];
-            int ret = 0;
-            for(;;) {
-                ret = read(ps->read_fd, buf, sizeof(buf));
-                if (ret >= 0)
-                    break;
-                if (errno != EAGAIN && errno != EINTR)
-                    break;
-            }
-        }
+    /* FILE I/O */
+    JS_CFUNC_DEF("open", 2, js_std_open ),
+    JS_CFUNC_DEF("popen", 2, js_std_popen ),
+    JS_CFUNC_DEF("fdopen", 2, js_std_fdopen ),
+    JS_CFUNC_DEF("tmpfile", 0, js_std_tmpfile ),
+    JS_CFUNC_MAGIC_DEF("puts", 1, js_std_file_puts, 0 ),
+    JS_CFUNC_DEF("printf", 1, js_std_printf ),
+    JS_CFUNC_DEF("sprintf", 1, js_std_sprintf ),
+    JS_PROP_INT32_DEF("SEEK_SET", SEEK_SET, JS_PROP_CONFIGURABLE ),
+    JS_PROP_INT32_DEF("SEEK_CUR", SEEK_CUR, JS_PROP_CONFIGURABLE ),
+    JS_PROP_INT32_DEF("SEEK_END", SEEK_END, JS_PROP_CONFIGURABLE ),
+    JS_OBJECT_DEF("Error", js_std_error_props, countof(js_std_error_props), JS_PROP_CONFIGURABLE),
+};
 
-        pthread_mutex_unlock(&ps->mutex);
+static const JSCFunctionListEntry js_std_file_proto_funcs[] = {
+    JS_CFUNC_DEF("close", 0, js_std_file_close ),
+    JS_CFUNC_MAGIC_DEF("puts", 1, js_std_file_puts, 1 ),
+    JS_CFUNC_DEF("printf", 1, js_std_file_printf ),
+    JS_CFUNC_DEF("flush", 0, js_std_file_flush ),
+    JS_CFUNC_MAGIC_DEF("tell", 0, js_std_file_tell, 0 ),
+    JS_CFUNC_MAGIC_DEF("tello", 0, js_std_file_tell, 1 ),
+    JS_CFUNC_DEF("seek", 2, js_std_file_seek ),
+    JS_CFUNC_DEF("eof", 0, js_std_file_eof ),
+    JS_CFUNC_DEF("fileno", 0, js_std_file_fileno ),
+    JS_CFUNC_DEF("error", 0, js_std_file_error ),
+    JS_CFUNC_DEF("clearerr", 0, js_std_file_clearerr ),
+    JS_CFUNC_MAGIC_DEF("read", 3, js_std_file_read_write, 0 ),
+    JS_CFUNC_MAGIC_DEF("write", 3, js_std_file_read_write, 1 ),
+    JS_CFUNC_DEF("getline", 0, js_std_file_getline ),
+    JS_CFUNC_DEF("readAsString", 0, js_std_file_readAsString ),
+    JS_CFUNC_DEF("getByte", 0, js_std_file_getByte ),
+    JS_CFUNC_DEF("putByte", 1, js_std_file_putByte ),
+    /* setvbuf, ...  */
+};
 
-        data_obj = JS_ReadObject(ctx, msg->data, msg->data_len,
-                                 JS_READ_OBJ_SAB | JS_READ_OBJ_REFERENCE);
+static int js_std_init(JSContext *ctx, JSModuleDef *m)
+{
+    JSValue proto, obj;
 
-        js_free_message(msg);
+    /* FILE class */
+    /* the class ID is created once */
+    JS_NewClassID(&js_std_file_class_id);
+    /* the class is created once per runtime */
+    JS_NewClass(JS_GetRuntime(ctx), js_std_file_class_id, &js_std_file_class);
+    proto = JS_NewObject(ctx);
+    JS_SetPropertyFunctionList(ctx, proto, js_std_file_proto_funcs,
+                               countof(js_std_file_proto_funcs));
+    JS_SetClassProto(ctx, js_std_file_class_id, proto);
 
-        if (JS_IsException(data_obj))
-            goto fail;
-        obj = JS_NewObject(ctx);
-        if (JS_IsException(obj)) {
-            JS_FreeValue(ctx, data_obj);
-            goto fail;
-        }
-        JS_DefinePropertyValueStr(ctx, obj, "data", data_obj, JS_PROP_C_W_E);
+    /* JSONParser class */
+    JS_NewClassID(&js_json_parser_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_json_parser_class_id, &js_json_parser_class);
+    proto = JS_NewObject(ctx);
+    JS_SetPropertyFunctionList(ctx, proto, js_json_parser_proto_funcs,
+                               countof(js_json_parser_proto_funcs));
+    JS_SetClassProto(ctx, js_json_parser_class_id, proto);
+    obj = JS_NewCFunction2(ctx, js_json_parser_ctor, "JSONParser", 2,
+                           JS_CFUNC_constructor, 0);
+    JS_SetConstructor(ctx, obj, proto);
+    JS_SetModuleExport(ctx, m, "JSONParser", obj);
 
-        /* 'func' might be destroyed when calling itself (if it frees the
-           handler), so must take extra care */
-        func = JS_DupValue(ctx, port->on_message_func);
-        retval = JS_Call(ctx, func, JS_UNDEFINED, 1, (JSValueConst *)&obj);
-        JS_FreeValue(ctx, obj);
-        JS_FreeValue(ctx, func);
-        if (JS_IsException(retval)) {
-        fail:
-            js_std_dump_error(ctx);
-        } else {
-            JS_FreeValue(ctx, retval);
-        }
-        ret = 1;
-    } else {
-        pthread_mutex_unlock(&ps->mutex);
-        ret = 0;
-    }
-    return ret;
-}
-#else
-static int handle_posted_message(JSRuntime *rt, JSContext *ctx,
-                                 JSWorkerMessageHandler *port)
-{
+    JS_SetModuleExportList(ctx, m, js_std_funcs,
+                           countof(js_std_funcs));
+    JS_SetModuleExport(ctx, m, "in", js_new_std_file(ctx, stdin, FALSE, FALSE));
+    JS_SetModuleExport(ctx, m, "out", js_new_std_file(ctx, stdout, FALSE, FALSE));
+    JS_SetModuleExport(ctx, m, "err", js_new_std_file(ctx, stderr, FALSE, FALSE));
     return 0;
 }
-#endif
 
-static int js_os_poll(JSContext *ctx)
+JSModuleDef *js_init_module_std(JSContext *ctx, const char *module_name)
 {
-    JSRuntime *rt = JS_GetRuntime(ctx);
-    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
-    int ret = 0, fd_max = 0, min_delay = 0;
-    int64_t cur_time = 0, delay = 0;
-    fd_set rfds, wfds;
-    JSOSRWHandler *rh;
-    struct list_head *el;
-    struct timeval tv, *tvp;
+    JSModuleDef *m;
+    m = JS_NewCModule(ctx, module_name, js_std_init);
+    if (!m)
+        return NULL;
+    JS_AddModuleExportList(ctx, m, js_std_funcs, countof(js_std_funcs));
+    JS_AddModuleExport(ctx, m, "in");
+    JS_AddModuleExport(ctx, m, "out");
+    JS_AddModuleExport(ctx, m, "err");
+    JS_AddModuleExport(ctx, m, "JSONParser");
+    return m;
+}
 
-    /* only check signals in the main thread */
-    if (!ts->recv_pipe &&
-        unlikely(os_pending_signals != 0)) {
-        JSOSSignalHandler *sh;
-        uint64_t mask = 0;
-        
-        list_for_each(el, &ts->os_signal_handlers) {
-            sh = list_entry(el, JSOSSignalHandler, link);
-            mask = (uint64_t)1 << sh->sig_num;
-            if (os_pending_signals & mask) {
-                os_pending_signals &= ~mask;
-                call_handler(ctx, sh->func);
-                return 0;
-            }
-        }
-    }
+/**********************************************************/
+/* 'os' object */
 
-    if (list_empty(&ts->os_rw_handlers) && list_empty(&ts->os_timers) &&
-        list_empty(&ts->port_list))
-        return -1; /* no more events */
+static JSValue js_os_open(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv)
+{
+    const char *filename = NULL;
+    int flags = 0, mode = 0, ret = 0;
 
-    if (!list_empty(&ts->os_timers)) {
-        cur_time = get_time_ms();
-        min_delay = 10000;
-        list_for_each(el, &ts->os_timers) {
-            JSOSTimer *th = list_entry(el, JSOSTimer, link);
-            delay = th->timeout - cur_time;
-            if (delay <= 0) {
-                JSValue func;
-                /* the timer expired */
-                func = th->func;
-                th->func = JS_UNDEFINED;
-                free_timer(rt, th);
-                call_handler(ctx, func);
-                JS_FreeValue(ctx, func);
-                return 0;
-            } else if (delay < min_delay) {
-                min_delay = delay;
-            }
+    filename = JS_ToCString(ctx, argv[0]);
+    if (!filename)
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &flags, argv[1]))
+        goto fail;
+    if (argc >= 3 && !JS_IsUndefined(argv[2])) {
+        if (JS_ToInt32(ctx, &mode, argv[2])) {
+        fail:
+            JS_FreeCString(ctx, filename);
+            return JS_EXCEPTION;
         }
-        tv.tv_sec = min_delay / 1000;
-        tv.tv_usec = (min_delay % 1000) * 1000;
-        tvp = &tv;
     } else {
-        tvp = NULL;
-    }
-
-    FD_ZERO(&rfds);
-    FD_ZERO(&wfds);
-    fd_max = -1;
-    list_for_each(el, &ts->os_rw_handlers) {
-        rh = list_entry(el, JSOSRWHandler, link);
-        fd_max = max_int(fd_max, rh->fd);
-        if (!JS_IsNull(rh->rw_func[0]))
-            FD_SET(rh->fd, &rfds);
-        if (!JS_IsNull(rh->rw_func[1]))
-            FD_SET(rh->fd, &wfds);
-    }
-
-    list_for_each(el, &ts->port_list) {
-        JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
-        if (!JS_IsNull(port->on_message_func)) {
-            JSWorkerMessagePipe *ps = port->recv_pipe;
-            fd_max = max_int(fd_max, ps->read_fd);
-            FD_SET(ps->read_fd, &rfds);
-        }
-    }
-
-    ret = select(fd_max + 1, &rfds, &wfds, NULL, tvp);
-    if (ret > 0) {
-        list_for_each(el, &ts->os_rw_handlers) {
-            rh = list_entry(el, JSOSRWHandler, link);
-            if (!JS_IsNull(rh->rw_func[0]) &&
-                FD_ISSET(rh->fd, &rfds)) {
-                call_handler(ctx, rh->rw_func[0]);
-                /* must stop because the list may have been modified */
-                goto done;
-            }
-            if (!JS_IsNull(rh->rw_func[1]) &&
-                FD_ISSET(rh->fd, &wfds)) {
-                call_handler(ctx, rh->rw_func[1]);
-                /* must stop because the list may have been modified */
-                goto done;
-            }
-        }
-
-        list_for_each(el, &ts->port_list) {
-            JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
-            if (!JS_IsNull(port->on_message_func)) {
-                JSWorkerMessagePipe *ps = port->recv_pipe;
-                if (FD_ISSET(ps->read_fd, &rfds)) {
-                    if (handle_posted_message(rt, ctx, port))
-                        goto done;
-                }
-            }
-        }
+        mode = 0666;
     }
-    done:
-    return 0;
+#if defined(_WIN32)
+    /* force binary mode by default */
+    if (!(flags & O_TEXT))
+        flags |= O_BINARY;
+#endif
+    ret = js_get_errno(open(filename, flags, mode));
+    JS_FreeCString(ctx, filename);
+    return JS_NewInt32(ctx, ret);
 }
-#endif /* !_WIN32 */
 
-static JSValue make_obj_error(JSContext *ctx,
-                              JSValue obj,
-                              int err)
+static JSValue js_os_close(JSContext *ctx, JSValueConst this_val,
+                           int argc, JSValueConst *argv)
 {
-    JSValue arr;
-    if (JS_IsException(obj))
-        return obj;
-    arr = JS_NewArray(ctx);
-    if (JS_IsException(arr))
+    int fd = 0, ret = 0;
+    if (JS_ToInt32(ctx, &fd, argv[0]))
         return JS_EXCEPTION;
-    JS_DefinePropertyValueUint32(ctx, arr, 0, obj,
-                                 JS_PROP_C_W_E);
-    JS_DefinePropertyValueUint32(ctx, arr, 1, JS_NewInt32(ctx, err),
-                                 JS_PROP_C_W_E);
-    return arr;
+    ret = js_get_errno(close(fd));
+    return JS_NewInt32(ctx, ret);
 }
 
-static JSValue make_string_error(JSContext *ctx,
-                                 const char *buf,
-                                 int err)
+static JSValue js_os_seek(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv)
 {
-    return make_obj_error(ctx, JS_NewString(ctx, buf), err);
+    int fd = 0, whence = 0;
+    int64_t pos = 0, ret = 0;
+    BOOL is_bigint = FALSE;
+    
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    is_bigint = JS_IsBigInt(ctx, argv[1]);
+    if (JS_ToInt64Ext(ctx, &pos, argv[1]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &whence, argv[2]))
+        return JS_EXCEPTION;
+    ret = lseek(fd, pos, whence);
+    if (ret == -1)
+        ret = -errno;
+    if (is_bigint)
+        return JS_NewBigInt64(ctx, ret);
+    else
+        return JS_NewInt64(ctx, ret);
 }
 
-/* return [cwd, errorcode] */
-static JSValue js_os_getcwd(JSContext *ctx, JSValueConst this_val,
-                            int argc, JSValueConst *argv)
+static JSValue js_os_read_write(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv, int magic)
 {
-    char buf[PATH_MAX];
-    int err = 0;
+    int fd = 0;
+    uint64_t pos = 0, len = 0;
+    size_t size = 0;
+    ssize_t ret = 0;
+    uint8_t *buf = NULL;
     
-    if (!getcwd(buf, sizeof(buf))) {
-        buf[0] = '\0';
-        err = errno;
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &pos, argv[2]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &len, argv[3]))
+        return JS_EXCEPTION;
+    buf = JS_GetArrayBuffer(ctx, &size, argv[1]);
+    if (!buf)
+        return JS_EXCEPTION;
+    if (pos + len > size)
+        return JS_ThrowRangeError(ctx, "read/write array buffer overflow");
+    if (magic)
+        ret = js_get_errno(write(fd, buf + pos, len));
+    else
+        ret = js_get_errno(read(fd, buf + pos, len));
+    return JS_NewInt64(ctx, ret);
+}
+
+static JSValue js_os_isatty(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    int fd = 0;
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    return JS_NewBool(ctx, isatty(fd));
+}
+
+#if defined(_WIN32)
+static JSValue js_os_ttyGetWinSize(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv)
+{
+    int fd = 0;
+    HANDLE handle = NULL;
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    JSValue obj;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    handle = (HANDLE)_get_osfhandle(fd);
+
+    if (!GetConsoleScreenBufferInfo(handle, &info))
+        return JS_NULL;
+    obj = JS_NewArray(ctx);
+    if (JS_IsException(obj))
+        return obj;
+    JS_DefinePropertyValueUint32(ctx, obj, 0, JS_NewInt32(ctx, info.dwSize.X), JS_PROP_C_W_E);
+    JS_DefinePropertyValueUint32(ctx, obj, 1, JS_NewInt32(ctx, info.dwSize.Y), JS_PROP_C_W_E);
+    return obj;
+}
+
+/* Windows 10 built-in VT100 emulation */
+#define __ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#define __ENABLE_VIRTUAL_TERMINAL_INPUT 0x0200
+
+static JSValue js_os_ttySetRaw(JSContext *ctx, JSValueConst this_val,
+                               int argc, JSValueConst *argv)
+{
+    int fd = 0;
+    HANDLE handle = NULL;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    handle = (HANDLE)_get_osfhandle(fd);
+    SetConsoleMode(handle, ENABLE_WINDOW_INPUT | __ENABLE_VIRTUAL_TERMINAL_INPUT);
+    _setmode(fd, _O_BINARY);
+    if (fd == 0) {
+        handle = (HANDLE)_get_osfhandle(1); /* corresponding output */
+        SetConsoleMode(handle, ENABLE_PROCESSED_OUTPUT | ENABLE_WRAP_AT_EOL_OUTPUT | __ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    }
+    return JS_UNDEFINED;
+}
+#else
+static JSValue js_os_ttyGetWinSize(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv)
+{
+    int fd = 0;
+    struct winsize ws;
+    JSValue obj;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (ioctl(fd, TIOCGWINSZ, &ws) == 0 &&
+        ws.ws_col >= 4 && ws.ws_row >= 4) {
+        obj = JS_NewArray(ctx);
+        if (JS_IsException(obj))
+            return obj;
+        JS_DefinePropertyValueUint32(ctx, obj, 0, JS_NewInt32(ctx, ws.ws_col), JS_PROP_C_W_E);
+        JS_DefinePropertyValueUint32(ctx, obj, 1, JS_NewInt32(ctx, ws.ws_row), JS_PROP_C_W_E);
+        return obj;
     } else {
-        err = 0;
+        return JS_NULL;
     }
-    return make_string_error(ctx, buf, err);
 }
 
-static JSValue js_os_chdir(JSContext *ctx, JSValueConst this_val,
-                           int argc, JSValueConst *argv)
+static struct termios oldtty;
+
+static void term_exit(void)
 {
-    const char *target = NULL;
-    int err = 0;
+    tcsetattr(0, TCSANOW, &oldtty);
+}
 
-    target = JS_ToCString(ctx, argv[0]);
-    if (!target)
+/* XXX: should add a way to go back to normal mode */
+static JSValue js_os_ttySetRaw(JSContext *ctx, JSValueConst this_val,
+                               int argc, JSValueConst *argv)
+{
+    struct termios tty;
+    int fd = 0;
+    
+    if (JS_ToInt32(ctx, &fd, argv[0]))
         return JS_EXCEPTION;
-    err = js_get_errno(chdir(target));
-    JS_FreeCString(ctx, target);
-    return JS_NewInt32(ctx, err);
+
+    memset(&tty, 0, sizeof(tty));
+    tcgetattr(fd, &tty);
+    oldtty = tty;
+
+    tty.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP
+                          |INLCR|IGNCR|ICRNL|IXON);
+    tty.c_oflag |= OPOST;
+    tty.c_lflag &= ~(ECHO|ECHONL|ICANON|IEXTEN);
+    tty.c_cflag &= ~(CSIZE|PARENB);
+    tty.c_cflag |= CS8;
+    tty.c_cc[VMIN] = 1;
+    tty.c_cc[VTIME] = 0;
+
+    tcsetattr(fd, TCSANOW, &tty);
+
+    atexit(term_exit);
+    return JS_UNDEFINED;
 }
 
-static JSValue js_os_mkdir(JSContext *ctx, JSValueConst this_val,
-                           int argc, JSValueConst *argv)
+#endif /* !_WIN32 */
+
+static JSValue js_os_remove(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
 {
-    int mode = 0, ret = 0;
-    const char *path = NULL;
+    const char *filename;
+    int ret = 0;
     
-    if (argc >= 2) {
-        if (JS_ToInt32(ctx, &mode, argv[1]))
-            return JS_EXCEPTION;
-    } else {
-        mode = 0777;
-    }
-    path = JS_ToCString(ctx, argv[0]);
-    if (!path)
+    filename = JS_ToCString(ctx, argv[0]);
+    if (!filename)
         return JS_EXCEPTION;
 #if defined(_WIN32)
-    (void)mode;
-    ret = js_get_errno(mkdir(path));
+    {
+        struct stat st;
+        if (stat(filename, &st) == 0 && S_ISDIR(st.st_mode)) {
+            ret = rmdir(filename);
+        } else {
+            ret = unlink(filename);
+        }
+    }
 #else
-    ret = js_get_errno(mkdir(path, mode));
+    ret = remove(filename);
 #endif
-    JS_FreeCString(ctx, path);
+    ret = js_get_errno(ret);
+    JS_FreeCString(ctx, filename);
     return JS_NewInt32(ctx, ret);
 }
 
-/* return [array, errorcode] */
-static JSValue js_os_readdir(JSContext *ctx, JSValueConst this_val,
-                             int argc, JSValueConst *argv)
+static JSValue js_os_rename(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
 {
-    const char *path = NULL;
-#if defined(_WIN32)
-    HANDLE hFind = NULL;
-    WIN32_FIND_DATAA hData;
-    int f = 0;
-#else
-    DIR *f;
-    struct dirent *d;
-#endif
-    JSValue obj;
-    int err = 0;
-    uint32_t len = 0;
+    const char *oldpath, *newpath;
+    int ret = 0;
     
-    path = JS_ToCString(ctx, argv[0]);
-    if (!path)
+    oldpath = JS_ToCString(ctx, argv[0]);
+    if (!oldpath)
         return JS_EXCEPTION;
-    obj = JS_NewArray(ctx);
-    if (JS_IsException(obj)) {
-        JS_FreeCString(ctx, path);
+    newpath = JS_ToCString(ctx, argv[1]);
+    if (!newpath) {
+        JS_FreeCString(ctx, oldpath);
         return JS_EXCEPTION;
     }
-#if defined(_WIN32)
-    char* _path = (char*)malloc(strlen(path) + 3);
-    memset(_path, 0, strlen(path) + 3);
-    strcpy(_path, path);
-    strcpy(_path + strlen(path), "\\*");
-    hFind = FindFirstFileA(_path, &hData);
-    free(_path);
-    f = hFind != INVALID_HANDLE_VALUE;
-#else
-    f = opendir(path);
-#endif
-    if (!f)
-#ifdef _WIN32
-        err = GetLastError();
-#else
-        err = errno;
-#endif
+    ret = js_get_errno(rename(oldpath, newpath));
+    JS_FreeCString(ctx, oldpath);
+    JS_FreeCString(ctx, newpath);
+    return JS_NewInt32(ctx, ret);
+}
+
+static BOOL is_main_thread(JSRuntime *rt)
+{
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    return !ts->recv_pipe;
+}
+
+/* TRUE if the handler waits for 'fd' to be readable (is_write = 0) or
+   writable (is_write = 1) */
+static BOOL rh_is_waiting(JSOSRWHandler *rh, int is_write)
+{
+    return !JS_IsNull(rh->rw_func[is_write]) ||
+        !list_empty(&rh->io_requests[is_write]);
+}
+
+static BOOL rh_is_unused(JSOSRWHandler *rh)
+{
+    return !rh_is_waiting(rh, 0) && !rh_is_waiting(rh, 1);
+}
+
+/* the request must be removed from its list */
+static void js_os_io_free(JSRuntime *rt, JSOSIORequest *req)
+{
+    JS_FreeValueRT(rt, req->buffer);
+    JS_FreeValueRT(rt, req->resolving_funcs[0]);
+    JS_FreeValueRT(rt, req->resolving_funcs[1]);
+    js_free_rt(rt, req->data);
+    js_free_rt(rt, req);
+}
+
+static JSOSRWHandler *find_rh(JSThreadState *ts, int fd)
+{
+    if (fd < 0 || fd >= ts->rh_tab_size)
+        return NULL;
+    return ts->rh_tab[fd];
+}
+
+#ifdef USE_EPOLL
+static void rh_set_epoll_rejected(JSThreadState *ts, JSOSRWHandler *rh,
+                                  BOOL rejected)
+{
+    if (rh->epoll_rejected == rejected)
+        return;
+    rh->epoll_rejected = rejected;
+    if (rejected)
+        list_add_tail(&rh->ready_link, &ts->os_ready_handlers);
     else
-        err = 0;
-    JS_FreeCString(ctx, path);
-    if (!f)
-        goto done;
-    len = 0;
-#if defined(_WIN32)
-    do
-    {
-        if (strcmp(hData.cFileName, ".") == 0 || strcmp(hData.cFileName, "..") == 0) {
-            continue;
-        }
-        JS_DefinePropertyValueUint32(ctx, obj, len++,
-                                     JS_NewString(ctx, hData.cFileName),
-                                     JS_PROP_C_W_E);
+        list_del(&rh->ready_link);
+}
 
-    } while (FindNextFileA(hFind, &hData));
-    FindClose(hFind);
-#else
-    for(;;) {
-        errno = 0;
-        d = readdir(f);
-        if (!d) {
-            err = errno;
-            break;
-        }
-        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
-            continue;
+static void os_epoll_ctl(JSThreadState *ts, int fd, int op, uint32_t events)
+{
+    struct epoll_event ev;
+    JSOSRWHandler *rh;
+    int ret;
+
+    if (ts->epoll_fd < 0)
+        return;
+    rh = find_rh(ts, fd);
+    if (rh && rh->epoll_rejected) {
+        if (op == EPOLL_CTL_DEL) {
+            rh_set_epoll_rejected(ts, rh, FALSE);
+            return;
         }
-        JS_DefinePropertyValueUint32(ctx, obj, len++,
-                                     JS_NewString(ctx, d->d_name),
-                                     JS_PROP_C_W_E);
-    }
-    closedir(f);
-#endif
- done:
-    return make_obj_error(ctx, obj, err);
+        /* the fd may have been closed and reused by a file supported
+           by epoll */
+        op = EPOLL_CTL_ADD;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    ret = epoll_ctl(ts->epoll_fd, op, fd, &ev);
+    /* the kernel removes a closed fd from the epoll set but its
+       handler may remain, so the fd number may be reused by a file
+       which is not in the set yet */
+    if (ret < 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+        ret = epoll_ctl(ts->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    else if (ret < 0 && op == EPOLL_CTL_ADD && errno == EEXIST)
+        ret = epoll_ctl(ts->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    if (op != EPOLL_CTL_DEL && rh) {
+        /* e.g. regular files are not supported by epoll (EPERM). As
+           with select(), they are considered as always ready. */
+        rh_set_epoll_rejected(ts, rh, ret < 0);
+    }
+}
+
+/* Update the events of 'fd' in the epoll set. events = 0 removes
+   it. */
+static void os_epoll_update(JSThreadState *ts, int fd, uint32_t old_events,
+                            uint32_t events)
+{
+    int op;
+
+    if (old_events == events)
+        return;
+    if (events == 0)
+        op = EPOLL_CTL_DEL;
+    else if (old_events == 0)
+        op = EPOLL_CTL_ADD;
+    else
+        op = EPOLL_CTL_MOD;
+    os_epoll_ctl(ts, fd, op, events);
 }
 
-#if !defined(_WIN32)
-static int64_t timespec_to_ms(const struct timespec *tv)
+static uint32_t rh_get_events(JSOSRWHandler *rh)
 {
-    return (int64_t)tv->tv_sec * 1000 + (tv->tv_nsec / 1000000);
-}
-#else
-static void filetime_to_ms(FILETIME t, time_t *tt) {
-    ULARGE_INTEGER ui;
-    ui.HighPart = t.dwHighDateTime;
-    ui.LowPart = t.dwLowDateTime;
-    *tt = ((LONGLONG)(ui.QuadPart - 116444736000000000) / 10000);
+    uint32_t events = 0;
+    if (!rh)
+        return 0;
+    if (rh_is_waiting(rh, 0))
+        events |= EPOLLIN;
+    if (rh_is_waiting(rh, 1))
+        events |= EPOLLOUT;
+    return events;
 }
+#endif
 
-static int fs__wide_to_utf8(WCHAR* w_source_ptr,
-                               DWORD w_source_len,
-                               char** target_ptr,
-                               uint64_t* target_len_ptr) {
-    int r = 0;
-    int target_len = 0;
-    char* target = NULL;
-    target_len = WideCharToMultiByte(CP_UTF8,
-                                    0,
-                                    w_source_ptr,
-                                    w_source_len,
-                                    NULL,
-                                    0,
-                                    NULL,
-                                    NULL);
+/* return the handler of 'fd', creating it if necessary */
+static JSOSRWHandler *get_rh(JSContext *ctx, JSThreadState *ts, int fd)
+{
+    JSOSRWHandler *rh;
 
-    if (target_len == 0) {
-        return -1;
-    }
-    if (target_len_ptr != NULL) {
-        *target_len_ptr = target_len;
+    rh = find_rh(ts, fd);
+    if (rh)
+        return rh;
+    if (fd >= ts->rh_tab_size) {
+        JSOSRWHandler **new_tab;
+        int new_size = max_int(fd + 1, ts->rh_tab_size * 3 / 2);
+        new_tab = js_realloc(ctx, ts->rh_tab,
+                             sizeof(new_tab[0]) * new_size);
+        if (!new_tab)
+            return NULL;
+        memset(new_tab + ts->rh_tab_size, 0,
+               sizeof(new_tab[0]) * (new_size - ts->rh_tab_size));
+        ts->rh_tab = new_tab;
+        ts->rh_tab_size = new_size;
     }
+    rh = js_mallocz(ctx, sizeof(*rh));
+    if (!rh)
+        return NULL;
+    rh->fd = fd;
+    rh->rw_func[0] = JS_NULL;
+    rh->rw_func[1] = JS_NULL;
+    init_list_head(&rh->io_requests[0]);
+    init_list_head(&rh->io_requests[1]);
+    list_add_tail(&rh->link, &ts->os_rw_handlers);
+    ts->rh_tab[fd] = rh;
+    return rh;
+}
 
-    if (target_ptr == NULL) {
-        return 0;
+static void free_rw_handler(JSRuntime *rt, JSOSRWHandler *rh)
+{
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    struct list_head *el, *el1;
+    int i = 0;
+#ifdef USE_EPOLL
+    os_epoll_update(ts, rh->fd, rh_get_events(rh), 0);
+    rh_set_epoll_rejected(ts, rh, FALSE);
+#endif
+    ts->rh_tab[rh->fd] = NULL;
+    list_del(&rh->link);
+    for(i = 0; i < 2; i++) {
+        JS_FreeValueRT(rt, rh->rw_func[i]);
+        /* only at exit: the pending requests are dropped */
+        list_for_each_safe(el, el1, &rh->io_requests[i]) {
+            JSOSIORequest *req = list_entry(el, JSOSIORequest, link);
+            list_del(&req->link);
+            js_os_io_free(rt, req);
+        }
     }
+    js_free_rt(rt, rh);
+}
 
-    target = malloc(target_len + 1);
-    if (target == NULL) {
-        SetLastError(ERROR_OUTOFMEMORY);
-        return -1;
+static JSValue js_os_setReadHandler(JSContext *ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv, int magic)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSOSRWHandler *rh;
+    int fd = 0;
+    JSValueConst func;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    func = argv[1];
+    if (JS_IsNull(func)) {
+        rh = find_rh(ts, fd);
+        if (rh) {
+#ifdef USE_EPOLL
+            uint32_t old_events = rh_get_events(rh);
+#endif
+            JS_FreeValue(ctx, rh->rw_func[magic]);
+            rh->rw_func[magic] = JS_NULL;
+#ifdef USE_EPOLL
+            os_epoll_update(ts, fd, old_events, rh_get_events(rh));
+#endif
+            if (rh_is_unused(rh)) {
+                /* remove the entry */
+                free_rw_handler(JS_GetRuntime(ctx), rh);
+            }
+        }
+    } else {
+        if (!JS_IsFunction(ctx, func))
+            return JS_ThrowTypeError(ctx, "not a function");
+        if (fd < 0)
+            return JS_ThrowRangeError(ctx, "invalid file descriptor");
+        rh = get_rh(ctx, ts, fd);
+        if (!rh)
+            return JS_EXCEPTION;
+#ifdef USE_EPOLL
+        {
+            uint32_t old_events = rh_get_events(rh);
+            uint32_t events;
+            JS_FreeValue(ctx, rh->rw_func[magic]);
+            rh->rw_func[magic] = JS_DupValue(ctx, func);
+            events = rh_get_events(rh);
+            /* always registered again in case the fd was closed and
+               reused */
+            if (old_events == events)
+                os_epoll_ctl(ts, fd, EPOLL_CTL_MOD, events);
+            else
+                os_epoll_update(ts, fd, old_events, events);
+        }
+#else
+        JS_FreeValue(ctx, rh->rw_func[magic]);
+        rh->rw_func[magic] = JS_DupValue(ctx, func);
+#endif
     }
-    r = WideCharToMultiByte(CP_UTF8,
-                            0,
-                            w_source_ptr,
-                            w_source_len,
-                            target,
-                            target_len,
-                            NULL,
-                            NULL);
-    assert(r == target_len);
-    target[target_len] = '\0';
-    *target_ptr = target;
-    return 0;
+    return JS_UNDEFINED;
 }
 
-typedef struct _REPARSE_DATA_BUFFER {
-    ULONG  ReparseTag;
-    USHORT ReparseDataLength;
-    USHORT Reserved;
-    union {
-        struct {
-            USHORT SubstituteNameOffset;
-            USHORT SubstituteNameLength;
-            USHORT PrintNameOffset;
-            USHORT PrintNameLength;
-            ULONG Flags;
-            WCHAR PathBuffer[1];
-        } SymbolicLinkReparseBuffer;
-        struct {
-            USHORT SubstituteNameOffset;
-            USHORT SubstituteNameLength;
-            USHORT PrintNameOffset;
-            USHORT PrintNameLength;
-            WCHAR PathBuffer[1];
-        } MountPointReparseBuffer;
-        struct {
-            UCHAR  DataBuffer[1];
-        } GenericReparseBuffer;
-        struct {
-            ULONG StringCount;
-            WCHAR StringList[1];
-        } AppExecLinkReparseBuffer;
-    };
-} REPARSE_DATA_BUFFER, *PREPARSE_DATA_BUFFER;
+static JSOSSignalHandler *find_sh(JSThreadState *ts, int sig_num)
+{
+    JSOSSignalHandler *sh;
+    struct list_head *el;
+    list_for_each(el, &ts->os_signal_handlers) {
+        sh = list_entry(el, JSOSSignalHandler, link);
+        if (sh->sig_num == sig_num)
+            return sh;
+    }
+    return NULL;
+}
 
-inline static int fs__readlink_handle(HANDLE handle, char** target_ptr,
-    uint64_t* target_len_ptr) {
-  char buffer[MAXIMUM_REPARSE_DATA_BUFFER_SIZE];
-  REPARSE_DATA_BUFFER* reparse_data = (REPARSE_DATA_BUFFER*) buffer;
-  WCHAR* w_target;
-  DWORD w_target_len;
-  DWORD bytes;
-  size_t i;
-  size_t len;
+static void free_sh(JSRuntime *rt, JSOSSignalHandler *sh)
+{
+    list_del(&sh->link);
+    JS_FreeValueRT(rt, sh->func);
+    js_free_rt(rt, sh);
+}
 
-  if (!DeviceIoControl(handle,
-                       FSCTL_GET_REPARSE_POINT,
-                       NULL,
-                       0,
-                       buffer,
-                       sizeof buffer,
-                       &bytes,
-                       NULL)) {
-    return -1;
-  }
+static void os_signal_handler(int sig_num)
+{
+    os_pending_signals |= ((uint64_t)1 << sig_num);
+}
 
-  if (reparse_data->ReparseTag == IO_REPARSE_TAG_SYMLINK) {
-    /* Real symlink */
-    w_target = reparse_data->SymbolicLinkReparseBuffer.PathBuffer +
-        (reparse_data->SymbolicLinkReparseBuffer.SubstituteNameOffset /
-        sizeof(WCHAR));
-    w_target_len =
-        reparse_data->SymbolicLinkReparseBuffer.SubstituteNameLength /
-        sizeof(WCHAR);
-    /* Real symlinks can contain pretty much everything, but the only thing we
-     * really care about is undoing the implicit conversion to an NT namespaced
-     * path that CreateSymbolicLink will perform on absolute paths. If the path
-     * is win32-namespaced then the user must have explicitly made it so, and
-     * we better just return the unmodified reparse data. */
-    if (w_target_len >= 4 &&
-        w_target[0] == L'\\' &&
-        w_target[1] == L'?' &&
-        w_target[2] == L'?' &&
-        w_target[3] == L'\\') {
-      /* Starts with \??\ */
-      if (w_target_len >= 6 &&
-          ((w_target[4] >= L'A' && w_target[4] <= L'Z') ||
-           (w_target[4] >= L'a' && w_target[4] <= L'z')) &&
-          w_target[5] == L':' &&
-          (w_target_len == 6 || w_target[6] == L'\\')) {
-        /* \??\<drive>:\ */
-        w_target += 4;
-        w_target_len -= 4;
+#if defined(_WIN32)
+typedef void (*sighandler_t)(int sig_num);
+#endif
 
-      } else if (w_target_len >= 8 &&
-                 (w_target[4] == L'U' || w_target[4] == L'u') &&
-                 (w_target[5] == L'N' || w_target[5] == L'n') &&
-                 (w_target[6] == L'C' || w_target[6] == L'c') &&
-                 w_target[7] == L'\\') {
-        /* \??\UNC\<server>\<share>\ - make sure the final path looks like
-         * \\<server>\<share>\ */
-        w_target += 6;
-        w_target[0] = L'\\';
-        w_target_len -= 6;
-      }
+static JSValue js_os_signal(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSOSSignalHandler *sh;
+    uint32_t sig_num = 0;
+    JSValueConst func;
+    sighandler_t handler;
+
+    if (!is_main_thread(rt))
+        return JS_ThrowTypeError(ctx, "signal handler can only be set in the main thread");
+
+    if (JS_ToUint32(ctx, &sig_num, argv[0]))
+        return JS_EXCEPTION;
+    if (sig_num >= 64)
+        return JS_ThrowRangeError(ctx, "invalid signal number");
+    func = argv[1];
+    /* func = null: SIG_DFL, func = undefined, SIG_IGN */
+    if (JS_IsNull(func) || JS_IsUndefined(func)) {
+        sh = find_sh(ts, sig_num);
+        if (sh) {
+            free_sh(JS_GetRuntime(ctx), sh);
+        }
+        if (JS_IsNull(func))
+            handler = SIG_DFL;
+        else
+            handler = SIG_IGN;
+        signal(sig_num, handler);
+    } else {
+        if (!JS_IsFunction(ctx, func))
+            return JS_ThrowTypeError(ctx, "not a function");
+        sh = find_sh(ts, sig_num);
+        if (!sh) {
+            sh = js_mallocz(ctx, sizeof(*sh));
+            if (!sh)
+                return JS_EXCEPTION;
+            sh->sig_num = sig_num;
+            list_add_tail(&sh->link, &ts->os_signal_handlers);
+        }
+        JS_FreeValue(ctx, sh->func);
+        sh->func = JS_DupValue(ctx, func);
+        signal(sig_num, os_signal_handler);
     }
+    return JS_UNDEFINED;
+}
 
-  } else if (reparse_data->ReparseTag == IO_REPARSE_TAG_MOUNT_POINT) {
-    /* Junction. */
-    w_target = reparse_data->MountPointReparseBuffer.PathBuffer +
-        (reparse_data->MountPointReparseBuffer.SubstituteNameOffset /
-        sizeof(WCHAR));
-    w_target_len = reparse_data->MountPointReparseBuffer.SubstituteNameLength /
-        sizeof(WCHAR);
+#if defined(__linux__) || defined(__APPLE__)
+static int64_t get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (ts.tv_nsec / 1000000);
+}
 
-    /* Only treat junctions that look like \??\<drive>:\ as symlink. Junctions
-     * can also be used as mount points, like \??\Volume{<guid>}, but that's
-     * confusing for programs since they wouldn't be able to actually
-     * understand such a path when returned by uv_readlink(). UNC paths are
-     * never valid for junctions so we don't care about them. */
-    if (!(w_target_len >= 6 &&
-          w_target[0] == L'\\' &&
-          w_target[1] == L'?' &&
-          w_target[2] == L'?' &&
-          w_target[3] == L'\\' &&
-          ((w_target[4] >= L'A' && w_target[4] <= L'Z') ||
-           (w_target[4] >= L'a' && w_target[4] <= L'z')) &&
-          w_target[5] == L':' &&
-          (w_target_len == 6 || w_target[6] == L'\\'))) {
-        SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
-        return -1;
+static int64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#else
+/* more portable, but does not work if the date is updated */
+static int64_t get_time_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + (tv.tv_usec / 1000);
+}
+
+static int64_t get_time_ns(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000000 + (tv.tv_usec * 1000);
+}
+#endif
+
+static JSValue js_os_now(JSContext *ctx, JSValue this_val,
+                         int argc, JSValue *argv)
+{
+    return JS_NewFloat64(ctx, (double)get_time_ns() / 1e6);
+}
+
+static inline BOOL timer_lt(const JSOSTimer *a, const JSOSTimer *b)
+{
+    return a->timeout < b->timeout ||
+        (a->timeout == b->timeout && a->seq < b->seq);
+}
+
+static inline void timer_heap_set(JSThreadState *ts, int idx, JSOSTimer *th)
+{
+    ts->timer_heap[idx] = th;
+    th->heap_idx = idx;
+}
+
+static void timer_heap_up(JSThreadState *ts, int idx)
+{
+    JSOSTimer *th = ts->timer_heap[idx];
+    int parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+        if (!timer_lt(th, ts->timer_heap[parent]))
+            break;
+        timer_heap_set(ts, idx, ts->timer_heap[parent]);
+        idx = parent;
     }
+    timer_heap_set(ts, idx, th);
+}
 
-    /* Remove leading \??\ */
-    w_target += 4;
-    w_target_len -= 4;
+static void timer_heap_down(JSThreadState *ts, int idx)
+{
+    JSOSTimer *th = ts->timer_heap[idx];
+    int child;
 
-  } else if (reparse_data->ReparseTag == IO_REPARSE_TAG_APPEXECLINK) {
-    /* String #3 in the list has the target filename. */
-    if (reparse_data->AppExecLinkReparseBuffer.StringCount < 3) {
-      SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
-      return -1;
+    for(;;) {
+        child = 2 * idx + 1;
+        if (child >= ts->timer_count)
+            break;
+        if (child + 1 < ts->timer_count &&
+            timer_lt(ts->timer_heap[child + 1], ts->timer_heap[child]))
+            child++;
+        if (!timer_lt(ts->timer_heap[child], th))
+            break;
+        timer_heap_set(ts, idx, ts->timer_heap[child]);
+        idx = child;
     }
-    w_target = reparse_data->AppExecLinkReparseBuffer.StringList;
-    /* The StringList buffer contains a list of strings separated by "\0",   */
-    /* with "\0\0" terminating the list. Move to the 3rd string in the list: */
-    for (i = 0; i < 2; ++i) {
-      len = wcslen(w_target);
-      if (len == 0) {
-        SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
+    timer_heap_set(ts, idx, th);
+}
+
+static int timer_hash_resize(JSRuntime *rt, JSThreadState *ts, int new_size)
+{
+    JSOSTimer **new_hash, *th, *th_next;
+    int i, h;
+
+    new_hash = js_mallocz_rt(rt, sizeof(new_hash[0]) * new_size);
+    if (!new_hash)
         return -1;
-      }
-      w_target += len + 1;
-    }
-    w_target_len = wcslen(w_target);
-    if (w_target_len == 0) {
-      SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
-      return -1;
-    }
-    /* Make sure it is an absolute path. */
-    if (!(w_target_len >= 3 &&
-         ((w_target[0] >= L'a' && w_target[0] <= L'z') ||
-          (w_target[0] >= L'A' && w_target[0] <= L'Z')) &&
-         w_target[1] == L':' &&
-         w_target[2] == L'\\')) {
-      SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
-      return -1;
+    for(i = 0; i < ts->timer_hash_size; i++) {
+        for(th = ts->timer_hash[i]; th != NULL; th = th_next) {
+            th_next = th->hash_next;
+            h = th->timer_id & (new_size - 1);
+            th->hash_next = new_hash[h];
+            new_hash[h] = th;
+        }
     }
+    js_free_rt(rt, ts->timer_hash);
+    ts->timer_hash = new_hash;
+    ts->timer_hash_size = new_size;
+    return 0;
+}
 
-  } else {
-    /* Reparse tag does not indicate a symlink. */
-    SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
-    return -1;
-  }
-
-  return fs__wide_to_utf8(w_target, w_target_len, target_ptr, target_len_ptr);
+/* return -1 if memory allocation failed */
+static int add_timer(JSContext *ctx, JSOSTimer *th)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    int h;
+
+    if (ts->timer_count >= ts->timer_size) {
+        JSOSTimer **new_heap;
+        int new_size = max_int(16, ts->timer_size * 3 / 2);
+        new_heap = js_realloc(ctx, ts->timer_heap,
+                              sizeof(new_heap[0]) * new_size);
+        if (!new_heap)
+            return -1;
+        ts->timer_heap = new_heap;
+        ts->timer_size = new_size;
+    }
+    if (th->timer_id > 0) {
+        if (ts->timer_hash_count >= ts->timer_hash_size &&
+            timer_hash_resize(rt, ts, max_int(16, ts->timer_hash_size * 2))) {
+            /* the hash table can be overloaded but not empty */
+            if (ts->timer_hash_size == 0) {
+                JS_ThrowOutOfMemory(ctx);
+                return -1;
+            }
+        }
+        h = th->timer_id & (ts->timer_hash_size - 1);
+        th->hash_next = ts->timer_hash[h];
+        ts->timer_hash[h] = th;
+        ts->timer_hash_count++;
+    }
+    th->seq = ts->timer_seq++;
+    ts->timer_heap[ts->timer_count++] = th;
+    timer_heap_up(ts, ts->timer_count - 1);
+    return 0;
 }
-#endif
 
-static JSValue js_os_issymlink(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
-    const char *path = NULL;
-    BOOL is_symlink = FALSE;
-    path = JS_ToCString(ctx, argv[0]);
-    if (!path)
-        return JS_EXCEPTION;
-#if defined(_WIN32)
-    DWORD dwAttrib = GetFileAttributesA(path);
-    if (dwAttrib != INVALID_FILE_ATTRIBUTES && (dwAttrib & FILE_ATTRIBUTE_REPARSE_POINT) == FILE_ATTRIBUTE_REPARSE_POINT) {
-        is_symlink = TRUE;
-    }
-#else
-    struct stat st;
-    int res = lstat(path, &st);
-    if (!res) {
-        is_symlink = S_ISLNK(st.st_mode);
+static void free_timer(JSRuntime *rt, JSOSTimer *th)
+{
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSOSTimer **pth, *last;
+    int idx;
+
+    /* remove from the heap */
+    idx = th->heap_idx;
+    ts->timer_count--;
+    if (idx != ts->timer_count) {
+        last = ts->timer_heap[ts->timer_count];
+        timer_heap_set(ts, idx, last);
+        timer_heap_down(ts, idx);
+        timer_heap_up(ts, last->heap_idx);
+    }
+    /* remove from the hash table */
+    if (th->timer_id > 0) {
+        pth = &ts->timer_hash[th->timer_id & (ts->timer_hash_size - 1)];
+        while (*pth != th)
+            pth = &(*pth)->hash_next;
+        *pth = th->hash_next;
+        ts->timer_hash_count--;
     }
-#endif
-    JS_FreeCString(ctx, path);
-    return JS_NewBool(ctx, is_symlink);
+    JS_FreeValueRT(rt, th->func);
+    js_free_rt(rt, th);
 }
 
-/* return [obj, errcode] */
-static JSValue js_os_stat(JSContext *ctx, JSValueConst this_val,
-                          int argc, JSValueConst *argv, int is_lstat)
+static JSValue js_os_setTimeout(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv)
 {
-    const char *path = NULL;
-    int err = 0, res = 0;
-    struct stat st;
-    JSValue obj;
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    int64_t delay = 0;
+    JSValueConst func;
+    JSOSTimer *th;
 
-    path = JS_ToCString(ctx, argv[0]);
-    if (!path)
-        return JS_EXCEPTION;
-    memset(&st, 0, sizeof(struct stat));
-#if defined(_WIN32)
-    HANDLE handle = NULL;
-    DWORD flags = 0;
-    flags = FILE_FLAG_BACKUP_SEMANTICS;
-    if (is_lstat)
-        flags |= FILE_FLAG_OPEN_REPARSE_POINT;
-    handle = CreateFileA(
-        path,
-        FILE_READ_ATTRIBUTES,
-        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-        NULL,
-        OPEN_EXISTING,
-        flags,
-        NULL
-    );
-    BY_HANDLE_FILE_INFORMATION info;
-    memset(&info, 0, sizeof(BY_HANDLE_FILE_INFORMATION));
-    if (handle != NULL && GetFileInformationByHandle(handle, &info)) {
-        if (info.dwFileAttributes != INVALID_FILE_ATTRIBUTES) {
-            if ((info.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == FILE_ATTRIBUTE_REPARSE_POINT) {
-                st.st_mode |= S_IFLNK;
-            }
-            if ((info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY) {
-                st.st_mode |= S_IFDIR;
-            } else {
-                st.st_mode |= S_IFREG;
-            }
-        }
-
-        filetime_to_ms(info.ftLastAccessTime, &st.st_atime);
-        filetime_to_ms(info.ftLastWriteTime, &st.st_mtime);
-        filetime_to_ms(info.ftCreationTime, &st.st_ctime);
-        st.st_dev = info.dwVolumeSerialNumber;
-        st.st_size = (info.nFileSizeHigh * (MAXDWORD + 1)) + info.nFileSizeLow;
-        st.st_ino = (info.nFileIndexHigh * (MAXDWORD + 1)) + info.nFileIndexLow;
-        st.st_nlink = info.nNumberOfLinks;
-    } else {
-        res = -1;
-    }
-    if (handle != NULL) {
-        CloseHandle(handle);
-    }
-#else
-    if (is_lstat)
-        res = lstat(path, &st);
-    else
-        res = stat(path, &st);
-#endif
-    if (res < 0)
-        err = errno;
+    func = argv[0];
+    if (!JS_IsFunction(ctx, func))
+        return JS_ThrowTypeError(ctx, "not a function");
+    if (JS_ToInt64(ctx, &delay, argv[1]))
+        return JS_EXCEPTION;
+    th = js_mallocz(ctx, sizeof(*th));
+    if (!th)
+        return JS_EXCEPTION;
+    th->timer_id = ts->next_timer_id;
+    if (ts->next_timer_id == INT32_MAX)
+        ts->next_timer_id = 1;
     else
-        err = 0;
-    JS_FreeCString(ctx, path);
-    if (res < 0) {
-#ifdef _WIN32
-        err = GetLastError();
-#else
-        err = errno;
-#endif
-        obj = JS_NULL;
-    } else {
-        obj = JS_NewObject(ctx);
-        if (JS_IsException(obj))
-            return JS_EXCEPTION;
-        JS_DefinePropertyValueStr(ctx, obj, "dev",
-                                  JS_NewInt64(ctx, st.st_dev),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "ino",
-                                  JS_NewInt64(ctx, st.st_ino),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "mode",
-                                  JS_NewInt32(ctx, st.st_mode),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "nlink",
-                                  JS_NewInt64(ctx, st.st_nlink),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "uid",
-                                  JS_NewInt64(ctx, st.st_uid),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "gid",
-                                  JS_NewInt64(ctx, st.st_gid),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "rdev",
-                                  JS_NewInt64(ctx, st.st_rdev),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "size",
-                                  JS_NewInt64(ctx, st.st_size),
-                                  JS_PROP_C_W_E);
-#if !defined(_WIN32)
-        JS_DefinePropertyValueStr(ctx, obj, "blocks",
-                                  JS_NewInt64(ctx, st.st_blocks),
-                                  JS_PROP_C_W_E);
-#endif
-#if defined(_WIN32)
-        JS_DefinePropertyValueStr(ctx, obj, "atime",
-                                  JS_NewInt64(ctx, (int64_t)st.st_atime),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "mtime",
-                                  JS_NewInt64(ctx, (int64_t)st.st_mtime),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "ctime",
-                                  JS_NewInt64(ctx, (int64_t)st.st_ctime),
-                                  JS_PROP_C_W_E);
-#elif defined(__APPLE__)
-        JS_DefinePropertyValueStr(ctx, obj, "atime",
-                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_atimespec)),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "mtime",
-                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_mtimespec)),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "ctime",
-                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_ctimespec)),
-                                  JS_PROP_C_W_E);
-#else
-        JS_DefinePropertyValueStr(ctx, obj, "atime",
-                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_atim)),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "mtime",
-                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_mtim)),
-                                  JS_PROP_C_W_E);
-        JS_DefinePropertyValueStr(ctx, obj, "ctime",
-                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_ctim)),
-                                  JS_PROP_C_W_E);
-#endif
+        ts->next_timer_id++;
+    th->timeout = get_time_ms() + delay;
+    th->func = JS_DupValue(ctx, func);
+    if (add_timer(ctx, th)) {
+        JS_FreeValue(ctx, th->func);
+        js_free(ctx, th);
+        return JS_EXCEPTION;
     }
-    return make_obj_error(ctx, obj, err);
+    return JS_NewInt32(ctx, th->timer_id);
 }
 
-#if !defined(_WIN32)
-static void ms_to_timeval(struct timeval *tv, uint64_t v)
+static JSOSTimer *find_timer_by_id(JSThreadState *ts, int timer_id)
 {
-    tv->tv_sec = v / 1000;
-    tv->tv_usec = (v % 1000) * 1000;
+    JSOSTimer *th;
+    if (timer_id <= 0 || ts->timer_hash_size == 0)
+        return NULL;
+    th = ts->timer_hash[timer_id & (ts->timer_hash_size - 1)];
+    while (th != NULL && th->timer_id != timer_id)
+        th = th->hash_next;
+    return th;
 }
-#endif
 
-static JSValue js_os_utimes(JSContext *ctx, JSValueConst this_val,
-                            int argc, JSValueConst *argv)
+static JSValue js_os_clearTimeout(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv)
 {
-    const char *path;
-    int64_t atime = 0, mtime = 0;
-    int ret = 0;
-    
-    if (JS_ToInt64(ctx, &atime, argv[1]))
-        return JS_EXCEPTION;
-    if (JS_ToInt64(ctx, &mtime, argv[2]))
-        return JS_EXCEPTION;
-    path = JS_ToCString(ctx, argv[0]);
-    if (!path)
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSOSTimer *th;
+    int timer_id;
+
+    if (JS_ToInt32(ctx, &timer_id, argv[0]))
         return JS_EXCEPTION;
-#if defined(_WIN32)
-    {
-        struct _utimbuf times;
-        times.actime = atime / 1000;
-        times.modtime = mtime / 1000;
-        ret = js_get_errno(_utime(path, &times));
-    }
-#else
-    {
-        struct timeval times[2];
-        ms_to_timeval(&times[0], atime);
-        ms_to_timeval(&times[1], mtime);
-        ret = js_get_errno(utimes(path, times));
-    }
-#endif
-    JS_FreeCString(ctx, path);
-    return JS_NewInt32(ctx, ret);
+    th = find_timer_by_id(ts, timer_id);
+    if (!th)
+        return JS_UNDEFINED;
+    free_timer(rt, th);
+    return JS_UNDEFINED;
 }
 
-/* sleep(delay_ms) */
-static JSValue js_os_sleep(JSContext *ctx, JSValueConst this_val,
-                           int argc, JSValueConst *argv)
+/* return a promise */
+static JSValue js_os_sleepAsync(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv)
 {
-    int64_t delay = 0;
-    int ret = 0;
-    
+    int64_t delay;
+    JSOSTimer *th;
+    JSValue promise, resolving_funcs[2];
+
     if (JS_ToInt64(ctx, &delay, argv[0]))
         return JS_EXCEPTION;
-    if (delay < 0)
-        delay = 0;
-#if defined(_WIN32)
-    {
-        if (delay > INT32_MAX)
-            delay = INT32_MAX;
-        Sleep(delay);
-        ret = 0;
-    }
-#else
-    {
-        struct timespec ts;
+    promise = JS_NewPromiseCapability(ctx, resolving_funcs);
+    if (JS_IsException(promise))
+        return JS_EXCEPTION;
 
-        ts.tv_sec = delay / 1000;
-        ts.tv_nsec = (delay % 1000) * 1000000;
-        ret = js_get_errno(nanosleep(&ts, NULL));
+    th = js_mallocz(ctx, sizeof(*th));
+    if (!th) {
+        JS_FreeValue(ctx, promise);
+        JS_FreeValue(ctx, resolving_funcs[0]);
+        JS_FreeValue(ctx, resolving_funcs[1]);
+        return JS_EXCEPTION;
     }
-#endif
-    return JS_NewInt32(ctx, ret);
+    th->timer_id = -1;
+    th->timeout = get_time_ms() + delay;
+    th->func = JS_DupValue(ctx, resolving_funcs[0]);
+    JS_FreeValue(ctx, resolving_funcs[0]);
+    JS_FreeValue(ctx, resolving_funcs[1]);
+    if (add_timer(ctx, th)) {
+        JS_FreeValue(ctx, th->func);
+        js_free(ctx, th);
+        JS_FreeValue(ctx, promise);
+        return JS_EXCEPTION;
+    }
+    return promise;
 }
 
-/* return [path, errorcode] */
-static JSValue js_os_realpath(JSContext *ctx, JSValueConst this_val,
-                              int argc, JSValueConst *argv)
+static void call_handler(JSContext *ctx, JSValueConst func)
 {
-    const char *path;
-    char buf[PATH_MAX], *res;
-    int err = 0;
+    JSValue ret, func1;
+    /* 'func' might be destroyed when calling itself (if it frees the
+       handler), so must take extra care */
+    func1 = JS_DupValue(ctx, func);
+    ret = JS_Call(ctx, func1, JS_UNDEFINED, 0, NULL);
+    JS_FreeValue(ctx, func1);
+    if (JS_IsException(ret))
+        js_std_dump_error(ctx);
+    JS_FreeValue(ctx, ret);
+}
 
-    path = JS_ToCString(ctx, argv[0]);
-    if (!path)
-        return JS_EXCEPTION;
-    res = realpath(path, buf);
-    JS_FreeCString(ctx, path);
-    if (!res) {
-        buf[0] = '\0';
-        err = errno;
+/* Call the first expired timer and return 1. Otherwise return 0 and
+   set '*pmin_delay' to the delay in ms before the next timer or -1 if
+   there is none. */
+static int js_os_run_timers(JSContext *ctx, int *pmin_delay)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSOSTimer *th;
+    int64_t delay;
+    JSValue func;
+
+    if (ts->timer_count == 0) {
+        *pmin_delay = -1;
+        return 0;
+    }
+    th = ts->timer_heap[0];
+    delay = th->timeout - get_time_ms();
+    if (delay <= 0) {
+        /* the timer expired */
+        func = th->func;
+        th->func = JS_UNDEFINED;
+        free_timer(rt, th);
+        call_handler(ctx, func);
+        JS_FreeValue(ctx, func);
+        return 1;
+    }
+    *pmin_delay = min_int64(delay, 10000);
+    return 0;
+}
+
+/* maximum wait in ms between two incremental GC steps when the
+   program is idle */
+#define OS_GC_STEP_DELAY 10
+
+/* run a step of the pending incremental GC pass, if any. The wait for
+   the events is limited so that the pass ends even if the program is
+   idle, without polling in a loop. */
+static void js_os_run_gc_step(JSRuntime *rt, int *pmin_delay)
+{
+    if (JS_IsGCPending(rt)) {
+        JS_RunGCStep(rt, 0);
+        if (*pmin_delay < 0 || *pmin_delay > OS_GC_STEP_DELAY)
+            *pmin_delay = OS_GC_STEP_DELAY;
+    }
+}
+
+#if defined(_WIN32)
+
+static int js_os_poll(JSContext *ctx)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    int min_delay = 0, console_fd = 0;
+    JSOSRWHandler *rh;
+    struct list_head *el;
+
+    /* XXX: handle signals if useful */
+
+    if (list_empty(&ts->os_rw_handlers) && ts->timer_count == 0)
+        return -1; /* no more events */
+
+    /* XXX: only timers and basic console input are supported */
+    if (js_os_run_timers(ctx, &min_delay))
+        return 0;
+
+    js_os_run_gc_step(rt, &min_delay);
+
+    console_fd = -1;
+    list_for_each(el, &ts->os_rw_handlers) {
+        rh = list_entry(el, JSOSRWHandler, link);
+        if (rh->fd == 0 && !JS_IsNull(rh->rw_func[0])) {
+            console_fd = rh->fd;
+            break;
+        }
+    }
+
+    if (console_fd >= 0) {
+        DWORD ti, ret;
+        HANDLE handle;
+        if (min_delay == -1)
+            ti = INFINITE;
+        else
+            ti = min_delay;
+        handle = (HANDLE)_get_osfhandle(console_fd);
+        ret = WaitForSingleObject(handle, ti);
+        if (ret == WAIT_OBJECT_0) {
+            list_for_each(el, &ts->os_rw_handlers) {
+                rh = list_entry(el, JSOSRWHandler, link);
+                if (rh->fd == console_fd && !JS_IsNull(rh->rw_func[0])) {
+                    call_handler(ctx, rh->rw_func[0]);
+                    /* must stop because the list may have been modified */
+                    break;
+                }
+            }
+        }
     } else {
-        err = 0;
+        Sleep(min_delay);
     }
-    return make_string_error(ctx, buf, err);
+    return 0;
+}
+#else
+
+/* Asynchronous I/O. os.readAsync() and os.writeAsync() queue a
+   request which is started by the next poll iteration, so that the
+   requests of a loop tick are submitted together. Regular files are
+   accessed with io_uring when it is available and synchronously
+   otherwise. The other descriptors (pipes, sockets, terminals) wait
+   in the poll set until they are ready and are then accessed with a
+   single read() or write(). */
+
+/* 'ret' value for a request failing with the pending exception */
+#define OS_IO_EXCEPTION INT64_MIN
+
+static uint8_t *js_os_io_get_buf(JSOSIORequest *req)
+{
+    size_t size = 0;
+    uint8_t *buf;
+
+    /* the buffer may have been detached in the mean time */
+    buf = JS_GetArrayBuffer(req->ctx, &size, req->buffer);
+    if (!buf)
+        return NULL;
+    if (req->pos + req->len > size) {
+        JS_ThrowRangeError(req->ctx, "read/write array buffer overflow");
+        return NULL;
+    }
+    return buf + req->pos;
+}
+
+/* resolve the promise of 'req' and free it */
+static void js_os_io_finish(JSRuntime *rt, JSOSIORequest *req, int64_t ret)
+{
+    JSContext *ctx = req->ctx;
+    JSValue val, res;
+    uint8_t *buf;
+    BOOL is_reject = FALSE;
+
+    if (ret != OS_IO_EXCEPTION && req->data && !req->is_write && ret > 0) {
+        buf = js_os_io_get_buf(req);
+        if (buf)
+            memcpy(buf, req->data, ret);
+        else
+            ret = OS_IO_EXCEPTION;
+    }
+    if (ret == OS_IO_EXCEPTION) {
+        val = JS_GetException(ctx);
+        is_reject = TRUE;
+    } else {
+        val = JS_NewInt64(ctx, ret);
+    }
+    res = JS_Call(ctx, req->resolving_funcs[is_reject], JS_UNDEFINED,
+                  1, (JSValueConst *)&val);
+    JS_FreeValue(ctx, res);
+    JS_FreeValue(ctx, val);
+    js_os_io_free(rt, req);
+}
+
+/* synchronous read() or write() of the request */
+static int64_t js_os_io_run(JSOSIORequest *req)
+{
+    uint8_t *buf;
+    ssize_t ret;
+
+    buf = js_os_io_get_buf(req);
+    if (!buf)
+        return OS_IO_EXCEPTION;
+    if (req->file_pos >= 0) {
+        if (req->is_write)
+            ret = pwrite(req->fd, buf, req->len, req->file_pos);
+        else
+            ret = pread(req->fd, buf, req->len, req->file_pos);
+    } else {
+        if (req->is_write)
+            ret = write(req->fd, buf, req->len);
+        else
+            ret = read(req->fd, buf, req->len);
+    }
+    return js_get_errno(ret);
+}
+
+/* Run the first request of 'rh' waiting for readiness. Return TRUE if
+   it completed. */
+static BOOL rh_run_io_request(JSRuntime *rt, JSOSRWHandler *rh,
+                              int is_write)
+{
+    JSOSIORequest *req;
+    int64_t ret;
+#ifdef USE_EPOLL
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    uint32_t old_events = rh_get_events(rh);
+#endif
+
+    req = list_entry(rh->io_requests[is_write].next, JSOSIORequest, link);
+    ret = js_os_io_run(req);
+    if (ret == -EAGAIN || ret == -EWOULDBLOCK || ret == -EINTR)
+        return FALSE;
+    list_del(&req->link);
+#ifdef USE_EPOLL
+    os_epoll_update(ts, rh->fd, old_events, rh_get_events(rh));
+#endif
+    if (rh_is_unused(rh))
+        free_rw_handler(rt, rh);
+    js_os_io_finish(rt, req, ret);
+    return TRUE;
+}
+
+/* Run a request waiting for the descriptor or call its handler. Return
+   TRUE if something was done. */
+static BOOL rh_call(JSContext *ctx, JSOSRWHandler *rh, int is_write)
+{
+    if (!list_empty(&rh->io_requests[is_write]))
+        return rh_run_io_request(JS_GetRuntime(ctx), rh, is_write);
+    if (!JS_IsNull(rh->rw_func[is_write])) {
+        call_handler(ctx, rh->rw_func[is_write]);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+#ifdef USE_IO_URING
+static void os_ring_free(JSRuntime *rt, JSOSRing *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    if (r->sq_ptr)
+        munmap(r->sq_ptr, r->sq_size);
+    if (r->event_fd >= 0)
+        close(r->event_fd);
+    close(r->fd);
+    js_free_rt(rt, r);
+}
+
+static void *os_ring_mmap(int fd, size_t size, off_t offset)
+{
+    void *ptr;
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (ptr == MAP_FAILED)
+        return NULL;
+    return ptr;
 }
 
-static JSValue js_os_symlink(JSContext *ctx, JSValueConst this_val,
-                             int argc, JSValueConst *argv)
-{
-    const char *target, *linkpath;
-    int err = 0;
-    
-    target = JS_ToCString(ctx, argv[0]);
-    if (!target)
-        return JS_EXCEPTION;
-    linkpath = JS_ToCString(ctx, argv[1]);
-    if (!linkpath) {
-        JS_FreeCString(ctx, target);
-        return JS_EXCEPTION;
-    }
-#if defined(_WIN32)
-    DWORD dwAttrib = GetFileAttributesA(target);
-    DWORD dwFlags = 0;
-    if (dwAttrib != INVALID_FILE_ATTRIBUTES && (dwAttrib & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY) {
-        dwFlags = 1;
+/* return NULL if io_uring is not usable */
+static JSOSRing *os_ring_new(JSRuntime *rt)
+{
+    struct io_uring_params p;
+    JSOSRing *r;
+    uint8_t *sq, *cq;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, OS_RING_ENTRIES, &p);
+    if (fd < 0)
+        return NULL;
+    r = js_mallocz_rt(rt, sizeof(*r));
+    if (!r) {
+        close(fd);
+        return NULL;
+    }
+    r->fd = fd;
+    r->event_fd = -1;
+    /* IORING_OP_READ/WRITE at the current file position need Linux
+       5.6 */
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))
+        goto fail;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->sq_size = max_int(r->sq_size, r->cq_size);
+        r->sq_ptr = os_ring_mmap(fd, r->sq_size, IORING_OFF_SQ_RING);
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->sq_ptr = os_ring_mmap(fd, r->sq_size, IORING_OFF_SQ_RING);
+        r->cq_ptr = os_ring_mmap(fd, r->cq_size, IORING_OFF_CQ_RING);
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = os_ring_mmap(fd, r->sqes_size, IORING_OFF_SQES);
+    if (!r->sq_ptr || !r->cq_ptr || !r->sqes)
+        goto fail;
+    sq = r->sq_ptr;
+    cq = r->cq_ptr;
+    r->sq_entries = p.sq_entries;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    r->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (r->event_fd < 0)
+        goto fail;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD,
+                &r->event_fd, 1) < 0)
+        goto fail;
+    return r;
+ fail:
+    os_ring_free(rt, r);
+    return NULL;
+}
+
+static JSOSRing *os_get_ring(JSRuntime *rt, JSThreadState *ts)
+{
+    if (!ts->ring && !ts->ring_unavailable) {
+        ts->ring = os_ring_new(rt);
+        if (!ts->ring) {
+            ts->ring_unavailable = TRUE;
+            return NULL;
+        }
+#ifdef USE_EPOLL
+        os_epoll_update(ts, ts->ring->event_fd, 0, EPOLLIN);
+#endif
+    }
+    return ts->ring;
+}
+
+/* The completion queue has twice the size of the submission queue, so
+   it cannot overflow if the number of requests in flight is limited
+   to 'sq_entries'. */
+static BOOL os_ring_is_full(JSOSRing *r)
+{
+    return r->inflight >= r->sq_entries;
+}
+
+static void os_ring_queue(JSOSRing *r, JSOSIORequest *req)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail, idx;
+
+    tail = *r->sq_tail;
+    idx = tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = req->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = req->fd;
+    sqe->addr = (uintptr_t)req->data;
+    sqe->len = req->len;
+    sqe->off = req->file_pos; /* -1 = current file position */
+    sqe->user_data = (uintptr_t)req;
+    r->sq_array[idx] = idx;
+    atomic_store_explicit((_Atomic(unsigned) *)r->sq_tail, tail + 1,
+                          memory_order_release);
+    r->to_submit++;
+    r->inflight++;
+}
+
+/* submit all the queued entries with a single system call */
+static int os_ring_submit(JSOSRing *r, unsigned min_complete)
+{
+    int ret;
+
+    for(;;) {
+        ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, min_complete,
+                      min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret >= 0 || errno != EINTR)
+            break;
+    }
+    if (ret > 0)
+        r->to_submit -= ret;
+    return ret;
+}
+
+/* Fail the queued entries which were not accepted by the kernel
+   because io_uring_enter() returned the error 'err'. */
+static void os_ring_fail_queued(JSRuntime *rt, JSOSRing *r, int err)
+{
+    struct io_uring_sqe *sqe;
+    JSOSIORequest *req;
+    unsigned head, tail;
+
+    head = atomic_load_explicit((_Atomic(unsigned) *)r->sq_head,
+                                memory_order_acquire);
+    tail = *r->sq_tail;
+    /* the kernel only reads the entries before the tail */
+    atomic_store_explicit((_Atomic(unsigned) *)r->sq_tail, head,
+                          memory_order_release);
+    r->to_submit = 0;
+    for(; head != tail; head++) {
+        sqe = &r->sqes[head & *r->sq_mask];
+        req = (JSOSIORequest *)(uintptr_t)sqe->user_data;
+        r->inflight--;
+        js_os_io_finish(rt, req, -err);
+    }
+}
+
+/* Handle the available completions. The requests are only freed if
+   'cancel' is TRUE. Return the number of completed requests. */
+static int os_ring_reap(JSRuntime *rt, JSOSRing *r, BOOL cancel)
+{
+    struct io_uring_cqe *cqe;
+    JSOSIORequest *req;
+    unsigned head, tail;
+    int64_t res;
+    int count = 0;
+
+    head = *r->cq_head;
+    for(;;) {
+        tail = atomic_load_explicit((_Atomic(unsigned) *)r->cq_tail,
+                                    memory_order_acquire);
+        if (head == tail)
+            break;
+        cqe = &r->cqes[head & *r->cq_mask];
+        req = (JSOSIORequest *)(uintptr_t)cqe->user_data;
+        res = cqe->res;
+        head++;
+        atomic_store_explicit((_Atomic(unsigned) *)r->cq_head, head,
+                              memory_order_release);
+        r->inflight--;
+        if (cancel)
+            js_os_io_free(rt, req);
+        else
+            js_os_io_finish(rt, req, res);
+        count++;
+    }
+    return count;
+}
+
+/* called when the ring event fd is readable */
+static int os_ring_poll(JSRuntime *rt, JSOSRing *r)
+{
+    uint64_t v;
+    while (read(r->event_fd, &v, sizeof(v)) < 0 && errno == EINTR)
+        continue;
+    return os_ring_reap(rt, r, FALSE) != 0;
+}
+
+static void os_ring_close(JSRuntime *rt, JSOSRing *r)
+{
+    /* the kernel may still access the request buffers */
+    while (r->inflight > 0) {
+        if (os_ring_submit(r, 1) < 0)
+            return; /* leak rather than free memory in use */
+        os_ring_reap(rt, r, TRUE);
+    }
+    os_ring_free(rt, r);
+}
+
+/* Start a request on a regular file. Return 0 if it was queued, 1 if it
+   completed and -1 if it must wait because the ring is full. */
+static int os_ring_start(JSRuntime *rt, JSOSRing *r, JSOSIORequest *req)
+{
+    uint8_t *buf;
+
+    if (os_ring_is_full(r))
+        return -1;
+    list_del(&req->link);
+    /* the kernel accesses a private copy of the data because the
+       ArrayBuffer could be detached before the completion */
+    req->data = js_malloc_rt(rt, max_int(req->len, 1));
+    if (!req->data) {
+        js_os_io_finish(rt, req, js_os_io_run(req));
+        return 1;
+    }
+    if (req->is_write) {
+        buf = js_os_io_get_buf(req);
+        if (!buf) {
+            js_os_io_finish(rt, req, OS_IO_EXCEPTION);
+            return 1;
+        }
+        memcpy(req->data, buf, req->len);
+    }
+    os_ring_queue(r, req);
+    return 0;
+}
+#endif /* USE_IO_URING */
+
+/* Start the requests queued since the last poll iteration. Return TRUE
+   if the poll must not wait because some requests completed or could
+   not be submitted. */
+static BOOL js_os_io_flush(JSRuntime *rt)
+{
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSOSIORequest *req;
+    JSOSRWHandler *rh;
+    struct stat st;
+    BOOL busy = FALSE;
+#ifdef USE_IO_URING
+    JSOSRing *r;
+    int ret;
+#endif
+
+    while (!list_empty(&ts->os_io_requests)) {
+        req = list_entry(ts->os_io_requests.next, JSOSIORequest, link);
+        if (fstat(req->fd, &st) < 0) {
+            list_del(&req->link);
+            js_os_io_finish(rt, req, -errno);
+            busy = TRUE;
+        } else if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) {
+#ifdef USE_IO_URING
+            r = os_get_ring(rt, ts);
+            if (r && req->len <= INT32_MAX) {
+                ret = os_ring_start(rt, r, req);
+                if (ret < 0)
+                    break; /* wait for completions */
+                if (ret > 0)
+                    busy = TRUE;
+                continue;
+            }
+#endif
+            /* readiness is meaningless for regular files */
+            list_del(&req->link);
+            js_os_io_finish(rt, req, js_os_io_run(req));
+            busy = TRUE;
+        } else {
+#ifdef USE_EPOLL
+            uint32_t old_events;
+#endif
+            rh = get_rh(req->ctx, ts, req->fd);
+            list_del(&req->link);
+            if (!rh) {
+                js_os_io_finish(rt, req, OS_IO_EXCEPTION);
+                busy = TRUE;
+                continue;
+            }
+#ifdef USE_EPOLL
+            old_events = rh_get_events(rh);
+#endif
+            list_add_tail(&req->link, &rh->io_requests[req->is_write]);
+#ifdef USE_EPOLL
+            os_epoll_update(ts, req->fd, old_events, rh_get_events(rh));
+#endif
+        }
+    }
+#ifdef USE_IO_URING
+    r = ts->ring;
+    if (r && r->to_submit > 0) {
+        if (os_ring_submit(r, 0) < 0 && errno != EAGAIN && errno != EBUSY) {
+            /* retrying would fail again: complete the queued requests
+               with the error instead */
+            os_ring_fail_queued(rt, r, errno);
+            busy = TRUE;
+        } else if (r->to_submit > 0) {
+            busy = TRUE;
+        }
+        /* the reads from the page cache usually complete during the
+           submission */
+        if (os_ring_reap(rt, r, FALSE) > 0)
+            busy = TRUE;
+    }
+#endif
+    return busy;
+}
+
+/* TRUE if some async requests are not completed */
+static BOOL js_os_io_pending(JSThreadState *ts)
+{
+#ifdef USE_IO_URING
+    if (ts->ring && ts->ring->inflight > 0)
+        return TRUE;
+#endif
+    return !list_empty(&ts->os_io_requests);
+}
+
+/* readAsync(fd, buffer, offset, length, position) /
+   writeAsync(fd, buffer, offset, length, position) -> promise resolved
+   with the number of bytes or -errno */
+static JSValue js_os_io_async(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv, int is_write)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSOSIORequest *req;
+    int fd = 0;
+    int64_t file_pos = -1;
+    uint64_t pos = 0, len = 0;
+    size_t size = 0;
+    JSValue promise;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &pos, argv[2]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &len, argv[3]))
+        return JS_EXCEPTION;
+    if (argc >= 5 && !JS_IsUndefined(argv[4]) &&
+        JS_ToInt64(ctx, &file_pos, argv[4]))
+        return JS_EXCEPTION;
+    if (!JS_GetArrayBuffer(ctx, &size, argv[1]))
+        return JS_EXCEPTION;
+    if (pos + len > size)
+        return JS_ThrowRangeError(ctx, "read/write array buffer overflow");
+    if (fd < 0)
+        return JS_ThrowRangeError(ctx, "invalid file descriptor");
+
+    req = js_mallocz(ctx, sizeof(*req));
+    if (!req)
+        return JS_EXCEPTION;
+    promise = JS_NewPromiseCapability(ctx, req->resolving_funcs);
+    if (JS_IsException(promise)) {
+        js_free(ctx, req);
+        return JS_EXCEPTION;
+    }
+    req->ctx = ctx;
+    req->fd = fd;
+    req->is_write = is_write;
+    req->file_pos = max_int64(file_pos, -1);
+    req->buffer = JS_DupValue(ctx, argv[1]);
+    req->pos = pos;
+    req->len = len;
+    list_add_tail(&req->link, &ts->os_io_requests);
+    return promise;
+}
+
+#ifdef USE_WORKER
+
+/* maximum number of messages handled in one poll iteration so that
+   the timers and I/O handlers are not starved */
+#define MAX_POSTED_MESSAGES 256
+
+static void js_free_message(JSWorkerMessage *msg);
+static JSWorkerMessagePipe *js_dup_message_pipe(JSWorkerMessagePipe *ps);
+static void js_free_message_pipe(JSWorkerMessagePipe *ps);
+
+/* can be called from any thread */
+static void js_message_pipe_push(JSWorkerMessagePipe *ps,
+                                 JSWorkerMessage *msg)
+{
+    JSWorkerMessage *prev;
+
+    msg->next = NULL;
+    prev = atomic_exchange((_Atomic(JSWorkerMessage *) *)&ps->tail, msg);
+    /* the consumer sees an empty queue until 'next' is set */
+    atomic_store((_Atomic(JSWorkerMessage *) *)&prev->next, msg);
+}
+
+/* only called by the consumer. Return NULL if no message is
+   available. */
+static JSWorkerMessage *js_message_pipe_pop(JSWorkerMessagePipe *ps)
+{
+    JSWorkerMessage *head, *next;
+
+    head = ps->head;
+    next = atomic_load((_Atomic(JSWorkerMessage *) *)&head->next);
+    if (head == &ps->stub) {
+        if (!next)
+            return NULL;
+        ps->head = next;
+        head = next;
+        next = atomic_load((_Atomic(JSWorkerMessage *) *)&head->next);
+    }
+    if (next) {
+        ps->head = next;
+        return head;
+    }
+    /* a producer is pushing a message */
+    if (head != atomic_load((_Atomic(JSWorkerMessage *) *)&ps->tail))
+        return NULL;
+    /* 'head' is the last message: put the stub behind it */
+    js_message_pipe_push(ps, &ps->stub);
+    next = atomic_load((_Atomic(JSWorkerMessage *) *)&head->next);
+    if (next) {
+        ps->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+/* wake up the consumer if it was not already signaled */
+static void js_message_pipe_signal(JSWorkerMessagePipe *ps)
+{
+    int ret;
+
+    if (atomic_exchange((_Atomic(int) *)&ps->signaled, 1) != 0)
+        return;
+    for(;;) {
+#ifdef USE_EVENTFD
+        uint64_t v = 1;
+        ret = write(ps->write_fd, &v, sizeof(v));
+#else
+        uint8_t ch = '\0';
+        ret = write(ps->write_fd, &ch, 1);
+#endif
+        if (ret >= 0 || errno != EINTR)
+            break;
+    }
+}
+
+/* called by the consumer when 'read_fd' is readable */
+static void js_message_pipe_clear_signal(JSWorkerMessagePipe *ps)
+{
+    int ret;
+#ifdef USE_EVENTFD
+    uint64_t buf[1];
+#else
+    uint8_t buf[16];
+#endif
+    for(;;) {
+        ret = read(ps->read_fd, buf, sizeof(buf));
+        if (ret >= 0 || errno != EINTR)
+            break;
+    }
+    /* the messages pushed after this point signal again */
+    atomic_store((_Atomic(int) *)&ps->signaled, 0);
+}
+
+static JSWorkerMessageHandler *find_message_port(JSThreadState *ts,
+                                                 JSWorkerMessagePipe *ps)
+{
+    struct list_head *el;
+    JSWorkerMessageHandler *port;
+
+    list_for_each(el, &ts->port_list) {
+        port = list_entry(el, JSWorkerMessageHandler, link);
+        if (port->recv_pipe == ps && !JS_IsNull(port->on_message_func))
+            return port;
+    }
+    return NULL;
+}
+
+/* return 1 if a message was handled, 0 if no message */
+static int handle_posted_message(JSRuntime *rt, JSContext *ctx,
+                                 JSWorkerMessageHandler *port)
+{
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSWorkerMessagePipe *ps = port->recv_pipe;
+    int count;
+    JSWorkerMessage *msg;
+    JSValue obj, data_obj, func, retval;
+
+    js_message_pipe_clear_signal(ps);
+
+    /* the handler may free the port, so keep the pipe alive */
+    js_dup_message_pipe(ps);
+    for(count = 0; count < MAX_POSTED_MESSAGES; count++) {
+        port = find_message_port(ts, ps);
+        if (!port)
+            break;
+        msg = js_message_pipe_pop(ps);
+        if (!msg)
+            break;
+
+        data_obj = JS_ReadObject(ctx, msg->data, msg->data_len,
+                                 JS_READ_OBJ_SAB | JS_READ_OBJ_REFERENCE);
+
+        js_free_message(msg);
+
+        if (JS_IsException(data_obj))
+            goto fail;
+        obj = JS_NewObject(ctx);
+        if (JS_IsException(obj)) {
+            JS_FreeValue(ctx, data_obj);
+            goto fail;
+        }
+        JS_DefinePropertyValueStr(ctx, obj, "data", data_obj, JS_PROP_C_W_E);
+
+        /* 'func' might be destroyed when calling itself (if it frees the
+           handler), so must take extra care */
+        func = JS_DupValue(ctx, port->on_message_func);
+        retval = JS_Call(ctx, func, JS_UNDEFINED, 1, (JSValueConst *)&obj);
+        JS_FreeValue(ctx, obj);
+        JS_FreeValue(ctx, func);
+        if (JS_IsException(retval)) {
+        fail:
+            js_std_dump_error(ctx);
+        } else {
+            JS_FreeValue(ctx, retval);
+        }
+    }
+    /* handle the remaining messages in the next iteration */
+    if (count == MAX_POSTED_MESSAGES)
+        js_message_pipe_signal(ps);
+    js_free_message_pipe(ps);
+    return count != 0;
+}
+#else
+static int handle_posted_message(JSRuntime *rt, JSContext *ctx,
+                                 JSWorkerMessageHandler *port)
+{
+    return 0;
+}
+#endif
+
+#ifdef USE_EPOLL
+/* return 1 if a handler was called */
+static int js_os_epoll_dispatch(JSContext *ctx, const struct epoll_event *ev)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSOSRWHandler *rh;
+    struct list_head *el;
+    int fd = ev->data.fd;
+
+#ifdef USE_IO_URING
+    if (ts->ring && fd == ts->ring->event_fd)
+        return os_ring_poll(rt, ts->ring);
+#endif
+    /* the handlers may have been modified since epoll_wait() */
+    rh = find_rh(ts, fd);
+    if (rh) {
+        if ((ev->events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+            rh_call(ctx, rh, 0))
+            return 1;
+        /* 'rh' is still valid if nothing was done */
+        if ((ev->events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) &&
+            rh_call(ctx, rh, 1))
+            return 1;
+        return 0;
+    }
+    list_for_each(el, &ts->port_list) {
+        JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
+        if (!JS_IsNull(port->on_message_func) &&
+            port->recv_pipe->read_fd == fd) {
+            return handle_posted_message(rt, ctx, port);
+        }
+    }
+    return 0;
+}
+
+/* call the handler of the next descriptor rejected by epoll. Return
+   1 if a handler was called. */
+static int js_os_run_ready_handler(JSContext *ctx)
+{
+    JSThreadState *ts = JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
+    JSOSRWHandler *rh;
+
+    if (list_empty(&ts->os_ready_handlers))
+        return 0;
+    rh = list_entry(ts->os_ready_handlers.next, JSOSRWHandler, ready_link);
+    /* round robin between the ready handlers */
+    list_del(&rh->ready_link);
+    list_add_tail(&rh->ready_link, &ts->os_ready_handlers);
+    if (rh_call(ctx, rh, 0))
+        return 1;
+    /* 'rh' is still valid if nothing was done */
+    return rh_call(ctx, rh, 1);
+}
+
+/* The file descriptors stay registered in the epoll set, so the cost
+   of an iteration does not depend on the number of handlers. Only one
+   handler is called per iteration so that the pending jobs are run
+   in between: the remaining events are kept for the next
+   iterations. */
+static int js_os_poll_epoll(JSContext *ctx, int timeout)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    int ret;
+
+    while (ts->epoll_event_index < ts->epoll_event_count) {
+        if (js_os_epoll_dispatch(ctx, &ts->epoll_events[ts->epoll_event_index++]))
+            return 0;
+    }
+    /* the descriptors rejected by epoll are always ready */
+    if (!list_empty(&ts->os_ready_handlers))
+        timeout = 0;
+    ret = epoll_wait(ts->epoll_fd, ts->epoll_events,
+                     countof(ts->epoll_events), timeout);
+    ts->epoll_event_index = 0;
+    ts->epoll_event_count = max_int(ret, 0);
+    while (ts->epoll_event_index < ts->epoll_event_count) {
+        if (js_os_epoll_dispatch(ctx, &ts->epoll_events[ts->epoll_event_index++]))
+            return 0;
+    }
+    js_os_run_ready_handler(ctx);
+    return 0;
+}
+#endif
+
+static int js_os_poll(JSContext *ctx)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    int ret = 0, fd_max = 0, min_delay = 0;
+    fd_set rfds, wfds;
+    JSOSRWHandler *rh;
+    struct list_head *el;
+    struct timeval tv, *tvp;
+    BOOL io_busy;
+
+    /* only check signals in the main thread */
+    if (!ts->recv_pipe &&
+        unlikely(os_pending_signals != 0)) {
+        JSOSSignalHandler *sh;
+        uint64_t mask = 0;
+        
+        list_for_each(el, &ts->os_signal_handlers) {
+            sh = list_entry(el, JSOSSignalHandler, link);
+            mask = (uint64_t)1 << sh->sig_num;
+            if (os_pending_signals & mask) {
+                os_pending_signals &= ~mask;
+                call_handler(ctx, sh->func);
+                return 0;
+            }
+        }
+    }
+
+    io_busy = js_os_io_flush(rt);
+
+    if (list_empty(&ts->os_rw_handlers) && ts->timer_count == 0 &&
+        list_empty(&ts->port_list) && !js_os_io_pending(ts) && !io_busy)
+        return -1; /* no more events */
+
+    if (js_os_run_timers(ctx, &min_delay))
+        return 0;
+
+    if (io_busy) {
+        /* run the promise jobs of the completed requests first */
+        min_delay = 0;
+    }
+
+    js_os_run_gc_step(rt, &min_delay);
+
+#ifdef USE_EPOLL
+    if (ts->epoll_fd >= 0)
+        return js_os_poll_epoll(ctx, min_delay);
+#endif
+
+    if (min_delay >= 0) {
+        tv.tv_sec = min_delay / 1000;
+        tv.tv_usec = (min_delay % 1000) * 1000;
+        tvp = &tv;
+    } else {
+        tvp = NULL;
+    }
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    fd_max = -1;
+    list_for_each(el, &ts->os_rw_handlers) {
+        rh = list_entry(el, JSOSRWHandler, link);
+        fd_max = max_int(fd_max, rh->fd);
+        if (rh_is_waiting(rh, 0))
+            FD_SET(rh->fd, &rfds);
+        if (rh_is_waiting(rh, 1))
+            FD_SET(rh->fd, &wfds);
+    }
+#ifdef USE_IO_URING
+    if (ts->ring && ts->ring->inflight > 0) {
+        fd_max = max_int(fd_max, ts->ring->event_fd);
+        FD_SET(ts->ring->event_fd, &rfds);
+    }
+#endif
+
+    list_for_each(el, &ts->port_list) {
+        JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
+        if (!JS_IsNull(port->on_message_func)) {
+            JSWorkerMessagePipe *ps = port->recv_pipe;
+            fd_max = max_int(fd_max, ps->read_fd);
+            FD_SET(ps->read_fd, &rfds);
+        }
+    }
+
+    ret = select(fd_max + 1, &rfds, &wfds, NULL, tvp);
+    if (ret > 0) {
+#ifdef USE_IO_URING
+        if (ts->ring && ts->ring->inflight > 0 &&
+            FD_ISSET(ts->ring->event_fd, &rfds) &&
+            os_ring_poll(rt, ts->ring))
+            goto done;
+#endif
+        list_for_each(el, &ts->os_rw_handlers) {
+            rh = list_entry(el, JSOSRWHandler, link);
+            /* must stop because the list may have been modified */
+            if (FD_ISSET(rh->fd, &rfds) && rh_call(ctx, rh, 0))
+                goto done;
+            if (FD_ISSET(rh->fd, &wfds) && rh_call(ctx, rh, 1))
+                goto done;
+        }
+
+        list_for_each(el, &ts->port_list) {
+            JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
+            if (!JS_IsNull(port->on_message_func)) {
+                JSWorkerMessagePipe *ps = port->recv_pipe;
+                if (FD_ISSET(ps->read_fd, &rfds)) {
+                    if (handle_posted_message(rt, ctx, port))
+                        goto done;
+                }
+            }
+        }
+    }
+    done:
+    return 0;
+}
+#endif /* !_WIN32 */
+
+static JSValue make_obj_error(JSContext *ctx,
+                              JSValue obj,
+                              int err)
+{
+    JSValue arr;
+    if (JS_IsException(obj))
+        return obj;
+    arr = JS_NewArray(ctx);
+    if (JS_IsException(arr))
+        return JS_EXCEPTION;
+    JS_DefinePropertyValueUint32(ctx, arr, 0, obj,
+                                 JS_PROP_C_W_E);
+    JS_DefinePropertyValueUint32(ctx, arr, 1, JS_NewInt32(ctx, err),
+                                 JS_PROP_C_W_E);
+    return arr;
+}
+
+static JSValue make_string_error(JSContext *ctx,
+                                 const char *buf,
+                                 int err)
+{
+    return make_obj_error(ctx, JS_NewString(ctx, buf), err);
+}
+
+/* return [cwd, errorcode] */
+static JSValue js_os_getcwd(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    char buf[PATH_MAX];
+    int err = 0;
+    
+    if (!getcwd(buf, sizeof(buf))) {
+        buf[0] = '\0';
+        err = errno;
+    } else {
+        err = 0;
+    }
+    return make_string_error(ctx, buf, err);
+}
+
+static JSValue js_os_chdir(JSContext *ctx, JSValueConst this_val,
+                           int argc, JSValueConst *argv)
+{
+    const char *target = NULL;
+    int err = 0;
+
+    target = JS_ToCString(ctx, argv[0]);
+    if (!target)
+        return JS_EXCEPTION;
+    err = js_get_errno(chdir(target));
+    JS_FreeCString(ctx, target);
+    return JS_NewInt32(ctx, err);
+}
+
+static JSValue js_os_mkdir(JSContext *ctx, JSValueConst this_val,
+                           int argc, JSValueConst *argv)
+{
+    int mode = 0, ret = 0;
+    const char *path = NULL;
+    
+    if (argc >= 2) {
+        if (JS_ToInt32(ctx, &mode, argv[1]))
+            return JS_EXCEPTION;
+    } else {
+        mode = 0777;
+    }
+    path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+        return JS_EXCEPTION;
+#if defined(_WIN32)
+    (void)mode;
+    ret = js_get_errno(mkdir(path));
+#else
+    ret = js_get_errno(mkdir(path, mode));
+#endif
+    JS_FreeCString(ctx, path);
+    return JS_NewInt32(ctx, ret);
+}
+
+/* return [array, errorcode] */
+static JSValue js_os_readdir(JSContext *ctx, JSValueConst this_val,
+                             int argc, JSValueConst *argv)
+{
+    const char *path = NULL;
+#if defined(_WIN32)
+    HANDLE hFind = NULL;
+    WIN32_FIND_DATAA hData;
+    int f = 0;
+#else
+    DIR *f;
+    struct dirent *d;
+#endif
+    JSValue obj;
+    int err = 0;
+    uint32_t len = 0;
+    
+    path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+        return JS_EXCEPTION;
+    obj = JS_NewArray(ctx);
+    if (JS_IsException(obj)) {
+        JS_FreeCString(ctx, path);
+        return JS_EXCEPTION;
+    }
+#if defined(_WIN32)
+    char* _path = (char*)malloc(strlen(path) + 3);
+    memset(_path, 0, strlen(path) + 3);
+    strcpy(_path, path);
+    strcpy(_path + strlen(path), "\\*");
+    hFind = FindFirstFileA(_path, &hData);
+    free(_path);
+    f = hFind != INVALID_HANDLE_VALUE;
+#else
+    f = opendir(path);
+#endif
+    if (!f)
+#ifdef _WIN32
+        err = GetLastError();
+#else
+        err = errno;
+#endif
+    else
+        err = 0;
+    JS_FreeCString(ctx, path);
+    if (!f)
+        goto done;
+    len = 0;
+#if defined(_WIN32)
+    do
+    {
+        if (strcmp(hData.cFileName, ".") == 0 || strcmp(hData.cFileName, "..") == 0) {
+            continue;
+        }
+        JS_DefinePropertyValueUint32(ctx, obj, len++,
+                                     JS_NewString(ctx, hData.cFileName),
+                                     JS_PROP_C_W_E);
+
+    } while (FindNextFileA(hFind, &hData));
+    FindClose(hFind);
+#else
+    for(;;) {
+        errno = 0;
+        d = readdir(f);
+        if (!d) {
+            err = errno;
+            break;
+        }
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+            continue;
+        }
+        JS_DefinePropertyValueUint32(ctx, obj, len++,
+                                     JS_NewString(ctx, d->d_name),
+                                     JS_PROP_C_W_E);
+    }
+    closedir(f);
+#endif
+ done:
+    return make_obj_error(ctx, obj, err);
+}
+
+#if !defined(_WIN32)
+static int64_t timespec_to_ms(const struct timespec *tv)
+{
+    return (int64_t)tv->tv_sec * 1000 + (tv->tv_nsec / 1000000);
+}
+#else
+static void filetime_to_ms(FILETIME t, time_t *tt) {
+    ULARGE_INTEGER ui;
+    ui.HighPart = t.dwHighDateTime;
+    ui.LowPart = t.dwLowDateTime;
+    *tt = ((LONGLONG)(ui.QuadPart - 116444736000000000) / 10000);
+}
+
+static int fs__wide_to_utf8(WCHAR* w_source_ptr,
+                               DWORD w_source_len,
+                               char** target_ptr,
+                               uint64_t* target_len_ptr) {
+    int r = 0;
+    int target_len = 0;
+    char* target = NULL;
+    target_len = WideCharToMultiByte(CP_UTF8,
+                                    0,
+                                    w_source_ptr,
+                                    w_source_len,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    NULL);
+
+    if (target_len == 0) {
+        return -1;
+    }
+    if (target_len_ptr != NULL) {
+        *target_len_ptr = target_len;
+    }
+
+    if (target_ptr == NULL) {
+        return 0;
+    }
+
+    target = malloc(target_len + 1);
+    if (target == NULL) {
+        SetLastError(ERROR_OUTOFMEMORY);
+        return -1;
+    }
+    r = WideCharToMultiByte(CP_UTF8,
+                            0,
+                            w_source_ptr,
+                            w_source_len,
+                            target,
+                            target_len,
+                            NULL,
+                            NULL);
+    assert(r == target_len);
+    target[target_len] = '\0';
+    *target_ptr = target;
+    return 0;
+}
+
+typedef struct _REPARSE_DATA_BUFFER {
+    ULONG  ReparseTag;
+    USHORT ReparseDataLength;
+    USHORT Reserved;
+    union {
+        struct {
+            USHORT SubstituteNameOffset;
+            USHORT SubstituteNameLength;
+            USHORT PrintNameOffset;
+            USHORT PrintNameLength;
+            ULONG Flags;
+            WCHAR PathBuffer[1];
+        } SymbolicLinkReparseBuffer;
+        struct {
+            USHORT SubstituteNameOffset;
+            USHORT SubstituteNameLength;
+            USHORT PrintNameOffset;
+            USHORT PrintNameLength;
+            WCHAR PathBuffer[1];
+        } MountPointReparseBuffer;
+        struct {
+            UCHAR  DataBuffer[1];
+        } GenericReparseBuffer;
+        struct {
+            ULONG StringCount;
+            WCHAR StringList[1];
+        } AppExecLinkReparseBuffer;
+    };
+} REPARSE_DATA_BUFFER, *PREPARSE_DATA_BUFFER;
+
+inline static int fs__readlink_handle(HANDLE handle, char** target_ptr,
+    uint64_t* target_len_ptr) {
+  char buffer[MAXIMUM_REPARSE_DATA_BUFFER_SIZE];
+  REPARSE_DATA_BUFFER* reparse_data = (REPARSE_DATA_BUFFER*) buffer;
+  WCHAR* w_target;
+  DWORD w_target_len;
+  DWORD bytes;
+  size_t i;
+  size_t len;
+
+  if (!DeviceIoControl(handle,
+                       FSCTL_GET_REPARSE_POINT,
+                       NULL,
+                       0,
+                       buffer,
+                       sizeof buffer,
+                       &bytes,
+                       NULL)) {
+    return -1;
+  }
+
+  if (reparse_data->ReparseTag == IO_REPARSE_TAG_SYMLINK) {
+    /* Real symlink */
+    w_target = reparse_data->SymbolicLinkReparseBuffer.PathBuffer +
+        (reparse_data->SymbolicLinkReparseBuffer.SubstituteNameOffset /
+        sizeof(WCHAR));
+    w_target_len =
+        reparse_data->SymbolicLinkReparseBuffer.SubstituteNameLength /
+        sizeof(WCHAR);
+    /* Real symlinks can contain pretty much everything, but the only thing we
+     * really care about is undoing the implicit conversion to an NT namespaced
+     * path that CreateSymbolicLink will perform on absolute paths. If the path
+     * is win32-namespaced then the user must have explicitly made it so, and
+     * we better just return the unmodified reparse data. */
+    if (w_target_len >= 4 &&
+        w_target[0] == L'\\' &&
+        w_target[1] == L'?' &&
+        w_target[2] == L'?' &&
+        w_target[3] == L'\\') {
+      /* Starts with \??\ */
+      if (w_target_len >= 6 &&
+          ((w_target[4] >= L'A' && w_target[4] <= L'Z') ||
+           (w_target[4] >= L'a' && w_target[4] <= L'z')) &&
+          w_target[5] == L':' &&
+          (w_target_len == 6 || w_target[6] == L'\\')) {
+        /* \??\<drive>:\ */
+        w_target += 4;
+        w_target_len -= 4;
+
+      } else if (w_target_len >= 8 &&
+                 (w_target[4] == L'U' || w_target[4] == L'u') &&
+                 (w_target[5] == L'N' || w_target[5] == L'n') &&
+                 (w_target[6] == L'C' || w_target[6] == L'c') &&
+                 w_target[7] == L'\\') {
+        /* \??\UNC\<server>\<share>\ - make sure the final path looks like
+         * \\<server>\<share>\ */
+        w_target += 6;
+        w_target[0] = L'\\';
+        w_target_len -= 6;
+      }
+    }
+
+  } else if (reparse_data->ReparseTag == IO_REPARSE_TAG_MOUNT_POINT) {
+    /* Junction. */
+    w_target = reparse_data->MountPointReparseBuffer.PathBuffer +
+        (reparse_data->MountPointReparseBuffer.SubstituteNameOffset /
+        sizeof(WCHAR));
+    w_target_len = reparse_data->MountPointReparseBuffer.SubstituteNameLength /
+        sizeof(WCHAR);
+
+    /* Only treat junctions that look like \??\<drive>:\ as symlink. Junctions
+     * can also be used as mount points, like \??\Volume{<guid>}, but that's
+     * confusing for programs since they wouldn't be able to actually
+     * understand such a path when returned by uv_readlink(). UNC paths are
+     * never valid for junctions so we don't care about them. */
+    if (!(w_target_len >= 6 &&
+          w_target[0] == L'\\' &&
+          w_target[1] == L'?' &&
+          w_target[2] == L'?' &&
+          w_target[3] == L'\\' &&
+          ((w_target[4] >= L'A' && w_target[4] <= L'Z') ||
+           (w_target[4] >= L'a' && w_target[4] <= L'z')) &&
+          w_target[5] == L':' &&
+          (w_target_len == 6 || w_target[6] == L'\\'))) {
+        SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
+        return -1;
+    }
+
+    /* Remove leading \??\ */
+    w_target += 4;
+    w_target_len -= 4;
+
+  } else if (reparse_data->ReparseTag == IO_REPARSE_TAG_APPEXECLINK) {
+    /* String #3 in the list has the target filename. */
+    if (reparse_data->AppExecLinkReparseBuffer.StringCount < 3) {
+      SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
+      return -1;
+    }
+    w_target = reparse_data->AppExecLinkReparseBuffer.StringList;
+    /* The StringList buffer contains a list of strings separated by "\0",   */
+    /* with "\0\0" terminating the list. Move to the 3rd string in the list: */
+    for (i = 0; i < 2; ++i) {
+      len = wcslen(w_target);
+      if (len == 0) {
+        SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
+        return -1;
+      }
+      w_target += len + 1;
+    }
+    w_target_len = wcslen(w_target);
+    if (w_target_len == 0) {
+      SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
+      return -1;
+    }
+    /* Make sure it is an absolute path. */
+    if (!(w_target_len >= 3 &&
+         ((w_target[0] >= L'a' && w_target[0] <= L'z') ||
+          (w_target[0] >= L'A' && w_target[0] <= L'Z')) &&
+         w_target[1] == L':' &&
+         w_target[2] == L'\\')) {
+      SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
+      return -1;
+    }
+
+  } else {
+    /* Reparse tag does not indicate a symlink. */
+    SetLastError(ERROR_SYMLINK_NOT_SUPPORTED);
+    return -1;
+  }
+
+  return fs__wide_to_utf8(w_target, w_target_len, target_ptr, target_len_ptr);
+}
+#endif
+
+static JSValue js_os_issymlink(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    const char *path = NULL;
+    BOOL is_symlink = FALSE;
+    path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+        return JS_EXCEPTION;
+#if defined(_WIN32)
+    DWORD dwAttrib = GetFileAttributesA(path);
+    if (dwAttrib != INVALID_FILE_ATTRIBUTES && (dwAttrib & FILE_ATTRIBUTE_REPARSE_POINT) == FILE_ATTRIBUTE_REPARSE_POINT) {
+        is_symlink = TRUE;
+    }
+#else
+    struct stat st;
+    int res = lstat(path, &st);
+    if (!res) {
+        is_symlink = S_ISLNK(st.st_mode);
+    }
+#endif
+    JS_FreeCString(ctx, path);
+    return JS_NewBool(ctx, is_symlink);
+}
+
+/* return [obj, errcode] */
+static JSValue js_os_stat(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv, int is_lstat)
+{
+    const char *path = NULL;
+    int err = 0, res = 0;
+    struct stat st;
+    JSValue obj;
+
+    path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+        return JS_EXCEPTION;
+    memset(&st, 0, sizeof(struct stat));
+#if defined(_WIN32)
+    HANDLE handle = NULL;
+    DWORD flags = 0;
+    flags = FILE_FLAG_BACKUP_SEMANTICS;
+    if (is_lstat)
+        flags |= FILE_FLAG_OPEN_REPARSE_POINT;
+    handle = CreateFileA(
+        path,
+        FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        flags,
+        NULL
+    );
+    BY_HANDLE_FILE_INFORMATION info;
+    memset(&info, 0, sizeof(BY_HANDLE_FILE_INFORMATION));
+    if (handle != NULL && GetFileInformationByHandle(handle, &info)) {
+        if (info.dwFileAttributes != INVALID_FILE_ATTRIBUTES) {
+            if ((info.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == FILE_ATTRIBUTE_REPARSE_POINT) {
+                st.st_mode |= S_IFLNK;
+            }
+            if ((info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY) {
+                st.st_mode |= S_IFDIR;
+            } else {
+                st.st_mode |= S_IFREG;
+            }
+        }
+
+        filetime_to_ms(info.ftLastAccessTime, &st.st_atime);
+        filetime_to_ms(info.ftLastWriteTime, &st.st_mtime);
+        filetime_to_ms(info.ftCreationTime, &st.st_ctime);
+        st.st_dev = info.dwVolumeSerialNumber;
+        st.st_size = (info.nFileSizeHigh * (MAXDWORD + 1)) + info.nFileSizeLow;
+        st.st_ino = (info.nFileIndexHigh * (MAXDWORD + 1)) + info.nFileIndexLow;
+        st.st_nlink = info.nNumberOfLinks;
+    } else {
+        res = -1;
+    }
+    if (handle != NULL) {
+        CloseHandle(handle);
+    }
+#else
+    if (is_lstat)
+        res = lstat(path, &st);
+    else
+        res = stat(path, &st);
+#endif
+    if (res < 0)
+        err = errno;
+    else
+        err = 0;
+    JS_FreeCString(ctx, path);
+    if (res < 0) {
+#ifdef _WIN32
+        err = GetLastError();
+#else
+        err = errno;
+#endif
+        obj = JS_NULL;
+    } else {
+        obj = JS_NewObject(ctx);
+        if (JS_IsException(obj))
+            return JS_EXCEPTION;
+        JS_DefinePropertyValueStr(ctx, obj, "dev",
+                                  JS_NewInt64(ctx, st.st_dev),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "ino",
+                                  JS_NewInt64(ctx, st.st_ino),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "mode",
+                                  JS_NewInt32(ctx, st.st_mode),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "nlink",
+                                  JS_NewInt64(ctx, st.st_nlink),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "uid",
+                                  JS_NewInt64(ctx, st.st_uid),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "gid",
+                                  JS_NewInt64(ctx, st.st_gid),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "rdev",
+                                  JS_NewInt64(ctx, st.st_rdev),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "size",
+                                  JS_NewInt64(ctx, st.st_size),
+                                  JS_PROP_C_W_E);
+#if !defined(_WIN32)
+        JS_DefinePropertyValueStr(ctx, obj, "blocks",
+                                  JS_NewInt64(ctx, st.st_blocks),
+                                  JS_PROP_C_W_E);
+#endif
+#if defined(_WIN32)
+        JS_DefinePropertyValueStr(ctx, obj, "atime",
+                                  JS_NewInt64(ctx, (int64_t)st.st_atime),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "mtime",
+                                  JS_NewInt64(ctx, (int64_t)st.st_mtime),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "ctime",
+                                  JS_NewInt64(ctx, (int64_t)st.st_ctime),
+                                  JS_PROP_C_W_E);
+#elif defined(__APPLE__)
+        JS_DefinePropertyValueStr(ctx, obj, "atime",
+                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_atimespec)),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "mtime",
+                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_mtimespec)),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "ctime",
+                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_ctimespec)),
+                                  JS_PROP_C_W_E);
+#else
+        JS_DefinePropertyValueStr(ctx, obj, "atime",
+                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_atim)),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "mtime",
+                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_mtim)),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "ctime",
+                                  JS_NewInt64(ctx, timespec_to_ms(&st.st_ctim)),
+                                  JS_PROP_C_W_E);
+#endif
+    }
+    return make_obj_error(ctx, obj, err);
+}
+
+#if !defined(_WIN32)
+static void ms_to_timeval(struct timeval *tv, uint64_t v)
+{
+    tv->tv_sec = v / 1000;
+    tv->tv_usec = (v % 1000) * 1000;
+}
+#endif
+
+static JSValue js_os_utimes(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    const char *path;
+    int64_t atime = 0, mtime = 0;
+    int ret = 0;
+    
+    if (JS_ToInt64(ctx, &atime, argv[1]))
+        return JS_EXCEPTION;
+    if (JS_ToInt64(ctx, &mtime, argv[2]))
+        return JS_EXCEPTION;
+    path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+        return JS_EXCEPTION;
+#if defined(_WIN32)
+    {
+        struct _utimbuf times;
+        times.actime = atime / 1000;
+        times.modtime = mtime / 1000;
+        ret = js_get_errno(_utime(path, &times));
+    }
+#else
+    {
+        struct timeval times[2];
+        ms_to_timeval(&times[0], atime);
+        ms_to_timeval(&times[1], mtime);
+        ret = js_get_errno(utimes(path, times));
+    }
+#endif
+    JS_FreeCString(ctx, path);
+    return JS_NewInt32(ctx, ret);
+}
+
+/* sleep(delay_ms) */
+static JSValue js_os_sleep(JSContext *ctx, JSValueConst this_val,
+                           int argc, JSValueConst *argv)
+{
+    int64_t delay = 0;
+    int ret = 0;
+    
+    if (JS_ToInt64(ctx, &delay, argv[0]))
+        return JS_EXCEPTION;
+    if (delay < 0)
+        delay = 0;
+#if defined(_WIN32)
+    {
+        if (delay > INT32_MAX)
+            delay = INT32_MAX;
+        Sleep(delay);
+        ret = 0;
+    }
+#else
+    {
+        struct timespec ts;
+
+        ts.tv_sec = delay / 1000;
+        ts.tv_nsec = (delay % 1000) * 1000000;
+        ret = js_get_errno(nanosleep(&ts, NULL));
+    }
+#endif
+    return JS_NewInt32(ctx, ret);
+}
+
+/* return [path, errorcode] */
+static JSValue js_os_realpath(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv)
+{
+    const char *path;
+    char buf[PATH_MAX], *res;
+    int err = 0;
+
+    path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+        return JS_EXCEPTION;
+    res = realpath(path, buf);
+    JS_FreeCString(ctx, path);
+    if (!res) {
+        buf[0] = '\0';
+        err = errno;
+    } else {
+        err = 0;
+    }
+    return make_string_error(ctx, buf, err);
+}
+
+static JSValue js_os_symlink(JSContext *ctx, JSValueConst this_val,
+                             int argc, JSValueConst *argv)
+{
+    const char *target, *linkpath;
+    int err = 0;
+    
+    target = JS_ToCString(ctx, argv[0]);
+    if (!target)
+        return JS_EXCEPTION;
+    linkpath = JS_ToCString(ctx, argv[1]);
+    if (!linkpath) {
+        JS_FreeCString(ctx, target);
+        return JS_EXCEPTION;
+    }
+#if defined(_WIN32)
+    DWORD dwAttrib = GetFileAttributesA(target);
+    DWORD dwFlags = 0;
+    if (dwAttrib != INVALID_FILE_ATTRIBUTES && (dwAttrib & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY) {
+        dwFlags = 1;
+    }
+    if (CreateSymbolicLinkA(linkpath, target, dwFlags)) {
+        err = 0;
+    } else {
+        err = GetLastError();
+    }
+#else
+    err = js_get_errno(symlink(target, linkpath));
+#endif
+    JS_FreeCString(ctx, target);
+    JS_FreeCString(ctx, linkpath);
+    return JS_NewInt32(ctx, err);
+}
+
+/* return [path, errorcode] */
+static JSValue js_os_readlink(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv)
+{
+    const char *path;
+    char buf[PATH_MAX];
+    int err = 0;
+    ssize_t res = 0;
+    
+    path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+        return JS_EXCEPTION;
+#ifdef _WIN32
+    HANDLE handle;
+    DWORD flags;
+    flags = FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT;
+    handle = CreateFileA(
+        path,
+        FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        flags,
+        NULL
+    );
+    char *buf2;
+    err = fs__readlink_handle(handle, &buf2, (uint64_t*)&res);
+    CloseHandle(handle);
+    strcpy(buf, buf2);
+    free(buf2);
+#else
+    res = readlink(path, buf, sizeof(buf) - 1);
+#endif
+    if (res < 0) {
+        buf[0] = '\0';
+#ifdef _WIN32
+#else
+        err = errno;
+#endif
+    } else {
+        buf[res] = '\0';
+        err = 0;
+    }
+    JS_FreeCString(ctx, path);
+    return make_string_error(ctx, buf, err);
+}
+
+/* dup(fd) */
+static JSValue js_os_dup(JSContext *ctx, JSValueConst this_val,
+                         int argc, JSValueConst *argv)
+{
+    int fd = 0, ret = 0;
+    
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    ret = js_get_errno(dup(fd));
+    return JS_NewInt32(ctx, ret);
+}
+
+/* dup2(fd) */
+static JSValue js_os_dup2(JSContext *ctx, JSValueConst this_val,
+                         int argc, JSValueConst *argv)
+{
+    int fd = 0, fd2 = 0, ret = 0;
+    
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &fd2, argv[1]))
+        return JS_EXCEPTION;
+    ret = js_get_errno(dup2(fd, fd2));
+    return JS_NewInt32(ctx, ret);
+}
+
+/* pipe() -> [read_fd, write_fd] or null if error */
+static JSValue js_os_pipe(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv)
+{
+    int pipe_fds[2];
+    int ret = 0;
+    JSValue obj;
+#ifdef _WIN32
+    HANDLE hReadPipe;
+    HANDLE hWritePipe;
+    if (CreatePipe(&hReadPipe, &hWritePipe, NULL, 0)) {
+        pipe_fds[0] = _open_osfhandle((intptr_t)hReadPipe, _O_RDONLY);
+        pipe_fds[1] = _open_osfhandle((intptr_t)hWritePipe, _O_WRONLY);
+    } else {
+        ret = GetLastError();
+    }
+#else
+    ret = pipe(pipe_fds);
+#endif
+    if (ret < 0)
+        return JS_NULL;
+    obj = JS_NewArray(ctx);
+    if (JS_IsException(obj))
+        return obj;
+    JS_DefinePropertyValueUint32(ctx, obj, 0, JS_NewInt32(ctx, pipe_fds[0]),
+                                 JS_PROP_C_W_E);
+    JS_DefinePropertyValueUint32(ctx, obj, 1, JS_NewInt32(ctx, pipe_fds[1]),
+                                 JS_PROP_C_W_E);
+    return obj;
+}
+
+#if !defined(_WIN32)
+static char **build_envp(JSContext *ctx, JSValueConst obj)
+{
+    uint32_t len = 0, i = 0;
+    JSPropertyEnum *tab;
+    char **envp, *pair;
+    const char *key, *str;
+    JSValue val;
+    size_t key_len, str_len;
+
+    if (JS_GetOwnPropertyNames(ctx, &tab, &len, obj,
+                               JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) < 0)
+        return NULL;
+    envp = js_mallocz(ctx, sizeof(envp[0]) * ((size_t)len + 1));
+    if (!envp)
+        goto fail;
+    for(i = 0; i < len; i++) {
+        val = JS_GetProperty(ctx, obj, tab[i].atom);
+        if (JS_IsException(val))
+            goto fail;
+        str = JS_ToCString(ctx, val);
+        JS_FreeValue(ctx, val);
+        if (!str)
+            goto fail;
+        key = JS_AtomToCString(ctx, tab[i].atom);
+        if (!key) {
+            JS_FreeCString(ctx, str);
+            goto fail;
+        }
+        key_len = strlen(key);
+        str_len = strlen(str);
+        pair = js_malloc(ctx, key_len + str_len + 2);
+        if (!pair) {
+            JS_FreeCString(ctx, key);
+            JS_FreeCString(ctx, str);
+            goto fail;
+        }
+        memcpy(pair, key, key_len);
+        pair[key_len] = '=';
+        memcpy(pair + key_len + 1, str, str_len);
+        pair[key_len + 1 + str_len] = '\0';
+        envp[i] = pair;
+        JS_FreeCString(ctx, key);
+        JS_FreeCString(ctx, str);
+    }
+ done:
+    for(i = 0; i < len; i++)
+        JS_FreeAtom(ctx, tab[i].atom);
+    js_free(ctx, tab);
+    return envp;
+ fail:
+    if (envp) {
+        for(i = 0; i < len; i++)
+            js_free(ctx, envp[i]);
+        js_free(ctx, envp);
+        envp = NULL;
+    }
+    goto done;
+}
+
+#ifdef _WIN32
+
+#endif
+
+/* execvpe is not available on non GNU systems */
+static int my_execvpe(const char *filename, char **argv, char **envp)
+{
+    char *path, *p, *p_next, *p1;
+    char buf[PATH_MAX];
+    size_t filename_len, path_len;
+    BOOL eacces_error;
+
+    filename_len = strlen(filename);
+    if (filename_len == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (strchr(filename, '/'))
+        return execve(filename, argv, envp);
+
+    path = getenv("PATH");
+    if (!path) {
+#ifdef _WIN32
+        path = (char *)"C:\\WINDOWS\\system32";
+#else
+        path = (char *)"/bin:/usr/bin";
+#endif
+    }
+    eacces_error = FALSE;
+    p = path;
+    for(p = path; p != NULL; p = p_next) {
+        p1 = strchr(p, ':');
+        if (!p1) {
+            p_next = NULL;
+            path_len = strlen(p);
+        } else {
+            p_next = p1 + 1;
+            path_len = p1 - p;
+        }
+        /* path too long */
+        if ((path_len + 1 + filename_len + 1) > PATH_MAX)
+            continue;
+        memcpy(buf, p, path_len);
+        buf[path_len] = '/';
+        memcpy(buf + path_len + 1, filename, filename_len);
+        buf[path_len + 1 + filename_len] = '\0';
+
+        execve(buf, argv, envp);
+
+        switch(errno) {
+        case EACCES:
+            eacces_error = TRUE;
+            break;
+        case ENOENT:
+        case ENOTDIR:
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (eacces_error)
+        errno = EACCES;
+    return -1;
+}
+
+/* exec(args[, options]) -> exitcode */
+static JSValue js_os_exec(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv)
+{
+    JSValueConst options, args = argv[0];
+    JSValue val, ret_val;
+    const char **exec_argv, *file = NULL, *str, *cwd = NULL;
+    char **envp = environ;
+    uint32_t exec_argc = 0, i = 0;
+    int ret = 0, pid = 0, status = 0;
+    BOOL block_flag = TRUE, use_path = TRUE;
+    static const char *std_name[3] = { "stdin", "stdout", "stderr" };
+    int std_fds[3];
+    uint32_t uid = -1, gid = -1;
+
+    val = JS_GetPropertyStr(ctx, args, "length");
+    if (JS_IsException(val))
+        return JS_EXCEPTION;
+    ret = JS_ToUint32(ctx, &exec_argc, val);
+    JS_FreeValue(ctx, val);
+    if (ret)
+        return JS_EXCEPTION;
+    /* arbitrary limit to avoid overflow */
+    if (exec_argc < 1 || exec_argc > 65535) {
+        return JS_ThrowTypeError(ctx, "invalid number of arguments");
+    }
+    exec_argv = js_mallocz(ctx, sizeof(exec_argv[0]) * (exec_argc + 1));
+    if (!exec_argv)
+        return JS_EXCEPTION;
+    for(i = 0; i < exec_argc; i++) {
+        val = JS_GetPropertyUint32(ctx, args, i);
+        if (JS_IsException(val))
+            goto exception;
+        str = JS_ToCString(ctx, val);
+        JS_FreeValue(ctx, val);
+        if (!str)
+            goto exception;
+        exec_argv[i] = str;
+    }
+    exec_argv[exec_argc] = NULL;
+
+    for(i = 0; i < 3; i++)
+        std_fds[i] = i;
+
+    /* get the options, if any */
+    if (argc >= 2) {
+        options = argv[1];
+
+        if (get_bool_option(ctx, &block_flag, options, "block"))
+            goto exception;
+        if (get_bool_option(ctx, &use_path, options, "usePath"))
+            goto exception;
+
+        val = JS_GetPropertyStr(ctx, options, "file");
+        if (JS_IsException(val))
+            goto exception;
+        if (!JS_IsUndefined(val)) {
+            file = JS_ToCString(ctx, val);
+            JS_FreeValue(ctx, val);
+            if (!file)
+                goto exception;
+        }
+
+        val = JS_GetPropertyStr(ctx, options, "cwd");
+        if (JS_IsException(val))
+            goto exception;
+        if (!JS_IsUndefined(val)) {
+            cwd = JS_ToCString(ctx, val);
+            JS_FreeValue(ctx, val);
+            if (!cwd)
+                goto exception;
+        }
+
+        /* stdin/stdout/stderr handles */
+        for(i = 0; i < 3; i++) {
+            val = JS_GetPropertyStr(ctx, options, std_name[i]);
+            if (JS_IsException(val))
+                goto exception;
+            if (!JS_IsUndefined(val)) {
+                int fd = 0;
+                ret = JS_ToInt32(ctx, &fd, val);
+                JS_FreeValue(ctx, val);
+                if (ret)
+                    goto exception;
+                std_fds[i] = fd;
+            }
+        }
+
+        val = JS_GetPropertyStr(ctx, options, "env");
+        if (JS_IsException(val))
+            goto exception;
+        if (!JS_IsUndefined(val)) {
+            envp = build_envp(ctx, val);
+            JS_FreeValue(ctx, val);
+            if (!envp)
+                goto exception;
+        }
+
+        val = JS_GetPropertyStr(ctx, options, "uid");
+        if (JS_IsException(val))
+            goto exception;
+        if (!JS_IsUndefined(val)) {
+            ret = JS_ToUint32(ctx, &uid, val);
+            JS_FreeValue(ctx, val);
+            if (ret)
+                goto exception;
+        }
+
+        val = JS_GetPropertyStr(ctx, options, "gid");
+        if (JS_IsException(val))
+            goto exception;
+        if (!JS_IsUndefined(val)) {
+            ret = JS_ToUint32(ctx, &gid, val);
+            JS_FreeValue(ctx, val);
+            if (ret)
+                goto exception;
+        }
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        JS_ThrowTypeError(ctx, "fork error");
+        goto exception;
+    }
+    if (pid == 0) {
+        /* child */
+        int fd_max = sysconf(_SC_OPEN_MAX);
+
+        /* remap the stdin/stdout/stderr handles if necessary */
+        for(i = 0; i < 3; i++) {
+            if (std_fds[i] != i) {
+                if (dup2(std_fds[i], i) < 0)
+                    _exit(127);
+            }
+        }
+
+        for(i = 3; i < fd_max; i++)
+            close(i);
+        if (cwd) {
+            if (chdir(cwd) < 0)
+                _exit(127);
+        }
+        if (uid != -1) {
+            if (setuid(uid) < 0)
+                _exit(127);
+        }
+        if (gid != -1) {
+            if (setgid(gid) < 0)
+                _exit(127);
+        }
+
+        if (!file)
+            file = exec_argv[0];
+        if (use_path)
+            ret = my_execvpe(file, (char **)exec_argv, envp);
+        else
+            ret = execve(file, (char **)exec_argv, envp);
+        _exit(127);
     }
-    if (CreateSymbolicLinkA(linkpath, target, dwFlags)) {
-        err = 0;
+    /* parent */
+    if (block_flag) {
+        for(;;) {
+            ret = waitpid(pid, &status, 0);
+            if (ret == pid) {
+                if (WIFEXITED(status)) {
+                    ret = WEXITSTATUS(status);
+                    break;
+                } else if (WIFSIGNALED(status)) {
+                    ret = -WTERMSIG(status);
+                    break;
+                }
+            }
+        }
     } else {
-        err = GetLastError();
+        ret = pid;
     }
-#else
-    err = js_get_errno(symlink(target, linkpath));
-#endif
-    JS_FreeCString(ctx, target);
-    JS_FreeCString(ctx, linkpath);
-    return JS_NewInt32(ctx, err);
-}
-
-/* return [path, errorcode] */
-static JSValue js_os_readlink(JSContext *ctx, JSValueConst this_val,
-                              int argc, JSValueConst *argv)
-{
-    const char *path;
-    char buf[PATH_MAX];
-    int err = 0;
-    ssize_t res = 0;
-    
-    path = JS_ToCString(ctx, argv[0]);
-    if (!path)
-        return JS_EXCEPTION;
-#ifdef _WIN32
-    HANDLE handle;
-    DWORD flags;
-    flags = FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT;
-    handle = CreateFileA(
-        path,
-        FILE_READ_ATTRIBUTES,
-        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-        NULL,
-        OPEN_EXISTING,
-        flags,
-        NULL
-    );
-    char *buf2;
-    err = fs__readlink_handle(handle, &buf2, (uint64_t*)&res);
-    CloseHandle(handle);
-    strcpy(buf, buf2);
-    free(buf2);
-#else
-    res = readlink(path, buf, sizeof(buf) - 1);
-#endif
-    if (res < 0) {
-        buf[0] = '\0';
-#ifdef _WIN32
-#else
-        err = errno;
-#endif
-    } else {
-        buf[res] = '\0';
-        err = 0;
+    ret_val = JS_NewInt32(ctx, ret);
+ done:
+    JS_FreeCString(ctx, file);
+    JS_FreeCString(ctx, cwd);
+    for(i = 0; i < exec_argc; i++)
+        JS_FreeCString(ctx, exec_argv[i]);
+    js_free(ctx, exec_argv);
+    if (envp != environ) {
+        char **p;
+        p = envp;
+        while (*p != NULL) {
+            js_free(ctx, *p);
+            p++;
+        }
+        js_free(ctx, envp);
     }
-    JS_FreeCString(ctx, path);
-    return make_string_error(ctx, buf, err);
+    return ret_val;
+ exception:
+    ret_val = JS_EXCEPTION;
+    goto done;
 }
 
-/* dup(fd) */
-static JSValue js_os_dup(JSContext *ctx, JSValueConst this_val,
-                         int argc, JSValueConst *argv)
+/* getpid() -> pid */
+static JSValue js_os_getpid(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
 {
-    int fd = 0, ret = 0;
-    
-    if (JS_ToInt32(ctx, &fd, argv[0]))
-        return JS_EXCEPTION;
-    ret = js_get_errno(dup(fd));
-    return JS_NewInt32(ctx, ret);
+    return JS_NewInt32(ctx, getpid());
 }
 
-/* dup2(fd) */
-static JSValue js_os_dup2(JSContext *ctx, JSValueConst this_val,
-                         int argc, JSValueConst *argv)
+/* waitpid(pid, block) -> [pid, status] */
+static JSValue js_os_waitpid(JSContext *ctx, JSValueConst this_val,
+                             int argc, JSValueConst *argv)
 {
-    int fd = 0, fd2 = 0, ret = 0;
-    
-    if (JS_ToInt32(ctx, &fd, argv[0]))
+    int pid = 0, status = 0, options = 0, ret = 0;
+    JSValue obj;
+
+    if (JS_ToInt32(ctx, &pid, argv[0]))
         return JS_EXCEPTION;
-    if (JS_ToInt32(ctx, &fd2, argv[1]))
+    if (JS_ToInt32(ctx, &options, argv[1]))
         return JS_EXCEPTION;
-    ret = js_get_errno(dup2(fd, fd2));
-    return JS_NewInt32(ctx, ret);
-}
 
-/* pipe() -> [read_fd, write_fd] or null if error */
-static JSValue js_os_pipe(JSContext *ctx, JSValueConst this_val,
-                          int argc, JSValueConst *argv)
-{
-    int pipe_fds[2];
-    int ret = 0;
-    JSValue obj;
-#ifdef _WIN32
-    HANDLE hReadPipe;
-    HANDLE hWritePipe;
-    if (CreatePipe(&hReadPipe, &hWritePipe, NULL, 0)) {
-        pipe_fds[0] = _open_osfhandle((intptr_t)hReadPipe, _O_RDONLY);
-        pipe_fds[1] = _open_osfhandle((intptr_t)hWritePipe, _O_WRONLY);
-    } else {
-        ret = GetLastError();
+    ret = waitpid(pid, &status, options);
+    if (ret < 0) {
+        ret = -errno;
+        status = 0;
     }
-#else
-    ret = pipe(pipe_fds);
-#endif
-    if (ret < 0)
-        return JS_NULL;
+
     obj = JS_NewArray(ctx);
     if (JS_IsException(obj))
         return obj;
-    JS_DefinePropertyValueUint32(ctx, obj, 0, JS_NewInt32(ctx, pipe_fds[0]),
+    JS_DefinePropertyValueUint32(ctx, obj, 0, JS_NewInt32(ctx, ret),
                                  JS_PROP_C_W_E);
-    JS_DefinePropertyValueUint32(ctx, obj, 1, JS_NewInt32(ctx, pipe_fds[1]),
+    JS_DefinePropertyValueUint32(ctx, obj, 1, JS_NewInt32(ctx, status),
                                  JS_PROP_C_W_E);
     return obj;
 }
 
-#if !defined(_WIN32)
-static char **build_envp(JSContext *ctx, JSValueConst obj)
-{
-    uint32_t len = 0, i = 0;
-    JSPropertyEnum *tab;
-    char **envp, *pair;
-    const char *key, *str;
-    JSValue val;
-    size_t key_len, str_len;
+#ifdef _WIN32
+static const DWORD NEEDEDACCESS = PROCESS_QUERY_INFORMATION | PROCESS_VM_WRITE | PROCESS_VM_READ | PROCESS_VM_OPERATION | PROCESS_CREATE_THREAD;
 
-    if (JS_GetOwnPropertyNames(ctx, &tab, &len, obj,
-                               JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) < 0)
-        return NULL;
-    envp = js_mallocz(ctx, sizeof(envp[0]) * ((size_t)len + 1));
-    if (!envp)
-        goto fail;
-    for(i = 0; i < len; i++) {
-        val = JS_GetProperty(ctx, obj, tab[i].atom);
-        if (JS_IsException(val))
-            goto fail;
-        str = JS_ToCString(ctx, val);
-        JS_FreeValue(ctx, val);
-        if (!str)
-            goto fail;
-        key = JS_AtomToCString(ctx, tab[i].atom);
-        if (!key) {
-            JS_FreeCString(ctx, str);
-            goto fail;
-        }
-        key_len = strlen(key);
-        str_len = strlen(str);
-        pair = js_malloc(ctx, key_len + str_len + 2);
-        if (!pair) {
-            JS_FreeCString(ctx, key);
-            JS_FreeCString(ctx, str);
-            goto fail;
-        }
-        memcpy(pair, key, key_len);
-        pair[key_len] = '=';
-        memcpy(pair + key_len + 1, str, str_len);
-        pair[key_len + 1 + str_len] = '\0';
-        envp[i] = pair;
-        JS_FreeCString(ctx, key);
-        JS_FreeCString(ctx, str);
+int waitpid(pid_t pid, int *status, int options) {
+    HANDLE hProcess = OpenProcess(NEEDEDACCESS, false, pid);
+    if (!hProcess) {
+        return -1;
     }
- done:
-    for(i = 0; i < len; i++)
-        JS_FreeAtom(ctx, tab[i].atom);
-    js_free(ctx, tab);
-    return envp;
- fail:
-    if (envp) {
-        for(i = 0; i < len; i++)
-            js_free(ctx, envp[i]);
-        js_free(ctx, envp);
-        envp = NULL;
+    int ret = WaitForSingleObject(hProcess, INFINITE);
+    DWORD s;
+    GetExitCodeProcess(hProcess, &s);
+    status = s;
+    return (ret == WAIT_OBJECT_0)? 0 : -ret;
+}
+
+int kill(int pid, int sig) {
+    DWORD sigType = CTRL_CLOSE_EVENT;
+    swich (sig) {
+        case SIGINT:
+            sigType = CTRL_C_EVENT;
+            break;
+        case SIGKILL:
+            sigType = CTRL_CLOSE_EVENT;
+            break;
+        case SIGTERM:
+            sigType = CTRL_BREAK_EVENT;
+            break;
     }
-    goto done;
+    return GenerateConsoleCtrlEvent(sigType, pid) ? 0 : -1;
 }
+#endif
 
-#ifdef _WIN32
+/* kill(pid, sig) */
+static JSValue js_os_kill(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv)
+{
+    int pid = 0, sig = 0, ret = 0;
+    
+    if (JS_ToInt32(ctx, &pid, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &sig, argv[1]))
+        return JS_EXCEPTION;
+    ret = js_get_errno(kill(pid, sig));
+    return JS_NewInt32(ctx, ret);
+}
 
-#endif
+static void js_os_munmap(JSRuntime *rt, void *opaque, void *ptr)
+{
+    uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t base = (uintptr_t)ptr & ~page_mask;
+    /* 'opaque' is the length of the mapping */
+    munmap((void *)base, (size_t)(uintptr_t)opaque);
+}
 
-/* execvpe is not available on non GNU systems */
-static int my_execvpe(const char *filename, char **argv, char **envp)
+/* mmap(fd, offset = 0, length = file size - offset, prot = PROT_READ)
+   -> [ArrayBuffer, errcode]. Without PROT_WRITE, the mapping is
+   private and copy-on-write so that writing to the ArrayBuffer does
+   not fault: the pages are shared with the page cache until they are
+   modified. With PROT_WRITE, the modifications go to the file. The
+   mapping is removed when the ArrayBuffer is freed. */
+static JSValue js_os_mmap(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv)
 {
-    char *path, *p, *p_next, *p1;
-    char buf[PATH_MAX];
-    size_t filename_len, path_len;
-    BOOL eacces_error;
+    int fd = 0, prot = PROT_READ, err = 0;
+    int64_t offset = 0, len = -1;
+    uint64_t delta;
+    size_t map_len;
+    struct stat st;
+    uint8_t *ptr;
+    JSValue obj;
 
-    filename_len = strlen(filename);
-    if (filename_len == 0) {
-        errno = ENOENT;
-        return -1;
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (argc >= 2 && !JS_IsUndefined(argv[1]) &&
+        JS_ToInt64Ext(ctx, &offset, argv[1]))
+        return JS_EXCEPTION;
+    if (argc >= 3 && !JS_IsUndefined(argv[2]) &&
+        JS_ToInt64Ext(ctx, &len, argv[2]))
+        return JS_EXCEPTION;
+    if (argc >= 4 && !JS_IsUndefined(argv[3]) &&
+        JS_ToInt32(ctx, &prot, argv[3]))
+        return JS_EXCEPTION;
+    if (offset < 0)
+        return JS_ThrowRangeError(ctx, "invalid offset");
+    if (fstat(fd, &st) < 0) {
+        err = errno;
+        goto fail;
     }
-    if (strchr(filename, '/'))
-        return execve(filename, argv, envp);
-
-    path = getenv("PATH");
-    if (!path) {
-#ifdef _WIN32
-        path = (char *)"C:\\WINDOWS\\system32";
-#else
-        path = (char *)"/bin:/usr/bin";
-#endif
+    if (len < 0) {
+        len = max_int64(st.st_size - offset, 0);
+    } else if (len > st.st_size - offset) {
+        /* accessing the pages past the end of file raises SIGBUS */
+        err = EINVAL;
+        goto fail;
     }
-    eacces_error = FALSE;
-    p = path;
-    for(p = path; p != NULL; p = p_next) {
-        p1 = strchr(p, ':');
-        if (!p1) {
-            p_next = NULL;
-            path_len = strlen(p);
-        } else {
-            p_next = p1 + 1;
-            path_len = p1 - p;
-        }
-        /* path too long */
-        if ((path_len + 1 + filename_len + 1) > PATH_MAX)
-            continue;
-        memcpy(buf, p, path_len);
-        buf[path_len] = '/';
-        memcpy(buf + path_len + 1, filename, filename_len);
-        buf[path_len + 1 + filename_len] = '\0';
+    if (len > INT32_MAX)
+        return JS_ThrowRangeError(ctx, "invalid array buffer length");
+    if (len == 0)
+        return make_obj_error(ctx, JS_NewArrayBufferCopy(ctx, NULL, 0), 0);
+
+    /* the offset of a mapping must be a multiple of the page size */
+    delta = offset & (sysconf(_SC_PAGESIZE) - 1);
+    map_len = len + delta;
+    if (prot & PROT_WRITE)
+        ptr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, offset - delta);
+    else
+        ptr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   fd, offset - delta);
+    if (ptr == MAP_FAILED) {
+        err = errno;
+        goto fail;
+    }
+    obj = JS_NewArrayBuffer(ctx, ptr + delta, len, js_os_munmap,
+                            (void *)(uintptr_t)map_len, FALSE);
+    if (JS_IsException(obj))
+        munmap(ptr, map_len);
+    return make_obj_error(ctx, obj, 0);
+ fail:
+    return make_obj_error(ctx, JS_NULL, err);
+}
 
-        execve(buf, argv, envp);
+/* sockets: all descriptors are created non-blocking and close-on-exec
+   so that they can be driven by os.setReadHandler() and
+   os.setWriteHandler(). Addresses are objects: { addr, port } for
+   AF_INET/AF_INET6 and { path } for AF_UNIX. */
 
-        switch(errno) {
-        case EACCES:
-            eacces_error = TRUE;
-            break;
-        case ENOENT:
-        case ENOTDIR:
-            break;
-        default:
+static int js_os_get_sockaddr(JSContext *ctx, struct sockaddr_storage *ss,
+                              socklen_t *plen, JSValueConst obj)
+{
+    JSValue val;
+    const char *str;
+    uint32_t port = 0;
+    size_t len;
+    int ret;
+
+    if (!JS_IsObject(obj)) {
+        JS_ThrowTypeError(ctx, "socket address must be an object");
+        return -1;
+    }
+    memset(ss, 0, sizeof(*ss));
+    val = JS_GetPropertyStr(ctx, obj, "path");
+    if (JS_IsException(val))
+        return -1;
+    if (!JS_IsUndefined(val)) {
+        struct sockaddr_un *sun = (struct sockaddr_un *)ss;
+        str = JS_ToCStringLen(ctx, &len, val);
+        JS_FreeValue(ctx, val);
+        if (!str)
+            return -1;
+        if (len >= sizeof(sun->sun_path)) {
+            JS_FreeCString(ctx, str);
+            JS_ThrowRangeError(ctx, "socket path too long");
             return -1;
         }
+        sun->sun_family = AF_UNIX;
+        memcpy(sun->sun_path, str, len + 1);
+        JS_FreeCString(ctx, str);
+        *plen = offsetof(struct sockaddr_un, sun_path) + len + 1;
+        return 0;
     }
-    if (eacces_error)
-        errno = EACCES;
-    return -1;
-}
-
-/* exec(args[, options]) -> exitcode */
-static JSValue js_os_exec(JSContext *ctx, JSValueConst this_val,
-                          int argc, JSValueConst *argv)
-{
-    JSValueConst options, args = argv[0];
-    JSValue val, ret_val;
-    const char **exec_argv, *file = NULL, *str, *cwd = NULL;
-    char **envp = environ;
-    uint32_t exec_argc = 0, i = 0;
-    int ret = 0, pid = 0, status = 0;
-    BOOL block_flag = TRUE, use_path = TRUE;
-    static const char *std_name[3] = { "stdin", "stdout", "stderr" };
-    int std_fds[3];
-    uint32_t uid = -1, gid = -1;
 
-    val = JS_GetPropertyStr(ctx, args, "length");
+    val = JS_GetPropertyStr(ctx, obj, "port");
     if (JS_IsException(val))
-        return JS_EXCEPTION;
-    ret = JS_ToUint32(ctx, &exec_argc, val);
+        return -1;
+    ret = JS_ToUint32(ctx, &port, val);
     JS_FreeValue(ctx, val);
     if (ret)
-        return JS_EXCEPTION;
-    /* arbitrary limit to avoid overflow */
-    if (exec_argc < 1 || exec_argc > 65535) {
-        return JS_ThrowTypeError(ctx, "invalid number of arguments");
+        return -1;
+    if (port > 0xffff) {
+        JS_ThrowRangeError(ctx, "invalid port");
+        return -1;
     }
-    exec_argv = js_mallocz(ctx, sizeof(exec_argv[0]) * (exec_argc + 1));
-    if (!exec_argv)
-        return JS_EXCEPTION;
-    for(i = 0; i < exec_argc; i++) {
-        val = JS_GetPropertyUint32(ctx, args, i);
-        if (JS_IsException(val))
-            goto exception;
+    val = JS_GetPropertyStr(ctx, obj, "addr");
+    if (JS_IsException(val))
+        return -1;
+    if (JS_IsUndefined(val)) {
+        str = NULL;
+    } else {
         str = JS_ToCString(ctx, val);
         JS_FreeValue(ctx, val);
         if (!str)
-            goto exception;
-        exec_argv[i] = str;
+            return -1;
     }
-    exec_argv[exec_argc] = NULL;
+    /* may block on a DNS lookup if 'addr' is not numeric */
+    ret = socket_addr_from(ss, plen, str ? str : "0.0.0.0", port);
+    if (ret)
+        JS_ThrowTypeError(ctx, "invalid socket address '%s': %s",
+                          str ? str : "0.0.0.0", gai_strerror(ret));
+    JS_FreeCString(ctx, str);
+    return ret ? -1 : 0;
+}
 
-    for(i = 0; i < 3; i++)
-        std_fds[i] = i;
+static JSValue js_os_new_sockaddr(JSContext *ctx, const struct sockaddr *sa,
+                                  socklen_t len)
+{
+    JSValue obj;
+    char ip[SOCKET_ADDRLEN];
+    u_short port;
 
-    /* get the options, if any */
-    if (argc >= 2) {
-        options = argv[1];
+    obj = JS_NewObject(ctx);
+    if (JS_IsException(obj))
+        return obj;
+    JS_DefinePropertyValueStr(ctx, obj, "family",
+                              JS_NewInt32(ctx, sa->sa_family),
+                              JS_PROP_C_W_E);
+    if (sa->sa_family == AF_UNIX) {
+        const struct sockaddr_un *sun = (const struct sockaddr_un *)sa;
+        size_t path_len = 0;
+        /* unnamed sockets have an empty path */
+        if (len > offsetof(struct sockaddr_un, sun_path))
+            path_len = strnlen(sun->sun_path,
+                               len - offsetof(struct sockaddr_un, sun_path));
+        JS_DefinePropertyValueStr(ctx, obj, "path",
+                                  JS_NewStringLen(ctx, sun->sun_path, path_len),
+                                  JS_PROP_C_W_E);
+    } else if (socket_addr_to(sa, len, ip, &port) == 0) {
+        JS_DefinePropertyValueStr(ctx, obj, "addr", JS_NewString(ctx, ip),
+                                  JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "port", JS_NewInt32(ctx, port),
+                                  JS_PROP_C_W_E);
+    }
+    return obj;
+}
 
-        if (get_bool_option(ctx, &block_flag, options, "block"))
-            goto exception;
-        if (get_bool_option(ctx, &use_path, options, "usePath"))
-            goto exception;
+#if !defined(__linux__)
+static int js_os_set_nonblock_cloexec(int fd)
+{
+    if (socket_setnonblock(fd, 1) < 0 ||
+        fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+#endif
 
-        val = JS_GetPropertyStr(ctx, options, "file");
-        if (JS_IsException(val))
-            goto exception;
-        if (!JS_IsUndefined(val)) {
-            file = JS_ToCString(ctx, val);
-            JS_FreeValue(ctx, val);
-            if (!file)
-                goto exception;
-        }
+/* socket(domain, type = SOCK_STREAM) -> fd or -errno */
+static JSValue js_os_socket(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    int domain = 0, type = SOCK_STREAM, fd;
 
-        val = JS_GetPropertyStr(ctx, options, "cwd");
-        if (JS_IsException(val))
-            goto exception;
-        if (!JS_IsUndefined(val)) {
-            cwd = JS_ToCString(ctx, val);
-            JS_FreeValue(ctx, val);
-            if (!cwd)
-                goto exception;
-        }
+    if (JS_ToInt32(ctx, &domain, argv[0]))
+        return JS_EXCEPTION;
+    if (argc >= 2 && !JS_IsUndefined(argv[1]) &&
+        JS_ToInt32(ctx, &type, argv[1]))
+        return JS_EXCEPTION;
+#if defined(__linux__)
+    fd = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+#else
+    fd = socket(domain, type, 0);
+    if (fd >= 0)
+        fd = js_os_set_nonblock_cloexec(fd);
+#endif
+    return JS_NewInt32(ctx, js_get_errno(fd));
+}
 
-        /* stdin/stdout/stderr handles */
-        for(i = 0; i < 3; i++) {
-            val = JS_GetPropertyStr(ctx, options, std_name[i]);
-            if (JS_IsException(val))
-                goto exception;
-            if (!JS_IsUndefined(val)) {
-                int fd = 0;
-                ret = JS_ToInt32(ctx, &fd, val);
-                JS_FreeValue(ctx, val);
-                if (ret)
-                    goto exception;
-                std_fds[i] = fd;
-            }
-        }
+/* bind(fd, addr) / connect(fd, addr) -> 0 or -errno. A non-blocking
+   connect() usually returns -EINPROGRESS: wait for the descriptor to
+   become writable and check the SO_ERROR option. */
+static JSValue js_os_bind_connect(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv, int is_connect)
+{
+    struct sockaddr_storage ss;
+    socklen_t len = 0;
+    int fd = 0, ret;
 
-        val = JS_GetPropertyStr(ctx, options, "env");
-        if (JS_IsException(val))
-            goto exception;
-        if (!JS_IsUndefined(val)) {
-            envp = build_envp(ctx, val);
-            JS_FreeValue(ctx, val);
-            if (!envp)
-                goto exception;
-        }
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (js_os_get_sockaddr(ctx, &ss, &len, argv[1]))
+        return JS_EXCEPTION;
+    if (is_connect)
+        ret = socket_connect(fd, (struct sockaddr *)&ss, len);
+    else
+        ret = socket_bind(fd, (struct sockaddr *)&ss, len);
+    return JS_NewInt32(ctx, js_get_errno(ret));
+}
 
-        val = JS_GetPropertyStr(ctx, options, "uid");
-        if (JS_IsException(val))
-            goto exception;
-        if (!JS_IsUndefined(val)) {
-            ret = JS_ToUint32(ctx, &uid, val);
-            JS_FreeValue(ctx, val);
-            if (ret)
-                goto exception;
-        }
+/* listen(fd, backlog = SOMAXCONN) -> 0 or -errno */
+static JSValue js_os_listen(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    int fd = 0, backlog = SOMAXCONN;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (argc >= 2 && !JS_IsUndefined(argv[1]) &&
+        JS_ToInt32(ctx, &backlog, argv[1]))
+        return JS_EXCEPTION;
+    return JS_NewInt32(ctx, js_get_errno(socket_listen(fd, backlog)));
+}
+
+/* accept(fd) -> new fd or -errno (-EAGAIN if no pending connection) */
+static JSValue js_os_accept(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    int fd = 0, ret;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+#if defined(__linux__)
+    ret = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    ret = accept(fd, NULL, NULL);
+    if (ret >= 0)
+        ret = js_os_set_nonblock_cloexec(ret);
+#endif
+    return JS_NewInt32(ctx, js_get_errno(ret));
+}
 
-        val = JS_GetPropertyStr(ctx, options, "gid");
-        if (JS_IsException(val))
-            goto exception;
-        if (!JS_IsUndefined(val)) {
-            ret = JS_ToUint32(ctx, &gid, val);
-            JS_FreeValue(ctx, val);
-            if (ret)
-                goto exception;
-        }
-    }
+/* shutdown(fd, how) -> 0 or -errno */
+static JSValue js_os_shutdown(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv)
+{
+    int fd = 0, how = 0;
 
-    pid = fork();
-    if (pid < 0) {
-        JS_ThrowTypeError(ctx, "fork error");
-        goto exception;
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &how, argv[1]))
+        return JS_EXCEPTION;
+    return JS_NewInt32(ctx, js_get_errno(socket_shutdown(fd, how)));
+}
+
+/* 'argv' points to the (buffer, offset, length) arguments */
+static uint8_t *js_os_get_socket_buf(JSContext *ctx, JSValueConst *argv,
+                                     size_t *plen)
+{
+    uint64_t pos = 0, len = 0;
+    size_t size = 0;
+    uint8_t *buf;
+
+    if (JS_ToIndex(ctx, &pos, argv[1]))
+        return NULL;
+    if (JS_ToIndex(ctx, &len, argv[2]))
+        return NULL;
+    buf = JS_GetArrayBuffer(ctx, &size, argv[0]);
+    if (!buf)
+        return NULL;
+    if (pos + len > size) {
+        JS_ThrowRangeError(ctx, "read/write array buffer overflow");
+        return NULL;
     }
-    if (pid == 0) {
-        /* child */
-        int fd_max = sysconf(_SC_OPEN_MAX);
+    *plen = len;
+    return buf + pos;
+}
 
-        /* remap the stdin/stdout/stderr handles if necessary */
-        for(i = 0; i < 3; i++) {
-            if (std_fds[i] != i) {
-                if (dup2(std_fds[i], i) < 0)
-                    _exit(127);
-            }
-        }
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
-        for(i = 3; i < fd_max; i++)
-            close(i);
-        if (cwd) {
-            if (chdir(cwd) < 0)
-                _exit(127);
-        }
-        if (uid != -1) {
-            if (setuid(uid) < 0)
-                _exit(127);
-        }
-        if (gid != -1) {
-            if (setgid(gid) < 0)
-                _exit(127);
-        }
+/* send(fd, buffer, offset, length) / recv(fd, buffer, offset, length)
+   -> bytes transferred or -errno. The data goes directly to or from the
+   ArrayBuffer. */
+static JSValue js_os_send_recv(JSContext *ctx, JSValueConst this_val,
+                               int argc, JSValueConst *argv, int is_send)
+{
+    int fd = 0;
+    size_t len = 0;
+    ssize_t ret;
+    uint8_t *buf;
 
-        if (!file)
-            file = exec_argv[0];
-        if (use_path)
-            ret = my_execvpe(file, (char **)exec_argv, envp);
-        else
-            ret = execve(file, (char **)exec_argv, envp);
-        _exit(127);
-    }
-    /* parent */
-    if (block_flag) {
-        for(;;) {
-            ret = waitpid(pid, &status, 0);
-            if (ret == pid) {
-                if (WIFEXITED(status)) {
-                    ret = WEXITSTATUS(status);
-                    break;
-                } else if (WIFSIGNALED(status)) {
-                    ret = -WTERMSIG(status);
-                    break;
-                }
-            }
-        }
-    } else {
-        ret = pid;
-    }
-    ret_val = JS_NewInt32(ctx, ret);
- done:
-    JS_FreeCString(ctx, file);
-    JS_FreeCString(ctx, cwd);
-    for(i = 0; i < exec_argc; i++)
-        JS_FreeCString(ctx, exec_argv[i]);
-    js_free(ctx, exec_argv);
-    if (envp != environ) {
-        char **p;
-        p = envp;
-        while (*p != NULL) {
-            js_free(ctx, *p);
-            p++;
-        }
-        js_free(ctx, envp);
-    }
-    return ret_val;
- exception:
-    ret_val = JS_EXCEPTION;
-    goto done;
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    buf = js_os_get_socket_buf(ctx, argv + 1, &len);
+    if (!buf)
+        return JS_EXCEPTION;
+    if (is_send)
+        ret = send(fd, buf, len, MSG_NOSIGNAL);
+    else
+        ret = recv(fd, buf, len, 0);
+    return JS_NewInt64(ctx, js_get_errno(ret));
 }
 
-/* getpid() -> pid */
-static JSValue js_os_getpid(JSContext *ctx, JSValueConst this_val,
+/* sendto(fd, buffer, offset, length, addr) -> bytes sent or -errno */
+static JSValue js_os_sendto(JSContext *ctx, JSValueConst this_val,
                             int argc, JSValueConst *argv)
 {
-    return JS_NewInt32(ctx, getpid());
+    struct sockaddr_storage ss;
+    socklen_t addr_len = 0;
+    int fd = 0;
+    size_t len = 0;
+    uint8_t *buf;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    /* convert the address first: it may run user code which could
+       detach the buffer */
+    if (js_os_get_sockaddr(ctx, &ss, &addr_len, argv[4]))
+        return JS_EXCEPTION;
+    buf = js_os_get_socket_buf(ctx, argv + 1, &len);
+    if (!buf)
+        return JS_EXCEPTION;
+    return JS_NewInt64(ctx, js_get_errno(sendto(fd, buf, len, MSG_NOSIGNAL,
+                                                (struct sockaddr *)&ss,
+                                                addr_len)));
 }
 
-/* waitpid(pid, block) -> [pid, status] */
-static JSValue js_os_waitpid(JSContext *ctx, JSValueConst this_val,
-                             int argc, JSValueConst *argv)
+/* recvfrom(fd, buffer, offset, length) -> [addr, bytes received or -errno]
+   (value first like getsockname() and stat()) */
+static JSValue js_os_recvfrom(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv)
 {
-    int pid = 0, status = 0, options = 0, ret = 0;
-    JSValue obj;
+    struct sockaddr_storage ss;
+    socklen_t addr_len = sizeof(ss);
+    int fd = 0;
+    size_t len = 0;
+    ssize_t ret;
+    uint8_t *buf;
+    JSValue obj, addr;
 
-    if (JS_ToInt32(ctx, &pid, argv[0]))
+    if (JS_ToInt32(ctx, &fd, argv[0]))
         return JS_EXCEPTION;
-    if (JS_ToInt32(ctx, &options, argv[1]))
+    buf = js_os_get_socket_buf(ctx, argv + 1, &len);
+    if (!buf)
         return JS_EXCEPTION;
-
-    ret = waitpid(pid, &status, options);
+    ret = js_get_errno(recvfrom(fd, buf, len, 0, (struct sockaddr *)&ss,
+                                &addr_len));
     if (ret < 0) {
-        ret = -errno;
-        status = 0;
+        addr = JS_NULL;
+    } else {
+        addr = js_os_new_sockaddr(ctx, (struct sockaddr *)&ss, addr_len);
+        if (JS_IsException(addr))
+            return addr;
     }
-
     obj = JS_NewArray(ctx);
-    if (JS_IsException(obj))
+    if (JS_IsException(obj)) {
+        JS_FreeValue(ctx, addr);
         return obj;
-    JS_DefinePropertyValueUint32(ctx, obj, 0, JS_NewInt32(ctx, ret),
-                                 JS_PROP_C_W_E);
-    JS_DefinePropertyValueUint32(ctx, obj, 1, JS_NewInt32(ctx, status),
+    }
+    JS_DefinePropertyValueUint32(ctx, obj, 0, addr, JS_PROP_C_W_E);
+    JS_DefinePropertyValueUint32(ctx, obj, 1, JS_NewInt64(ctx, ret),
                                  JS_PROP_C_W_E);
     return obj;
 }
 
-#ifdef _WIN32
-static const DWORD NEEDEDACCESS = PROCESS_QUERY_INFORMATION | PROCESS_VM_WRITE | PROCESS_VM_READ | PROCESS_VM_OPERATION | PROCESS_CREATE_THREAD;
+/* getsockname(fd) / getpeername(fd) -> [addr, errcode] */
+static JSValue js_os_getsockname(JSContext *ctx, JSValueConst this_val,
+                                 int argc, JSValueConst *argv, int is_peer)
+{
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    int fd = 0, res, err = 0;
+    JSValue addr;
 
-int waitpid(pid_t pid, int *status, int options) {
-    HANDLE hProcess = OpenProcess(NEEDEDACCESS, false, pid);
-    if (!hProcess) {
-        return -1;
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (is_peer)
+        res = getpeername(fd, (struct sockaddr *)&ss, &len);
+    else
+        res = getsockname(fd, (struct sockaddr *)&ss, &len);
+    if (res < 0) {
+        err = errno;
+        addr = JS_NULL;
+    } else {
+        addr = js_os_new_sockaddr(ctx, (struct sockaddr *)&ss, len);
+        if (JS_IsException(addr))
+            return addr;
     }
-    int ret = WaitForSingleObject(hProcess, INFINITE);
-    DWORD s;
-    GetExitCodeProcess(hProcess, &s);
-    status = s;
-    return (ret == WAIT_OBJECT_0)? 0 : -ret;
+    return make_obj_error(ctx, addr, err);
 }
 
-int kill(int pid, int sig) {
-    DWORD sigType = CTRL_CLOSE_EVENT;
-    swich (sig) {
-        case SIGINT:
-            sigType = CTRL_C_EVENT;
-            break;
-        case SIGKILL:
-            sigType = CTRL_CLOSE_EVENT;
-            break;
-        case SIGTERM:
-            sigType = CTRL_BREAK_EVENT;
-            break;
-    }
-    return GenerateConsoleCtrlEvent(sigType, pid) ? 0 : -1;
+/* setsockopt(fd, level, name, value) -> 0 or -errno */
+static JSValue js_os_setsockopt(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv)
+{
+    int fd = 0, level = 0, name = 0, val = 0;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &level, argv[1]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &name, argv[2]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &val, argv[3]))
+        return JS_EXCEPTION;
+    return JS_NewInt32(ctx, js_get_errno(setsockopt(fd, level, name, &val,
+                                                    sizeof(val))));
 }
-#endif
 
-/* kill(pid, sig) */
-static JSValue js_os_kill(JSContext *ctx, JSValueConst this_val,
-                          int argc, JSValueConst *argv)
+/* getsockopt(fd, level, name) -> [value, errcode] */
+static JSValue js_os_getsockopt(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv)
 {
-    int pid = 0, sig = 0, ret = 0;
-    
-    if (JS_ToInt32(ctx, &pid, argv[0]))
+    int fd = 0, level = 0, name = 0, val = 0, err = 0;
+    socklen_t len = sizeof(val);
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
         return JS_EXCEPTION;
-    if (JS_ToInt32(ctx, &sig, argv[1]))
+    if (JS_ToInt32(ctx, &level, argv[1]))
         return JS_EXCEPTION;
-    ret = js_get_errno(kill(pid, sig));
-    return JS_NewInt32(ctx, ret);
+    if (JS_ToInt32(ctx, &name, argv[2]))
+        return JS_EXCEPTION;
+    if (getsockopt(fd, level, name, &val, &len) < 0)
+        err = errno;
+    return make_obj_error(ctx, JS_NewInt32(ctx, val), err);
 }
 
 #endif /* !_WIN32 */
@@ -3747,18 +6155,29 @@ static JSWorkerMessagePipe *js_new_message_pipe(void)
 {
     JSWorkerMessagePipe *ps;
     int pipe_fds[2];
+#ifdef USE_EVENTFD
+    pipe_fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (pipe_fds[0] < 0)
+        return NULL;
+    pipe_fds[1] = pipe_fds[0];
+#else
     if (pipe(pipe_fds) < 0)
         return NULL;
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+#endif
 
     ps = malloc(sizeof(*ps));
     if (!ps) {
         close(pipe_fds[0]);
-        close(pipe_fds[1]);
+        if (pipe_fds[1] != pipe_fds[0])
+            close(pipe_fds[1]);
         return NULL;
     }
     ps->ref_count = 1;
-    init_list_head(&ps->msg_queue);
-    pthread_mutex_init(&ps->mutex, NULL);
+    ps->stub.next = NULL;
+    ps->head = &ps->stub;
+    ps->tail = &ps->stub;
+    ps->signaled = 0;
     ps->read_fd = pipe_fds[0];
     ps->write_fd = pipe_fds[1];
     return ps;
@@ -3784,7 +6203,6 @@ static void js_free_message(JSWorkerMessage *msg)
 
 static void js_free_message_pipe(JSWorkerMessagePipe *ps)
 {
-    struct list_head *el, *el1;
     JSWorkerMessage *msg;
     int ref_count;
 
@@ -3794,23 +6212,45 @@ static void js_free_message_pipe(JSWorkerMessagePipe *ps)
     ref_count = atomic_add_int(&ps->ref_count, -1);
     assert(ref_count >= 0);
     if (ref_count == 0) {
-        list_for_each_safe(el, el1, &ps->msg_queue) {
-            msg = list_entry(el, JSWorkerMessage, link);
+        while ((msg = js_message_pipe_pop(ps)) != NULL)
             js_free_message(msg);
-        }
-        pthread_mutex_destroy(&ps->mutex);
         close(ps->read_fd);
-        close(ps->write_fd);
+        if (ps->write_fd != ps->read_fd)
+            close(ps->write_fd);
         free(ps);
     }
 }
 
+/* register the pipe of a new port in the poll set, or unregister it
+   after the last port using it is removed */
+static void port_update_poll(JSRuntime *rt, JSWorkerMessagePipe *ps,
+                             BOOL add)
+{
+#ifdef USE_EPOLL
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    struct list_head *el;
+
+    if (!ts)
+        return;
+    list_for_each(el, &ts->port_list) {
+        JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
+        if (port->recv_pipe == ps)
+            return;
+    }
+    if (add)
+        os_epoll_update(ts, ps->read_fd, 0, EPOLLIN);
+    else
+        os_epoll_update(ts, ps->read_fd, EPOLLIN, 0);
+#endif
+}
+
 static void js_free_port(JSRuntime *rt, JSWorkerMessageHandler *port)
 {
     if (port) {
+        list_del(&port->link);
+        port_update_poll(rt, port->recv_pipe, FALSE);
         js_free_message_pipe(port->recv_pipe);
         JS_FreeValueRT(rt, port->on_message_func);
-        list_del(&port->link);
         js_free_rt(rt, port);
     }
 }
@@ -4003,15 +6443,48 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
     uint8_t *data;
     JSWorkerMessage *msg;
     uint8_t **sab_tab;
+    JSValue *transfer_list;
+    uint32_t transfer_len;
 
     if (!worker)
         return JS_EXCEPTION;
 
-    data = JS_WriteObject2(ctx, &data_len, argv[0],
+    transfer_list = NULL;
+    transfer_len = 0;
+    if (argc > 1 && !JS_IsUndefined(argv[1])) {
+        JSValue val;
+        val = JS_GetPropertyStr(ctx, argv[1], "length");
+        if (JS_IsException(val))
+            return JS_EXCEPTION;
+        if (JS_ToUint32(ctx, &transfer_len, val)) {
+            JS_FreeValue(ctx, val);
+            return JS_EXCEPTION;
+        }
+        JS_FreeValue(ctx, val);
+        transfer_list = js_mallocz(ctx, sizeof(transfer_list[0]) *
+                                   max_int(transfer_len, 1));
+        if (!transfer_list)
+            return JS_EXCEPTION;
+        for(i = 0; i < transfer_len; i++) {
+            transfer_list[i] = JS_GetPropertyUint32(ctx, argv[1], i);
+            if (JS_IsException(transfer_list[i])) {
+                transfer_len = i;
+                data = NULL;
+                sab_tab = NULL;
+                msg = NULL;
+                goto fail;
+            }
+        }
+    }
+
+    data = JS_WriteObject3(ctx, &data_len, argv[0],
                            JS_WRITE_OBJ_SAB | JS_WRITE_OBJ_REFERENCE,
-                           &sab_tab, &sab_tab_len);
-    if (!data)
-        return JS_EXCEPTION;
+                           &sab_tab, &sab_tab_len,
+                           (JSValueConst *)transfer_list, transfer_len);
+    if (!data) {
+        msg = NULL;
+        goto fail;
+    }
 
     msg = malloc(sizeof(*msg));
     if (!msg)
@@ -4042,22 +6515,17 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
         js_sab_dup(NULL, msg->sab_tab[i]);
     }
 
+    /* the message now holds a reference to the transferred data */
+    for(i = 0; i < transfer_len; i++) {
+        JS_DetachArrayBuffer(ctx, transfer_list[i]);
+        JS_FreeValue(ctx, transfer_list[i]);
+    }
+    js_free(ctx, transfer_list);
+
     ps = worker->send_pipe;
-    pthread_mutex_lock(&ps->mutex);
+    js_message_pipe_push(ps, msg);
     /* indicate that data is present */
-    if (list_empty(&ps->msg_queue)) {
-        uint8_t ch = '\0';
-        int ret = 0;
-        for(;;) {
-            ret = write(ps->write_fd, &ch, 1);
-            if (ret == 1)
-                break;
-            if (ret < 0 && (errno != EAGAIN || errno != EINTR))
-                break;
-        }
-    }
-    list_add_tail(&msg->link, &ps->msg_queue);
-    pthread_mutex_unlock(&ps->mutex);
+    js_message_pipe_signal(ps);
     return JS_UNDEFINED;
  fail:
     if (msg) {
@@ -4067,6 +6535,9 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
     }
     js_free(ctx, data);
     js_free(ctx, sab_tab);
+    for(i = 0; i < transfer_len; i++)
+        JS_FreeValue(ctx, transfer_list[i]);
+    js_free(ctx, transfer_list);
     return JS_EXCEPTION;
 
 }
@@ -4097,6 +6568,7 @@ static JSValue js_worker_set_onmessage(JSContext *ctx, JSValueConst this_val,
                 return JS_EXCEPTION;
             port->recv_pipe = js_dup_message_pipe(worker->recv_pipe);
             port->on_message_func = JS_NULL;
+            port_update_poll(rt, port->recv_pipe, TRUE);
             list_add_tail(&port->link, &ts->port_list);
             worker->msg_handler = port;
         }
@@ -4121,7 +6593,7 @@ static JSValue js_worker_get_onmessage(JSContext *ctx, JSValueConst this_val)
 }
 
 static const JSCFunctionListEntry js_worker_proto_funcs[] = {
-    JS_CFUNC_DEF("postMessage", 1, js_worker_postMessage ),
+    JS_CFUNC_DEF("postMessage", 2, js_worker_postMessage ),
     JS_CGETSET_DEF("onmessage", js_worker_get_onmessage, js_worker_set_onmessage ),
 };
 
@@ -4218,6 +6690,44 @@ static const JSCFunctionListEntry js_os_funcs[] = {
     OS_FLAG(WNOHANG),
     JS_CFUNC_DEF("pipe", 0, js_os_pipe ),
     JS_CFUNC_DEF("kill", 2, js_os_kill ),
+    JS_CFUNC_DEF("mmap", 4, js_os_mmap ),
+    OS_FLAG(PROT_READ),
+    OS_FLAG(PROT_WRITE),
+    JS_CFUNC_MAGIC_DEF("readAsync", 5, js_os_io_async, 0 ),
+    JS_CFUNC_MAGIC_DEF("writeAsync", 5, js_os_io_async, 1 ),
+    JS_CFUNC_DEF("socket", 2, js_os_socket ),
+    JS_CFUNC_MAGIC_DEF("bind", 2, js_os_bind_connect, 0 ),
+    JS_CFUNC_MAGIC_DEF("connect", 2, js_os_bind_connect, 1 ),
+    JS_CFUNC_DEF("listen", 2, js_os_listen ),
+    JS_CFUNC_DEF("accept", 1, js_os_accept ),
+    JS_CFUNC_DEF("shutdown", 2, js_os_shutdown ),
+    JS_CFUNC_MAGIC_DEF("send", 4, js_os_send_recv, 1 ),
+    JS_CFUNC_MAGIC_DEF("recv", 4, js_os_send_recv, 0 ),
+    JS_CFUNC_DEF("sendto", 5, js_os_sendto ),
+    JS_CFUNC_DEF("recvfrom", 4, js_os_recvfrom ),
+    JS_CFUNC_MAGIC_DEF("getsockname", 1, js_os_getsockname, 0 ),
+    JS_CFUNC_MAGIC_DEF("getpeername", 1, js_os_getsockname, 1 ),
+    JS_CFUNC_DEF("setsockopt", 4, js_os_setsockopt ),
+    JS_CFUNC_DEF("getsockopt", 3, js_os_getsockopt ),
+    OS_FLAG(AF_INET),
+    OS_FLAG(AF_INET6),
+    OS_FLAG(AF_UNIX),
+    OS_FLAG(SOCK_STREAM),
+    OS_FLAG(SOCK_DGRAM),
+    OS_FLAG(SHUT_RD),
+    OS_FLAG(SHUT_WR),
+    OS_FLAG(SHUT_RDWR),
+    OS_FLAG(SOL_SOCKET),
+    OS_FLAG(SO_REUSEADDR),
+#if defined(SO_REUSEPORT)
+    OS_FLAG(SO_REUSEPORT),
+#endif
+    OS_FLAG(SO_KEEPALIVE),
+    OS_FLAG(SO_SNDBUF),
+    OS_FLAG(SO_RCVBUF),
+    OS_FLAG(SO_ERROR),
+    OS_FLAG(IPPROTO_TCP),
+    OS_FLAG(TCP_NODELAY),
 #endif
 };
 
@@ -4334,9 +6844,14 @@ void js_std_init_handlers(JSRuntime *rt)
     memset(ts, 0, sizeof(*ts));
     init_list_head(&ts->os_rw_handlers);
     init_list_head(&ts->os_signal_handlers);
-    init_list_head(&ts->os_timers);
     init_list_head(&ts->port_list);
+    init_list_head(&ts->os_io_requests);
     ts->next_timer_id = 1;
+#ifdef USE_EPOLL
+    /* select() is used if epoll is not available */
+    ts->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    init_list_head(&ts->os_ready_handlers);
+#endif
 
     JS_SetRuntimeOpaque(rt, ts);
 
@@ -4363,15 +6878,30 @@ void js_std_free_handlers(JSRuntime *rt)
         free_rw_handler(rt, rh);
     }
 
+    list_for_each_safe(el, el1, &ts->os_io_requests) {
+        JSOSIORequest *req = list_entry(el, JSOSIORequest, link);
+        list_del(&req->link);
+        js_os_io_free(rt, req);
+    }
+#ifdef USE_IO_URING
+    if (ts->ring)
+        os_ring_close(rt, ts->ring);
+#endif
+
     list_for_each_safe(el, el1, &ts->os_signal_handlers) {
         JSOSSignalHandler *sh = list_entry(el, JSOSSignalHandler, link);
         free_sh(rt, sh);
     }
 
-    list_for_each_safe(el, el1, &ts->os_timers) {
-        JSOSTimer *th = list_entry(el, JSOSTimer, link);
-        free_timer(rt, th);
-    }
+    while (ts->timer_count > 0)
+        free_timer(rt, ts->timer_heap[0]);
+    js_free_rt(rt, ts->timer_heap);
+    js_free_rt(rt, ts->timer_hash);
+    js_free_rt(rt, ts->rh_tab);
+#ifdef USE_EPOLL
+    if (ts->epoll_fd >= 0)
+        close(ts->epoll_fd);
+#endif
 
 #ifdef USE_WORKER
     /* XXX: free port_list ? */
@@ -53,6 +53,7 @@ FMT(atom_u16)
 FMT(atom_label_u8)
 FMT(atom_label_u16)
 FMT(label_u16)
+FMT(ic)
 #undef FMT
 #endif /* FMT */
 
@@ -367,6 +368,21 @@ DEF(typeof_is_undefined, 1, 1, 1, none)
 DEF( typeof_is_function, 1, 1, 1, none)
 #endif
 
+/* field accesses with an inline cache. They replace get_field,
+   get_field2 and put_field in the final bytecode (must be in the same
+   order) */
+DEF(   get_field_ic, 5, 1, 1, ic)
+DEF(  get_field2_ic, 5, 1, 2, ic)
+DEF(   put_field_ic, 5, 2, 0, ic)
+/* global variable accesses with an inline cache. They replace get_var
+   and put_var in the final bytecode */
+DEF(     get_var_ic, 5, 0, 1, ic)
+DEF(     put_var_ic, 5, 1, 0, ic)
+/* superinstructions emitted by resolve_labels() for the most frequent
+   opcode pairs of the loops (see DUMP_OPCODE_PAIRS) */
+DEF(    lt_if_false, 5, 2, 0, label) /* lt if_false */
+DEF(   inc_loc_goto, 7, 0, 0, label_u16) /* inc_loc goto */
+
 #undef DEF
 #undef def
 #endif  /* DEF */
@@ -45,6 +45,10 @@
 #include "libregexp.h"
 #include "libbf.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifndef CONFIG_DIRECT_DISPATCH
 #define CONFIG_DIRECT_DISPATCH 1
 #endif
@@ -83,6 +87,17 @@
 #define CONFIG_STACK_CHECK
 #endif
 
+/* the baseline JIT (CONFIG_JIT) is only available on x86-64 with the
+   System V ABI */
+#if defined(CONFIG_JIT) && (!defined(__x86_64__) || defined(_WIN32) || \
+                            defined(__APPLE__) || defined(JS_NAN_BOXING) || \
+                            defined(CONFIG_CHECK_JSVALUE))
+#undef CONFIG_JIT
+#endif
+#ifdef CONFIG_JIT
+#include <sys/mman.h>
+#endif
+
 
 /* dump object free */
 //#define DUMP_FREE
@@ -111,6 +126,10 @@
 //#define DUMP_MODULE_RESOLVE
 //#define DUMP_PROMISE
 //#define DUMP_READ_OBJECT
+/* dump the most frequent pairs of consecutive opcodes executed by the
+   interpreter when freeing the runtime (used to choose the
+   superinstructions) */
+//#define DUMP_OPCODE_PAIRS
 
 /* test the GC by forcing it before each object allocation */
 //#define FORCE_GC_AT_MALLOC
@@ -211,6 +230,28 @@ typedef enum JSErrorEnum {
 #define JS_MAX_LOCAL_VARS 65535
 #define JS_STACK_SIZE_MAX 65534
 #define JS_STRING_LEN_MAX ((1 << 30) - 1)
+/* generational GC: amount of memory allocated between two young
+   collections */
+#define JS_GC_YOUNG_SIZE (1024 * 1024)
+/* bounds of the number of old objects scanned in an incremental GC step */
+#define JS_GC_STEP_MIN_SIZE 256
+#define JS_GC_STEP_MAX_SIZE (1 << 20)
+/* incremental GC: the amount of memory allocated between two steps
+   of a pass is the remaining memory before a full collection divided
+   by JS_GC_STEP_INTERVAL_DIV, at least JS_GC_STEP_MIN_INTERVAL and at
+   most JS_GC_YOUNG_SIZE */
+#define JS_GC_STEP_INTERVAL_DIV 32
+#define JS_GC_STEP_MIN_INTERVAL (64 * 1024)
+/* memory pools for the small GC objects: one free list per size
+   class of 16 bytes up to JS_POOL_MAX_SIZE */
+#define JS_POOL_CLASS_SHIFT 4
+#define JS_POOL_CLASS_COUNT 16
+#define JS_POOL_MAX_SIZE (JS_POOL_CLASS_COUNT << JS_POOL_CLASS_SHIFT)
+#define JS_POOL_CHUNK_SIZE (16 * 1024)
+#define JS_POOL_CHUNK_HEADER_SIZE 16
+/* context arenas (see JS_EnableContextArena()) */
+#define JS_ARENA_CHUNK_SIZE (256 * 1024)
+#define JS_ARENA_CHUNK_HEADER_SIZE 32
 #if defined(_WIN32)
 #define __exception
 #else
@@ -247,11 +288,44 @@ typedef struct {
     int (*mul_pow10)(JSContext *ctx, JSValue *sp);
 } JSNumericOperations;
 
+typedef struct JSPoolFreeItem {
+    struct JSPoolFreeItem *next;
+} JSPoolFreeItem;
+
+typedef struct JSPoolChunk {
+    int cl; /* size class of the items */
+    int free_count; /* only used in js_pool_trim() */
+    /* the items start at JS_POOL_CHUNK_HEADER_SIZE */
+} JSPoolChunk;
+
+typedef struct JSArenaChunk {
+    uint8_t *ptr; /* free space */
+    uint8_t *end;
+    int live_count; /* number of items not yet freed */
+    BOOL retired; /* no more allocation: freed when live_count = 0 */
+    /* the items start at JS_ARENA_CHUNK_HEADER_SIZE */
+} JSArenaChunk;
+
 struct JSRuntime {
     JSMallocFunctions mf;
     JSMallocState malloc_state;
     const char *rt_info;
 
+    /* memory pools (see js_pool_malloc_rt()) */
+    JSPoolFreeItem *pool_free_list[JS_POOL_CLASS_COUNT];
+    uint8_t *pool_ptr[JS_POOL_CLASS_COUNT]; /* free space in the last chunk */
+    uint8_t *pool_end[JS_POOL_CLASS_COUNT];
+    size_t pool_free_size; /* total size of the items in the free lists */
+    /* pool chunks sorted by address */
+    JSPoolChunk **pool_chunks;
+    int pool_chunk_count;
+    int pool_chunk_size;
+    /* arena chunks sorted by address */
+    JSArenaChunk **arena_chunks;
+    int arena_chunk_count;
+    int arena_chunk_size;
+    BOOL context_arena : 8; /* new contexts allocate from an arena */
+
     int atom_hash_size; /* power of two */
     int atom_count;
     int atom_size;
@@ -267,11 +341,33 @@ struct JSRuntime {
     /* list of JSGCObjectHeader.link. List of allocated GC objects (used
        by the garbage collector) */
     struct list_head gc_obj_list;
+    /* list of JSGCObjectHeader.link. GC objects allocated since the
+       last collection in generational mode. */
+    struct list_head gc_young_obj_list;
+    /* list of JSGCObjectHeader.link. Incremental GC: objects found
+       alive whose children are not marked yet */
+    struct list_head gc_gray_obj_list;
     /* list of JSGCObjectHeader.link. Used during JS_FreeValueRT() */
     struct list_head gc_zero_ref_count_list;
     struct list_head tmp_obj_list; /* used during GC */
     JSGCPhaseEnum gc_phase : 8;
+    BOOL gc_generational : 8;
     size_t malloc_gc_threshold;
+    /* generational mode: the automatic GC only scans the young
+       objects until the memory usage exceeds this threshold */
+    size_t gc_full_threshold;
+    /* incremental GC: a collection pass is in progress */
+    BOOL gc_pass_pending : 8;
+    uint8_t gc_epoch; /* flipped at the start of each pass */
+    int gc_step_size; /* number of old objects scanned per step */
+    int gc_mark_step_size; /* number of objects marked per step */
+    int gc_slice_len; /* amount of work done in the current step */
+    /* memory usage at the start of the pass and memory freed by its
+       steps, used to estimate the live size at the end of the pass */
+    size_t gc_pass_start_size;
+    size_t gc_pass_freed_size;
+    int64_t gc_pause_budget; /* in us, 0 if the automatic GC is not incremental */
+    JSGCStats gc_stats;
 #ifdef DUMP_LEAKS
     struct list_head string_list; /* list of JSString.link */
 #endif
@@ -301,6 +397,12 @@ struct JSRuntime {
     int64_t module_async_evaluation_next_timestamp;
 
     BOOL can_block : 8; /* TRUE if Atomics.wait can block */
+#ifdef CONFIG_JIT
+    BOOL jit_enabled : 8; /* TRUE if the hot functions are compiled */
+#endif
+#ifdef DUMP_OPCODE_PAIRS
+    uint64_t opcode_pair_count[256][256];
+#endif
     /* used to allocate, free and clone SharedArrayBuffers */
     JSSharedArrayBufferFunctions sab_funcs;
 
@@ -368,7 +470,10 @@ typedef enum {
 struct JSGCObjectHeader {
     int ref_count; /* must come first, 32-bit */
     JSGCObjectTypeEnum gc_obj_type : 4;
-    uint8_t mark : 4; /* used by the GC */
+    uint8_t mark : 1; /* used by the GC */
+    uint8_t is_young : 1; /* TRUE if in gc_young_obj_list */
+    uint8_t gc_epoch : 1; /* incremental GC: rt->gc_epoch if already scanned */
+    uint8_t dummy0 : 1;
     uint8_t dummy1; /* not used by the GC */
     uint16_t dummy2; /* not used by the GC */
     struct list_head link;
@@ -434,8 +539,11 @@ struct JSContext {
 
     uint16_t binary_object_count;
     int binary_object_size;
+    BOOL use_arena : 8;
+    JSArenaChunk *arena_chunk; /* current arena chunk or NULL */
 
     JSShape *array_shape;   /* initial shape for Array objects */
+    JSShape *regexp_result_shape; /* RegExp exec() result, created on demand */
 
     JSValue *class_proto;
     JSValue function_proto;
@@ -520,6 +628,24 @@ struct JSString {
     } u;
 };
 
+/* A rope (JS_TAG_STRING_ROPE) is the lazy concatenation of two
+   strings or ropes. It is flattened to a JSString when its characters
+   are needed: the flat string is then kept in 'left', 'right' is
+   JS_UNDEFINED and depth is 0. */
+typedef struct JSStringRope {
+    JSRefCountHeader header; /* must come first, 32-bit */
+    uint32_t len : 31;
+    uint8_t is_wide_char : 1;
+    uint8_t depth; /* 0 if flattened */
+    JSValue left;
+    JSValue right;
+} JSStringRope;
+
+static inline BOOL tag_is_string(uint32_t tag)
+{
+    return tag == JS_TAG_STRING || tag == JS_TAG_STRING_ROPE;
+}
+
 typedef struct JSClosureVar {
     uint8_t is_local : 1;
     uint8_t is_arg : 1;
@@ -600,6 +726,37 @@ typedef enum JSFunctionKindEnum {
     JS_FUNC_ASYNC_GENERATOR = (JS_FUNC_GENERATOR | JS_FUNC_ASYNC),
 } JSFunctionKindEnum;
 
+/* number of shapes remembered by each inline cache */
+#define JS_INLINE_CACHE_SIZE 4
+
+typedef struct JSInlineCacheEntry {
+    JSShape *shape; /* shape of the object, NULL if unused */
+    /* shape of the prototype holding the property or NULL if the
+       property is an own property of the object */
+    JSShape *proto_shape;
+    uint32_t prop_idx; /* index of the property in the holder object */
+} JSInlineCacheEntry;
+
+/* inline cache of a property access site. Only data properties of
+   objects with a hashed shape are cached. The cache holds a reference
+   to the shapes so that they are never modified in place (see
+   js_shape_prepare_update()).
+   For the global variable accesses, a single entry is used: 'shape'
+   is the shape of global_var_obj and 'proto_shape' is the shape of
+   global_obj or NULL if the variable is a lexical one. */
+typedef struct JSInlineCache {
+    JSAtom atom; /* property name */
+    uint8_t count; /* number of used entries */
+    /* the global variable sites never replace their single entry, so
+       they reuse the byte for the retry delay */
+    union {
+        uint8_t next; /* next entry to replace when the cache is full */
+        uint8_t retry_shift; /* log2 of the retry delay (global variables) */
+    } u;
+    uint16_t update_count; /* number of global variable cache updates */
+    JSInlineCacheEntry entries[JS_INLINE_CACHE_SIZE];
+} JSInlineCache;
+
 typedef struct JSFunctionBytecode {
     JSGCObjectHeader header; /* must come first */
     uint8_t js_mode;
@@ -617,7 +774,10 @@ typedef struct JSFunctionBytecode {
     uint8_t backtrace_barrier : 1; /* stop backtrace on this function */
     uint8_t read_only_bytecode : 1;
     uint8_t is_direct_or_indirect_eval : 1; /* used by JS_GetScriptOrModuleName() */
-    /* XXX: 10 bits available */
+#ifdef CONFIG_JIT
+    uint8_t jit_disabled : 1; /* TRUE if the function cannot be compiled */
+#endif
+    /* XXX: 9 bits available */
     uint8_t *byte_code_buf; /* (self pointer) */
     int byte_code_len;
     JSAtom func_name;
@@ -631,6 +791,12 @@ typedef struct JSFunctionBytecode {
     JSValue *cpool; /* constant pool (self pointer) */
     int cpool_count;
     int closure_var_count;
+    int ic_count;
+    JSInlineCache *ic; /* inline caches of the OP_FMT_ic opcodes */
+#ifdef CONFIG_JIT
+    int jit_counter; /* number of calls and loop iterations */
+    struct JSJITCode *jit; /* machine code or NULL if not compiled */
+#endif
     struct {
         /* debug info, move to separate structure to save memory? */
         JSAtom filename;
@@ -671,8 +837,17 @@ typedef struct JSForInIterator {
 typedef struct JSRegExp {
     JSString *pattern;
     JSString *bytecode; /* also contains the flags */
+    /* lazy DFA. Before it is created, the number of exec() calls. A
+       count of JS_REGEXP_DFA_EXEC_COUNT means that there is no DFA. */
+    union {
+        struct REDFA *dfa;
+        uintptr_t exec_count;
+    };
 } JSRegExp;
 
+/* number of exec() calls on a RegExp object before its DFA is created */
+#define JS_REGEXP_DFA_EXEC_COUNT 8
+
 typedef struct JSProxyData {
     JSValue target;
     JSValue handler;
@@ -927,7 +1102,7 @@ struct JSObject {
     JSShape *shape; /* prototype and property names + flag */
     JSProperty *prop; /* array of properties */
     /* byte offsets: 24/40 */
-    struct JSMapRecord *first_weak_ref; /* XXX: use a bit and an external hash table? */
+    struct JSMapWeakRef *first_weak_ref; /* XXX: use a bit and an external hash table? */
     /* byte offsets: 28/48 */
     union {
         void *opaque;
@@ -986,7 +1161,7 @@ struct JSObject {
             } u;
             uint32_t count; /* <= 2^31-1. 0 for a detached typed array */
         } array;    /* 12/20 bytes */
-        JSRegExp regexp;    /* JS_CLASS_REGEXP: 8/16 bytes */
+        JSRegExp regexp;    /* JS_CLASS_REGEXP: 12/24 bytes */
         JSValue object_data;    /* for JS_SetObjectData(): 8/16/16 bytes */
     } u;
     /* byte sizes: 40/48/72 */
@@ -1052,6 +1227,26 @@ static JSValue js_call_bound_function(JSContext *ctx, JSValueConst func_obj,
 static JSValue JS_CallInternal(JSContext *ctx, JSValueConst func_obj,
                                JSValueConst this_obj, JSValueConst new_target,
                                int argc, JSValue *argv, int flags);
+#ifdef CONFIG_JIT
+typedef struct JSJITResult {
+    const uint8_t *pc;
+    JSValue *sp;
+} JSJITResult;
+typedef struct JSJITCode {
+    uint8_t *code; /* executable memory */
+    size_t code_size; /* size of the mapping */
+    /* for each position in the bytecode, 1 + position of the entry
+       point in the machine code or 0 if it is not an entry point */
+    uint32_t entry_pos[0];
+} JSJITCode;
+static JSJITResult js_jit_call(JSContext *ctx, JSFunctionBytecode *b,
+                               JSValue *arg_buf, JSValue *var_buf,
+                               JSValue *sp, const uint8_t *pc);
+static void js_jit_free(JSRuntime *rt, JSFunctionBytecode *b);
+#endif
+#ifdef DUMP_OPCODE_PAIRS
+static void js_dump_opcode_pairs(JSRuntime *rt);
+#endif
 static JSValue JS_CallConstructorInternal(JSContext *ctx,
                                           JSValueConst func_obj,
                                           JSValueConst new_target,
@@ -1143,6 +1338,11 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
 static JSValue js_regexp_constructor_internal(JSContext *ctx, JSValueConst ctor,
                                               JSValue pattern, JSValue bc);
 static void gc_decref(JSRuntime *rt);
+static void gc_run_young(JSRuntime *rt);
+static void gc_start_pass(JSRuntime *rt);
+static void gc_run_step(JSRuntime *rt, int64_t budget_us);
+static void gc_promote_young(JSRuntime *rt);
+static void gc_merge_lists(JSRuntime *rt);
 static int JS_NewClass1(JSRuntime *rt, JSClassID class_id,
                         const JSClassDef *class_def, JSAtom name);
 
@@ -1212,6 +1412,11 @@ static JSValue js_array_buffer_constructor3(JSContext *ctx,
                                             uint8_t *buf,
                                             JSFreeArrayBufferDataFunc *free_func,
                                             void *opaque, BOOL alloc_flag);
+static void js_array_buffer_free(JSRuntime *rt, void *opaque, void *ptr);
+static void js_array_buffer_sab_free(JSRuntime *rt, void *opaque, void *ptr);
+static int js_array_buffer_sab_charge(JSContext *ctx, size_t size);
+static void js_array_buffer_sab_uncharge(JSRuntime *rt, size_t size);
+static int js_array_buffer_move_to_sab(JSContext *ctx, JSArrayBuffer *abuf);
 static JSArrayBuffer *js_get_array_buffer(JSContext *ctx, JSValueConst obj);
 static JSValue js_typed_array_constructor(JSContext *ctx,
                                           JSValueConst this_val,
@@ -1308,24 +1513,378 @@ static const JSClassExoticMethods js_proxy_exotic_methods;
 static const JSClassExoticMethods js_module_ns_exotic_methods;
 static JSClassID js_class_id_alloc = JS_CLASS_INIT_COUNT;
 
+/* allocated memory minus the free pool items */
+static inline size_t js_gc_used_size(JSRuntime *rt)
+{
+    return rt->malloc_state.malloc_size - rt->pool_free_size;
+}
+
 static void js_trigger_gc(JSRuntime *rt, size_t size)
 {
     BOOL force_gc;
+    size_t used_size, step_interval;
+
+    /* the free pool items are not counted so that the reused memory
+       triggers the GC as the newly allocated memory */
+    used_size = js_gc_used_size(rt) + size;
 #ifdef FORCE_GC_AT_MALLOC
     force_gc = TRUE;
 #else
-    force_gc = ((rt->malloc_state.malloc_size + size) >
-                rt->malloc_gc_threshold);
+    force_gc = (used_size > rt->malloc_gc_threshold);
 #endif
     if (force_gc) {
 #ifdef DUMP_GC
         printf("GC: size=%" PRIu64 "\n",
                (uint64_t)rt->malloc_state.malloc_size);
 #endif
-        JS_RunGC(rt);
-        rt->malloc_gc_threshold = rt->malloc_state.malloc_size +
-            (rt->malloc_state.malloc_size >> 1);
+        if (rt->gc_pause_budget > 0 &&
+            used_size <= 2 * rt->gc_full_threshold) {
+            /* incremental mode: a full collection is only done if the
+               steps cannot keep up with the allocations */
+            if (!rt->gc_generational || used_size > rt->gc_full_threshold)
+                gc_start_pass(rt);
+            gc_run_step(rt, rt->gc_pause_budget);
+        } else if (rt->gc_generational &&
+                   used_size <= rt->gc_full_threshold) {
+            gc_run_young(rt);
+        } else {
+            if (rt->gc_pause_budget > 0)
+                rt->gc_stats.fallback_count++;
+            JS_RunGC(rt);
+            rt->gc_full_threshold = js_gc_used_size(rt) +
+                (js_gc_used_size(rt) >> 1);
+        }
+        used_size = js_gc_used_size(rt);
+        rt->malloc_gc_threshold = used_size + (used_size >> 1);
+        if ((rt->gc_generational || rt->gc_pause_budget > 0) &&
+            rt->malloc_gc_threshold - used_size > JS_GC_YOUNG_SIZE) {
+            /* collect the young objects more often */
+            rt->malloc_gc_threshold = used_size + JS_GC_YOUNG_SIZE;
+        }
+        if (rt->gc_pass_pending) {
+            /* run the steps more often when the memory usage
+               approaches the full collection limit */
+            step_interval = 0;
+            if (2 * rt->gc_full_threshold > used_size)
+                step_interval = (2 * rt->gc_full_threshold - used_size) /
+                    JS_GC_STEP_INTERVAL_DIV;
+            if (step_interval < JS_GC_STEP_MIN_INTERVAL)
+                step_interval = JS_GC_STEP_MIN_INTERVAL;
+            if (rt->malloc_gc_threshold - used_size > step_interval)
+                rt->malloc_gc_threshold = used_size + step_interval;
+        }
+    }
+}
+
+/* Memory pools: JSObject, JSShape, JSVarRef and JSStringRope are
+   allocated from per-runtime free lists indexed by size class. The
+   chunks are allocated with js_malloc_rt() so they are accounted in
+   malloc_state. The chunks whose items are all free are released by
+   js_pool_trim() after the full collections and when an allocation
+   fails. The size must be given when freeing. */
+static no_inline void *js_pool_malloc_slow(JSRuntime *rt, int cl)
+{
+    size_t item_size = (size_t)(cl + 1) << JS_POOL_CLASS_SHIFT;
+    JSPoolChunk *c, **new_chunks;
+    int pos, new_size;
+    void *ptr;
+
+    if (rt->pool_end[cl] - rt->pool_ptr[cl] < item_size) {
+        if (rt->pool_chunk_count >= rt->pool_chunk_size) {
+            new_size = max_int(rt->pool_chunk_size * 3 / 2, 8);
+            new_chunks = js_realloc_rt(rt, rt->pool_chunks,
+                                       sizeof(rt->pool_chunks[0]) * new_size);
+            if (!new_chunks)
+                return NULL;
+            rt->pool_chunks = new_chunks;
+            rt->pool_chunk_size = new_size;
+        }
+        c = js_malloc_rt(rt, JS_POOL_CHUNK_SIZE);
+        if (!c)
+            return NULL;
+        c->cl = cl;
+        /* insert sorted */
+        for(pos = rt->pool_chunk_count; pos > 0; pos--) {
+            if (rt->pool_chunks[pos - 1] < c)
+                break;
+            rt->pool_chunks[pos] = rt->pool_chunks[pos - 1];
+        }
+        rt->pool_chunks[pos] = c;
+        rt->pool_chunk_count++;
+        rt->pool_ptr[cl] = (uint8_t *)c + JS_POOL_CHUNK_HEADER_SIZE;
+        rt->pool_end[cl] = (uint8_t *)c + JS_POOL_CHUNK_SIZE;
+    }
+    ptr = rt->pool_ptr[cl];
+    rt->pool_ptr[cl] += item_size;
+    return ptr;
+}
+
+static inline void *js_pool_malloc_rt(JSRuntime *rt, size_t size)
+{
+    JSPoolFreeItem *item;
+    int cl;
+
+    if (unlikely(size > JS_POOL_MAX_SIZE))
+        return js_malloc_rt(rt, size);
+    cl = (size - 1) >> JS_POOL_CLASS_SHIFT;
+    item = rt->pool_free_list[cl];
+    if (likely(item != NULL)) {
+        rt->pool_free_list[cl] = item->next;
+        rt->pool_free_size -= (size_t)(cl + 1) << JS_POOL_CLASS_SHIFT;
+        return item;
+    }
+    return js_pool_malloc_slow(rt, cl);
+}
+
+/* Context arenas: the pool items of a context are bump allocated
+   from large chunks. The items are freed individually as usual but
+   only decrement the live count of their chunk. A chunk is released
+   once it is retired (full or its context is freed) and all its items
+   are freed, so the objects escaping their context only keep their
+   chunk alive. */
+static void js_arena_free_chunk(JSRuntime *rt, int idx)
+{
+    JSArenaChunk *c = rt->arena_chunks[idx];
+    memmove(rt->arena_chunks + idx, rt->arena_chunks + idx + 1,
+            sizeof(rt->arena_chunks[0]) * (rt->arena_chunk_count - idx - 1));
+    rt->arena_chunk_count--;
+    js_free_rt(rt, c);
+}
+
+static void js_arena_retire(JSRuntime *rt, JSArenaChunk *c)
+{
+    int i;
+
+    c->retired = TRUE;
+    if (c->live_count == 0) {
+        for(i = 0; i < rt->arena_chunk_count; i++) {
+            if (rt->arena_chunks[i] == c) {
+                js_arena_free_chunk(rt, i);
+                break;
+            }
+        }
+    }
+}
+
+static no_inline void *js_arena_malloc(JSContext *ctx, size_t size)
+{
+    JSRuntime *rt = ctx->rt;
+    JSArenaChunk *c, **new_chunks;
+    int pos, new_size;
+    void *ptr;
+
+    size = (size + (1 << JS_POOL_CLASS_SHIFT) - 1) &
+        ~(size_t)((1 << JS_POOL_CLASS_SHIFT) - 1);
+    c = ctx->arena_chunk;
+    if (!c || c->end - c->ptr < size) {
+        if (c) {
+            ctx->arena_chunk = NULL;
+            js_arena_retire(rt, c);
+        }
+        if (rt->arena_chunk_count >= rt->arena_chunk_size) {
+            new_size = max_int(rt->arena_chunk_size * 3 / 2, 8);
+            new_chunks = js_realloc_rt(rt, rt->arena_chunks,
+                                       sizeof(rt->arena_chunks[0]) * new_size);
+            if (!new_chunks)
+                return NULL;
+            rt->arena_chunks = new_chunks;
+            rt->arena_chunk_size = new_size;
+        }
+        c = js_malloc_rt(rt, JS_ARENA_CHUNK_SIZE);
+        if (!c)
+            return NULL;
+        c->ptr = (uint8_t *)c + JS_ARENA_CHUNK_HEADER_SIZE;
+        c->end = (uint8_t *)c + JS_ARENA_CHUNK_SIZE;
+        c->live_count = 0;
+        c->retired = FALSE;
+        /* insert sorted */
+        for(pos = rt->arena_chunk_count; pos > 0; pos--) {
+            if (rt->arena_chunks[pos - 1] < c)
+                break;
+            rt->arena_chunks[pos] = rt->arena_chunks[pos - 1];
+        }
+        rt->arena_chunks[pos] = c;
+        rt->arena_chunk_count++;
+        ctx->arena_chunk = c;
+    }
+    ptr = c->ptr;
+    c->ptr += size;
+    c->live_count++;
+    return ptr;
+}
+
+/* return TRUE if ptr was allocated in an arena */
+static BOOL js_arena_free(JSRuntime *rt, void *ptr)
+{
+    JSArenaChunk *c;
+    int a, b, m;
+
+    /* find the last chunk <= ptr */
+    a = 0;
+    b = rt->arena_chunk_count - 1;
+    while (a <= b) {
+        m = (a + b) >> 1;
+        if ((uint8_t *)rt->arena_chunks[m] <= (uint8_t *)ptr)
+            a = m + 1;
+        else
+            b = m - 1;
+    }
+    if (b < 0)
+        return FALSE;
+    c = rt->arena_chunks[b];
+    if ((uint8_t *)ptr >= (uint8_t *)c + JS_ARENA_CHUNK_SIZE)
+        return FALSE;
+    if (--c->live_count == 0 && c->retired)
+        js_arena_free_chunk(rt, b);
+    return TRUE;
+}
+
+static inline void js_pool_free_rt(JSRuntime *rt, void *ptr, size_t size)
+{
+    JSPoolFreeItem *item;
+    int cl;
+
+    if (unlikely(size > JS_POOL_MAX_SIZE)) {
+        js_free_rt(rt, ptr);
+        return;
+    }
+    if (unlikely(rt->arena_chunk_count != 0) && js_arena_free(rt, ptr))
+        return;
+    cl = (size - 1) >> JS_POOL_CLASS_SHIFT;
+    item = ptr;
+    item->next = rt->pool_free_list[cl];
+    rt->pool_free_list[cl] = item;
+    rt->pool_free_size += (size_t)(cl + 1) << JS_POOL_CLASS_SHIFT;
+}
+
+/* Throw out of memory in case of error */
+static inline void *js_pool_malloc(JSContext *ctx, size_t size)
+{
+    void *ptr;
+    if (unlikely(ctx->use_arena) && size <= JS_POOL_MAX_SIZE)
+        ptr = js_arena_malloc(ctx, size);
+    else
+        ptr = js_pool_malloc_rt(ctx->rt, size);
+    if (unlikely(!ptr)) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    return ptr;
+}
+
+/* return the pool chunk containing ptr or NULL */
+static JSPoolChunk *js_pool_find_chunk(JSRuntime *rt, void *ptr)
+{
+    JSPoolChunk *c;
+    int a, b, m;
+
+    /* find the last chunk <= ptr */
+    a = 0;
+    b = rt->pool_chunk_count - 1;
+    while (a <= b) {
+        m = (a + b) >> 1;
+        if ((uint8_t *)rt->pool_chunks[m] <= (uint8_t *)ptr)
+            a = m + 1;
+        else
+            b = m - 1;
     }
+    if (b < 0)
+        return NULL;
+    c = rt->pool_chunks[b];
+    if ((uint8_t *)ptr >= (uint8_t *)c + JS_POOL_CHUNK_SIZE)
+        return NULL;
+    return c;
+}
+
+/* Release the pool chunks whose items are all in the free lists. The
+   cost is proportional to the number of free items. Return TRUE if
+   some chunks were released. */
+static BOOL js_pool_trim(JSRuntime *rt)
+{
+    JSPoolChunk *c;
+    JSPoolFreeItem *item, **pitem;
+    uint8_t *end;
+    int i, j, cl, n, item_size;
+
+    if (rt->pool_chunk_count == 0)
+        return FALSE;
+    for(i = 0; i < rt->pool_chunk_count; i++)
+        rt->pool_chunks[i]->free_count = 0;
+    for(cl = 0; cl < JS_POOL_CLASS_COUNT; cl++) {
+        for(item = rt->pool_free_list[cl]; item != NULL; item = item->next) {
+            c = js_pool_find_chunk(rt, item);
+            if (c)
+                c->free_count++;
+        }
+    }
+
+    /* free_count = -1 for the chunks to release */
+    n = 0;
+    for(i = 0; i < rt->pool_chunk_count; i++) {
+        c = rt->pool_chunks[i];
+        item_size = (c->cl + 1) << JS_POOL_CLASS_SHIFT;
+        end = (uint8_t *)c + JS_POOL_CHUNK_SIZE;
+        /* only the start of the current chunk is allocated */
+        if (rt->pool_end[c->cl] == end)
+            end = rt->pool_ptr[c->cl];
+        if (c->free_count ==
+            (end - ((uint8_t *)c + JS_POOL_CHUNK_HEADER_SIZE)) / item_size) {
+            c->free_count = -1;
+            n++;
+        }
+    }
+    if (n == 0)
+        return FALSE;
+
+    for(cl = 0; cl < JS_POOL_CLASS_COUNT; cl++) {
+        pitem = &rt->pool_free_list[cl];
+        while ((item = *pitem) != NULL) {
+            c = js_pool_find_chunk(rt, item);
+            if (c && c->free_count < 0) {
+                *pitem = item->next;
+                rt->pool_free_size -= (size_t)(cl + 1) << JS_POOL_CLASS_SHIFT;
+            } else
+                pitem = &item->next;
+        }
+    }
+    j = 0;
+    for(i = 0; i < rt->pool_chunk_count; i++) {
+        c = rt->pool_chunks[i];
+        if (c->free_count < 0) {
+            if (rt->pool_end[c->cl] == (uint8_t *)c + JS_POOL_CHUNK_SIZE) {
+                rt->pool_ptr[c->cl] = NULL;
+                rt->pool_end[c->cl] = NULL;
+            }
+            js_free_rt(rt, c);
+        } else {
+            rt->pool_chunks[j++] = c;
+        }
+    }
+    rt->pool_chunk_count = j;
+    return TRUE;
+}
+
+static void js_pool_free_all(JSRuntime *rt)
+{
+    int i;
+
+    for(i = 0; i < rt->pool_chunk_count; i++)
+        js_free_rt(rt, rt->pool_chunks[i]);
+    js_free_rt(rt, rt->pool_chunks);
+    rt->pool_chunks = NULL;
+    rt->pool_chunk_count = 0;
+    rt->pool_free_size = 0;
+    rt->pool_chunk_size = 0;
+    while (rt->arena_chunk_count != 0)
+        js_arena_free_chunk(rt, rt->arena_chunk_count - 1);
+    js_free_rt(rt, rt->arena_chunks);
+    rt->arena_chunks = NULL;
+    rt->arena_chunk_size = 0;
+}
+
+void JS_EnableContextArena(JSRuntime *rt, BOOL enable)
+{
+    rt->context_arena = enable;
 }
 
 static size_t js_malloc_usable_size_unknown(const void *ptr)
@@ -1335,7 +1894,12 @@ static size_t js_malloc_usable_size_unknown(const void *ptr)
 
 void *js_malloc_rt(JSRuntime *rt, size_t size)
 {
-    return rt->mf.js_malloc(&rt->malloc_state, size);
+    void *ptr;
+    ptr = rt->mf.js_malloc(&rt->malloc_state, size);
+    /* retry after releasing the free pool chunks */
+    if (unlikely(!ptr) && js_pool_trim(rt))
+        ptr = rt->mf.js_malloc(&rt->malloc_state, size);
+    return ptr;
 }
 
 void js_free_rt(JSRuntime *rt, void *ptr)
@@ -1345,7 +1909,11 @@ void js_free_rt(JSRuntime *rt, void *ptr)
 
 void *js_realloc_rt(JSRuntime *rt, void *ptr, size_t size)
 {
-    return rt->mf.js_realloc(&rt->malloc_state, ptr, size);
+    void *ret;
+    ret = rt->mf.js_realloc(&rt->malloc_state, ptr, size);
+    if (unlikely(!ret) && size != 0 && js_pool_trim(rt))
+        ret = rt->mf.js_realloc(&rt->malloc_state, ptr, size);
+    return ret;
 }
 
 size_t js_malloc_usable_size_rt(JSRuntime *rt, const void *ptr)
@@ -1682,8 +2250,12 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
 
     init_list_head(&rt->context_list);
     init_list_head(&rt->gc_obj_list);
+    init_list_head(&rt->gc_young_obj_list);
+    init_list_head(&rt->gc_gray_obj_list);
     init_list_head(&rt->gc_zero_ref_count_list);
     rt->gc_phase = JS_GC_PHASE_NONE;
+    rt->gc_step_size = JS_GC_STEP_MIN_SIZE;
+    rt->gc_mark_step_size = JS_GC_STEP_MIN_SIZE;
 
 #ifdef DUMP_LEAKS
     init_list_head(&rt->string_list);
@@ -1980,6 +2552,10 @@ void JS_FreeRuntime(JSRuntime *rt)
 
     JS_RunGC(rt);
 
+#ifdef DUMP_OPCODE_PAIRS
+    js_dump_opcode_pairs(rt);
+#endif
+
 #ifdef DUMP_LEAKS
     /* leaking objects */
     {
@@ -2103,6 +2679,7 @@ void JS_FreeRuntime(JSRuntime *rt)
     js_free_rt(rt, rt->atom_array);
     js_free_rt(rt, rt->atom_hash);
     js_free_rt(rt, rt->shape_hash);
+    js_pool_free_all(rt);
 #ifdef DUMP_LEAKS
     if (!list_empty(&rt->string_list)) {
         if (rt->rt_info) {
@@ -2149,7 +2726,8 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
 }
 
-JSContext *JS_NewContextRaw(JSRuntime *rt)
+/* allocate a context without any intrinsic object */
+static JSContext *js_new_context(JSRuntime *rt)
 {
     JSContext *ctx;
     int i;
@@ -2167,6 +2745,7 @@ JSContext *JS_NewContextRaw(JSRuntime *rt)
         return NULL;
     }
     ctx->rt = rt;
+    ctx->use_arena = rt->context_arena;
     list_add_tail(&ctx->link, &rt->context_list);
     ctx->bf_ctx = &rt->bf_ctx;
 #ifdef CONFIG_BIGNUM
@@ -2179,6 +2758,16 @@ JSContext *JS_NewContextRaw(JSRuntime *rt)
     ctx->regexp_ctor = JS_NULL;
     ctx->promise_ctor = JS_NULL;
     init_list_head(&ctx->loaded_modules);
+    return ctx;
+}
+
+JSContext *JS_NewContextRaw(JSRuntime *rt)
+{
+    JSContext *ctx;
+
+    ctx = js_new_context(rt);
+    if (!ctx)
+        return NULL;
 
     JS_AddIntrinsicBasicObjects(ctx);
 
@@ -2306,6 +2895,8 @@ static void JS_MarkContext(JSRuntime *rt, JSContext *ctx,
 
     if (ctx->array_shape)
         mark_func(rt, &ctx->array_shape->header);
+    if (ctx->regexp_result_shape)
+        mark_func(rt, &ctx->regexp_result_shape->header);
 }
 
 void JS_FreeContext(JSContext *ctx)
@@ -2329,6 +2920,7 @@ void JS_FreeContext(JSContext *ctx)
         JSGCObjectHeader *p;
         printf("JSObjects: {\n");
         JS_DumpObjectHeader(ctx->rt);
+        gc_merge_lists(rt);
         list_for_each(el, &rt->gc_obj_list) {
             p = list_entry(el, JSGCObjectHeader, link);
             JS_DumpGCObject(rt, p);
@@ -2373,6 +2965,10 @@ void JS_FreeContext(JSContext *ctx)
     JS_FreeValue(ctx, ctx->function_proto);
 
     js_free_shape_null(ctx->rt, ctx->array_shape);
+    js_free_shape_null(ctx->rt, ctx->regexp_result_shape);
+
+    if (ctx->arena_chunk)
+        js_arena_retire(rt, ctx->arena_chunk);
 
     list_del(&ctx->link);
     remove_gc_object(&ctx->header);
@@ -4226,39 +4822,365 @@ static JSValue JS_ConcatString1(JSContext *ctx,
     return JS_MKPTR(JS_TAG_STRING, p);
 }
 
-static BOOL JS_ConcatStringInPlace(JSContext *ctx, JSString *p1, JSValueConst op2) {
-    if (JS_VALUE_GET_TAG(op2) == JS_TAG_STRING) {
-        JSString *p2 = JS_VALUE_GET_STRING(op2);
-        size_t size1;
+static BOOL js_string_append_in_place(JSContext *ctx, JSString *p1,
+                                      const JSString *p2)
+{
+    size_t size1;
 
-        if (p2->len == 0)
+    if (p2->len == 0)
+        return TRUE;
+    /* an atom may be only referenced by a value but it is still in
+       the atom hash table */
+    if (p1->header.ref_count != 1 || p1->atom_type)
+        return FALSE;
+    size1 = js_malloc_usable_size(ctx, p1);
+    if (p1->is_wide_char) {
+        if (size1 >= sizeof(*p1) + ((p1->len + p2->len) << 1)) {
+            if (p2->is_wide_char) {
+                memcpy(p1->u.str16 + p1->len, p2->u.str16, p2->len << 1);
+                p1->len += p2->len;
+                return TRUE;
+            } else {
+                size_t i;
+                for (i = 0; i < p2->len; i++) {
+                    p1->u.str16[p1->len++] = p2->u.str8[i];
+                }
+                return TRUE;
+            }
+        }
+    } else if (!p2->is_wide_char) {
+        if (size1 >= sizeof(*p1) + p1->len + p2->len + 1) {
+            memcpy(p1->u.str8 + p1->len, p2->u.str8, p2->len);
+            p1->len += p2->len;
+            p1->u.str8[p1->len] = '\0';
             return TRUE;
-        if (p1->header.ref_count != 1)
-            return FALSE;
-        size1 = js_malloc_usable_size(ctx, p1);
-        if (p1->is_wide_char) {
-            if (size1 >= sizeof(*p1) + ((p1->len + p2->len) << 1)) {
-                if (p2->is_wide_char) {
-                    memcpy(p1->u.str16 + p1->len, p2->u.str16, p2->len << 1);
-                    p1->len += p2->len;
-                    return TRUE;
-                } else {
-                    size_t i;
-                    for (i = 0; i < p2->len; i++) {
-                        p1->u.str16[p1->len++] = p2->u.str8[i];
-                    }
-                    return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Ropes: a concatenation giving more than JS_STRING_ROPE_LEAF_LEN
+   characters builds a rope node instead of copying its operands. The
+   short leaves at the ends of a rope are merged with the appended or
+   prepended strings, and the nodes are combined like a binary counter
+   so that the depth stays logarithmic for 's += x' in a loop. */
+#define JS_STRING_ROPE_LEAF_LEN  512
+#define JS_STRING_ROPE_MAX_DEPTH 64
+
+static inline uint32_t js_string_value_len(JSValueConst v)
+{
+    if (JS_VALUE_GET_TAG(v) == JS_TAG_STRING)
+        return JS_VALUE_GET_STRING(v)->len;
+    else
+        return ((JSStringRope *)JS_VALUE_GET_PTR(v))->len;
+}
+
+static inline int js_string_value_depth(JSValueConst v)
+{
+    if (JS_VALUE_GET_TAG(v) == JS_TAG_STRING)
+        return 0;
+    else
+        return ((JSStringRope *)JS_VALUE_GET_PTR(v))->depth;
+}
+
+static inline BOOL js_string_value_is_wide_char(JSValueConst v)
+{
+    if (JS_VALUE_GET_TAG(v) == JS_TAG_STRING)
+        return JS_VALUE_GET_STRING(v)->is_wide_char;
+    else
+        return ((JSStringRope *)JS_VALUE_GET_PTR(v))->is_wide_char;
+}
+
+static void js_string_copy(JSString *d, uint32_t pos, const JSString *p)
+{
+    if (d->is_wide_char)
+        copy_str16(d->u.str16 + pos, p, 0, p->len);
+    else
+        memcpy(d->u.str8 + pos, p->u.str8, p->len);
+}
+
+/* the recursion is bounded by JS_STRING_ROPE_MAX_DEPTH */
+static void js_string_rope_copy(JSString *d, uint32_t pos, JSValueConst v)
+{
+    JSStringRope *r;
+
+    while (JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(v);
+        if (r->depth == 0) {
+            v = r->left;
+            break;
+        }
+        js_string_rope_copy(d, pos, r->left);
+        pos += js_string_value_len(r->left);
+        v = r->right;
+    }
+    js_string_copy(d, pos, JS_VALUE_GET_STRING(v));
+}
+
+/* Return the flat string of the rope. The result is kept in the rope
+   and is not duplicated. Return NULL in case of exception. */
+static JSString *js_string_rope_flatten(JSContext *ctx, JSStringRope *r)
+{
+    JSString *p;
+
+    if (r->depth == 0)
+        return JS_VALUE_GET_STRING(r->left);
+    p = js_alloc_string(ctx, r->len, r->is_wide_char);
+    if (!p)
+        return NULL;
+    js_string_rope_copy(p, 0, JS_MKPTR(JS_TAG_STRING_ROPE, r));
+    if (!p->is_wide_char)
+        p->u.str8[p->len] = '\0';
+    JS_FreeValue(ctx, r->left);
+    JS_FreeValue(ctx, r->right);
+    r->left = JS_MKPTR(JS_TAG_STRING, p);
+    r->right = JS_UNDEFINED;
+    r->depth = 0;
+    return p;
+}
+
+/* Return the flat string of a string or a rope. It is not duplicated.
+   Return NULL in case of exception. */
+static JSString *js_string_value_get(JSContext *ctx, JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING)
+        return JS_VALUE_GET_STRING(val);
+    return js_string_rope_flatten(ctx, JS_VALUE_GET_PTR(val));
+}
+
+/* Return a flat string from a string or a rope. 'val' is freed. */
+static JSValue js_string_flatten_free(JSContext *ctx, JSValue val)
+{
+    JSStringRope *r;
+    JSString *p;
+
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING_ROPE)
+        return val;
+    r = JS_VALUE_GET_PTR(val);
+    if (r->depth != 0 && r->header.ref_count == 1) {
+        /* no need to keep the result in the rope */
+        p = js_alloc_string(ctx, r->len, r->is_wide_char);
+        if (p) {
+            js_string_rope_copy(p, 0, val);
+            if (!p->is_wide_char)
+                p->u.str8[p->len] = '\0';
+        }
+    } else {
+        p = js_string_rope_flatten(ctx, r);
+        if (p)
+            p->header.ref_count++;
+    }
+    JS_FreeValue(ctx, val);
+    if (!p)
+        return JS_EXCEPTION;
+    return JS_MKPTR(JS_TAG_STRING, p);
+}
+
+/* update the length and depth of 'r' after a change of its children.
+   Return FALSE if it is too deep. */
+static BOOL js_string_rope_update(JSStringRope *r)
+{
+    int depth;
+
+    r->len = js_string_value_len(r->left) + js_string_value_len(r->right);
+    r->is_wide_char = js_string_value_is_wide_char(r->left) |
+        js_string_value_is_wide_char(r->right);
+    depth = max_int(js_string_value_depth(r->left),
+                    js_string_value_depth(r->right)) + 1;
+    r->depth = min_int(depth, JS_STRING_ROPE_MAX_DEPTH + 1);
+    return depth <= JS_STRING_ROPE_MAX_DEPTH;
+}
+
+static JSValue js_new_string_rope(JSContext *ctx, JSValue op1, JSValue op2)
+{
+    JSStringRope *r;
+    JSValue ret;
+
+    r = js_pool_malloc(ctx, sizeof(JSStringRope));
+    if (!r) {
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        return JS_EXCEPTION;
+    }
+    r->header.ref_count = 1;
+    r->left = op1;
+    r->right = op2;
+    ret = JS_MKPTR(JS_TAG_STRING_ROPE, r);
+    /* keep the copy recursion bounded */
+    if (!js_string_rope_update(r))
+        ret = js_string_flatten_free(ctx, ret);
+    return ret;
+}
+
+/* a flattened rope is replaced by its flat string */
+static inline JSValue js_string_rope_unwrap(JSContext *ctx, JSValue val)
+{
+    JSStringRope *r;
+    JSValue ret;
+
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING_ROPE)
+        return val;
+    r = JS_VALUE_GET_PTR(val);
+    if (r->depth != 0)
+        return val;
+    ret = JS_DupValue(ctx, r->left);
+    JS_FreeValue(ctx, val);
+    return ret;
+}
+
+/* Return op1 + op2 where op1 and op2 are non empty strings or ropes
+   and the result is longer than JS_STRING_ROPE_LEAF_LEN if it is the
+   top level concatenation. The unshared nodes are modified in place. */
+static JSValue js_concat_string_rope(JSContext *ctx, JSValue op1, JSValue op2)
+{
+    JSStringRope *r;
+    JSString *p1, *p2, *p;
+    JSValue v;
+    uint32_t len;
+
+    op1 = js_string_rope_unwrap(ctx, op1);
+    op2 = js_string_rope_unwrap(ctx, op2);
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
+        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING) {
+        /* leaf merge */
+        p1 = JS_VALUE_GET_STRING(op1);
+        p2 = JS_VALUE_GET_STRING(op2);
+        if (js_string_append_in_place(ctx, p1, p2)) {
+            JS_FreeValue(ctx, op2);
+            return op1;
+        }
+        len = p1->len + p2->len;
+        if (len > JS_STRING_ROPE_LEAF_LEN)
+            return js_new_string_rope(ctx, op1, op2);
+        /* leave some room for the next appends */
+        p = js_alloc_string(ctx, len + len / 2,
+                            p1->is_wide_char | p2->is_wide_char);
+        if (p) {
+            p->len = len;
+            js_string_copy(p, 0, p1);
+            js_string_copy(p, p1->len, p2);
+            if (!p->is_wide_char)
+                p->u.str8[len] = '\0';
+        }
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        if (!p)
+            return JS_EXCEPTION;
+        return JS_MKPTR(JS_TAG_STRING, p);
+    }
+
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE) {
+        /* append to the right child */
+        r = JS_VALUE_GET_PTR(op1);
+        if (js_string_value_depth(r->right) < js_string_value_depth(r->left) ||
+            (JS_VALUE_GET_TAG(r->right) == JS_TAG_STRING &&
+             JS_VALUE_GET_TAG(op2) == JS_TAG_STRING &&
+             js_string_value_len(r->right) + js_string_value_len(op2) <=
+             JS_STRING_ROPE_LEAF_LEN)) {
+            if (r->header.ref_count == 1) {
+                v = r->right;
+                r->right = JS_UNDEFINED;
+                v = js_concat_string_rope(ctx, v, op2);
+                if (JS_IsException(v)) {
+                    JS_FreeValue(ctx, op1);
+                    return JS_EXCEPTION;
                 }
+                r->right = v;
+                if (!js_string_rope_update(r))
+                    op1 = js_string_flatten_free(ctx, op1);
+                return op1;
+            } else {
+                v = js_concat_string_rope(ctx, JS_DupValue(ctx, r->right), op2);
+                if (JS_IsException(v)) {
+                    JS_FreeValue(ctx, op1);
+                    return JS_EXCEPTION;
+                }
+                op2 = v;
+                v = JS_DupValue(ctx, r->left);
+                JS_FreeValue(ctx, op1);
+                return js_new_string_rope(ctx, v, op2);
             }
-        } else if (!p2->is_wide_char) {
-            if (size1 >= sizeof(*p1) + p1->len + p2->len + 1) {
-                memcpy(p1->u.str8 + p1->len, p2->u.str8, p2->len);
-                p1->len += p2->len;
-                p1->u.str8[p1->len] = '\0';
-                return TRUE;
+        }
+    }
+
+    if (JS_VALUE_GET_TAG(op2) == JS_TAG_STRING_ROPE) {
+        /* prepend to the left child */
+        r = JS_VALUE_GET_PTR(op2);
+        if (js_string_value_depth(r->left) < js_string_value_depth(r->right) ||
+            (JS_VALUE_GET_TAG(r->left) == JS_TAG_STRING &&
+             JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
+             js_string_value_len(op1) + js_string_value_len(r->left) <=
+             JS_STRING_ROPE_LEAF_LEN)) {
+            if (r->header.ref_count == 1) {
+                v = r->left;
+                r->left = JS_UNDEFINED;
+                v = js_concat_string_rope(ctx, op1, v);
+                if (JS_IsException(v)) {
+                    JS_FreeValue(ctx, op2);
+                    return JS_EXCEPTION;
+                }
+                r->left = v;
+                if (!js_string_rope_update(r))
+                    op2 = js_string_flatten_free(ctx, op2);
+                return op2;
+            } else {
+                v = js_concat_string_rope(ctx, op1, JS_DupValue(ctx, r->left));
+                if (JS_IsException(v)) {
+                    JS_FreeValue(ctx, op2);
+                    return JS_EXCEPTION;
+                }
+                op1 = v;
+                v = JS_DupValue(ctx, r->right);
+                JS_FreeValue(ctx, op2);
+                return js_new_string_rope(ctx, op1, v);
             }
         }
     }
+    return js_new_string_rope(ctx, op1, op2);
+}
+
+/* Append p2 to the last leaf of the rope r without allocating, if the
+   path to the leaf is not shared. */
+static BOOL js_string_rope_append(JSContext *ctx, JSStringRope *r,
+                                  const JSString *p2)
+{
+    JSStringRope *r1;
+    JSValue v;
+
+    r1 = r;
+    for(;;) {
+        if (r1->header.ref_count != 1 || r1->depth == 0)
+            return FALSE;
+        v = r1->right;
+        if (JS_VALUE_GET_TAG(v) != JS_TAG_STRING_ROPE)
+            break;
+        r1 = JS_VALUE_GET_PTR(v);
+    }
+    if (!js_string_append_in_place(ctx, JS_VALUE_GET_STRING(v), p2))
+        return FALSE;
+    for(r1 = r;; r1 = JS_VALUE_GET_PTR(r1->right)) {
+        r1->len += p2->len;
+        if (JS_VALUE_GET_TAG(r1->right) != JS_TAG_STRING_ROPE)
+            break;
+    }
+    return TRUE;
+}
+
+/* op1 is a string or a rope. Return TRUE if op2 was appended to op1 */
+static BOOL JS_ConcatStringInPlace(JSContext *ctx, JSValueConst op1, JSValueConst op2) {
+    if (JS_VALUE_GET_TAG(op2) == JS_TAG_STRING) {
+        JSString *p2 = JS_VALUE_GET_STRING(op2);
+
+        if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE) {
+            if (p2->len == 0)
+                return TRUE;
+            if (((JSStringRope *)JS_VALUE_GET_PTR(op1))->len + p2->len >
+                JS_STRING_LEN_MAX)
+                return FALSE;
+            return js_string_rope_append(ctx, JS_VALUE_GET_PTR(op1), p2);
+        }
+        return js_string_append_in_place(ctx, JS_VALUE_GET_STRING(op1), p2);
+    }
     return FALSE;
 }
 
@@ -4267,29 +5189,46 @@ static BOOL JS_ConcatStringInPlace(JSContext *ctx, JSString *p1, JSValueConst op
 static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
 {
     JSValue ret;
-    JSString *p1, *p2;
+    uint32_t len1, len2;
 
-    if (unlikely(JS_VALUE_GET_TAG(op1) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op1)))) {
         op1 = JS_ToStringFree(ctx, op1);
         if (JS_IsException(op1)) {
             JS_FreeValue(ctx, op2);
             return JS_EXCEPTION;
         }
     }
-    if (unlikely(JS_VALUE_GET_TAG(op2) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op2)))) {
         op2 = JS_ToStringFree(ctx, op2);
         if (JS_IsException(op2)) {
             JS_FreeValue(ctx, op1);
             return JS_EXCEPTION;
         }
     }
-    p1 = JS_VALUE_GET_STRING(op1);
-    if (JS_ConcatStringInPlace(ctx, p1, op2)) {
+    if (JS_ConcatStringInPlace(ctx, op1, op2)) {
         JS_FreeValue(ctx, op2);
         return op1;
     }
-    p2 = JS_VALUE_GET_STRING(op2);
-    ret = JS_ConcatString1(ctx, p1, p2);
+    len1 = js_string_value_len(op1);
+    len2 = js_string_value_len(op2);
+    if (len1 == 0) {
+        JS_FreeValue(ctx, op1);
+        return op2;
+    }
+    if (len2 == 0) {
+        JS_FreeValue(ctx, op2);
+        return op1;
+    }
+    if (len1 + len2 > JS_STRING_LEN_MAX) {
+        ret = JS_ThrowInternalError(ctx, "string too long");
+    } else if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
+               JS_VALUE_GET_TAG(op2) == JS_TAG_STRING &&
+               len1 + len2 <= JS_STRING_ROPE_LEAF_LEN) {
+        ret = JS_ConcatString1(ctx, JS_VALUE_GET_STRING(op1),
+                               JS_VALUE_GET_STRING(op2));
+    } else {
+        return js_concat_string_rope(ctx, op1, op2);
+    }
     JS_FreeValue(ctx, op1);
     JS_FreeValue(ctx, op2);
     return ret;
@@ -4417,7 +5356,7 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
         resize_shape_hash(rt, rt->shape_hash_bits + 1);
     }
 
-    sh_alloc = js_malloc(ctx, get_shape_size(hash_size, prop_size));
+    sh_alloc = js_pool_malloc(ctx, get_shape_size(hash_size, prop_size));
     if (!sh_alloc)
         return NULL;
     sh = get_shape_from_alloc(sh_alloc, hash_size);
@@ -4459,7 +5398,7 @@ static JSShape *js_clone_shape(JSContext *ctx, JSShape *sh1)
 
     hash_size = sh1->prop_hash_mask + 1;
     size = get_shape_size(hash_size, sh1->prop_size);
-    sh_alloc = js_malloc(ctx, size);
+    sh_alloc = js_pool_malloc(ctx, size);
     if (!sh_alloc)
         return NULL;
     sh_alloc1 = get_alloc_from_shape(sh1);
@@ -4500,7 +5439,8 @@ static void js_free_shape0(JSRuntime *rt, JSShape *sh)
         pr++;
     }
     remove_gc_object(&sh->header);
-    js_free_rt(rt, get_alloc_from_shape(sh));
+    js_pool_free_rt(rt, get_alloc_from_shape(sh),
+                    get_shape_size(sh->prop_hash_mask + 1, sh->prop_size));
 }
 
 static void js_free_shape(JSRuntime *rt, JSShape *sh)
@@ -4544,15 +5484,16 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
     /* resize the property shapes. Using js_realloc() is not possible in
        case the GC runs during the allocation */
     old_sh = sh;
-    sh_alloc = js_malloc(ctx, get_shape_size(new_hash_size, new_size));
+    sh_alloc = js_pool_malloc(ctx, get_shape_size(new_hash_size, new_size));
     if (!sh_alloc)
         return -1;
     sh = get_shape_from_alloc(sh_alloc, new_hash_size);
-    list_del(&old_sh->header.link);
     /* copy all the shape properties */
     memcpy(sh, old_sh,
            sizeof(JSShape) + sizeof(sh->prop[0]) * old_sh->prop_count);
-    list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+    /* replace the old shape in its GC object list */
+    list_add_tail(&sh->header.link, &old_sh->header.link);
+    list_del(&old_sh->header.link);
 
     if (new_hash_size != (sh->prop_hash_mask + 1)) {
         /* resize the hash table and the properties */
@@ -4572,7 +5513,9 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
         memcpy(prop_hash_end(sh) - new_hash_size, prop_hash_end(old_sh) - new_hash_size,
                sizeof(prop_hash_end(sh)[0]) * new_hash_size);
     }
-    js_free(ctx, get_alloc_from_shape(old_sh));
+    js_pool_free_rt(ctx->rt, get_alloc_from_shape(old_sh),
+                    get_shape_size(old_sh->prop_hash_mask + 1,
+                                   old_sh->prop_size));
     *psh = sh;
     sh->prop_size = new_size;
     return 0;
@@ -4602,13 +5545,14 @@ static int compact_properties(JSContext *ctx, JSObject *p)
 
     /* resize the hash table and the properties */
     old_sh = sh;
-    sh_alloc = js_malloc(ctx, get_shape_size(new_hash_size, new_size));
+    sh_alloc = js_pool_malloc(ctx, get_shape_size(new_hash_size, new_size));
     if (!sh_alloc)
         return -1;
     sh = get_shape_from_alloc(sh_alloc, new_hash_size);
-    list_del(&old_sh->header.link);
     memcpy(sh, old_sh, sizeof(JSShape));
-    list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+    /* replace the old shape in its GC object list */
+    list_add_tail(&sh->header.link, &old_sh->header.link);
+    list_del(&old_sh->header.link);
 
     memset(prop_hash_end(sh) - new_hash_size, 0,
            sizeof(prop_hash_end(sh)[0]) * new_hash_size);
@@ -4637,7 +5581,9 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     sh->prop_count = j;
 
     p->shape = sh;
-    js_free(ctx, get_alloc_from_shape(old_sh));
+    js_pool_free_rt(ctx->rt, get_alloc_from_shape(old_sh),
+                    get_shape_size(old_sh->prop_hash_mask + 1,
+                                   old_sh->prop_size));
 
     /* reduce the size of the object properties */
     new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
@@ -4775,6 +5721,7 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
         }
     }
     /* dump non-hashed shapes */
+    gc_merge_lists(rt);
     list_for_each(el, &rt->gc_obj_list) {
         gp = list_entry(el, JSGCObjectHeader, link);
         if (gp->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
@@ -4792,7 +5739,7 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     JSObject *p;
 
     js_trigger_gc(ctx->rt, sizeof(JSObject));
-    p = js_malloc(ctx, sizeof(JSObject));
+    p = js_pool_malloc(ctx, sizeof(JSObject));
     if (unlikely(!p))
         goto fail;
     p->class_id = class_id;
@@ -4809,7 +5756,7 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     p->shape = sh;
     p->prop = js_malloc(ctx, sizeof(JSProperty) * sh->prop_size);
     if (unlikely(!p->prop)) {
-        js_free(ctx, p);
+        js_pool_free_rt(ctx->rt, p, sizeof(JSObject));
     fail:
         js_free_shape(ctx->rt, sh);
         return JS_EXCEPTION;
@@ -4827,7 +5774,8 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
             p->u.array.count = 0;
             p->u.array.u1.size = 0;
             /* the length property is always the first one */
-            if (likely(sh == ctx->array_shape)) {
+            if (likely(sh == ctx->array_shape ||
+                       sh == ctx->regexp_result_shape)) {
                 pr = &p->prop[0];
             } else {
                 /* only used for the first array */
@@ -4877,6 +5825,7 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     case JS_CLASS_REGEXP:
         p->u.regexp.pattern = NULL;
         p->u.regexp.bytecode = NULL;
+        p->u.regexp.exec_count = 0;
         goto set_exotic;
     default:
     set_exotic:
@@ -5308,7 +6257,7 @@ static void free_var_ref(JSRuntime *rt, JSVarRef *var_ref)
                     async_func_free(rt, var_ref->async_func);
             }
             remove_gc_object(&var_ref->header);
-            js_free_rt(rt, var_ref);
+            js_pool_free_rt(rt, var_ref, sizeof(JSVarRef));
         }
     }
 }
@@ -5510,7 +6459,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && p->header.ref_count != 0) {
         list_add_tail(&p->header.link, &rt->gc_zero_ref_count_list);
     } else {
-        js_free_rt(rt, p);
+        js_pool_free_rt(rt, p, sizeof(JSObject));
     }
 }
 
@@ -5548,6 +6497,19 @@ static void free_zero_refcount(JSRuntime *rt)
     rt->gc_phase = JS_GC_PHASE_NONE;
 }
 
+/* Called when the ref_count of 'p' reaches zero while the cycles are
+   removed and 'p' is not one of the objects being freed (mark = 0).
+   It happens in a young collection or a GC step when an object outside
+   of the scanned set was only referenced by the freed cycles. 'p' is
+   added to tmp_obj_list so that gc_free_cycles() frees it in the same
+   pass. */
+static void gc_free_unmarked(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    p->mark = 1;
+    list_del(&p->link);
+    list_add_tail(&p->link, &rt->tmp_obj_list);
+}
+
 /* called with the ref_count of 'v' reaches zero. */
 void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
 {
@@ -5579,6 +6541,14 @@ void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
             }
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(v);
+            JS_FreeValueRT(rt, r->left);
+            JS_FreeValueRT(rt, r->right);
+            js_pool_free_rt(rt, r, sizeof(JSStringRope));
+        }
+        break;
     case JS_TAG_OBJECT:
     case JS_TAG_FUNCTION_BYTECODE:
         {
@@ -5589,6 +6559,8 @@ void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
                 if (rt->gc_phase == JS_GC_PHASE_NONE) {
                     free_zero_refcount(rt);
                 }
+            } else if (p->mark == 0) {
+                gc_free_unmarked(rt, p);
             }
         }
         break;
@@ -5638,7 +6610,12 @@ static void add_gc_object(JSRuntime *rt, JSGCObjectHeader *h,
 {
     h->mark = 0;
     h->gc_obj_type = type;
-    list_add_tail(&h->link, &rt->gc_obj_list);
+    h->is_young = rt->gc_generational;
+    h->gc_epoch = rt->gc_epoch;
+    if (h->is_young)
+        list_add_tail(&h->link, &rt->gc_young_obj_list);
+    else
+        list_add_tail(&h->link, &rt->gc_obj_list);
 }
 
 static void remove_gc_object(JSGCObjectHeader *h)
@@ -5713,6 +6690,15 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
             for(i = 0; i < b->cpool_count; i++) {
                 JS_MarkValue(rt, b->cpool[i], mark_func);
             }
+            for(i = 0; i < b->ic_count; i++) {
+                JSInlineCache *ic = &b->ic[i];
+                int j;
+                for(j = 0; j < ic->count; j++) {
+                    mark_func(rt, &ic->entries[j].shape->header);
+                    if (ic->entries[j].proto_shape)
+                        mark_func(rt, &ic->entries[j].proto_shape->header);
+                }
+            }
             if (b->realm)
                 mark_func(rt, &b->realm->header);
         }
@@ -5779,7 +6765,17 @@ static void gc_decref_child(JSRuntime *rt, JSGCObjectHeader *p)
     }
 }
 
-static void gc_decref(JSRuntime *rt)
+/* in a young collection, the references to the old objects are
+   ignored so that only the cycles of young objects are freed. The old
+   objects referencing young objects are handled as roots. */
+static void gc_decref_young_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->is_young)
+        gc_decref_child(rt, p);
+}
+
+static void gc_decref1(JSRuntime *rt, struct list_head *obj_list,
+                       JS_MarkFunc *decref_child)
 {
     struct list_head *el, *el1;
     JSGCObjectHeader *p;
@@ -5789,11 +6785,12 @@ static void gc_decref(JSRuntime *rt)
     /* decrement the refcount of all the children of all the GC
        objects and move the GC objects with zero refcount to
        tmp_obj_list */
-    list_for_each_safe(el, el1, &rt->gc_obj_list) {
+    list_for_each_safe(el, el1, obj_list) {
         p = list_entry(el, JSGCObjectHeader, link);
         assert(p->mark == 0);
-        mark_children(rt, p, gc_decref_child);
+        mark_children(rt, p, decref_child);
         p->mark = 1;
+        p->gc_epoch = rt->gc_epoch;
         if (p->ref_count == 0) {
             list_del(&p->link);
             list_add_tail(&p->link, &rt->tmp_obj_list);
@@ -5801,6 +6798,11 @@ static void gc_decref(JSRuntime *rt)
     }
 }
 
+static void gc_decref(JSRuntime *rt)
+{
+    gc_decref1(rt, &rt->gc_obj_list, gc_decref_child);
+}
+
 static void gc_scan_incref_child(JSRuntime *rt, JSGCObjectHeader *p)
 {
     p->ref_count++;
@@ -5818,26 +6820,51 @@ static void gc_scan_incref_child2(JSRuntime *rt, JSGCObjectHeader *p)
     p->ref_count++;
 }
 
-static void gc_scan(JSRuntime *rt)
+static void gc_scan_incref_young_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->is_young) {
+        p->ref_count++;
+        if (p->ref_count == 1) {
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->gc_young_obj_list);
+            p->mark = 0;
+        }
+    }
+}
+
+static void gc_scan_incref_young_child2(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->is_young)
+        p->ref_count++;
+}
+
+static void gc_scan1(JSRuntime *rt, struct list_head *obj_list,
+                     JS_MarkFunc *incref_child, JS_MarkFunc *incref_child2)
 {
     struct list_head *el;
     JSGCObjectHeader *p;
 
     /* keep the objects with a refcount > 0 and their children. */
-    list_for_each(el, &rt->gc_obj_list) {
+    list_for_each(el, obj_list) {
         p = list_entry(el, JSGCObjectHeader, link);
         assert(p->ref_count > 0);
         p->mark = 0; /* reset the mark for the next GC call */
-        mark_children(rt, p, gc_scan_incref_child);
+        mark_children(rt, p, incref_child);
     }
 
     /* restore the refcount of the objects to be deleted. */
     list_for_each(el, &rt->tmp_obj_list) {
         p = list_entry(el, JSGCObjectHeader, link);
-        mark_children(rt, p, gc_scan_incref_child2);
+        mark_children(rt, p, incref_child2);
     }
 }
 
+static void gc_scan(JSRuntime *rt)
+{
+    gc_scan1(rt, &rt->gc_obj_list, gc_scan_incref_child,
+             gc_scan_incref_child2);
+}
+
 static void gc_free_cycles(JSRuntime *rt)
 {
     struct list_head *el, *el1;
@@ -5883,14 +6910,318 @@ static void gc_free_cycles(JSRuntime *rt)
         assert(p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT ||
                p->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE ||
                p->gc_obj_type == JS_GC_OBJ_TYPE_ASYNC_FUNCTION);
-        js_free_rt(rt, p);
+        if (p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT)
+            js_pool_free_rt(rt, p, sizeof(JSObject));
+        else
+            js_free_rt(rt, p);
     }
 
     init_list_head(&rt->gc_zero_ref_count_list);
 }
 
+/* move the young objects to the old generation */
+static void gc_promote_young(JSRuntime *rt)
+{
+    struct list_head *el, *el1;
+    JSGCObjectHeader *p;
+
+    list_for_each_safe(el, el1, &rt->gc_young_obj_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        p->is_young = FALSE;
+        p->gc_epoch = rt->gc_epoch;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_obj_list);
+    }
+}
+
+/* move all the GC objects to gc_obj_list. The marking of a pending
+   incremental pass is stopped: the gray objects are considered as
+   scanned. */
+static void gc_merge_lists(JSRuntime *rt)
+{
+    struct list_head *el, *el1;
+
+    list_for_each_safe(el, el1, &rt->gc_gray_obj_list) {
+        list_del(el);
+        list_add_tail(el, &rt->gc_obj_list);
+    }
+    gc_promote_young(rt);
+}
+
+static int64_t gc_get_time_us(void)
+{
+    struct timespec ts;
+    clock_getmonotonic(&ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void gc_update_stats(JSRuntime *rt, int64_t start_time)
+{
+    JSGCStats *st = &rt->gc_stats;
+    int64_t pause;
+    int i;
+
+    pause = max_int64(gc_get_time_us() - start_time, 0);
+    st->total_pause_us += pause;
+    st->max_pause_us = max_int64(st->max_pause_us, pause);
+    /* bucket i > 0 contains the pauses in [2^(i-1), 2^i[ us */
+    i = 0;
+    if (pause != 0)
+        i = min_int(64 - clz64(pause), JS_GC_PAUSE_HISTOGRAM_SIZE - 1);
+    st->pause_histogram[i]++;
+}
+
+/* collect the cycles made only of young objects. The surviving young
+   objects are promoted to the old generation. */
+static void gc_collect_young(JSRuntime *rt)
+{
+    gc_decref1(rt, &rt->gc_young_obj_list, gc_decref_young_child);
+    gc_scan1(rt, &rt->gc_young_obj_list, gc_scan_incref_young_child,
+             gc_scan_incref_young_child2);
+    gc_free_cycles(rt);
+    gc_promote_young(rt);
+}
+
+static void gc_run_young(JSRuntime *rt)
+{
+    int64_t start_time = gc_get_time_us();
+
+    gc_collect_young(rt);
+    rt->gc_stats.young_count++;
+    gc_update_stats(rt, start_time);
+}
+
+/* Incremental collection. A pass has two phases:
+
+   - marking: the objects reachable from the contexts and the pending
+     jobs are marked alive by traversing gc_gray_obj_list, a part of
+     it at each step. They are moved to the tail of gc_obj_list.
+
+   - collection: the remaining old objects are scanned in slices
+     taken from the head of gc_obj_list. A slice is extended with the
+     unscanned old objects referenced by its objects and by the young
+     objects, so that a cycle is usually contained in a single slice.
+     It is collected together with the young objects exactly as a
+     young collection.
+
+   The objects marked or scanned in the pass have gc_epoch =
+   rt->gc_epoch, so the pass is finished when the head of gc_obj_list
+   has the current epoch. The mutator only runs between the steps and
+   the marking is only used to choose the slices: any reference from
+   outside a slice is a root, so a step never frees a live object
+   whatever the modifications done since the previous steps, and no
+   write barrier is needed. The objects which become alive only
+   through a marked object are scanned as unreachable ones, and the
+   garbage cycles larger than a slice are not freed by the steps: they
+   are left to JS_RunGC(), which the automatic GC runs when the memory
+   usage reaches twice gc_full_threshold. Its pause is not bounded by
+   the budget and it is counted in gc_stats.fallback_count. The
+   objects allocated during a pass are scanned by the next one, so
+   js_trigger_gc() runs the steps more often as the memory usage
+   approaches this limit. */
+
+/* mark 'p' as alive if it is an old object not scanned in this pass */
+static void gc_mark_alive_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (!p->is_young && p->gc_epoch != rt->gc_epoch) {
+        p->gc_epoch = rt->gc_epoch;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_gray_obj_list);
+        rt->gc_slice_len++;
+    }
+}
+
+/* add 'p' to the current slice if it is an old object not scanned in
+   this pass */
+static void gc_add_slice_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (!p->is_young && p->gc_epoch != rt->gc_epoch &&
+        rt->gc_slice_len < rt->gc_step_size) {
+        p->is_young = TRUE;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_young_obj_list);
+        rt->gc_slice_len++;
+    }
+}
+
+static void gc_start_pass(JSRuntime *rt)
+{
+    struct list_head *el;
+    JSContext *ctx;
+    JSJobEntry *e;
+    int i;
+
+    if (rt->gc_pass_pending)
+        return;
+    rt->gc_epoch ^= 1;
+    rt->gc_pass_pending = TRUE;
+    rt->gc_pass_start_size = js_gc_used_size(rt);
+    rt->gc_pass_freed_size = 0;
+    list_for_each(el, &rt->context_list) {
+        ctx = list_entry(el, JSContext, link);
+        gc_mark_alive_child(rt, &ctx->header);
+    }
+    list_for_each(el, &rt->job_list) {
+        e = list_entry(el, JSJobEntry, link);
+        for(i = 0; i < e->argc; i++)
+            JS_MarkValue(rt, e->argv[i], gc_mark_alive_child);
+    }
+}
+
+/* mark the gray objects until about gc_mark_step_size objects are
+   traversed or marked. The children of an object are all marked in
+   the same step. Return the amount of work done. */
+static int gc_mark_step(JSRuntime *rt)
+{
+    struct list_head *el;
+    JSGCObjectHeader *p;
+
+    rt->gc_slice_len = 0;
+    while (rt->gc_slice_len < rt->gc_mark_step_size) {
+        el = rt->gc_gray_obj_list.next;
+        if (el == &rt->gc_gray_obj_list)
+            break;
+        p = list_entry(el, JSGCObjectHeader, link);
+        mark_children(rt, p, gc_mark_alive_child);
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_obj_list);
+        rt->gc_slice_len++;
+    }
+    return rt->gc_slice_len;
+}
+
+/* move a slice of at most gc_step_size old objects to the young
+   objects. Return its length. */
+static int gc_take_slice(JSRuntime *rt)
+{
+    struct list_head *el;
+    JSGCObjectHeader *p;
+
+    rt->gc_slice_len = 0;
+    el = rt->gc_young_obj_list.next;
+    for(;;) {
+        if (el == &rt->gc_young_obj_list) {
+            /* all the objects of the slice are extended: take the
+               next unscanned object */
+            if (rt->gc_slice_len >= rt->gc_step_size)
+                break;
+            el = rt->gc_obj_list.next;
+            if (el == &rt->gc_obj_list)
+                break;
+            p = list_entry(el, JSGCObjectHeader, link);
+            if (p->gc_epoch == rt->gc_epoch) {
+                /* all the objects have been scanned */
+                rt->gc_pass_pending = FALSE;
+                break;
+            }
+            gc_add_slice_child(rt, p);
+            el = &p->link;
+        }
+        p = list_entry(el, JSGCObjectHeader, link);
+        if (rt->gc_slice_len < rt->gc_step_size)
+            mark_children(rt, p, gc_add_slice_child);
+        el = el->next;
+    }
+    return rt->gc_slice_len;
+}
+
+/* adapt the number of objects processed per step so that the next
+   step fits in the budget. 'n' objects were processed in 'pause'
+   us. */
+static void gc_adapt_step_size(int *psize, int n, int64_t pause,
+                               int64_t budget_us)
+{
+    int size;
+
+    if (n < *psize || budget_us <= 0)
+        return;
+    /* aim at 3/4 of the budget, at most doubling the size */
+    if (pause * 2 < budget_us)
+        size = n * 2;
+    else
+        size = (int)((int64_t)n * budget_us * 3 / (pause * 4));
+    *psize = max_int(min_int(size, JS_GC_STEP_MAX_SIZE), JS_GC_STEP_MIN_SIZE);
+}
+
+static void gc_run_step(JSRuntime *rt, int64_t budget_us)
+{
+    int64_t start_time;
+    int n, *psize;
+    BOOL is_step;
+    size_t used_size, live_size;
+
+    start_time = gc_get_time_us();
+    n = 0;
+    psize = NULL;
+    /* without a pending pass, only the young objects are collected */
+    is_step = rt->gc_pass_pending;
+    if (is_step) {
+        /* marking an object is much faster than collecting it, so
+           each phase has its own step size */
+        if (!list_empty(&rt->gc_gray_obj_list)) {
+            n = gc_mark_step(rt);
+            psize = &rt->gc_mark_step_size;
+        } else {
+            n = gc_take_slice(rt);
+            psize = &rt->gc_step_size;
+        }
+    }
+
+    used_size = js_gc_used_size(rt);
+    gc_collect_young(rt);
+    if (is_step && js_gc_used_size(rt) < used_size)
+        rt->gc_pass_freed_size += used_size - js_gc_used_size(rt);
+    if (is_step && !rt->gc_pass_pending) {
+        /* js_pool_trim() is not called because its cost is not
+           bounded: the free pool items are reused by the next
+           allocations. The objects allocated during the pass are not
+           scanned, so the live size is estimated from the size at its
+           start. */
+        live_size = 0;
+        if (rt->gc_pass_start_size > rt->gc_pass_freed_size)
+            live_size = rt->gc_pass_start_size - rt->gc_pass_freed_size;
+        rt->gc_full_threshold = live_size + (live_size >> 1);
+    }
+    if (is_step)
+        rt->gc_stats.step_count++;
+    else
+        rt->gc_stats.young_count++;
+    gc_update_stats(rt, start_time);
+
+    if (psize)
+        gc_adapt_step_size(psize, n, gc_get_time_us() - start_time, budget_us);
+}
+
+BOOL JS_RunGCStep(JSRuntime *rt, int64_t budget_us)
+{
+    if (budget_us <= 0)
+        budget_us = rt->gc_pause_budget;
+    gc_start_pass(rt);
+    gc_run_step(rt, budget_us);
+    return rt->gc_pass_pending;
+}
+
+BOOL JS_IsGCPending(JSRuntime *rt)
+{
+    return rt->gc_pass_pending;
+}
+
+void JS_SetGCPauseBudget(JSRuntime *rt, int64_t budget_us)
+{
+    rt->gc_pause_budget = max_int64(budget_us, 0);
+    rt->gc_full_threshold = rt->malloc_gc_threshold;
+}
+
 void JS_RunGC(JSRuntime *rt)
 {
+    int64_t start_time = gc_get_time_us();
+
+    /* a pending incremental pass is finished by this collection */
+    rt->gc_pass_pending = FALSE;
+
+    /* all the objects are scanned */
+    gc_merge_lists(rt);
+
     /* decrement the reference of the children of each object. mark =
        1 after this pass. */
     gc_decref(rt);
@@ -5900,6 +7231,24 @@ void JS_RunGC(JSRuntime *rt)
 
     /* free the GC objects in a cycle */
     gc_free_cycles(rt);
+
+    js_pool_trim(rt);
+
+    rt->gc_stats.full_count++;
+    gc_update_stats(rt, start_time);
+}
+
+void JS_EnableGenerationalGC(JSRuntime *rt, BOOL enable)
+{
+    if (!enable)
+        gc_merge_lists(rt);
+    rt->gc_generational = enable;
+    rt->gc_full_threshold = rt->malloc_gc_threshold;
+}
+
+void JS_GetGCStats(JSRuntime *rt, JSGCStats *s)
+{
+    *s = rt->gc_stats;
 }
 
 /* Return false if not an object or if the object has already been
@@ -5961,6 +7310,10 @@ static void compute_bytecode_size(JSFunctionBytecode *b, JSMemoryUsage_helper *h
     if (!b->read_only_bytecode && b->byte_code_buf) {
         hp->js_func_code_size += b->byte_code_len;
     }
+    if (b->ic) {
+        memory_used_count++;
+        js_func_size += b->ic_count * sizeof(*b->ic);
+    }
     if (b->has_debug) {
         js_func_size += sizeof(*b) - offsetof(JSFunctionBytecode, debug);
         if (b->debug.source) {
@@ -6000,6 +7353,9 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
     int i;
     JSMemoryUsage_helper mem = { 0 }, *hp = &mem;
 
+    /* so that gc_obj_list contains all the GC objects */
+    gc_merge_lists(rt);
+
     memset(s, 0, sizeof(*s));
     s->malloc_count = rt->malloc_state.malloc_count;
     s->malloc_size = rt->malloc_state.malloc_size;
@@ -6323,6 +7679,7 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
             int obj_classes[JS_CLASS_INIT_COUNT + 1] = { 0 };
             int class_id;
             struct list_head *el;
+            gc_merge_lists(rt);
             list_for_each(el, &rt->gc_obj_list) {
                 JSGCObjectHeader *gp = list_entry(el, JSGCObjectHeader, link);
                 JSObject *p;
@@ -6992,6 +8349,7 @@ static JSValueConst JS_GetPrototypePrimitive(JSContext *ctx, JSValueConst val)
         val = ctx->class_proto[JS_CLASS_BOOLEAN];
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = ctx->class_proto[JS_CLASS_STRING];
         break;
     case JS_TAG_SYMBOL:
@@ -7205,6 +8563,21 @@ JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
                 }
             }
             break;
+        case JS_TAG_STRING_ROPE:
+            {
+                JSStringRope *r = JS_VALUE_GET_PTR(obj);
+                if (__JS_AtomIsTaggedInt(prop)) {
+                    if (__JS_AtomToUInt32(prop) < r->len) {
+                        if (!js_string_rope_flatten(ctx, r))
+                            return JS_EXCEPTION;
+                        return JS_GetPropertyInternal(ctx, r->left, prop,
+                                                      this_obj, throw_ref_error);
+                    }
+                } else if (prop == JS_ATOM_length) {
+                    return JS_NewInt32(ctx, r->len);
+                }
+            }
+            break;
         default:
             break;
         }
@@ -8106,17 +9479,21 @@ static JSProperty *add_property(JSContext *ctx,
             p->shape = js_dup_shape(new_sh);
             js_free_shape(ctx->rt, sh);
             return &p->prop[new_sh->prop_count - 1];
-        } else if (sh->header.ref_count != 1) {
-            /* if the shape is shared, clone it */
-            new_sh = js_clone_shape(ctx, sh);
-            if (!new_sh)
-                return NULL;
+        }
+    }
+    if (sh->header.ref_count != 1) {
+        /* if the shape is shared (it can be an unhashed shape
+           referenced by an inline cache), clone it */
+        new_sh = js_clone_shape(ctx, sh);
+        if (!new_sh)
+            return NULL;
+        if (sh->is_hashed) {
             /* hash the cloned shape */
             new_sh->is_hashed = TRUE;
             js_shape_hash_link(ctx->rt, new_sh);
-            js_free_shape(ctx->rt, p->shape);
-            p->shape = new_sh;
         }
+        js_free_shape(ctx->rt, p->shape);
+        p->shape = new_sh;
     }
     assert(p->shape->header.ref_count == 1);
     if (add_shape_property(ctx, &p->shape, p, prop, prop_flags))
@@ -9050,22 +10427,20 @@ static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
     uint32_t idx = 0;    /* prevent warning */
 
     sh = p->shape;
-    if (sh->is_hashed) {
-        if (sh->header.ref_count != 1) {
-            if (pprs)
-                idx = *pprs - get_shape_prop(sh);
-            /* clone the shape (the resulting one is no longer hashed) */
-            sh = js_clone_shape(ctx, sh);
-            if (!sh)
-                return -1;
-            js_free_shape(ctx->rt, p->shape);
-            p->shape = sh;
-            if (pprs)
-                *pprs = get_shape_prop(sh) + idx;
-        } else {
-            js_shape_hash_unlink(ctx->rt, sh);
-            sh->is_hashed = FALSE;
-        }
+    if (sh->header.ref_count != 1) {
+        if (pprs)
+            idx = *pprs - get_shape_prop(sh);
+        /* clone the shape (the resulting one is no longer hashed) */
+        sh = js_clone_shape(ctx, sh);
+        if (!sh)
+            return -1;
+        js_free_shape(ctx->rt, p->shape);
+        p->shape = sh;
+        if (pprs)
+            *pprs = get_shape_prop(sh) + idx;
+    } else if (sh->is_hashed) {
+        js_shape_hash_unlink(ctx->rt, sh);
+        sh->is_hashed = FALSE;
     }
     return 0;
 }
@@ -10008,6 +11383,10 @@ static int JS_ToBoolFree(JSContext *ctx, JSValue val)
             JS_FreeValue(ctx, val);
             return ret;
         }
+    case JS_TAG_STRING_ROPE:
+        /* a rope is never empty */
+        JS_FreeValue(ctx, val);
+        return TRUE;
     case JS_TAG_BIG_INT:
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_FLOAT:
@@ -10539,6 +11918,7 @@ static JSValue JS_ToNumberHintFree(JSContext *ctx, JSValue val,
             return JS_EXCEPTION;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str;
             const char *p;
@@ -11782,6 +13162,13 @@ JSValue JS_ToStringInternal(JSContext *ctx, JSValueConst val, BOOL is_ToProperty
     switch(tag) {
     case JS_TAG_STRING:
         return JS_DupValue(ctx, val);
+    case JS_TAG_STRING_ROPE:
+        {
+            JSString *p = js_string_rope_flatten(ctx, JS_VALUE_GET_PTR(val));
+            if (!p)
+                return JS_EXCEPTION;
+            return JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, p));
+        }
     case JS_TAG_INT:
         snprintf(buf, sizeof(buf), "%d", JS_VALUE_GET_INT(val));
         str = buf;
@@ -11866,26 +13253,55 @@ static JSValue JS_ToStringCheckObject(JSContext *ctx, JSValueConst val)
     return JS_ToString(ctx, val);
 }
 
-static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
+/* Return the first character of str8[i..len) which must be escaped in
+   a JSON string */
+static uint32_t find_quoted_char8(const uint8_t *str8, uint32_t i,
+                                  uint32_t len)
 {
-    JSValue val;
-    JSString *p;
-    int i;
-    uint32_t c;
-    StringBuffer b_s, *b = &b_s;
-    char buf[16];
+#if defined(__SSE2__)
+    const __m128i v_quote = _mm_set1_epi8('\"');
+    const __m128i v_bs = _mm_set1_epi8('\\');
+    const __m128i v_ctrl = _mm_set1_epi8(0x1f);
+    __m128i v, m;
+    int mask;
 
-    val = JS_ToStringCheckObject(ctx, val1);
-    if (JS_IsException(val))
-        return val;
-    p = JS_VALUE_GET_STRING(val);
+    while (len - i >= 16) {
+        v = _mm_loadu_si128((const __m128i *)(str8 + i));
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, v_quote), _mm_cmpeq_epi8(v, v_bs));
+        /* unsigned v <= 0x1f */
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, v_ctrl), v));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0)
+            return i + ctz32(mask);
+        i += 16;
+    }
+#endif
+    while (i < len && str8[i] != '\"' && str8[i] != '\\' && str8[i] >= 0x20)
+        i++;
+    return i;
+}
 
-    if (string_buffer_init(ctx, b, p->len + 2))
-        goto fail;
+/* append the JSON quoted form of 'p' to 'b' */
+static int string_buffer_put_quoted(StringBuffer *b, JSString *p)
+{
+    int i;
+    uint32_t j, c;
+    char buf[16];
 
     if (string_buffer_putc8(b, '\"'))
-        goto fail;
+        return -1;
     for(i = 0; i < p->len; ) {
+        if (!p->is_wide_char) {
+            /* copy the characters which need no escape at once */
+            j = find_quoted_char8(p->u.str8, i, p->len);
+            if (j > i) {
+                if (string_buffer_write8(b, p->u.str8 + i, j - i))
+                    return -1;
+                i = j;
+                if (i >= p->len)
+                    break;
+            }
+        }
         c = string_getc(p, &i);
         switch(c) {
         case '\t':
@@ -11907,23 +13323,39 @@ static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
         case '\\':
         quote:
             if (string_buffer_putc8(b, '\\'))
-                goto fail;
+                return -1;
             if (string_buffer_putc8(b, c))
-                goto fail;
+                return -1;
             break;
         default:
             if (c < 32 || is_surrogate(c)) {
                 snprintf(buf, sizeof(buf), "\\u%04x", c);
                 if (string_buffer_puts8(b, buf))
-                    goto fail;
+                    return -1;
             } else {
                 if (string_buffer_putc(b, c))
-                    goto fail;
+                    return -1;
             }
             break;
         }
     }
-    if (string_buffer_putc8(b, '\"'))
+    return string_buffer_putc8(b, '\"');
+}
+
+static JSValue JS_ToQuotedString(JSContext *ctx, JSValueConst val1)
+{
+    JSValue val;
+    JSString *p;
+    StringBuffer b_s, *b = &b_s;
+
+    val = JS_ToStringCheckObject(ctx, val1);
+    if (JS_IsException(val))
+        return val;
+    p = JS_VALUE_GET_STRING(val);
+
+    if (string_buffer_init(ctx, b, p->len + 2))
+        goto fail;
+    if (string_buffer_put_quoted(b, p))
         goto fail;
     JS_FreeValue(ctx, val);
     return string_buffer_end(b);
@@ -12148,6 +13580,12 @@ static __maybe_unused void JS_DumpValueShort(JSRuntime *rt,
             JS_DumpString(rt, p);
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(val);
+            printf("[rope len=%u depth=%d]", r->len, r->depth);
+        }
+        break;
     case JS_TAG_FUNCTION_BYTECODE:
         {
             JSFunctionBytecode *b = JS_VALUE_GET_PTR(val);
@@ -12365,6 +13803,11 @@ static bf_t *JS_ToBigIntFree(JSContext *ctx, bf_t *buf, JSValue val)
         if (JS_IsException(val))
             return NULL;
         goto redo;
+    case JS_TAG_STRING_ROPE:
+        val = js_string_flatten_free(ctx, val);
+        if (JS_IsException(val))
+            return NULL;
+        goto redo;
     case JS_TAG_OBJECT:
         val = JS_ToPrimitiveFree(ctx, val, HINT_NUMBER);
         if (JS_IsException(val))
@@ -13763,10 +15206,10 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         /* try to call an overloaded operator */
         if ((tag1 == JS_TAG_OBJECT &&
              (tag2 != JS_TAG_NULL && tag2 != JS_TAG_UNDEFINED &&
-              tag2 != JS_TAG_STRING)) ||
+              !tag_is_string(tag2))) ||
             (tag2 == JS_TAG_OBJECT &&
              (tag1 != JS_TAG_NULL && tag1 != JS_TAG_UNDEFINED &&
-              tag1 != JS_TAG_STRING))) {
+              !tag_is_string(tag1)))) {
             JSValue res;
             int ret = js_call_binary_op_fallback(ctx, &res, op1, op2, OP_add,
                                                  FALSE, HINT_NONE);
@@ -13797,7 +15240,7 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         tag2 = JS_VALUE_GET_NORM_TAG(op2);
     }
 
-    if (tag1 == JS_TAG_STRING || tag2 == JS_TAG_STRING) {
+    if (tag_is_string(tag1) || tag_is_string(tag2)) {
         sp[-2] = JS_ConcatString(ctx, op1, op2);
         if (JS_IsException(sp[-2]))
             goto exception;
@@ -14091,6 +15534,16 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
         JS_FreeValue(ctx, op1);
         goto exception;
     }
+    op1 = js_string_flatten_free(ctx, op1);
+    if (JS_IsException(op1)) {
+        JS_FreeValue(ctx, op2);
+        goto exception;
+    }
+    op2 = js_string_flatten_free(ctx, op2);
+    if (JS_IsException(op2)) {
+        JS_FreeValue(ctx, op1);
+        goto exception;
+    }
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
 
@@ -14234,6 +15687,16 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
     op1 = sp[-2];
     op2 = sp[-1];
  redo:
+    op1 = js_string_flatten_free(ctx, op1);
+    if (JS_IsException(op1)) {
+        JS_FreeValue(ctx, op2);
+        goto exception;
+    }
+    op2 = js_string_flatten_free(ctx, op2);
+    if (JS_IsException(op2)) {
+        JS_FreeValue(ctx, op1);
+        goto exception;
+    }
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
     if (tag_is_number(tag1) && tag_is_number(tag2)) {
@@ -14510,14 +15973,23 @@ static BOOL js_strict_eq2(JSContext *ctx, JSValue op1, JSValue op2,
         res = (tag1 == tag2);
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             JSString *p1, *p2;
-            if (tag1 != tag2) {
+            if (!tag_is_string(tag2)) {
+                res = FALSE;
+            } else if (js_string_value_len(op1) != js_string_value_len(op2)) {
                 res = FALSE;
             } else {
-                p1 = JS_VALUE_GET_STRING(op1);
-                p2 = JS_VALUE_GET_STRING(op2);
-                res = (js_string_compare(ctx, p1, p2) == 0);
+                p1 = js_string_value_get(ctx, op1);
+                p2 = js_string_value_get(ctx, op2);
+                if (!p1 || !p2) {
+                    /* out of memory: the exception cannot be returned */
+                    JS_FreeValue(ctx, JS_GetException(ctx));
+                    res = FALSE;
+                } else {
+                    res = (js_string_compare(ctx, p1, p2) == 0);
+                }
             }
         }
         break;
@@ -14799,6 +16271,7 @@ static __exception int js_operator_typeof(JSContext *ctx, JSValueConst op1)
         atom = JS_ATOM_boolean;
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         atom = JS_ATOM_string;
         break;
     case JS_TAG_OBJECT:
@@ -15742,7 +17215,7 @@ static JSVarRef *get_var_ref(JSContext *ctx, JSStackFrame *sf,
         }
     }
     /* create a new one */
-    var_ref = js_malloc(ctx, sizeof(JSVarRef));
+    var_ref = js_pool_malloc(ctx, sizeof(JSVarRef));
     if (!var_ref)
         return NULL;
     var_ref->header.ref_count = 1;
@@ -16241,6 +17714,296 @@ static JSValue JS_ThrowTypeErrorNotAFunction2(JSContext *ctx, JSAtom first, JSAt
                             JS_AtomGetStr(ctx, buf2, sizeof(buf2), second));
 }
 
+static inline BOOL js_is_get_field2(int op)
+{
+    return op == OP_get_field2 || op == OP_get_field2_ic;
+}
+
+static inline BOOL js_is_get_var(int op)
+{
+    return op == OP_get_var || op == OP_get_var_ic;
+}
+
+/* return the atom of the OP_get_field2, OP_get_var opcode or of their
+   inline cache variant whose operand is at 'pc' */
+static JSAtom js_get_atom_operand(JSFunctionBytecode *b, const uint8_t *pc)
+{
+    uint32_t idx;
+    if (pc[-1] == OP_get_field2_ic || pc[-1] == OP_get_var_ic) {
+        idx = get_u32(pc);
+        return idx < b->ic_count ? b->ic[idx].atom : JS_ATOM_NULL;
+    } else {
+        return get_u32(pc);
+    }
+}
+
+/* Inline caches: the shape of the object is compared to the shapes
+   remembered by the access site. On a hit, the property value is
+   directly read from (or written to) the cached slot. */
+
+/* the exotic behaviors of the object can be skipped when looking up a
+   non index property in its prototype */
+static inline BOOL js_ic_proto_lookup_ok(JSObject *p)
+{
+    return !p->is_exotic ||
+        (p->fast_array && (p->class_id == JS_CLASS_ARRAY ||
+                           p->class_id == JS_CLASS_ARGUMENTS));
+}
+
+static void js_ic_add(JSRuntime *rt, JSInlineCache *ic, JSShape *sh,
+                      JSShape *proto_sh, uint32_t prop_idx)
+{
+    JSInlineCacheEntry *e;
+    JSShape *old_sh, *old_proto_sh;
+    int i;
+
+    for(i = 0; i < ic->count; i++) {
+        e = &ic->entries[i];
+        if (e->shape == sh)
+            goto replace;
+    }
+    if (ic->count < JS_INLINE_CACHE_SIZE) {
+        e = &ic->entries[ic->count++];
+        e->shape = js_dup_shape(sh);
+        e->proto_shape = proto_sh ? js_dup_shape(proto_sh) : NULL;
+        e->prop_idx = prop_idx;
+        return;
+    }
+    e = &ic->entries[ic->u.next];
+    ic->u.next = (ic->u.next + 1) % JS_INLINE_CACHE_SIZE;
+ replace:
+    old_sh = e->shape;
+    old_proto_sh = e->proto_shape;
+    e->shape = js_dup_shape(sh);
+    e->proto_shape = proto_sh ? js_dup_shape(proto_sh) : NULL;
+    e->prop_idx = prop_idx;
+    js_free_shape(rt, old_sh);
+    js_free_shape_null(rt, old_proto_sh);
+}
+
+static void js_ic_update_get(JSRuntime *rt, JSInlineCache *ic, JSObject *p)
+{
+    JSShape *sh = p->shape;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSObject *p1;
+
+    if (!sh->is_hashed)
+        return;
+    prs = find_own_property(&pr, p, ic->atom);
+    if (prs) {
+        if (!(prs->flags & JS_PROP_TMASK))
+            js_ic_add(rt, ic, sh, NULL, pr - p->prop);
+        return;
+    }
+    p1 = sh->proto;
+    if (!p1 || !p1->shape->is_hashed || !js_ic_proto_lookup_ok(p) ||
+        __JS_AtomIsTaggedInt(ic->atom))
+        return;
+    prs = find_own_property(&pr, p1, ic->atom);
+    if (prs && !(prs->flags & JS_PROP_TMASK))
+        js_ic_add(rt, ic, sh, p1->shape, pr - p1->prop);
+}
+
+static no_inline JSValue js_get_field_ic_slow(JSContext *ctx,
+                                              JSInlineCache *ic,
+                                              JSValueConst obj)
+{
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)
+        js_ic_update_get(ctx->rt, ic, JS_VALUE_GET_OBJ(obj));
+    return JS_GetProperty(ctx, obj, ic->atom);
+}
+
+static force_inline JSValue js_get_field_ic(JSContext *ctx, JSInlineCache *ic,
+                                            JSValueConst obj)
+{
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)) {
+        JSObject *p = JS_VALUE_GET_OBJ(obj), *p1;
+        JSShape *sh = p->shape;
+        JSInlineCacheEntry *e;
+        int i;
+
+        for(i = 0; i < ic->count; i++) {
+            e = &ic->entries[i];
+            if (e->shape == sh) {
+                if (!e->proto_shape)
+                    return JS_DupValue(ctx, p->prop[e->prop_idx].u.value);
+                p1 = sh->proto;
+                if (p1->shape == e->proto_shape && js_ic_proto_lookup_ok(p))
+                    return JS_DupValue(ctx, p1->prop[e->prop_idx].u.value);
+                break;
+            }
+        }
+    }
+    return js_get_field_ic_slow(ctx, ic, obj);
+}
+
+static no_inline int js_put_field_ic_slow(JSContext *ctx, JSInlineCache *ic,
+                                          JSValueConst obj, JSValue val)
+{
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSObject *p;
+
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
+        p = JS_VALUE_GET_OBJ(obj);
+        if (p->shape->is_hashed) {
+            prs = find_own_property(&pr, p, ic->atom);
+            if (prs && (prs->flags & (JS_PROP_TMASK | JS_PROP_WRITABLE |
+                                      JS_PROP_LENGTH)) == JS_PROP_WRITABLE) {
+                js_ic_add(ctx->rt, ic, p->shape, NULL, pr - p->prop);
+            }
+        }
+    }
+    return JS_SetPropertyInternal(ctx, obj, ic->atom, val, obj,
+                                  JS_PROP_THROW_STRICT);
+}
+
+/* only own writable data properties are cached */
+static force_inline int js_put_field_ic(JSContext *ctx, JSInlineCache *ic,
+                                        JSValueConst obj, JSValue val)
+{
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)) {
+        JSObject *p = JS_VALUE_GET_OBJ(obj);
+        JSShape *sh = p->shape;
+        int i;
+
+        for(i = 0; i < ic->count; i++) {
+            if (ic->entries[i].shape == sh) {
+                set_value(ctx, &p->prop[ic->entries[i].prop_idx].u.value, val);
+                return TRUE;
+            }
+        }
+    }
+    return js_put_field_ic_slow(ctx, ic, obj, val);
+}
+
+/* Global variable inline caches. The global objects are usually not
+   hashed, so they are cloned when they are modified while an inline
+   cache references their shape. In order to avoid a quadratic
+   behavior when global variables are created in a loop, the caching
+   is disabled after JS_VAR_IC_MAX_UPDATES updates. It is tried again
+   after JS_VAR_IC_RETRY_DELAY uncached accesses, so that a site is
+   cached again once the global object is stable. The delay doubles
+   each time the caching is disabled again. */
+#define JS_VAR_IC_MAX_UPDATES 16
+#define JS_VAR_IC_RETRY_DELAY 1024
+#define JS_VAR_IC_RETRY_SHIFT_MAX 5 /* update_count must fit in 16 bits */
+
+static void js_ic_reset(JSRuntime *rt, JSInlineCache *ic)
+{
+    int i;
+    for(i = 0; i < ic->count; i++) {
+        js_free_shape(rt, ic->entries[i].shape);
+        js_free_shape_null(rt, ic->entries[i].proto_shape);
+        ic->entries[i].shape = NULL;
+        ic->entries[i].proto_shape = NULL;
+    }
+    ic->count = 0;
+}
+
+static void js_var_ic_update(JSContext *ctx, JSInlineCache *ic, BOOL is_put)
+{
+    JSObject *p, *p1;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSShape *proto_sh;
+
+    js_ic_reset(ctx->rt, ic);
+    if (ic->update_count >= JS_VAR_IC_MAX_UPDATES) {
+        if (++ic->update_count < JS_VAR_IC_MAX_UPDATES +
+            (JS_VAR_IC_RETRY_DELAY << ic->u.retry_shift))
+            return;
+        /* a single update is allowed before the next delay */
+        ic->update_count = JS_VAR_IC_MAX_UPDATES - 1;
+        if (ic->u.retry_shift < JS_VAR_IC_RETRY_SHIFT_MAX)
+            ic->u.retry_shift++;
+    }
+    ic->update_count++;
+    p = JS_VALUE_GET_OBJ(ctx->global_var_obj);
+    prs = find_own_property(&pr, p, ic->atom);
+    if (prs) {
+        p1 = p;
+        proto_sh = NULL;
+    } else {
+        p1 = JS_VALUE_GET_OBJ(ctx->global_obj);
+        prs = find_own_property(&pr, p1, ic->atom);
+        if (!prs)
+            return;
+        proto_sh = p1->shape;
+    }
+    if (prs->flags & JS_PROP_TMASK)
+        return;
+    if (is_put && !(prs->flags & JS_PROP_WRITABLE))
+        return;
+    js_ic_add(ctx->rt, ic, p->shape, proto_sh, pr - p1->prop);
+}
+
+/* return the cached property of the global variable or NULL */
+static force_inline JSProperty *js_var_ic_find(JSContext *ctx,
+                                               JSInlineCache *ic)
+{
+    JSInlineCacheEntry *e = &ic->entries[0];
+    JSObject *p;
+
+    /* 'e->shape' is NULL if the cache is empty */
+    p = JS_VALUE_GET_OBJ(ctx->global_var_obj);
+    if (likely(p->shape == e->shape)) {
+        if (e->proto_shape) {
+            p = JS_VALUE_GET_OBJ(ctx->global_obj);
+            if (unlikely(p->shape != e->proto_shape))
+                return NULL;
+        }
+        return &p->prop[e->prop_idx];
+    }
+    return NULL;
+}
+
+static no_inline JSValue js_get_var_ic_slow(JSContext *ctx, JSInlineCache *ic)
+{
+    JSValue val;
+
+    val = JS_GetGlobalVar(ctx, ic->atom, TRUE);
+    if (!JS_IsException(val))
+        js_var_ic_update(ctx, ic, FALSE);
+    return val;
+}
+
+static force_inline JSValue js_get_var_ic(JSContext *ctx, JSInlineCache *ic)
+{
+    JSProperty *pr;
+
+    pr = js_var_ic_find(ctx, ic);
+    /* uninitialized lexical variables are handled in the slow path */
+    if (likely(pr && !JS_IsUninitialized(pr->u.value)))
+        return JS_DupValue(ctx, pr->u.value);
+    return js_get_var_ic_slow(ctx, ic);
+}
+
+static no_inline int js_put_var_ic_slow(JSContext *ctx, JSInlineCache *ic,
+                                        JSValue val)
+{
+    int ret;
+
+    ret = JS_SetGlobalVar(ctx, ic->atom, val, 0);
+    if (ret >= 0)
+        js_var_ic_update(ctx, ic, TRUE);
+    return ret;
+}
+
+static force_inline int js_put_var_ic(JSContext *ctx, JSInlineCache *ic,
+                                      JSValue val)
+{
+    JSProperty *pr;
+
+    pr = js_var_ic_find(ctx, ic);
+    if (likely(pr && !JS_IsUninitialized(pr->u.value))) {
+        set_value(ctx, &pr->u.value, val);
+        return 0;
+    }
+    return js_put_var_ic_slow(ctx, ic, val);
+}
+
 /* argv[] is modified if (flags & JS_CALL_FLAG_COPY_ARGV) = 0. */
 static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                                JSValueConst this_obj, JSValueConst new_target,
@@ -16256,6 +18019,9 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     JSValue *local_buf, *stack_buf, *var_buf, *arg_buf, *sp, ret_val, *pval;
     JSVarRef **var_refs;
     size_t alloca_size;
+#ifdef DUMP_OPCODE_PAIRS
+    int prev_opcode = OP_invalid;
+#endif
 
 #if !DIRECT_DISPATCH
 #define SWITCH(pc)      switch (opcode = *pc++)
@@ -16269,11 +18035,8 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 #else
     static const void * const dispatch_table[256] = {
 #define DEF(id, size, n_pop, n_push, f) && case_OP_ ## id,
-#if SHORT_OPCODES
+/* the temporary opcodes overlap with the short and inline cache opcodes */
 #define def(id, size, n_pop, n_push, f)
-#else
-#define def(id, size, n_pop, n_push, f) && case_default,
-#endif
 #include "quickjs-opcode.h"
         [ OP_COUNT ... 255 ] = &&case_default
     };
@@ -16281,11 +18044,8 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 #ifdef CONFIG_DEBUGGER
     static const void * const debugger_dispatch_table[256] = {
 #define DEF(id, size, n_pop, n_push, f) && case_debugger_OP_ ## id,
-#if SHORT_OPCODES
+/* the temporary opcodes overlap with the short and inline cache opcodes */
 #define def(id, size, n_pop, n_push, f)
-#else
-#define def(id, size, n_pop, n_push, f) && case_default,
-#endif
 #include "quickjs-opcode.h"
         [ OP_COUNT ... 255 ] = &&case_default
     };
@@ -16304,6 +18064,25 @@ const void * const * active_dispatch_table = caller_ctx->rt->debugger_info.trans
 const void * const * active_dispatch_table = dispatch_table;
 #endif
 #endif
+#ifdef CONFIG_JIT
+/* continue the execution in the compiled code if it is available at
+   'pc'. Once the function is compiled, the positions which are not
+   entry points are skipped without calling js_jit_call(). */
+#define JIT_ENTRY()                                                     \
+    do {                                                                \
+        if (unlikely(rt->jit_enabled) && !b->jit_disabled &&            \
+            (!b->jit || b->jit->entry_pos[pc - b->byte_code_buf])) {    \
+            JSJITResult jr;                                             \
+            jr = js_jit_call(ctx, b, arg_buf, var_buf, sp, pc);         \
+            pc = jr.pc;                                                 \
+            sp = jr.sp;                                                 \
+        }                                                               \
+    } while (0)
+#else
+#define JIT_ENTRY() do { } while (0)
+#endif
+/* the loop headers are the targets of the backward jumps */
+#define JIT_LOOP_ENTRY(diff) do { if ((diff) < 0) JIT_ENTRY(); } while (0)
 
     if (js_poll_interrupts(caller_ctx))
         return JS_EXCEPTION;
@@ -16387,6 +18166,7 @@ const void * const * active_dispatch_table = dispatch_table;
     sf->prev_frame = rt->current_stack_frame;
     rt->current_stack_frame = sf;
     ctx = b->realm; /* set the current realm */
+    JIT_ENTRY();
 
  restart:
     for(;;) {
@@ -16396,6 +18176,10 @@ const void * const * active_dispatch_table = dispatch_table;
         js_debugger_check(ctx, NULL);
 #endif
 switch_restart:
+#ifdef DUMP_OPCODE_PAIRS
+        rt->opcode_pair_count[prev_opcode][*pc]++;
+        prev_opcode = *pc;
+#endif
         SWITCH(pc) {
         CASE(OP_push_i32):
             *sp++ = JS_NewInt32(ctx, get_u32(pc));
@@ -16751,9 +18535,9 @@ switch_restart:
                             goto exception;
                         } else if(pc[-2] == OP_get_arg3) {
                             NOT_FONCTION(b->vardefs[3].var_name);
-                        } else if(pc[-6] == OP_get_var){
+                        } else if(js_is_get_var(pc[-6])){
                             pc -= 5;
-                            NOT_FONCTION(get_u32(pc));
+                            NOT_FONCTION(js_get_atom_operand(b, pc));
                         } else if(pc[-4] == OP_get_var_ref) {
                             NOT_FONCTION(b->closure_var[pc[-3]].var_name);
                         } else if(pc[-2] == OP_get_var_ref0) {
@@ -16766,9 +18550,9 @@ switch_restart:
                             NOT_FONCTION(b->closure_var[3].var_name);
                         }
                     } else if(opcode == OP_call1) {
-                        if(pc[-3] == OP_fclosure8 && pc[-8] == OP_get_var) {
+                        if(pc[-3] == OP_fclosure8 && js_is_get_var(pc[-8])) {
                             pc -= 7;
-                            NOT_FONCTION(get_u32(pc));
+                            NOT_FONCTION(js_get_atom_operand(b, pc));
                         }
                     }
                 }
@@ -16813,36 +18597,36 @@ switch_restart:
                 if(!JS_IsFunction(ctx, func)) {
                     // Currently, only call_method is handled.
                     if(opcode == OP_call_method) {
-                        if(pc[-5] == OP_push_const8 && pc[-10] == OP_get_field2) {
+                        if(pc[-5] == OP_push_const8 && js_is_get_field2(pc[-10])) {
                             pc -= 9;
-                            JS_ThrowTypeErrorNotAFunction(ctx, get_u32(pc));
+                            JS_ThrowTypeErrorNotAFunction(ctx, js_get_atom_operand(b, pc));
                             goto exception;
-                        } else if(pc[-8] == OP_get_field2) {
+                        } else if(js_is_get_field2(pc[-8])) {
                             pc -= 7;
-                            JS_ThrowTypeErrorNotAFunction(ctx, get_u32(pc));
+                            JS_ThrowTypeErrorNotAFunction(ctx, js_get_atom_operand(b, pc));
                             goto exception;
-                        } else if(pc[-4] == OP_push_0 && pc[-9] == OP_get_field2) {
+                        } else if(pc[-4] == OP_push_0 && js_is_get_field2(pc[-9])) {
                             pc -= 8;
-                            JS_ThrowTypeErrorNotAFunction(ctx, get_u32(pc));
+                            JS_ThrowTypeErrorNotAFunction(ctx, js_get_atom_operand(b, pc));
                             goto exception;
                         } else if(pc[-4] == OP_push_1) {
-                            if(pc[-9] == OP_get_field2) {
+                            if(js_is_get_field2(pc[-9])) {
                                 pc -= 8;
-                                JS_ThrowTypeErrorNotAFunction(ctx, get_u32(pc));
+                                JS_ThrowTypeErrorNotAFunction(ctx, js_get_atom_operand(b, pc));
                                 goto exception;
-                            } else if(pc[-5] == OP_push_0 && pc[-10] == OP_get_field2 && pc[-15] == OP_push_atom_value) {
+                            } else if(pc[-5] == OP_push_0 && js_is_get_field2(pc[-10]) && pc[-15] == OP_push_atom_value) {
                                 const uint8_t * first = pc - 14;
                                 const uint8_t * second = pc - 9;
-                                JS_ThrowTypeErrorNotAFunction2(ctx, get_u32(first), get_u32(second));
+                                JS_ThrowTypeErrorNotAFunction2(ctx, get_u32(first), js_get_atom_operand(b, second));
                                 goto exception;
                             }
-                        } else if(pc[-8] == OP_push_atom_value && pc[-13] == OP_get_field2) {
+                        } else if(pc[-8] == OP_push_atom_value && js_is_get_field2(pc[-13])) {
                             pc -= 12;
-                            JS_ThrowTypeErrorNotAFunction(ctx, get_u32(pc));
+                            JS_ThrowTypeErrorNotAFunction(ctx, js_get_atom_operand(b, pc));
                             goto exception;
-                        } else if(pc[-5] == OP_fclosure8 && pc[-10] == OP_get_field2) {
+                        } else if(pc[-5] == OP_fclosure8 && js_is_get_field2(pc[-10])) {
                             pc -= 9;
-                            JS_ThrowTypeErrorNotAFunction(ctx, get_u32(pc));
+                            JS_ThrowTypeErrorNotAFunction(ctx, js_get_atom_operand(b, pc));
                             goto exception;
                         }
                     }
@@ -17449,25 +19233,37 @@ switch_restart:
             BREAK;
 
         CASE(OP_goto):
-            pc += (int32_t)get_u32(pc);
-            if (unlikely(js_poll_interrupts(ctx)))
-                goto exception;
+            {
+                int32_t diff = get_u32(pc);
+                pc += diff;
+                if (unlikely(js_poll_interrupts(ctx)))
+                    goto exception;
+                JIT_LOOP_ENTRY(diff);
+            }
             BREAK;
 #if SHORT_OPCODES
         CASE(OP_goto16):
-            pc += (int16_t)get_u16(pc);
-            if (unlikely(js_poll_interrupts(ctx)))
-                goto exception;
+            {
+                int32_t diff = (int16_t)get_u16(pc);
+                pc += diff;
+                if (unlikely(js_poll_interrupts(ctx)))
+                    goto exception;
+                JIT_LOOP_ENTRY(diff);
+            }
             BREAK;
         CASE(OP_goto8):
-            pc += (int8_t)pc[0];
-            if (unlikely(js_poll_interrupts(ctx)))
-                goto exception;
+            {
+                int32_t diff = (int8_t)pc[0];
+                pc += diff;
+                if (unlikely(js_poll_interrupts(ctx)))
+                    goto exception;
+                JIT_LOOP_ENTRY(diff);
+            }
             BREAK;
 #endif
         CASE(OP_if_true):
             {
-                int res;
+                int res, diff;
                 JSValue op1;
 
                 op1 = sp[-1];
@@ -17478,16 +19274,19 @@ switch_restart:
                     res = JS_ToBoolFree(ctx, op1);
                 }
                 sp--;
+                diff = 0;
                 if (res) {
-                    pc += (int32_t)get_u32(pc - 4) - 4;
+                    diff = (int32_t)get_u32(pc - 4) - 4;
+                    pc += diff;
                 }
                 if (unlikely(js_poll_interrupts(ctx)))
                     goto exception;
+                JIT_LOOP_ENTRY(diff);
             }
             BREAK;
         CASE(OP_if_false):
             {
-                int res;
+                int res, diff;
                 JSValue op1;
 
                 op1 = sp[-1];
@@ -17499,17 +19298,20 @@ switch_restart:
                     res = JS_ToBoolFree(ctx, op1);
                 }
                 sp--;
+                diff = 0;
                 if (!res) {
-                    pc += (int32_t)get_u32(pc - 4) - 4;
+                    diff = (int32_t)get_u32(pc - 4) - 4;
+                    pc += diff;
                 }
                 if (unlikely(js_poll_interrupts(ctx)))
                     goto exception;
+                JIT_LOOP_ENTRY(diff);
             }
             BREAK;
 #if SHORT_OPCODES
         CASE(OP_if_true8):
             {
-                int res;
+                int res, diff;
                 JSValue op1;
 
                 op1 = sp[-1];
@@ -17520,16 +19322,19 @@ switch_restart:
                     res = JS_ToBoolFree(ctx, op1);
                 }
                 sp--;
+                diff = 0;
                 if (res) {
-                    pc += (int8_t)pc[-1] - 1;
+                    diff = (int8_t)pc[-1] - 1;
+                    pc += diff;
                 }
                 if (unlikely(js_poll_interrupts(ctx)))
                     goto exception;
+                JIT_LOOP_ENTRY(diff);
             }
             BREAK;
         CASE(OP_if_false8):
             {
-                int res;
+                int res, diff;
                 JSValue op1;
 
                 op1 = sp[-1];
@@ -17540,14 +19345,71 @@ switch_restart:
                     res = JS_ToBoolFree(ctx, op1);
                 }
                 sp--;
+                diff = 0;
                 if (!res) {
-                    pc += (int8_t)pc[-1] - 1;
+                    diff = (int8_t)pc[-1] - 1;
+                    pc += diff;
                 }
                 if (unlikely(js_poll_interrupts(ctx)))
                     goto exception;
+                JIT_LOOP_ENTRY(diff);
             }
             BREAK;
 #endif
+        CASE(OP_lt_if_false):
+            {
+                int res, diff;
+                JSValue op1, op2;
+
+                op1 = sp[-2];
+                op2 = sp[-1];
+                pc += 4;
+                if (likely(JS_VALUE_IS_BOTH_INT(op1, op2))) {
+                    res = JS_VALUE_GET_INT(op1) < JS_VALUE_GET_INT(op2);
+                } else {
+                    if (js_relational_slow(ctx, sp, OP_lt))
+                        goto exception;
+                    res = JS_VALUE_GET_BOOL(sp[-2]);
+                }
+                sp -= 2;
+                diff = 0;
+                if (!res) {
+                    diff = (int32_t)get_u32(pc - 4) - 4;
+                    pc += diff;
+                }
+                if (unlikely(js_poll_interrupts(ctx)))
+                    goto exception;
+                JIT_LOOP_ENTRY(diff);
+            }
+            BREAK;
+        CASE(OP_inc_loc_goto):
+            {
+                JSValue op1;
+                int32_t diff;
+                int val, idx;
+
+                diff = get_u32(pc);
+                idx = get_u16(pc + 4);
+                pc += 6;
+                op1 = var_buf[idx];
+                if (JS_VALUE_GET_TAG(op1) == JS_TAG_INT) {
+                    val = JS_VALUE_GET_INT(op1);
+                    if (unlikely(val == INT32_MAX))
+                        goto inc_loc_goto_slow;
+                    var_buf[idx] = JS_NewInt32(ctx, val + 1);
+                } else {
+                inc_loc_goto_slow:
+                    op1 = JS_DupValue(ctx, op1);
+                    if (js_unary_arith_slow(ctx, &op1 + 1, OP_inc))
+                        goto exception;
+                    set_value(ctx, &var_buf[idx], op1);
+                }
+                pc += diff - 6;
+                if (unlikely(js_poll_interrupts(ctx)))
+                    goto exception;
+                JIT_LOOP_ENTRY(diff);
+            }
+            BREAK;
         CASE(OP_catch):
             {
                 int32_t diff;
@@ -17763,6 +19625,78 @@ switch_restart:
             }
             BREAK;
 
+        CASE(OP_get_field_ic):
+            {
+                JSValue val;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                val = js_get_field_ic(ctx, ic, sp[-1]);
+                if (unlikely(JS_IsException(val)))
+                    goto exception;
+                JS_FreeValue(ctx, sp[-1]);
+                sp[-1] = val;
+            }
+            BREAK;
+
+        CASE(OP_get_field2_ic):
+            {
+                JSValue val;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                val = js_get_field_ic(ctx, ic, sp[-1]);
+                if (unlikely(JS_IsException(val)))
+                    goto exception;
+                *sp++ = val;
+            }
+            BREAK;
+
+        CASE(OP_put_field_ic):
+            {
+                int ret;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                ret = js_put_field_ic(ctx, ic, sp[-2], sp[-1]);
+                JS_FreeValue(ctx, sp[-2]);
+                sp -= 2;
+                if (unlikely(ret < 0))
+                    goto exception;
+            }
+            BREAK;
+
+        CASE(OP_get_var_ic):
+            {
+                JSValue val;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                val = js_get_var_ic(ctx, ic);
+                if (unlikely(JS_IsException(val)))
+                    goto exception;
+                *sp++ = val;
+            }
+            BREAK;
+
+        CASE(OP_put_var_ic):
+            {
+                int ret;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                ret = js_put_var_ic(ctx, ic, sp[-1]);
+                sp--;
+                if (unlikely(ret < 0))
+                    goto exception;
+            }
+            BREAK;
+
         CASE(OP_private_symbol):
             {
                 JSAtom atom;
@@ -18150,12 +20084,12 @@ switch_restart:
                     *pv = __JS_NewFloat64(ctx, JS_VALUE_GET_FLOAT64(*pv) +
                                                JS_VALUE_GET_FLOAT64(op2));
                     sp--;
-                } else if (JS_VALUE_GET_TAG(*pv) == JS_TAG_STRING) {
+                } else if (tag_is_string(JS_VALUE_GET_TAG(*pv))) {
                     sp--;
                     op2 = JS_ToPrimitiveFree(ctx, op2, HINT_NONE);
                     if (JS_IsException(op2))
                         goto exception;
-                    if (JS_ConcatStringInPlace(ctx, JS_VALUE_GET_STRING(*pv), op2)) {
+                    if (JS_ConcatStringInPlace(ctx, *pv, op2)) {
                         JS_FreeValue(ctx, op2);
                     } else {
                         op2 = JS_ConcatString(ctx, JS_DupValue(ctx, *pv), op2);
@@ -19215,6 +21149,8 @@ static void async_func_free(JSRuntime *rt, JSAsyncFunctionState *s)
             if (rt->gc_phase == JS_GC_PHASE_NONE) {
                 free_zero_refcount(rt);
             }
+        } else if (s->header.mark == 0) {
+            gc_free_unmarked(rt, &s->header);
         }
     }
 }
@@ -20322,7 +22258,7 @@ typedef struct JSParseState {
 } JSParseState;
 
 typedef struct JSOpCode {
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(DUMP_OPCODE_PAIRS)
     const char *name;
 #endif
     uint8_t size; /* in bytes */
@@ -20335,7 +22271,7 @@ typedef struct JSOpCode {
 
 static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
 #define FMT(f)
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(DUMP_OPCODE_PAIRS)
 #define DEF(id, size, n_pop, n_push, f) { #id, size, n_pop, n_push, OP_FMT_ ## f },
 #else
 #define DEF(id, size, n_pop, n_push, f) { size, n_pop, n_push, OP_FMT_ ## f },
@@ -20345,16 +22281,56 @@ static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
 #undef FMT
 };
 
-#if SHORT_OPCODES
-/* After the final compilation pass, short opcodes are used. Their
-   opcodes overlap with the temporary opcodes which cannot appear in
-   the final bytecode. Their description is after the temporary
-   opcodes in opcode_info[]. */
+/* After the final compilation pass, short opcodes and inline cache
+   opcodes are used. Their opcodes overlap with the temporary opcodes
+   which cannot appear in the final bytecode. Their description is
+   after the temporary opcodes in opcode_info[]. */
 #define short_opcode_info(op)           \
     opcode_info[(op) >= OP_TEMP_START ? \
                 (op) + (OP_TEMP_END - OP_TEMP_START) : (op)]
-#else
-#define short_opcode_info(op) opcode_info[op]
+
+#ifdef DUMP_OPCODE_PAIRS
+#define OPCODE_PAIRS_DUMP_COUNT 50
+
+static void js_dump_opcode_pairs(JSRuntime *rt)
+{
+    uint16_t pairs[OPCODE_PAIRS_DUMP_COUNT];
+    uint64_t total, count;
+    int i, j, k, n;
+
+    /* select the most frequent pairs by insertion */
+    total = 0;
+    n = 0;
+    for(i = 0; i < 256 * 256; i++) {
+        count = rt->opcode_pair_count[i >> 8][i & 0xff];
+        if (count == 0)
+            continue;
+        total += count;
+        for(j = n; j > 0; j--) {
+            k = pairs[j - 1];
+            if (rt->opcode_pair_count[k >> 8][k & 0xff] >= count)
+                break;
+            if (j < OPCODE_PAIRS_DUMP_COUNT)
+                pairs[j] = k;
+        }
+        if (j < OPCODE_PAIRS_DUMP_COUNT) {
+            pairs[j] = i;
+            if (n < OPCODE_PAIRS_DUMP_COUNT)
+                n++;
+        }
+    }
+    if (total == 0)
+        return;
+    printf("%-20s %-20s %14s %6s\n", "OPCODE1", "OPCODE2", "COUNT", "%");
+    for(i = 0; i < n; i++) {
+        k = pairs[i];
+        count = rt->opcode_pair_count[k >> 8][k & 0xff];
+        printf("%-20s %-20s %14" PRIu64 " %6.2f\n",
+               short_opcode_info(k >> 8).name,
+               short_opcode_info(k & 0xff).name,
+               count, (double)count * 100 / total);
+    }
+}
 #endif
 
 static __exception int next_token(JSParseState *s);
@@ -20554,6 +22530,35 @@ static __exception int js_parse_template_part(JSParseState *s, const uint8_t *p)
     return -1;
 }
 
+/* Return the first byte of [p, end) which is 'sep', a backslash, a
+   control character or a non ASCII byte. The bytes before it can be
+   copied as is to the string. */
+static const uint8_t *skip_plain_string_chars(const uint8_t *p,
+                                              const uint8_t *end, int sep)
+{
+#if defined(__SSE2__)
+    const __m128i v_sep = _mm_set1_epi8(sep);
+    const __m128i v_bs = _mm_set1_epi8('\\');
+    const __m128i v_space = _mm_set1_epi8(0x20);
+    __m128i v, m;
+    int mask;
+
+    while (end - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *)p);
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, v_sep), _mm_cmpeq_epi8(v, v_bs));
+        /* signed comparison: also true for the bytes >= 0x80 */
+        m = _mm_or_si128(m, _mm_cmplt_epi8(v, v_space));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0)
+            return p + ctz32(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != sep && *p != '\\' && *p >= 0x20 && *p < 0x80)
+        p++;
+    return p;
+}
+
 static __exception int js_parse_string(JSParseState *s, int sep,
                                        BOOL do_throw, const uint8_t *p,
                                        JSToken *token, const uint8_t **pp)
@@ -20561,11 +22566,32 @@ static __exception int js_parse_string(JSParseState *s, int sep,
     int ret;
     uint32_t c;
     StringBuffer b_s, *b = &b_s;
-
+    const uint8_t *p1;
+
+    p1 = p;
+    if (sep != '`') {
+        p1 = skip_plain_string_chars(p, s->buf_end, sep);
+        if (p1 < s->buf_end && *p1 == sep && p1 - p <= JS_STRING_LEN_MAX) {
+            /* fast path: ASCII string without escape sequence */
+            token->u.str.str = js_new_string8(s->ctx, p, p1 - p);
+            if (JS_IsException(token->u.str.str))
+                return -1;
+            token->val = TOK_STRING;
+            token->u.str.sep = sep;
+            *pp = p1 + 1;
+            return 0;
+        }
+    }
     /* string */
-    if (string_buffer_init(s->ctx, b, 32))
+    if (string_buffer_init(s->ctx, b, max_int(32, min_int(p1 - p, 65536))))
         goto fail;
     for(;;) {
+        if (p1 > p) {
+            /* copy the run of plain characters at once */
+            if (string_buffer_write8(b, p, p1 - p))
+                goto fail;
+            p = p1;
+        }
         if (p >= s->buf_end)
             goto invalid_char;
         c = *p;
@@ -20675,6 +22701,8 @@ static __exception int js_parse_string(JSParseState *s, int sep,
         }
         if (string_buffer_putc(b, c))
             goto fail;
+        if (sep != '`')
+            p1 = skip_plain_string_chars(p, s->buf_end, sep);
     }
     token->val = TOK_STRING;
     token->u.str.sep = c;
@@ -21495,7 +23523,10 @@ static __exception int json_next_token(JSParseState *s)
         /* fall through */
     case ' ':
     case '\t':
-        p++;
+        /* indentation is usually a run of spaces */
+        do {
+            p++;
+        } while (*p == ' ' || *p == '\t');
         goto redo;
     case '/':
         if (!s->ext_json) {
@@ -28330,7 +30361,7 @@ static int js_resolve_module(JSContext *ctx, JSModuleDef *m)
 static JSVarRef *js_create_module_var(JSContext *ctx, BOOL is_lexical)
 {
     JSVarRef *var_ref;
-    var_ref = js_malloc(ctx, sizeof(JSVarRef));
+    var_ref = js_pool_malloc(ctx, sizeof(JSVarRef));
     if (!var_ref)
         return NULL;
     var_ref->header.ref_count = 1;
@@ -30060,6 +32091,12 @@ static void dump_byte_code(JSContext *ctx, int pass,
             printf(" ");
             print_atom(ctx, get_u32(tab + pos));
             break;
+        case OP_FMT_ic:
+            idx = get_u32(tab + pos);
+            printf(" %u: ", idx);
+            if (b && idx < b->ic_count)
+                print_atom(ctx, b->ic[idx].atom);
+            break;
         case OP_FMT_atom_u8:
             printf(" ");
             print_atom(ctx, get_u32(tab + pos));
@@ -32930,6 +34967,21 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
             }
             goto no_change;
 
+        case OP_lt:
+            if (OPTIMIZE) {
+                /* transformation (condition of the loops):
+                   lt if_false(l) -> lt_if_false(l)
+                 */
+                if (code_match(&cc, pos_next, OP_if_false, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    op = OP_lt_if_false;
+                    label = cc.label;
+                    pos_next = cc.pos;
+                    goto has_label;
+                }
+            }
+            goto no_change;
+
         case OP_dup:
             if (OPTIMIZE) {
                 /* Transformation: dup put_x(n) drop -> put_x(n) */
@@ -32972,10 +35024,37 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 if (code_match(&cc, pos_next, M2(OP_post_dec, OP_post_inc), OP_put_loc, idx, OP_drop, -1) ||
                     code_match(&cc, pos_next, M2(OP_dec, OP_inc), OP_dup, OP_put_loc, idx, OP_drop, -1)) {
                     if (cc.line_num >= 0) line_num = cc.line_num;
+                    op1 = (cc.op == OP_inc || cc.op == OP_post_inc) ? OP_inc_loc : OP_dec_loc;
+                    pos_next = cc.pos;
+                    /* transformation (end of the 'for' loops):
+                       inc_loc(n) goto(l) -> inc_loc_goto(l, n)
+                     */
+                    if (op1 == OP_inc_loc && code_match(&cc, pos_next, OP_goto, -1)) {
+                        if (cc.line_num >= 0) line_num = cc.line_num;
+                        label = cc.label;
+                        add_pc2line_info(s, bc_out.size, line_num);
+                        pos_next = skip_dead_code(s, bc_buf, bc_len, cc.pos, &line_num);
+                        assert(label >= 0 && label < s->label_count);
+                        ls = &label_slots[label];
+#if SHORT_OPCODES
+                        jp = &s->jump_slots[s->jump_count++];
+                        jp->op = OP_inc_loc_goto;
+                        jp->size = 4;
+                        jp->pos = bc_out.size + 1;
+                        jp->label = label;
+#endif
+                        dbuf_putc(&bc_out, OP_inc_loc_goto);
+                        dbuf_put_u32(&bc_out, ls->addr - bc_out.size);
+                        if (ls->addr == -1) {
+                            if (!add_reloc(ctx, ls, bc_out.size - 4, 4))
+                                goto fail;
+                        }
+                        dbuf_put_u16(&bc_out, idx);
+                        break;
+                    }
                     add_pc2line_info(s, bc_out.size, line_num);
-                    dbuf_putc(&bc_out, (cc.op == OP_inc || cc.op == OP_post_inc) ? OP_inc_loc : OP_dec_loc);
+                    dbuf_putc(&bc_out, op1);
                     dbuf_putc(&bc_out, idx);
-                    pos_next = cc.pos;
                     break;
                 }
                 /* transformation:
@@ -33421,10 +35500,15 @@ static __exception int compute_stack_size(JSContext *ctx,
 #endif
         case OP_if_true:
         case OP_if_false:
+        case OP_lt_if_false:
             diff = get_u32(bc_buf + pos + 1);
             if (ss_check(ctx, s, pos + 1 + diff, op, stack_len, catch_pos))
                 goto fail;
             break;
+        case OP_inc_loc_goto:
+            diff = get_u32(bc_buf + pos + 1);
+            pos_next = pos + 1 + diff;
+            break;
         case OP_gosub:
             diff = get_u32(bc_buf + pos + 1);
             if (ss_check(ctx, s, pos + 1 + diff, op, stack_len + 1, catch_pos))
@@ -33551,6 +35635,1228 @@ static int add_module_variables(JSContext *ctx, JSFunctionDef *fd)
     return 0;
 }
 
+/* return the inline cache opcode replacing 'op' or 0 if none */
+static int js_ic_opcode(int op)
+{
+    switch(op) {
+    case OP_get_field:
+    case OP_get_field2:
+    case OP_put_field:
+        return op - OP_get_field + OP_get_field_ic;
+    case OP_get_var:
+        return OP_get_var_ic;
+    case OP_put_var:
+        return OP_put_var_ic;
+    default:
+        return 0;
+    }
+}
+
+/* inverse of js_ic_opcode() */
+static int js_ic_base_opcode(int op)
+{
+    switch(op) {
+    case OP_get_var_ic:
+        return OP_get_var;
+    case OP_put_var_ic:
+        return OP_put_var;
+    default:
+        return op - OP_get_field_ic + OP_get_field;
+    }
+}
+
+/* Replace the atom operand of the field and global variable access
+   opcodes by an index in the inline cache table of the function. The
+   atoms are then owned by the inline caches. The bytecode is left
+   unchanged if the table cannot be allocated. */
+static void js_create_inline_caches(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    uint8_t *bc_buf = b->byte_code_buf;
+    int pos, len, op, ic_count, idx;
+    JSInlineCache *ic;
+
+    if (b->read_only_bytecode)
+        return;
+    ic_count = 0;
+    for(pos = 0; pos < b->byte_code_len; pos += len) {
+        op = bc_buf[pos];
+        len = short_opcode_info(op).size;
+        if (js_ic_opcode(op))
+            ic_count++;
+    }
+    if (ic_count == 0)
+        return;
+    ic = js_mallocz_rt(rt, sizeof(ic[0]) * ic_count);
+    if (!ic)
+        return;
+    idx = 0;
+    for(pos = 0; pos < b->byte_code_len; pos += len) {
+        op = bc_buf[pos];
+        len = short_opcode_info(op).size;
+        if (js_ic_opcode(op)) {
+            ic[idx].atom = get_u32(bc_buf + pos + 1);
+            bc_buf[pos] = js_ic_opcode(op);
+            put_u32(bc_buf + pos + 1, idx);
+            idx++;
+        }
+    }
+    b->ic = ic;
+    b->ic_count = ic_count;
+}
+
+static void js_free_inline_caches(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    JSInlineCache *ic;
+    int i, j;
+
+    for(i = 0; i < b->ic_count; i++) {
+        ic = &b->ic[i];
+        JS_FreeAtomRT(rt, ic->atom);
+        for(j = 0; j < ic->count; j++) {
+            js_free_shape(rt, ic->entries[j].shape);
+            js_free_shape_null(rt, ic->entries[j].proto_shape);
+        }
+    }
+    js_free_rt(rt, b->ic);
+}
+
+#ifdef CONFIG_JIT
+/* Baseline JIT for x86-64.
+
+   Each opcode of a subset is translated to a template of machine code
+   working directly on the interpreter frame (arg_buf, var_buf and the
+   value stack). Only the fast paths are compiled (int32 and float64
+   operands, non exotic values). In all the other cases and for the
+   unsupported opcodes, the machine code returns to the interpreter at
+   the current opcode, so the exceptions, the calls and the debugger
+   are always handled by the interpreter. The machine code is entered
+   at the start of the function and at the loop headers when the
+   function or the loop body only contains supported opcodes. */
+
+/* number of calls and loop iterations before compiling a function */
+#define JS_JIT_THRESHOLD 1000
+
+/* 'target' is the machine code address where the execution starts.
+   Return the position and the stack pointer where the interpreter
+   must continue. */
+typedef JSJITResult JSJITFunc(JSValue *sp, JSValue *var_buf,
+                              JSValue *arg_buf, const uint8_t *target,
+                              JSContext *ctx, const uint8_t *byte_code_buf);
+
+enum {
+    JIT_RAX, JIT_RCX, JIT_RDX, JIT_RBX, JIT_RSP, JIT_RBP, JIT_RSI, JIT_RDI,
+    JIT_R8, JIT_R9, JIT_R10, JIT_R11, JIT_R12, JIT_R13, JIT_R14, JIT_R15,
+};
+
+/* registers holding the interpreter state (callee saved) */
+#define JIT_SP      JIT_R12
+#define JIT_VAR_BUF JIT_R13
+#define JIT_ARG_BUF JIT_R14
+#define JIT_CTX     JIT_R15
+#define JIT_BC_BUF  JIT_RBX
+
+/* condition codes */
+enum {
+    JIT_CC_O = 0x0, JIT_CC_B = 0x2, JIT_CC_AE = 0x3, JIT_CC_E = 0x4,
+    JIT_CC_NE = 0x5, JIT_CC_BE = 0x6, JIT_CC_A = 0x7, JIT_CC_S = 0x8,
+    JIT_CC_L = 0xc, JIT_CC_GE = 0xd, JIT_CC_LE = 0xe, JIT_CC_G = 0xf,
+};
+
+/* offsets in the value stack */
+#define JIT_VAL(n) ((n) * (int)sizeof(JSValue))
+#define JIT_TAG(n) ((n) * (int)sizeof(JSValue) + (int)offsetof(JSValue, tag))
+
+typedef struct JSJITFixup {
+    uint32_t code_pos; /* position of the 32 bit displacement */
+    uint32_t pc_pos;
+    BOOL is_exit; /* jump to the exit stub of 'pc_pos' */
+} JSJITFixup;
+
+typedef struct JSJITState {
+    JSContext *ctx;
+    JSFunctionBytecode *b;
+    DynBuf code;
+    int pc_pos; /* position of the opcode being compiled */
+    int exit_pos; /* position of the common exit code */
+    int *label_pos; /* machine code position of each opcode or -1 */
+    int *stub_pos; /* position of the exit stub of each opcode or -1 */
+    JSJITFixup *fixups;
+    int fixup_count;
+    int fixup_size;
+    BOOL error;
+} JSJITState;
+
+static void jit_rex(DynBuf *d, int w, int r, int rm)
+{
+    int v = 0x40 | (w << 3) | ((r >> 3) << 2) | (rm >> 3);
+    if (v != 0x40)
+        dbuf_putc(d, v);
+}
+
+static void jit_opcode(DynBuf *d, int op)
+{
+    if (op > 0xff)
+        dbuf_putc(d, op >> 8);
+    dbuf_putc(d, op);
+}
+
+/* [prefix] [rex] op modrm(r, [base + disp]) */
+static void jit_op_mem(DynBuf *d, int prefix, int w, int op, int r,
+                       int base, int disp)
+{
+    int mod;
+    if (prefix)
+        dbuf_putc(d, prefix);
+    jit_rex(d, w, r, base);
+    jit_opcode(d, op);
+    mod = (disp >= -128 && disp <= 127) ? 0x40 : 0x80;
+    dbuf_putc(d, mod | ((r & 7) << 3) | (base & 7));
+    if ((base & 7) == JIT_RSP)
+        dbuf_putc(d, 0x24); /* SIB byte */
+    if (mod == 0x40)
+        dbuf_putc(d, disp);
+    else
+        dbuf_put_u32(d, disp);
+}
+
+/* [rex] op modrm(r, rm) */
+static void jit_op_reg(DynBuf *d, int w, int op, int r, int rm)
+{
+    jit_rex(d, w, r, rm);
+    jit_opcode(d, op);
+    dbuf_putc(d, 0xc0 | ((r & 7) << 3) | (rm & 7));
+}
+
+static void jit_load64(DynBuf *d, int r, int base, int disp)
+{
+    jit_op_mem(d, 0, 1, 0x8b, r, base, disp);
+}
+
+static void jit_store64(DynBuf *d, int r, int base, int disp)
+{
+    jit_op_mem(d, 0, 1, 0x89, r, base, disp);
+}
+
+static void jit_load32(DynBuf *d, int r, int base, int disp)
+{
+    jit_op_mem(d, 0, 0, 0x8b, r, base, disp);
+}
+
+static void jit_store32(DynBuf *d, int r, int base, int disp)
+{
+    jit_op_mem(d, 0, 0, 0x89, r, base, disp);
+}
+
+/* store a sign extended 32 bit immediate in a 64 bit memory location */
+static void jit_store_imm64(DynBuf *d, int base, int disp, int32_t val)
+{
+    jit_op_mem(d, 0, 1, 0xc7, 0, base, disp);
+    dbuf_put_u32(d, val);
+}
+
+/* cmp dword [base + disp], imm */
+static void jit_cmp_mem_imm(DynBuf *d, int base, int disp, int32_t val)
+{
+    if (val >= -128 && val <= 127) {
+        jit_op_mem(d, 0, 0, 0x83, 7, base, disp);
+        dbuf_putc(d, val);
+    } else {
+        jit_op_mem(d, 0, 0, 0x81, 7, base, disp);
+        dbuf_put_u32(d, val);
+    }
+}
+
+/* op reg, imm8 where 'ext' selects the operation (0 = add, 5 = sub,
+   7 = cmp) */
+static void jit_op_reg_imm8(DynBuf *d, int w, int ext, int r, int val)
+{
+    jit_op_reg(d, w, 0x83, ext, r);
+    dbuf_putc(d, val);
+}
+
+static void jit_add_sp(DynBuf *d, int n)
+{
+    jit_op_reg_imm8(d, 1, 0, JIT_SP, n * (int)sizeof(JSValue));
+}
+
+/* short forward jump. Return the position to patch with
+   jit_patch8() */
+static int jit_jcc8(DynBuf *d, int cc)
+{
+    dbuf_putc(d, cc < 0 ? 0xeb : 0x70 | cc);
+    dbuf_putc(d, 0);
+    return d->size;
+}
+
+static void jit_patch8(JSJITState *s, int pos)
+{
+    int diff = s->code.size - pos;
+    if (diff > 127) {
+        s->error = TRUE;
+        return;
+    }
+    if (!s->code.error)
+        s->code.buf[pos - 1] = diff;
+}
+
+/* jump (cc < 0) or conditional jump to the opcode at 'pc_pos' or to
+   its exit stub */
+static void jit_jump(JSJITState *s, int cc, int pc_pos, BOOL is_exit)
+{
+    DynBuf *d = &s->code;
+    JSJITFixup *f;
+
+    if (cc < 0) {
+        dbuf_putc(d, 0xe9);
+    } else {
+        dbuf_putc(d, 0x0f);
+        dbuf_putc(d, 0x80 | cc);
+    }
+    if (js_resize_array(s->ctx, (void **)&s->fixups, sizeof(s->fixups[0]),
+                        &s->fixup_size, s->fixup_count + 1)) {
+        s->error = TRUE;
+        return;
+    }
+    f = &s->fixups[s->fixup_count++];
+    f->code_pos = d->size;
+    f->pc_pos = pc_pos;
+    f->is_exit = is_exit;
+    dbuf_put_u32(d, 0);
+}
+
+/* jump to the interpreter at the current opcode */
+static void jit_exit(JSJITState *s, int cc)
+{
+    jit_jump(s, cc, s->pc_pos, TRUE);
+}
+
+/* increment the reference count of the value in (ptr, tag) */
+static void jit_dup_value(JSJITState *s, int ptr, int tag)
+{
+    DynBuf *d = &s->code;
+    int pos;
+    jit_op_reg_imm8(d, 0, 7, tag, JS_TAG_FIRST);
+    pos = jit_jcc8(d, JIT_CC_B);
+    jit_op_mem(d, 0, 0, 0xff, 0, ptr, 0); /* inc dword [ptr] */
+    jit_patch8(s, pos);
+}
+
+/* free the value in (rax, rdx). The caller saved registers are
+   modified. */
+static void jit_free_value(JSJITState *s)
+{
+    DynBuf *d = &s->code;
+    int pos1, pos2;
+    jit_op_reg_imm8(d, 0, 7, JIT_RDX, JS_TAG_FIRST);
+    pos1 = jit_jcc8(d, JIT_CC_B);
+    jit_op_mem(d, 0, 0, 0xff, 1, JIT_RAX, 0); /* dec dword [rax] */
+    pos2 = jit_jcc8(d, JIT_CC_NE);
+    /* __JS_FreeValueRT(ctx->rt, (rax, rdx)) */
+    jit_op_reg(d, 1, 0x89, JIT_RAX, JIT_RSI);
+    jit_load64(d, JIT_RDI, JIT_CTX, offsetof(JSContext, rt));
+    dbuf_putc(d, 0x48); /* mov rax, imm64 */
+    dbuf_putc(d, 0xb8);
+    dbuf_put_u64(d, (uintptr_t)__JS_FreeValueRT);
+    dbuf_putc(d, 0xff); /* call rax */
+    dbuf_putc(d, 0xd0);
+    jit_patch8(s, pos1);
+    jit_patch8(s, pos2);
+}
+
+static void jit_push_imm(JSJITState *s, int tag, int32_t val)
+{
+    DynBuf *d = &s->code;
+    jit_store_imm64(d, JIT_SP, JIT_VAL(0), val);
+    jit_store_imm64(d, JIT_SP, JIT_TAG(0), tag);
+    jit_add_sp(d, 1);
+}
+
+static void jit_push_float64(JSJITState *s, double d1)
+{
+    DynBuf *d = &s->code;
+    JSFloat64Union u;
+    u.d = d1;
+    jit_rex(d, 1, 0, JIT_RAX); /* mov rax, imm64 */
+    dbuf_putc(d, 0xb8 | JIT_RAX);
+    dbuf_put_u32(d, (uint32_t)u.u64);
+    dbuf_put_u32(d, (uint32_t)(u.u64 >> 32));
+    jit_store64(d, JIT_RAX, JIT_SP, JIT_VAL(0));
+    jit_store_imm64(d, JIT_SP, JIT_TAG(0), JS_TAG_FLOAT64);
+    jit_add_sp(d, 1);
+}
+
+static void jit_get_var(JSJITState *s, int base, int idx, BOOL check)
+{
+    DynBuf *d = &s->code;
+    int disp = idx * sizeof(JSValue);
+    if (check) {
+        jit_cmp_mem_imm(d, base, disp + JIT_TAG(0), JS_TAG_UNINITIALIZED);
+        jit_exit(s, JIT_CC_E);
+    }
+    jit_load64(d, JIT_RAX, base, disp + JIT_VAL(0));
+    jit_load64(d, JIT_RDX, base, disp + JIT_TAG(0));
+    jit_store64(d, JIT_RAX, JIT_SP, JIT_VAL(0));
+    jit_store64(d, JIT_RDX, JIT_SP, JIT_TAG(0));
+    jit_add_sp(d, 1);
+    jit_dup_value(s, JIT_RAX, JIT_RDX);
+}
+
+/* put_loc (pop = TRUE) or set_loc (pop = FALSE) */
+static void jit_put_var(JSJITState *s, int base, int idx, BOOL check,
+                        BOOL pop)
+{
+    DynBuf *d = &s->code;
+    int disp = idx * sizeof(JSValue);
+    if (check) {
+        jit_cmp_mem_imm(d, base, disp + JIT_TAG(0), JS_TAG_UNINITIALIZED);
+        jit_exit(s, JIT_CC_E);
+    }
+    jit_load64(d, JIT_RCX, JIT_SP, JIT_VAL(-1));
+    jit_load64(d, JIT_RSI, JIT_SP, JIT_TAG(-1));
+    if (!pop)
+        jit_dup_value(s, JIT_RCX, JIT_RSI);
+    jit_load64(d, JIT_RAX, base, disp + JIT_VAL(0));
+    jit_load64(d, JIT_RDX, base, disp + JIT_TAG(0));
+    jit_store64(d, JIT_RCX, base, disp + JIT_VAL(0));
+    jit_store64(d, JIT_RSI, base, disp + JIT_TAG(0));
+    if (pop)
+        jit_add_sp(d, -1);
+    jit_free_value(s);
+}
+
+/* set ZF if sp[-2] and sp[-1] are both int */
+static void jit_test_both_int(JSJITState *s)
+{
+    DynBuf *d = &s->code;
+    jit_load32(d, JIT_RCX, JIT_SP, JIT_TAG(-2));
+    jit_op_mem(d, 0, 0, 0x0b, JIT_RCX, JIT_SP, JIT_TAG(-1)); /* or */
+}
+
+/* exit if sp[-2] or sp[-1] is not a float64 */
+static void jit_check_both_float(JSJITState *s)
+{
+    DynBuf *d = &s->code;
+    jit_cmp_mem_imm(d, JIT_SP, JIT_TAG(-2), JS_TAG_FLOAT64);
+    jit_exit(s, JIT_CC_NE);
+    jit_cmp_mem_imm(d, JIT_SP, JIT_TAG(-1), JS_TAG_FLOAT64);
+    jit_exit(s, JIT_CC_NE);
+}
+
+/* add, sub, mul, and, or, xor. 'float_op' is the SSE2 opcode of the
+   float64 case or 0 */
+static void jit_binary_arith(JSJITState *s, int op, int float_op)
+{
+    DynBuf *d = &s->code;
+    int pos_float = 0, pos_done, pos;
+
+    jit_test_both_int(s);
+    if (float_op)
+        pos_float = jit_jcc8(d, JIT_CC_NE);
+    else
+        jit_exit(s, JIT_CC_NE);
+    jit_load32(d, JIT_RAX, JIT_SP, JIT_VAL(-2));
+    jit_op_mem(d, 0, 0, op, JIT_RAX, JIT_SP, JIT_VAL(-1));
+    if (op == 0x03 || op == 0x2b || op == 0x0faf) {
+        /* add, sub, imul: the overflow is handled by the interpreter */
+        jit_exit(s, JIT_CC_O);
+    }
+    if (op == 0x0faf) {
+        /* -0 result */
+        jit_op_reg(d, 0, 0x85, JIT_RAX, JIT_RAX);
+        pos = jit_jcc8(d, JIT_CC_NE);
+        jit_load32(d, JIT_RCX, JIT_SP, JIT_VAL(-2));
+        jit_op_mem(d, 0, 0, 0x0b, JIT_RCX, JIT_SP, JIT_VAL(-1));
+        jit_exit(s, JIT_CC_S);
+        jit_patch8(s, pos);
+    }
+    jit_store32(d, JIT_RAX, JIT_SP, JIT_VAL(-2));
+    jit_add_sp(d, -1);
+    if (float_op) {
+        pos_done = jit_jcc8(d, -1);
+        jit_patch8(s, pos_float);
+        jit_check_both_float(s);
+        jit_op_mem(d, 0xf2, 0, 0x0f10, 0, JIT_SP, JIT_VAL(-2)); /* movsd */
+        jit_op_mem(d, 0xf2, 0, float_op, 0, JIT_SP, JIT_VAL(-1));
+        jit_op_mem(d, 0xf2, 0, 0x0f11, 0, JIT_SP, JIT_VAL(-2));
+        jit_add_sp(d, -1);
+        jit_patch8(s, pos_done);
+    }
+}
+
+/* mod, shl, sar, shr on int operands */
+static void jit_binary_int(JSJITState *s, int opcode)
+{
+    DynBuf *d = &s->code;
+
+    jit_test_both_int(s);
+    jit_exit(s, JIT_CC_NE);
+    jit_load32(d, JIT_RAX, JIT_SP, JIT_VAL(-2));
+    jit_load32(d, JIT_RCX, JIT_SP, JIT_VAL(-1));
+    switch(opcode) {
+    case OP_mod:
+        /* negative or zero operands are handled by the interpreter */
+        jit_op_reg(d, 0, 0x85, JIT_RAX, JIT_RAX);
+        jit_exit(s, JIT_CC_S);
+        jit_op_reg(d, 0, 0x85, JIT_RCX, JIT_RCX);
+        jit_exit(s, JIT_CC_LE);
+        dbuf_putc(d, 0x99); /* cdq */
+        jit_op_reg(d, 0, 0xf7, 7, JIT_RCX); /* idiv ecx */
+        jit_store32(d, JIT_RDX, JIT_SP, JIT_VAL(-2));
+        break;
+    case OP_shl:
+        jit_op_reg(d, 0, 0xd3, 4, JIT_RAX);
+        jit_store32(d, JIT_RAX, JIT_SP, JIT_VAL(-2));
+        break;
+    case OP_sar:
+        jit_op_reg(d, 0, 0xd3, 7, JIT_RAX);
+        jit_store32(d, JIT_RAX, JIT_SP, JIT_VAL(-2));
+        break;
+    case OP_shr:
+        jit_op_reg(d, 0, 0xd3, 5, JIT_RAX);
+        /* results >= 2^31 are not int32 */
+        jit_op_reg(d, 0, 0x85, JIT_RAX, JIT_RAX);
+        jit_exit(s, JIT_CC_S);
+        jit_store32(d, JIT_RAX, JIT_SP, JIT_VAL(-2));
+        break;
+    default:
+        abort();
+    }
+    jit_add_sp(d, -1);
+}
+
+/* store the boolean in al in sp[-n] */
+static void jit_set_bool(JSJITState *s, int cc, int n)
+{
+    DynBuf *d = &s->code;
+    dbuf_putc(d, 0x0f); /* setcc al */
+    dbuf_putc(d, 0x90 | cc);
+    dbuf_putc(d, 0xc0);
+    jit_op_reg(d, 0, 0x0fb6, JIT_RAX, JIT_RAX); /* movzx eax, al */
+    jit_store32(d, JIT_RAX, JIT_SP, JIT_VAL(-n));
+    jit_store_imm64(d, JIT_SP, JIT_TAG(-n), JS_TAG_BOOL);
+}
+
+/* int comparisons. 'float_cc' is the condition code of the float64
+   comparison or -1 */
+static void jit_compare(JSJITState *s, int cc, int float_cc, BOOL swap)
+{
+    DynBuf *d = &s->code;
+    int pos_float = 0, pos_done = 0;
+
+    jit_test_both_int(s);
+    if (float_cc >= 0)
+        pos_float = jit_jcc8(d, JIT_CC_NE);
+    else
+        jit_exit(s, JIT_CC_NE);
+    jit_load32(d, JIT_RAX, JIT_SP, JIT_VAL(-2));
+    jit_op_mem(d, 0, 0, 0x3b, JIT_RAX, JIT_SP, JIT_VAL(-1)); /* cmp */
+    jit_set_bool(s, cc, 2);
+    jit_add_sp(d, -1);
+    if (float_cc >= 0) {
+        pos_done = jit_jcc8(d, -1);
+        jit_patch8(s, pos_float);
+        jit_check_both_float(s);
+        /* ucomisd gives the unordered result for NaN, so the operands
+           are swapped so that only 'above' conditions are used */
+        jit_op_mem(d, 0xf2, 0, 0x0f10, 0, JIT_SP, JIT_VAL(swap ? -1 : -2));
+        jit_op_mem(d, 0x66, 0, 0x0f2e, 0, JIT_SP, JIT_VAL(swap ? -2 : -1));
+        jit_set_bool(s, float_cc, 2);
+        jit_add_sp(d, -1);
+        jit_patch8(s, pos_done);
+    }
+}
+
+/* add 'incr' to the int at [base + disp] */
+static void jit_inc_int(JSJITState *s, int base, int disp, int incr)
+{
+    DynBuf *d = &s->code;
+    jit_cmp_mem_imm(d, base, disp + JIT_TAG(0), JS_TAG_INT);
+    jit_exit(s, JIT_CC_NE);
+    jit_load32(d, JIT_RAX, base, disp + JIT_VAL(0));
+    jit_op_reg_imm8(d, 0, 0, JIT_RAX, incr);
+    jit_exit(s, JIT_CC_O);
+    jit_store32(d, JIT_RAX, base, disp + JIT_VAL(0));
+}
+
+/* decrement the interrupt counter and exit when it expires so that
+   the interpreter polls the interrupts */
+static void jit_poll_interrupts(JSJITState *s)
+{
+    jit_op_mem(&s->code, 0, 0, 0x83, 5, JIT_CTX,
+               offsetof(JSContext, interrupt_counter));
+    dbuf_putc(&s->code, 1);
+    jit_exit(s, JIT_CC_LE);
+}
+
+/* pop the int or bool at the top of the stack and jump to 'target' if
+   it is true (is_true = TRUE) or false */
+static void jit_branch(JSJITState *s, BOOL is_true, int target)
+{
+    DynBuf *d = &s->code;
+    jit_load32(d, JIT_RAX, JIT_SP, JIT_VAL(-1));
+    jit_add_sp(d, -1);
+    jit_op_reg(d, 0, 0x85, JIT_RAX, JIT_RAX);
+    jit_jump(s, is_true ? JIT_CC_NE : JIT_CC_E, target, FALSE);
+}
+
+/* if_true (is_true = TRUE) or if_false */
+static void jit_if(JSJITState *s, BOOL is_true, int target)
+{
+    DynBuf *d = &s->code;
+    jit_poll_interrupts(s);
+    /* int, bool, null and undefined */
+    jit_cmp_mem_imm(d, JIT_SP, JIT_TAG(-1), JS_TAG_UNDEFINED);
+    jit_exit(s, JIT_CC_A);
+    jit_branch(s, is_true, target);
+}
+
+static void jit_goto(JSJITState *s, int target)
+{
+    jit_poll_interrupts(s);
+    jit_jump(s, -1, target, FALSE);
+}
+
+/* return TRUE if the opcode has a compiled fast path */
+static BOOL js_jit_is_supported(int op)
+{
+    switch(op) {
+    case OP_push_i32:
+    case OP_push_minus1:
+    case OP_push_0:
+    case OP_push_1:
+    case OP_push_2:
+    case OP_push_3:
+    case OP_push_4:
+    case OP_push_5:
+    case OP_push_6:
+    case OP_push_7:
+    case OP_push_i8:
+    case OP_push_i16:
+    case OP_undefined:
+    case OP_null:
+    case OP_push_false:
+    case OP_push_true:
+    case OP_drop:
+    case OP_dup:
+    case OP_swap:
+    case OP_nop:
+    case OP_get_loc:
+    case OP_put_loc:
+    case OP_set_loc:
+    case OP_get_arg:
+    case OP_put_arg:
+    case OP_set_arg:
+    case OP_get_loc8:
+    case OP_put_loc8:
+    case OP_set_loc8:
+    case OP_get_loc0:
+    case OP_get_loc1:
+    case OP_get_loc2:
+    case OP_get_loc3:
+    case OP_put_loc0:
+    case OP_put_loc1:
+    case OP_put_loc2:
+    case OP_put_loc3:
+    case OP_set_loc0:
+    case OP_set_loc1:
+    case OP_set_loc2:
+    case OP_set_loc3:
+    case OP_get_arg0:
+    case OP_get_arg1:
+    case OP_get_arg2:
+    case OP_get_arg3:
+    case OP_put_arg0:
+    case OP_put_arg1:
+    case OP_put_arg2:
+    case OP_put_arg3:
+    case OP_set_arg0:
+    case OP_set_arg1:
+    case OP_set_arg2:
+    case OP_set_arg3:
+    case OP_get_loc_check:
+    case OP_put_loc_check:
+    case OP_add:
+    case OP_sub:
+    case OP_mul:
+    case OP_mod:
+    case OP_and:
+    case OP_or:
+    case OP_xor:
+    case OP_shl:
+    case OP_sar:
+    case OP_shr:
+    case OP_lt:
+    case OP_lte:
+    case OP_gt:
+    case OP_gte:
+    case OP_eq:
+    case OP_neq:
+    case OP_strict_eq:
+    case OP_strict_neq:
+    case OP_inc:
+    case OP_dec:
+    case OP_neg:
+    case OP_plus:
+    case OP_not:
+    case OP_lnot:
+    case OP_inc_loc:
+    case OP_dec_loc:
+    case OP_add_loc:
+    case OP_if_true:
+    case OP_if_false:
+    case OP_if_true8:
+    case OP_if_false8:
+    case OP_goto:
+    case OP_goto8:
+    case OP_goto16:
+    case OP_lt_if_false:
+    case OP_inc_loc_goto:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* return the target of a jump opcode or -1 */
+static int js_jit_jump_target(const uint8_t *bc_buf, int pos)
+{
+    switch(bc_buf[pos]) {
+    case OP_if_true:
+    case OP_if_false:
+    case OP_goto:
+    case OP_lt_if_false:
+    case OP_inc_loc_goto:
+        return pos + 1 + (int32_t)get_u32(bc_buf + pos + 1);
+    case OP_if_true8:
+    case OP_if_false8:
+    case OP_goto8:
+        return pos + 1 + (int8_t)bc_buf[pos + 1];
+    case OP_goto16:
+        return pos + 1 + (int16_t)get_u16(bc_buf + pos + 1);
+    default:
+        return -1;
+    }
+}
+
+/* return the index of the float64 constant pushed at 'pos' or -1 */
+static int js_jit_float_const(JSFunctionBytecode *b, int pos)
+{
+    const uint8_t *bc_buf = b->byte_code_buf;
+    int idx;
+
+    switch(bc_buf[pos]) {
+    case OP_push_const:
+        idx = get_u32(bc_buf + pos + 1);
+        break;
+    case OP_push_const8:
+        idx = bc_buf[pos + 1];
+        break;
+    default:
+        return -1;
+    }
+    if (JS_VALUE_GET_TAG(b->cpool[idx]) != JS_TAG_FLOAT64)
+        return -1;
+    return idx;
+}
+
+static void js_jit_compile_opcode(JSJITState *s, const uint8_t *bc_buf,
+                                  int pos)
+{
+    DynBuf *d = &s->code;
+    int op = bc_buf[pos], idx, pos1, pos2;
+
+    switch(op) {
+    case OP_push_i32:
+        jit_push_imm(s, JS_TAG_INT, get_u32(bc_buf + pos + 1));
+        break;
+    case OP_push_minus1:
+    case OP_push_0:
+    case OP_push_1:
+    case OP_push_2:
+    case OP_push_3:
+    case OP_push_4:
+    case OP_push_5:
+    case OP_push_6:
+    case OP_push_7:
+        jit_push_imm(s, JS_TAG_INT, op - OP_push_0);
+        break;
+    case OP_push_i8:
+        jit_push_imm(s, JS_TAG_INT, (int8_t)bc_buf[pos + 1]);
+        break;
+    case OP_push_const:
+    case OP_push_const8:
+        idx = js_jit_float_const(s->b, pos);
+        if (idx >= 0)
+            jit_push_float64(s, JS_VALUE_GET_FLOAT64(s->b->cpool[idx]));
+        else
+            jit_exit(s, -1);
+        break;
+    case OP_push_i16:
+        jit_push_imm(s, JS_TAG_INT, (int16_t)get_u16(bc_buf + pos + 1));
+        break;
+    case OP_undefined:
+        jit_push_imm(s, JS_TAG_UNDEFINED, 0);
+        break;
+    case OP_null:
+        jit_push_imm(s, JS_TAG_NULL, 0);
+        break;
+    case OP_push_false:
+    case OP_push_true:
+        jit_push_imm(s, JS_TAG_BOOL, op - OP_push_false);
+        break;
+    case OP_drop:
+        jit_load64(d, JIT_RAX, JIT_SP, JIT_VAL(-1));
+        jit_load64(d, JIT_RDX, JIT_SP, JIT_TAG(-1));
+        jit_add_sp(d, -1);
+        jit_free_value(s);
+        break;
+    case OP_dup:
+        jit_load64(d, JIT_RAX, JIT_SP, JIT_VAL(-1));
+        jit_load64(d, JIT_RDX, JIT_SP, JIT_TAG(-1));
+        jit_store64(d, JIT_RAX, JIT_SP, JIT_VAL(0));
+        jit_store64(d, JIT_RDX, JIT_SP, JIT_TAG(0));
+        jit_add_sp(d, 1);
+        jit_dup_value(s, JIT_RAX, JIT_RDX);
+        break;
+    case OP_swap:
+        jit_load64(d, JIT_RAX, JIT_SP, JIT_VAL(-2));
+        jit_load64(d, JIT_RDX, JIT_SP, JIT_TAG(-2));
+        jit_load64(d, JIT_RCX, JIT_SP, JIT_VAL(-1));
+        jit_load64(d, JIT_RSI, JIT_SP, JIT_TAG(-1));
+        jit_store64(d, JIT_RCX, JIT_SP, JIT_VAL(-2));
+        jit_store64(d, JIT_RSI, JIT_SP, JIT_TAG(-2));
+        jit_store64(d, JIT_RAX, JIT_SP, JIT_VAL(-1));
+        jit_store64(d, JIT_RDX, JIT_SP, JIT_TAG(-1));
+        break;
+    case OP_nop:
+        break;
+    case OP_get_loc:
+        jit_get_var(s, JIT_VAR_BUF, get_u16(bc_buf + pos + 1), FALSE);
+        break;
+    case OP_put_loc:
+        jit_put_var(s, JIT_VAR_BUF, get_u16(bc_buf + pos + 1), FALSE, TRUE);
+        break;
+    case OP_set_loc:
+        jit_put_var(s, JIT_VAR_BUF, get_u16(bc_buf + pos + 1), FALSE, FALSE);
+        break;
+    case OP_get_arg:
+        jit_get_var(s, JIT_ARG_BUF, get_u16(bc_buf + pos + 1), FALSE);
+        break;
+    case OP_put_arg:
+        jit_put_var(s, JIT_ARG_BUF, get_u16(bc_buf + pos + 1), FALSE, TRUE);
+        break;
+    case OP_set_arg:
+        jit_put_var(s, JIT_ARG_BUF, get_u16(bc_buf + pos + 1), FALSE, FALSE);
+        break;
+    case OP_get_loc8:
+        jit_get_var(s, JIT_VAR_BUF, bc_buf[pos + 1], FALSE);
+        break;
+    case OP_put_loc8:
+        jit_put_var(s, JIT_VAR_BUF, bc_buf[pos + 1], FALSE, TRUE);
+        break;
+    case OP_set_loc8:
+        jit_put_var(s, JIT_VAR_BUF, bc_buf[pos + 1], FALSE, FALSE);
+        break;
+    case OP_get_loc0:
+    case OP_get_loc1:
+    case OP_get_loc2:
+    case OP_get_loc3:
+        jit_get_var(s, JIT_VAR_BUF, op - OP_get_loc0, FALSE);
+        break;
+    case OP_put_loc0:
+    case OP_put_loc1:
+    case OP_put_loc2:
+    case OP_put_loc3:
+        jit_put_var(s, JIT_VAR_BUF, op - OP_put_loc0, FALSE, TRUE);
+        break;
+    case OP_set_loc0:
+    case OP_set_loc1:
+    case OP_set_loc2:
+    case OP_set_loc3:
+        jit_put_var(s, JIT_VAR_BUF, op - OP_set_loc0, FALSE, FALSE);
+        break;
+    case OP_get_arg0:
+    case OP_get_arg1:
+    case OP_get_arg2:
+    case OP_get_arg3:
+        jit_get_var(s, JIT_ARG_BUF, op - OP_get_arg0, FALSE);
+        break;
+    case OP_put_arg0:
+    case OP_put_arg1:
+    case OP_put_arg2:
+    case OP_put_arg3:
+        jit_put_var(s, JIT_ARG_BUF, op - OP_put_arg0, FALSE, TRUE);
+        break;
+    case OP_set_arg0:
+    case OP_set_arg1:
+    case OP_set_arg2:
+    case OP_set_arg3:
+        jit_put_var(s, JIT_ARG_BUF, op - OP_set_arg0, FALSE, FALSE);
+        break;
+    case OP_get_loc_check:
+        jit_get_var(s, JIT_VAR_BUF, get_u16(bc_buf + pos + 1), TRUE);
+        break;
+    case OP_put_loc_check:
+        jit_put_var(s, JIT_VAR_BUF, get_u16(bc_buf + pos + 1), TRUE, TRUE);
+        break;
+    case OP_add:
+        jit_binary_arith(s, 0x03, 0x0f58);
+        break;
+    case OP_sub:
+        jit_binary_arith(s, 0x2b, 0x0f5c);
+        break;
+    case OP_mul:
+        jit_binary_arith(s, 0x0faf, 0x0f59);
+        break;
+    case OP_and:
+        jit_binary_arith(s, 0x23, 0);
+        break;
+    case OP_or:
+        jit_binary_arith(s, 0x0b, 0);
+        break;
+    case OP_xor:
+        jit_binary_arith(s, 0x33, 0);
+        break;
+    case OP_mod:
+    case OP_shl:
+    case OP_sar:
+    case OP_shr:
+        jit_binary_int(s, op);
+        break;
+    case OP_lt:
+        jit_compare(s, JIT_CC_L, JIT_CC_A, TRUE);
+        break;
+    case OP_lte:
+        jit_compare(s, JIT_CC_LE, JIT_CC_AE, TRUE);
+        break;
+    case OP_gt:
+        jit_compare(s, JIT_CC_G, JIT_CC_A, FALSE);
+        break;
+    case OP_gte:
+        jit_compare(s, JIT_CC_GE, JIT_CC_AE, FALSE);
+        break;
+    case OP_eq:
+    case OP_strict_eq:
+        jit_compare(s, JIT_CC_E, -1, FALSE);
+        break;
+    case OP_neq:
+    case OP_strict_neq:
+        jit_compare(s, JIT_CC_NE, -1, FALSE);
+        break;
+    case OP_inc:
+        jit_inc_int(s, JIT_SP, JIT_VAL(-1), 1);
+        break;
+    case OP_dec:
+        jit_inc_int(s, JIT_SP, JIT_VAL(-1), -1);
+        break;
+    case OP_inc_loc:
+        jit_inc_int(s, JIT_VAR_BUF, bc_buf[pos + 1] * sizeof(JSValue), 1);
+        break;
+    case OP_dec_loc:
+        jit_inc_int(s, JIT_VAR_BUF, bc_buf[pos + 1] * sizeof(JSValue), -1);
+        break;
+    case OP_neg:
+        jit_cmp_mem_imm(d, JIT_SP, JIT_TAG(-1), JS_TAG_INT);
+        jit_exit(s, JIT_CC_NE);
+        jit_load32(d, JIT_RAX, JIT_SP, JIT_VAL(-1));
+        /* 0 and INT32_MIN give a float64 result */
+        dbuf_putc(d, 0xa9); /* test eax, imm32 */
+        dbuf_put_u32(d, 0x7fffffff);
+        jit_exit(s, JIT_CC_E);
+        jit_op_reg(d, 0, 0xf7, 3, JIT_RAX); /* neg eax */
+        jit_store32(d, JIT_RAX, JIT_SP, JIT_VAL(-1));
+        break;
+    case OP_plus:
+        jit_load32(d, JIT_RCX, JIT_SP, JIT_TAG(-1));
+        jit_op_reg(d, 0, 0x85, JIT_RCX, JIT_RCX);
+        pos1 = jit_jcc8(d, JIT_CC_E);
+        jit_op_reg_imm8(d, 0, 7, JIT_RCX, JS_TAG_FLOAT64);
+        jit_exit(s, JIT_CC_NE);
+        jit_patch8(s, pos1);
+        break;
+    case OP_not:
+        jit_cmp_mem_imm(d, JIT_SP, JIT_TAG(-1), JS_TAG_INT);
+        jit_exit(s, JIT_CC_NE);
+        jit_op_mem(d, 0, 0, 0xf7, 2, JIT_SP, JIT_VAL(-1)); /* not */
+        break;
+    case OP_lnot:
+        jit_cmp_mem_imm(d, JIT_SP, JIT_TAG(-1), JS_TAG_UNDEFINED);
+        jit_exit(s, JIT_CC_A);
+        jit_load32(d, JIT_RAX, JIT_SP, JIT_VAL(-1));
+        jit_op_reg(d, 0, 0x85, JIT_RAX, JIT_RAX);
+        jit_set_bool(s, JIT_CC_E, 1);
+        break;
+    case OP_add_loc:
+        idx = bc_buf[pos + 1] * sizeof(JSValue);
+        jit_load32(d, JIT_RCX, JIT_VAR_BUF, idx + JIT_TAG(0));
+        jit_op_mem(d, 0, 0, 0x0b, JIT_RCX, JIT_SP, JIT_TAG(-1));
+        pos1 = jit_jcc8(d, JIT_CC_NE);
+        jit_load32(d, JIT_RAX, JIT_VAR_BUF, idx + JIT_VAL(0));
+        jit_op_mem(d, 0, 0, 0x03, JIT_RAX, JIT_SP, JIT_VAL(-1));
+        jit_exit(s, JIT_CC_O);
+        jit_store32(d, JIT_RAX, JIT_VAR_BUF, idx + JIT_VAL(0));
+        jit_add_sp(d, -1);
+        pos2 = jit_jcc8(d, -1);
+        jit_patch8(s, pos1);
+        jit_cmp_mem_imm(d, JIT_VAR_BUF, idx + JIT_TAG(0), JS_TAG_FLOAT64);
+        jit_exit(s, JIT_CC_NE);
+        jit_cmp_mem_imm(d, JIT_SP, JIT_TAG(-1), JS_TAG_FLOAT64);
+        jit_exit(s, JIT_CC_NE);
+        jit_op_mem(d, 0xf2, 0, 0x0f10, 0, JIT_VAR_BUF, idx + JIT_VAL(0));
+        jit_op_mem(d, 0xf2, 0, 0x0f58, 0, JIT_SP, JIT_VAL(-1));
+        jit_op_mem(d, 0xf2, 0, 0x0f11, 0, JIT_VAR_BUF, idx + JIT_VAL(0));
+        jit_add_sp(d, -1);
+        jit_patch8(s, pos2);
+        break;
+    case OP_if_true:
+    case OP_if_true8:
+        jit_if(s, TRUE, js_jit_jump_target(bc_buf, pos));
+        break;
+    case OP_if_false:
+    case OP_if_false8:
+        jit_if(s, FALSE, js_jit_jump_target(bc_buf, pos));
+        break;
+    case OP_goto:
+    case OP_goto8:
+    case OP_goto16:
+        jit_goto(s, js_jit_jump_target(bc_buf, pos));
+        break;
+    /* the exits must happen before the first side effect of the
+       superinstructions, so the interrupts are polled first */
+    case OP_lt_if_false:
+        jit_poll_interrupts(s);
+        jit_compare(s, JIT_CC_L, JIT_CC_A, TRUE);
+        jit_branch(s, FALSE, js_jit_jump_target(bc_buf, pos));
+        break;
+    case OP_inc_loc_goto:
+        jit_poll_interrupts(s);
+        jit_inc_int(s, JIT_VAR_BUF,
+                    get_u16(bc_buf + pos + 5) * sizeof(JSValue), 1);
+        jit_jump(s, -1, js_jit_jump_target(bc_buf, pos), FALSE);
+        break;
+    default:
+        /* executed by the interpreter */
+        jit_exit(s, -1);
+        break;
+    }
+}
+
+/* return TRUE if the opcodes between 'start' and 'end' (included) can
+   be executed by the compiled code */
+static BOOL js_jit_check_range(JSFunctionBytecode *b, int start, int end)
+{
+    const uint8_t *bc_buf = b->byte_code_buf;
+    int pos, op;
+    for(pos = start; pos <= end; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        /* the interpreter executes the return opcodes */
+        if (!js_jit_is_supported(op) && op != OP_return &&
+            op != OP_return_undef && js_jit_float_const(b, pos) < 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static JSJITCode *js_jit_compile(JSContext *ctx, JSFunctionBytecode *b)
+{
+    JSJITState s_s, *s = &s_s;
+    DynBuf *d = &s->code;
+    const uint8_t *bc_buf = b->byte_code_buf;
+    int bc_len = b->byte_code_len;
+    int pos, len, op, target, i, entry_count, code_size, disp;
+    JSJITCode *jc = NULL;
+    uint8_t *code, *is_entry = NULL;
+    JSJITFixup *f;
+
+#ifdef CONFIG_BIGNUM
+    if (b->js_mode & JS_MODE_MATH)
+        return NULL;
+#endif
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->b = b;
+    js_dbuf_init(ctx, d);
+    s->label_pos = js_malloc(ctx, sizeof(s->label_pos[0]) * bc_len * 2);
+    if (!s->label_pos)
+        goto fail;
+    s->stub_pos = s->label_pos + bc_len;
+    for(i = 0; i < bc_len * 2; i++)
+        s->label_pos[i] = -1;
+    is_entry = js_mallocz(ctx, bc_len);
+    if (!is_entry)
+        goto fail;
+
+    /* the entry points are the function start and the loop headers
+       (target of backward jumps) */
+    entry_count = 0;
+    if (js_jit_check_range(b, 0, bc_len - 1)) {
+        is_entry[0] = TRUE;
+        entry_count++;
+    }
+    for(pos = 0; pos < bc_len; pos += len) {
+        op = bc_buf[pos];
+        len = short_opcode_info(op).size;
+        target = js_jit_jump_target(bc_buf, pos);
+        if (target >= 0 && target <= pos && !is_entry[target] &&
+            js_jit_check_range(b, target, pos)) {
+            is_entry[target] = TRUE;
+            entry_count++;
+        }
+    }
+    if (entry_count == 0)
+        goto fail;
+    jc = js_mallocz(ctx, sizeof(*jc) + sizeof(jc->entry_pos[0]) * bc_len);
+    if (!jc)
+        goto fail;
+
+    /* prologue: save the callee saved registers, load the interpreter
+       state and jump to the target */
+    dbuf_putc(d, 0x53); /* push rbx */
+    dbuf_putc(d, 0x41); /* push r12 */
+    dbuf_putc(d, 0x54);
+    dbuf_putc(d, 0x41); /* push r13 */
+    dbuf_putc(d, 0x55);
+    dbuf_putc(d, 0x41); /* push r14 */
+    dbuf_putc(d, 0x56);
+    dbuf_putc(d, 0x41); /* push r15 */
+    dbuf_putc(d, 0x57);
+    jit_op_reg(d, 1, 0x89, JIT_RDI, JIT_SP);
+    jit_op_reg(d, 1, 0x89, JIT_RSI, JIT_VAR_BUF);
+    jit_op_reg(d, 1, 0x89, JIT_RDX, JIT_ARG_BUF);
+    jit_op_reg(d, 1, 0x89, JIT_R8, JIT_CTX);
+    jit_op_reg(d, 1, 0x89, JIT_R9, JIT_BC_BUF);
+    jit_op_reg(d, 0, 0xff, 4, JIT_RCX); /* jmp rcx */
+
+    /* epilogue: return the position in the bytecode (eax) and the
+       stack pointer */
+    s->exit_pos = d->size;
+    jit_op_reg(d, 1, 0x89, JIT_SP, JIT_RDX);
+    jit_op_reg(d, 1, 0x01, JIT_BC_BUF, JIT_RAX); /* add rax, rbx */
+    dbuf_putc(d, 0x41); /* pop r15 */
+    dbuf_putc(d, 0x5f);
+    dbuf_putc(d, 0x41); /* pop r14 */
+    dbuf_putc(d, 0x5e);
+    dbuf_putc(d, 0x41); /* pop r13 */
+    dbuf_putc(d, 0x5d);
+    dbuf_putc(d, 0x41); /* pop r12 */
+    dbuf_putc(d, 0x5c);
+    dbuf_putc(d, 0x5b); /* pop rbx */
+    dbuf_putc(d, 0xc3); /* ret */
+
+    for(pos = 0; pos < bc_len; pos += len) {
+        op = bc_buf[pos];
+        len = short_opcode_info(op).size;
+        if (is_entry[pos])
+            jc->entry_pos[pos] = d->size + 1;
+        s->label_pos[pos] = d->size;
+        s->pc_pos = pos;
+        js_jit_compile_opcode(s, bc_buf, pos);
+    }
+
+    /* exit stubs */
+    for(i = 0; i < s->fixup_count; i++) {
+        f = &s->fixups[i];
+        if (f->is_exit && s->stub_pos[f->pc_pos] < 0) {
+            s->stub_pos[f->pc_pos] = d->size;
+            dbuf_putc(d, 0xb8); /* mov eax, imm32 */
+            dbuf_put_u32(d, f->pc_pos);
+            dbuf_putc(d, 0xe9); /* jmp rel32 */
+            dbuf_put_u32(d, s->exit_pos - (d->size + 4));
+        }
+    }
+    if (s->error || dbuf_error(d))
+        goto fail;
+    for(i = 0; i < s->fixup_count; i++) {
+        f = &s->fixups[i];
+        if (f->is_exit)
+            target = s->stub_pos[f->pc_pos];
+        else
+            target = s->label_pos[f->pc_pos];
+        if (target < 0)
+            goto fail;
+        disp = target - (f->code_pos + 4);
+        put_u32(d->buf + f->code_pos, disp);
+    }
+
+    code_size = (d->size + 4095) & ~4095;
+    code = mmap(NULL, code_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        goto fail;
+    memcpy(code, d->buf, d->size);
+    if (mprotect(code, code_size, PROT_READ | PROT_EXEC)) {
+        munmap(code, code_size);
+        goto fail;
+    }
+    jc->code = code;
+    jc->code_size = code_size;
+    dbuf_free(d);
+    js_free(ctx, is_entry);
+    js_free(ctx, s->label_pos);
+    js_free(ctx, s->fixups);
+    return jc;
+ fail:
+    js_free(ctx, jc);
+    dbuf_free(d);
+    js_free(ctx, is_entry);
+    js_free(ctx, s->label_pos);
+    js_free(ctx, s->fixups);
+    return NULL;
+}
+
+static void js_jit_free(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    JSJITCode *jc = b->jit;
+    munmap(jc->code, jc->code_size);
+    js_free_rt(rt, jc);
+    b->jit = NULL;
+}
+
+/* Called by the interpreter at the start of the function and after
+   the backward jumps. Execute the compiled code if 'pc' is an entry
+   point. Otherwise update the counter and compile the function when
+   it is hot. */
+static no_inline JSJITResult js_jit_call(JSContext *ctx, JSFunctionBytecode *b,
+                                         JSValue *arg_buf, JSValue *var_buf,
+                                         JSValue *sp, const uint8_t *pc)
+{
+    JSJITResult res;
+    JSJITCode *jc;
+    uint32_t code_pos;
+
+    res.pc = pc;
+    res.sp = sp;
+#ifdef CONFIG_DEBUGGER
+    if (ctx->rt->debugger_info.transport_close)
+        return res;
+#endif
+    jc = b->jit;
+    if (!jc) {
+        if (++b->jit_counter < JS_JIT_THRESHOLD)
+            return res;
+        jc = js_jit_compile(ctx, b);
+        if (!jc) {
+            b->jit_disabled = TRUE;
+            return res;
+        }
+        b->jit = jc;
+    }
+    code_pos = jc->entry_pos[pc - b->byte_code_buf];
+    if (code_pos == 0)
+        return res;
+    return ((JSJITFunc *)(void *)jc->code)(sp, var_buf, arg_buf,
+                                          jc->code + code_pos - 1,
+                                          ctx, b->byte_code_buf);
+}
+#endif /* CONFIG_JIT */
+
+void JS_EnableJIT(JSRuntime *rt, BOOL enable)
+{
+#ifdef CONFIG_JIT
+    rt->jit_enabled = enable;
+#endif
+}
+
 /* create a function object from a function definition. The function
    definition is freed. All the child functions are also created. It
    must be done this way to resolve all the variables. */
@@ -33763,6 +37069,8 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
 
     add_gc_object(ctx->rt, &b->header, JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
 
+    js_create_inline_caches(ctx->rt, b);
+
 #if defined(DUMP_BYTECODE) && (DUMP_BYTECODE & 1)
     if (!(fd->js_mode & JS_MODE_STRIP)) {
         js_dump_function_bytecode(ctx, b);
@@ -33793,6 +37101,12 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
     }
 #endif
     free_bytecode_atoms(rt, b->byte_code_buf, b->byte_code_len, TRUE);
+    if (b->ic)
+        js_free_inline_caches(rt, b);
+#ifdef CONFIG_JIT
+    if (b->jit)
+        js_jit_free(rt, b);
+#endif
 
     if (b->vardefs) {
         for(i = 0; i < b->arg_count + b->var_count; i++) {
@@ -34995,12 +38309,13 @@ typedef enum BCTagEnum {
     BC_TAG_BIG_FLOAT,
     BC_TAG_BIG_DECIMAL,
 #endif
+    BC_TAG_ARRAY_BUFFER_TRANSFER,
 } BCTagEnum;
 
 #ifdef CONFIG_BIGNUM
-#define BC_VERSION 0x43
+#define BC_VERSION 0x44
 #else
-#define BC_VERSION 3
+#define BC_VERSION 4
 #endif
 
 typedef struct BCWriterState {
@@ -35018,6 +38333,9 @@ typedef struct BCWriterState {
     uint8_t **sab_tab;
     int sab_tab_len;
     int sab_tab_size;
+    /* ArrayBuffers written by reference */
+    JSValueConst *transfer_list;
+    int transfer_len;
     /* list of referenced objects (used if allow_reference = TRUE) */
     JSObjectList object_list;
 } BCWriterState;
@@ -35048,6 +38366,7 @@ static const char * const bc_tag_str[] = {
     "bigfloat",
     "bigdecimal",
 #endif
+    "ArrayBufferTransfer",
 };
 #endif
 
@@ -35218,23 +38537,32 @@ static void bc_byte_swap(uint8_t *bc_buf, int bc_len)
 }
 
 static int JS_WriteFunctionBytecode(BCWriterState *s,
-                                    const uint8_t *bc_buf1, int bc_len)
+                                    const JSFunctionBytecode *b)
 {
-    int pos, len, op;
+    int pos, len, op, bc_len;
     JSAtom atom;
     uint8_t *bc_buf;
     uint32_t val;
 
+    bc_len = b->byte_code_len;
     bc_buf = js_malloc(s->ctx, bc_len);
     if (!bc_buf)
         return -1;
-    memcpy(bc_buf, bc_buf1, bc_len);
+    memcpy(bc_buf, b->byte_code_buf, bc_len);
 
     pos = 0;
     while (pos < bc_len) {
         op = bc_buf[pos];
         len = short_opcode_info(op).size;
         switch(short_opcode_info(op).fmt) {
+        case OP_FMT_ic:
+            /* the inline caches are not serialized */
+            atom = b->ic[get_u32(bc_buf + pos + 1)].atom;
+            bc_buf[pos] = js_ic_base_opcode(op);
+            if (bc_atom_to_idx(s, &val, atom))
+                goto fail;
+            put_u32(bc_buf + pos + 1, val);
+            break;
         case OP_FMT_atom:
         case OP_FMT_atom_u8:
         case OP_FMT_atom_u16:
@@ -35474,7 +38802,7 @@ static int JS_WriteFunctionTag(BCWriterState *s, JSValueConst obj)
         bc_put_u8(s, flags);
     }
 
-    if (JS_WriteFunctionBytecode(s, b->byte_code_buf, b->byte_code_len))
+    if (JS_WriteFunctionBytecode(s, b))
         goto fail;
 
     if (b->has_debug) {
@@ -35639,6 +38967,16 @@ static int JS_WriteTypedArray(BCWriterState *s, JSValueConst obj)
     return 0;
 }
 
+static BOOL bc_is_transferred(BCWriterState *s, JSValueConst obj)
+{
+    int i;
+    for(i = 0; i < s->transfer_len; i++) {
+        if (JS_VALUE_GET_PTR(s->transfer_list[i]) == JS_VALUE_GET_PTR(obj))
+            return TRUE;
+    }
+    return FALSE;
+}
+
 static int JS_WriteArrayBuffer(BCWriterState *s, JSValueConst obj)
 {
     JSObject *p = JS_VALUE_GET_OBJ(obj);
@@ -35647,6 +38985,19 @@ static int JS_WriteArrayBuffer(BCWriterState *s, JSValueConst obj)
         JS_ThrowTypeErrorDetachedArrayBuffer(s->ctx);
         return -1;
     }
+    /* the data can only be moved if it comes from the shared
+       allocator, otherwise it is copied */
+    if (abuf->free_func == js_array_buffer_sab_free &&
+        bc_is_transferred(s, obj)) {
+        bc_put_u8(s, BC_TAG_ARRAY_BUFFER_TRANSFER);
+        bc_put_leb128(s, abuf->byte_length);
+        bc_put_u64(s, (uintptr_t)abuf->data);
+        if (js_resize_array(s->ctx, (void **)&s->sab_tab, sizeof(s->sab_tab[0]),
+                            &s->sab_tab_size, s->sab_tab_len + 1))
+            return -1;
+        s->sab_tab[s->sab_tab_len++] = abuf->data;
+        return 0;
+    }
     bc_put_u8(s, BC_TAG_ARRAY_BUFFER);
     bc_put_leb128(s, abuf->byte_length);
     dbuf_put(&s->dbuf, abuf->data, abuf->byte_length);
@@ -35702,8 +39053,11 @@ static int JS_WriteObjectRec(BCWriterState *s, JSValueConst obj)
         }
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
-            JSString *p = JS_VALUE_GET_STRING(obj);
+            JSString *p = js_string_value_get(s->ctx, obj);
+            if (!p)
+                goto fail;
             bc_put_u8(s, BC_TAG_STRING);
             JS_WriteString(s, p);
         }
@@ -35841,16 +39195,51 @@ static int JS_WriteObjectAtoms(BCWriterState *s)
     return -1;
 }
 
-uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
-                         int flags, uint8_t ***psab_tab, size_t *psab_tab_len)
+uint8_t *JS_WriteObject3(JSContext *ctx, size_t *psize, JSValueConst obj,
+                         int flags, uint8_t ***psab_tab, size_t *psab_tab_len,
+                         JSValueConst *transfer_list, int transfer_len)
 {
     BCWriterState ss, *s = &ss;
+    JSObject *p;
+    int i, j;
 
     memset(s, 0, sizeof(*s));
     s->ctx = ctx;
     s->allow_bytecode = ((flags & JS_WRITE_OBJ_BYTECODE) != 0);
     s->allow_sab = ((flags & JS_WRITE_OBJ_SAB) != 0);
     s->allow_reference = ((flags & JS_WRITE_OBJ_REFERENCE) != 0);
+    for(i = 0; i < transfer_len; i++) {
+        if (JS_VALUE_GET_TAG(transfer_list[i]) != JS_TAG_OBJECT)
+            goto invalid_transfer;
+        p = JS_VALUE_GET_OBJ(transfer_list[i]);
+        if (p->class_id != JS_CLASS_ARRAY_BUFFER) {
+        invalid_transfer:
+            JS_ThrowTypeError(ctx, "only ArrayBuffers can be transferred");
+            goto fail1;
+        }
+        if (p->u.array_buffer->detached) {
+            JS_ThrowTypeErrorDetachedArrayBuffer(ctx);
+            goto fail1;
+        }
+        for(j = 0; j < i; j++) {
+            if (JS_VALUE_GET_PTR(transfer_list[j]) == p) {
+                JS_ThrowTypeError(ctx, "duplicate transferred ArrayBuffer");
+                goto fail1;
+            }
+        }
+    }
+    if (s->allow_sab && ctx->rt->sab_funcs.sab_alloc &&
+        ctx->rt->sab_funcs.sab_dup) {
+        /* only the ArrayBuffers with external data are copied */
+        for(i = 0; i < transfer_len; i++) {
+            p = JS_VALUE_GET_OBJ(transfer_list[i]);
+            if (p->u.array_buffer->free_func != js_array_buffer_sab_free &&
+                js_array_buffer_move_to_sab(ctx, p->u.array_buffer))
+                goto fail1;
+        }
+        s->transfer_list = transfer_list;
+        s->transfer_len = transfer_len;
+    }
     /* XXX: could use a different version when bytecode is included */
     if (s->allow_bytecode)
         s->first_atom = JS_ATOM_END;
@@ -35869,6 +39258,8 @@ uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
     *psize = s->dbuf.size;
     if (psab_tab)
         *psab_tab = s->sab_tab;
+    else
+        js_free(ctx, s->sab_tab);
     if (psab_tab_len)
         *psab_tab_len = s->sab_tab_len;
     return s->dbuf.buf;
@@ -35876,7 +39267,9 @@ uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
     js_object_list_end(ctx, &s->object_list);
     js_free(ctx, s->atom_to_idx);
     js_free(ctx, s->idx_to_atom);
+    js_free(ctx, s->sab_tab);
     dbuf_free(&s->dbuf);
+ fail1:
     *psize = 0;
     if (psab_tab)
         *psab_tab = NULL;
@@ -35885,6 +39278,13 @@ uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
     return NULL;
 }
 
+uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
+                         int flags, uint8_t ***psab_tab, size_t *psab_tab_len)
+{
+    return JS_WriteObject3(ctx, psize, obj, flags, psab_tab, psab_tab_len,
+                           NULL, 0);
+}
+
 uint8_t *JS_WriteObject(JSContext *ctx, size_t *psize, JSValueConst obj,
                         int flags)
 {
@@ -36506,6 +39906,7 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
         bc_read_trace(s, "bytecode {\n");
         if (JS_ReadFunctionBytecode(s, b, byte_code_offset, b->byte_code_len))
             goto fail;
+        js_create_inline_caches(ctx->rt, b);
         bc_read_trace(s, "}\n");
     }
     if (b->has_debug) {
@@ -36832,6 +40233,41 @@ static JSValue JS_ReadSharedArrayBuffer(BCReaderState *s)
     return JS_EXCEPTION;
 }
 
+static JSValue JS_ReadArrayBufferTransfer(BCReaderState *s)
+{
+    JSContext *ctx = s->ctx;
+    JSRuntime *rt = ctx->rt;
+    uint32_t byte_length;
+    uint8_t *data_ptr;
+    JSValue obj;
+    uint64_t u64;
+
+    if (bc_get_leb128(s, &byte_length))
+        return JS_EXCEPTION;
+    if (bc_get_u64(s, &u64))
+        return JS_EXCEPTION;
+    data_ptr = (uint8_t *)(uintptr_t)u64;
+    if (js_array_buffer_sab_charge(ctx, byte_length))
+        return JS_EXCEPTION;
+    obj = js_array_buffer_constructor3(ctx, JS_UNDEFINED, byte_length,
+                                       JS_CLASS_ARRAY_BUFFER,
+                                       data_ptr, js_array_buffer_sab_free,
+                                       (void *)(uintptr_t)byte_length,
+                                       FALSE);
+    if (JS_IsException(obj)) {
+        js_array_buffer_sab_uncharge(rt, byte_length);
+        return obj;
+    }
+    /* the data is released by the ArrayBuffer finalizer */
+    rt->sab_funcs.sab_dup(rt->sab_funcs.sab_opaque, data_ptr);
+    if (BC_add_object_ref(s, obj))
+        goto fail;
+    return obj;
+ fail:
+    JS_FreeValue(ctx, obj);
+    return JS_EXCEPTION;
+}
+
 static JSValue JS_ReadDate(BCReaderState *s)
 {
     JSContext *ctx = s->ctx;
@@ -36959,6 +40395,11 @@ static JSValue JS_ReadObjectRec(BCReaderState *s)
             goto invalid_tag;
         obj = JS_ReadSharedArrayBuffer(s);
         break;
+    case BC_TAG_ARRAY_BUFFER_TRANSFER:
+        if (!s->allow_sab || !ctx->rt->sab_funcs.sab_dup)
+            goto invalid_tag;
+        obj = JS_ReadArrayBufferTransfer(s);
+        break;
     case BC_TAG_DATE:
         obj = JS_ReadDate(s);
         break;
@@ -37423,6 +40864,13 @@ static JSValue JS_ToObject(JSContext *ctx, JSValueConst val)
             JS_DefinePropertyValue(ctx, obj, JS_ATOM_length, JS_NewInt32(ctx, p1->len), 0);
         }
         goto set_value;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSString *p1 = js_string_value_get(ctx, val);
+            if (!p1)
+                return JS_EXCEPTION;
+            return JS_ToObject(ctx, JS_MKPTR(JS_TAG_STRING, p1));
+        }
     case JS_TAG_BOOL:
         obj = JS_NewObjectClass(ctx, JS_CLASS_BOOLEAN);
         goto set_value;
@@ -41819,6 +45267,8 @@ static JSValue js_thisStringValue(JSContext *ctx, JSValueConst this_val)
 {
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING)
         return JS_DupValue(ctx, this_val);
+    if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING_ROPE)
+        return JS_ToString(ctx, this_val);
 
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_OBJECT) {
         JSObject *p = JS_VALUE_GET_OBJ(this_val);
@@ -42068,32 +45518,189 @@ static int string_cmp(JSString *p1, JSString *p2, int x1, int x2, int len)
     return 0;
 }
 
-static int string_indexof_char(JSString *p, int c, int from)
+/* minimum needle length for which string_indexof() uses the
+   Boyer-Moore-Horspool algorithm */
+#define STRING_INDEXOF_BMH_MIN 32
+
+static force_inline int str_get1(const void *s, int shift, int i)
 {
-    /* assuming 0 <= from <= p->len */
-    int i, len = p->len;
-    if (p->is_wide_char) {
-        for (i = from; i < len; i++) {
-            if (p->u.str16[i] == c)
-                return i;
+    if (shift)
+        return ((const uint16_t *)s)[i];
+    else
+        return ((const uint8_t *)s)[i];
+}
+
+/* return the first position >= 'from' of 'c' in 's' or -1 */
+static force_inline int str_find_char(const void *s, int shift, int from,
+                                      int len, int c)
+{
+    const uint16_t *str16;
+    int i;
+
+    if (!shift) {
+        const uint8_t *q;
+        if (c & ~0xff)
+            return -1;
+        q = memchr((const uint8_t *)s + from, c, len - from);
+        if (!q)
+            return -1;
+        return q - (const uint8_t *)s;
+    }
+    str16 = s;
+    i = from;
+#if defined(__SSE2__)
+    {
+        const __m128i v_c = _mm_set1_epi16(c);
+        int mask;
+        while (len - i >= 8) {
+            mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(str16 + i)), v_c));
+            if (mask != 0)
+                return i + (ctz32(mask) >> 1);
+            i += 8;
         }
-    } else {
-        if ((c & ~0xff) == 0) {
-            for (i = from; i < len; i++) {
-                if (p->u.str8[i] == (uint8_t)c)
-                    return i;
-            }
+    }
+#endif
+    for (; i < len; i++) {
+        if (str16[i] == c)
+            return i;
+    }
+    return -1;
+}
+
+/* compare 'len' characters of 's' at position 'i' with the start of 'p' */
+static force_inline BOOL str_equal(const void *s, int shift1, int i,
+                                   const void *p, int shift2, int len)
+{
+    int k;
+
+    if (shift1 == shift2)
+        return !memcmp((const uint8_t *)s + (i << shift1), p, len << shift1);
+    for (k = 0; k < len; k++) {
+        if (str_get1(s, shift1, i + k) != str_get1(p, shift2, k))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Search 'p' of length 'plen' >= 2 in 's' of length 'len' from
+   position 'from'. The characters of 'p' must fit in the characters
+   of 's'. The function is specialized by the compiler for each
+   combination of constant 'shift1' and 'shift2'. */
+static force_inline int str_indexof(const void *s, int shift1, int len,
+                                    const void *p, int shift2, int plen,
+                                    int from)
+{
+    int i, c, first, last, last_pos;
+
+    first = str_get1(p, shift2, 0);
+    last = str_get1(p, shift2, plen - 1);
+    last_pos = len - plen; /* last possible match position */
+    i = from;
+    if (plen >= STRING_INDEXOF_BMH_MIN) {
+        /* Boyer-Moore-Horspool. The shift table is indexed by the
+           low 8 bits of the characters: a collision only gives a
+           shorter shift. */
+        int shift_tab[256], k;
+
+        for (k = 0; k < 256; k++)
+            shift_tab[k] = plen;
+        for (k = 0; k < plen - 1; k++)
+            shift_tab[str_get1(p, shift2, k) & 0xff] = plen - 1 - k;
+        while (i <= last_pos) {
+            c = str_get1(s, shift1, i + plen - 1);
+            if (c == last && str_equal(s, shift1, i, p, shift2, plen - 1))
+                return i;
+            i += shift_tab[c & 0xff];
         }
+        return -1;
+    }
+#if defined(__SSE2__)
+    /* compare 16 bytes at the positions of the first and last
+       characters of the needle at once, then check the candidates */
+    if (!shift1) {
+        const uint8_t *str8 = s;
+        const __m128i v_first = _mm_set1_epi8(first);
+        const __m128i v_last = _mm_set1_epi8(last);
+        __m128i m;
+        int mask, j;
+
+        while (last_pos - i >= 16) {
+            m = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(str8 + i)), v_first),
+                              _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(str8 + i + plen - 1)), v_last));
+            mask = _mm_movemask_epi8(m);
+            while (mask != 0) {
+                j = i + ctz32(mask);
+                if (str_equal(s, shift1, j + 1, (const uint8_t *)p + (1 << shift2),
+                              shift2, plen - 2))
+                    return j;
+                mask &= mask - 1;
+            }
+            i += 16;
+        }
+    } else {
+        const uint16_t *str16 = s;
+        const __m128i v_first = _mm_set1_epi16(first);
+        const __m128i v_last = _mm_set1_epi16(last);
+        __m128i m;
+        int mask, j;
+
+        while (last_pos - i >= 8) {
+            m = _mm_and_si128(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(str16 + i)), v_first),
+                              _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(str16 + i + plen - 1)), v_last));
+            /* two bits per character */
+            mask = _mm_movemask_epi8(m) & 0x5555;
+            while (mask != 0) {
+                j = i + (ctz32(mask) >> 1);
+                if (str_equal(s, shift1, j + 1, (const uint8_t *)p + (1 << shift2),
+                              shift2, plen - 2))
+                    return j;
+                mask &= mask - 1;
+            }
+            i += 8;
+        }
+    }
+#endif
+    while (i <= last_pos) {
+        i = str_find_char(s, shift1, i, last_pos + 1, first);
+        if (i < 0)
+            break;
+        if (str_get1(s, shift1, i + plen - 1) == last &&
+            str_equal(s, shift1, i + 1, (const uint8_t *)p + (1 << shift2),
+                      shift2, plen - 2))
+            return i;
+        i++;
     }
     return -1;
 }
 
+static int string_indexof_char(JSString *p, int c, int from)
+{
+    /* assuming 0 <= from <= p->len */
+    if (p->is_wide_char)
+        return str_find_char(p->u.str16, 1, from, p->len, c);
+    else
+        return str_find_char(p->u.str8, 0, from, p->len, c);
+}
+
 static int string_indexof(JSString *p1, JSString *p2, int from)
 {
     /* assuming 0 <= from <= p1->len */
     int c, i, j, len1 = p1->len, len2 = p2->len;
     if (len2 == 0)
         return from;
+    if (len2 > len1 - from)
+        return -1;
+    if (len2 == 1)
+        return string_indexof_char(p1, string_get(p2, 0), from);
+    if (p1->is_wide_char) {
+        if (p2->is_wide_char)
+            return str_indexof(p1->u.str16, 1, len1, p2->u.str16, 1, len2, from);
+        else
+            return str_indexof(p1->u.str16, 1, len1, p2->u.str8, 0, len2, from);
+    } else if (!p2->is_wide_char) {
+        return str_indexof(p1->u.str8, 0, len1, p2->u.str8, 0, len2, from);
+    }
+    /* 16 bit needle in a 8 bit string */
     for (i = from, c = string_get(p2, 0); i + len2 <= len1; i = j + 1) {
         j = string_indexof_char(p1, c, i);
         if (j < 0 || j + len2 > len1)
@@ -42194,7 +45801,7 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv, int lastIndexOf)
 {
     JSValue str, v;
-    int i, len, v_len, pos, start, stop, ret, inc;
+    int i, len, v_len, pos, ret;
     JSString *p;
     JSString *p1;
 
@@ -42208,6 +45815,7 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
     p1 = JS_VALUE_GET_STRING(v);
     len = p->len;
     v_len = p1->len;
+    ret = -1;
     if (lastIndexOf) {
         pos = len - v_len;
         if (argc > 1) {
@@ -42221,29 +45829,23 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
                     pos = d;
             }
         }
-        start = pos;
-        stop = 0;
-        inc = -1;
+        if (len >= v_len && pos >= 0) {
+            for (i = pos;; i--) {
+                if (!string_cmp(p, p1, i, 0, v_len)) {
+                    ret = i;
+                    break;
+                }
+                if (i == 0)
+                    break;
+            }
+        }
     } else {
         pos = 0;
         if (argc > 1) {
             if (JS_ToInt32Clamp(ctx, &pos, argv[1], 0, len, 0))
                 goto fail;
         }
-        start = pos;
-        stop = len - v_len;
-        inc = 1;
-    }
-    ret = -1;
-    if (len >= v_len && inc * (stop - start) >= 0) {
-        for (i = start;; i += inc) {
-            if (!string_cmp(p, p1, i, 0, v_len)) {
-                ret = i;
-                break;
-            }
-            if (i == stop)
-                break;
-        }
+        ret = string_indexof(p, p1, pos);
     }
     JS_FreeValue(ctx, str);
     JS_FreeValue(ctx, v);
@@ -42290,8 +45892,8 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
     len -= v_len;
     ret = 0;
     if (magic == 0) {
-        start = pos;
-        stop = len;
+        ret = (string_indexof(p, p1, pos) >= 0);
+        goto done;
     } else {
         if (magic == 1) {
             if (pos > len)
@@ -42422,8 +46024,10 @@ static JSValue js_string___GetSubstitution(JSContext *ctx, JSValueConst this_val
     if (!JS_IsString(rep) || !JS_IsString(str))
         return JS_ThrowTypeError(ctx, "not a string");
 
-    sp = JS_VALUE_GET_STRING(str);
-    rp = JS_VALUE_GET_STRING(rep);
+    sp = js_string_value_get(ctx, str);
+    rp = js_string_value_get(ctx, rep);
+    if (!sp || !rp)
+        return JS_EXCEPTION;
 
     string_buffer_init(ctx, b, 0);
 
@@ -43845,10 +47449,18 @@ static JSValue js___date_create(JSContext *ctx, JSValueConst this_val,
 
 /* RegExp */
 
+static void js_regexp_free_dfa(JSRegExp *re)
+{
+    if (re->exec_count > JS_REGEXP_DFA_EXEC_COUNT)
+        lre_dfa_free(re->dfa);
+    re->exec_count = 0;
+}
+
 static void js_regexp_finalizer(JSRuntime *rt, JSValue val)
 {
     JSObject *p = JS_VALUE_GET_OBJ(val);
     JSRegExp *re = &p->u.regexp;
+    js_regexp_free_dfa(re);
     JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, re->bytecode));
     JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, re->pattern));
 }
@@ -44090,6 +47702,7 @@ static JSValue js_regexp_compile(JSContext *ctx, JSValueConst this_val,
         if (JS_IsException(bc))
             goto fail;
     }
+    js_regexp_free_dfa(re);
     JS_FreeValue(ctx, JS_MKPTR(JS_TAG_STRING, re->pattern));
     JS_FreeValue(ctx, JS_MKPTR(JS_TAG_STRING, re->bytecode));
     re->pattern = JS_VALUE_GET_STRING(pattern);
@@ -44298,12 +47911,130 @@ void *lre_realloc(void *opaque, void *ptr, size_t size)
     return js_realloc_rt(ctx->rt, ptr, size);
 }
 
-static JSValue js_regexp_exec(JSContext *ctx, JSValueConst this_val,
-                              int argc, JSValueConst *argv)
+/* 'lastIndex' is the first property of the RegExp objects. As it is
+   not configurable, it stays a data property at this position. */
+static int js_regexp_get_last_index(JSContext *ctx, int64_t *plast_index,
+                                    JSValueConst obj)
+{
+    JSObject *p = JS_VALUE_GET_OBJ(obj);
+    JSShapeProperty *prs = get_shape_prop(p->shape);
+    JSValue val;
+
+    if (likely(p->shape->prop_count != 0 &&
+               prs->atom == JS_ATOM_lastIndex)) {
+        val = p->prop[0].u.value;
+        if (likely(JS_VALUE_GET_TAG(val) == JS_TAG_INT)) {
+            *plast_index = max_int(JS_VALUE_GET_INT(val), 0);
+            return 0;
+        }
+        val = JS_DupValue(ctx, val);
+    } else {
+        val = JS_GetProperty(ctx, obj, JS_ATOM_lastIndex);
+        if (JS_IsException(val))
+            return -1;
+    }
+    return JS_ToLengthFree(ctx, plast_index, val);
+}
+
+static int js_regexp_set_last_index(JSContext *ctx, JSValueConst obj,
+                                    int last_index)
+{
+    JSObject *p = JS_VALUE_GET_OBJ(obj);
+    JSShapeProperty *prs = get_shape_prop(p->shape);
+
+    if (likely(p->shape->prop_count != 0 &&
+               prs->atom == JS_ATOM_lastIndex &&
+               (prs->flags & JS_PROP_WRITABLE))) {
+        set_value(ctx, &p->prop[0].u.value, JS_NewInt32(ctx, last_index));
+        return 0;
+    }
+    return JS_SetProperty(ctx, obj, JS_ATOM_lastIndex,
+                          JS_NewInt32(ctx, last_index));
+}
+
+/* Return an array of 'len' undefined elements with the 'index',
+   'input' and 'groups' properties set to undefined. They are
+   respectively at prop[1], prop[2] and prop[3]. */
+static JSValue js_regexp_new_result(JSContext *ctx, int len)
+{
+    JSShape *sh;
+    JSObject *p;
+    JSValue obj;
+    int i;
+
+    sh = ctx->regexp_result_shape;
+    if (!sh) {
+        sh = js_new_shape2(ctx, get_proto_obj(ctx->class_proto[JS_CLASS_ARRAY]),
+                           JS_PROP_INITIAL_HASH_SIZE, 4);
+        if (!sh)
+            return JS_EXCEPTION;
+        if (add_shape_property(ctx, &sh, NULL, JS_ATOM_length,
+                               JS_PROP_WRITABLE | JS_PROP_LENGTH) ||
+            add_shape_property(ctx, &sh, NULL, JS_ATOM_index, JS_PROP_C_W_E) ||
+            add_shape_property(ctx, &sh, NULL, JS_ATOM_input, JS_PROP_C_W_E) ||
+            add_shape_property(ctx, &sh, NULL, JS_ATOM_groups, JS_PROP_C_W_E)) {
+            js_free_shape(ctx->rt, sh);
+            return JS_EXCEPTION;
+        }
+        ctx->regexp_result_shape = sh;
+    }
+    obj = JS_NewObjectFromShape(ctx, js_dup_shape(sh), JS_CLASS_ARRAY);
+    if (JS_IsException(obj))
+        return obj;
+    p = JS_VALUE_GET_OBJ(obj);
+    p->prop[1].u.value = JS_UNDEFINED;
+    p->prop[2].u.value = JS_UNDEFINED;
+    p->prop[3].u.value = JS_UNDEFINED;
+    if (len > 0) {
+        if (expand_fast_array(ctx, p, len) < 0) {
+            JS_FreeValue(ctx, obj);
+            return JS_EXCEPTION;
+        }
+        for(i = 0; i < len; i++)
+            p->u.array.u.values[i] = JS_UNDEFINED;
+        p->u.array.count = len;
+        p->prop[0].u.value = JS_NewInt32(ctx, len);
+    }
+    return obj;
+}
+
+/* Return 1 if the regexp matches 'str' at or after 'last_index', 0
+   if not, or -1 if its DFA is not available. */
+static int js_regexp_dfa_exec(JSContext *ctx, JSRegExp *re, JSString *str,
+                              int last_index)
+{
+    int ret;
+
+    if (re->exec_count < JS_REGEXP_DFA_EXEC_COUNT) {
+        if (++re->exec_count < JS_REGEXP_DFA_EXEC_COUNT)
+            return -1;
+        re->dfa = lre_dfa_new(re->bytecode->u.str8, ctx->rt,
+                              (DynBufReallocFunc *)js_realloc_rt);
+        if (!re->dfa) {
+            re->exec_count = JS_REGEXP_DFA_EXEC_COUNT;
+            return -1;
+        }
+    } else if (re->exec_count == JS_REGEXP_DFA_EXEC_COUNT) {
+        return -1;
+    }
+    ret = lre_dfa_exec(re->dfa, str->u.str8, last_index, str->len,
+                       str->is_wide_char);
+    if (ret < 0) {
+        /* too many states: use lre_exec() only */
+        lre_dfa_free(re->dfa);
+        re->exec_count = JS_REGEXP_DFA_EXEC_COUNT;
+    }
+    return ret;
+}
+
+/* if 'test_only' is TRUE, return a boolean instead of the match result */
+static JSValue js_regexp_exec_internal(JSContext *ctx, JSValueConst this_val,
+                                       JSValueConst arg, BOOL test_only)
 {
     JSRegExp *re = js_get_regexp(ctx, this_val, TRUE);
     JSString *str;
-    JSValue t, ret, str_val, obj, val, groups;
+    JSObject *p;
+    JSValue t, ret, str_val, obj, groups;
     JSValue indices, indices_groups;
     uint8_t *re_bytecode;
     uint8_t **capture, *str_buf;
@@ -44314,19 +48045,18 @@ static JSValue js_regexp_exec(JSContext *ctx, JSValueConst this_val,
     if (!re)
         return JS_EXCEPTION;
 
-    str_val = JS_ToString(ctx, argv[0]);
+    str_val = JS_ToString(ctx, arg);
     if (JS_IsException(str_val))
         return JS_EXCEPTION;
 
     ret = JS_EXCEPTION;
-    obj = JS_NULL;
+    obj = test_only ? JS_FALSE : JS_NULL;
     groups = JS_UNDEFINED;
     indices = JS_UNDEFINED;
     indices_groups = JS_UNDEFINED;
     capture = NULL;
 
-    val = JS_GetProperty(ctx, this_val, JS_ATOM_lastIndex);
-    if (JS_IsException(val) || JS_ToLengthFree(ctx, &last_index, val))
+    if (js_regexp_get_last_index(ctx, &last_index, this_val))
         goto fail;
 
     re_bytecode = re->bytecode->u.str8;
@@ -44336,25 +48066,30 @@ static JSValue js_regexp_exec(JSContext *ctx, JSValueConst this_val,
     }
     str = JS_VALUE_GET_STRING(str_val);
     capture_count = lre_get_capture_count(re_bytecode);
-    if (capture_count > 0) {
-        capture = js_malloc(ctx, sizeof(capture[0]) * capture_count * 2);
-        if (!capture)
-            goto fail;
-    }
     shift = str->is_wide_char;
     str_buf = str->u.str8;
     if (last_index > str->len) {
         rc = 2;
     } else {
-        rc = lre_exec(capture, re_bytecode,
-                      str_buf, last_index, str->len,
-                      shift, ctx);
+        /* the DFA quickly rejects the strings which do not match */
+        rc = js_regexp_dfa_exec(ctx, re, str, last_index);
+        if (rc == 1 && test_only &&
+            !(re_flags & (LRE_FLAG_GLOBAL | LRE_FLAG_STICKY))) {
+            ret = JS_TRUE;
+            goto fail;
+        }
+        if (rc != 0) {
+            /* at most 255 captures */
+            capture = alloca(sizeof(capture[0]) * capture_count * 2);
+            rc = lre_exec(capture, re_bytecode,
+                          str_buf, last_index, str->len,
+                          shift, ctx);
+        }
     }
     if (rc != 1) {
         if (rc >= 0) {
             if (rc == 2 || (re_flags & (LRE_FLAG_GLOBAL | LRE_FLAG_STICKY))) {
-                if (JS_SetProperty(ctx, this_val, JS_ATOM_lastIndex,
-                                   JS_NewInt32(ctx, 0)) < 0)
+                if (js_regexp_set_last_index(ctx, this_val, 0) < 0)
                     goto fail;
             }
         } else {
@@ -44364,13 +48099,18 @@ static JSValue js_regexp_exec(JSContext *ctx, JSValueConst this_val,
     } else {
         int prop_flags;
         if (re_flags & (LRE_FLAG_GLOBAL | LRE_FLAG_STICKY)) {
-            if (JS_SetProperty(ctx, this_val, JS_ATOM_lastIndex,
-                               JS_NewInt32(ctx, (capture[1] - str_buf) >> shift)) < 0)
+            if (js_regexp_set_last_index(ctx, this_val,
+                                         (capture[1] - str_buf) >> shift) < 0)
                 goto fail;
         }
-        obj = JS_NewArray(ctx);
+        if (test_only) {
+            ret = JS_TRUE;
+            goto fail;
+        }
+        obj = js_regexp_new_result(ctx, capture_count);
         if (JS_IsException(obj))
             goto fail;
+        p = JS_VALUE_GET_OBJ(obj);
         prop_flags = JS_PROP_C_W_E | JS_PROP_THROW;
         group_name_ptr = lre_get_groupnames(re_bytecode);
         if (group_name_ptr) {
@@ -44455,23 +48195,14 @@ static JSValue js_regexp_exec(JSContext *ctx, JSValueConst this_val,
                 }
             }
 
-            if (JS_DefinePropertyValueUint32(ctx, obj, i, val, prop_flags) < 0)
-                goto fail;
+            p->u.array.u.values[i] = val;
         }
 
-        t = groups, groups = JS_UNDEFINED;
-        if (JS_DefinePropertyValue(ctx, obj, JS_ATOM_groups,
-                                   t, prop_flags) < 0) {
-            goto fail;
-        }
-
-        t = JS_NewInt32(ctx, (capture[0] - str_buf) >> shift);
-        if (JS_DefinePropertyValue(ctx, obj, JS_ATOM_index, t, prop_flags) < 0)
-            goto fail;
-
-        t = str_val, str_val = JS_UNDEFINED;
-        if (JS_DefinePropertyValue(ctx, obj, JS_ATOM_input, t, prop_flags) < 0)
-            goto fail;
+        p->prop[1].u.value = JS_NewInt32(ctx, (capture[0] - str_buf) >> shift);
+        p->prop[2].u.value = str_val;
+        str_val = JS_UNDEFINED;
+        p->prop[3].u.value = groups;
+        groups = JS_UNDEFINED;
 
         if (!JS_IsUndefined(indices)) {
             t = indices_groups, indices_groups = JS_UNDEFINED;
@@ -44494,16 +48225,21 @@ fail:
     JS_FreeValue(ctx, str_val);
     JS_FreeValue(ctx, groups);
     JS_FreeValue(ctx, obj);
-    js_free(ctx, capture);
     return ret;
 }
 
+static JSValue js_regexp_exec(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv)
+{
+    return js_regexp_exec_internal(ctx, this_val, argv[0], FALSE);
+}
+
 /* delete portions of a string that match a given regex */
 static JSValue JS_RegExpDelete(JSContext *ctx, JSValueConst this_val, JSValueConst arg)
 {
     JSRegExp *re = js_get_regexp(ctx, this_val, TRUE);
     JSString *str;
-    JSValue str_val, val;
+    JSValue str_val;
     uint8_t *re_bytecode;
     int ret;
     uint8_t **capture, *str_buf;
@@ -44527,8 +48263,7 @@ static JSValue JS_RegExpDelete(JSContext *ctx, JSValueConst this_val, JSValueCon
     if ((re_flags & (LRE_FLAG_GLOBAL | LRE_FLAG_STICKY)) == 0) {
         last_index = 0;
     } else {
-        val = JS_GetProperty(ctx, this_val, JS_ATOM_lastIndex);
-        if (JS_IsException(val) || JS_ToLengthFree(ctx, &last_index, val))
+        if (js_regexp_get_last_index(ctx, &last_index, this_val))
             goto fail;
     }
     capture_count = lre_get_capture_count(re_bytecode);
@@ -44549,8 +48284,7 @@ static JSValue JS_RegExpDelete(JSContext *ctx, JSValueConst this_val, JSValueCon
         if (ret != 1) {
             if (ret >= 0) {
                 if (ret == 2 || (re_flags & (LRE_FLAG_GLOBAL | LRE_FLAG_STICKY))) {
-                    if (JS_SetProperty(ctx, this_val, JS_ATOM_lastIndex,
-                                       JS_NewInt32(ctx, 0)) < 0)
+                    if (js_regexp_set_last_index(ctx, this_val, 0) < 0)
                         goto fail;
                 }
             } else {
@@ -44568,8 +48302,7 @@ static JSValue JS_RegExpDelete(JSContext *ctx, JSValueConst this_val, JSValueCon
         }
         next_src_pos = end;
         if (!(re_flags & LRE_FLAG_GLOBAL)) {
-            if (JS_SetProperty(ctx, this_val, JS_ATOM_lastIndex,
-                               JS_NewInt32(ctx, end)) < 0)
+            if (js_regexp_set_last_index(ctx, this_val, end) < 0)
                 goto fail;
             break;
         }
@@ -44594,13 +48327,12 @@ fail:
     return JS_EXCEPTION;
 }
 
-static JSValue JS_RegExpExec(JSContext *ctx, JSValueConst r, JSValueConst s)
+/* 'method' is the value of the 'exec' property of 'r' */
+static JSValue JS_RegExpExecMethod(JSContext *ctx, JSValueConst r,
+                                   JSValueConst s, JSValue method)
 {
-    JSValue method, ret;
+    JSValue ret;
 
-    method = JS_GetProperty(ctx, r, JS_ATOM_exec);
-    if (JS_IsException(method))
-        return method;
     if (JS_IsFunction(ctx, method)) {
         ret = JS_CallFree(ctx, method, r, 1, &s);
         if (JS_IsException(ret))
@@ -44615,6 +48347,16 @@ static JSValue JS_RegExpExec(JSContext *ctx, JSValueConst r, JSValueConst s)
     return js_regexp_exec(ctx, r, 1, &s);
 }
 
+static JSValue JS_RegExpExec(JSContext *ctx, JSValueConst r, JSValueConst s)
+{
+    JSValue method;
+
+    method = JS_GetProperty(ctx, r, JS_ATOM_exec);
+    if (JS_IsException(method))
+        return method;
+    return JS_RegExpExecMethod(ctx, r, s, method);
+}
+
 #if 0
 static JSValue js_regexp___RegExpExec(JSContext *ctx, JSValueConst this_val,
                                       int argc, JSValueConst *argv)
@@ -44631,10 +48373,19 @@ static JSValue js_regexp___RegExpDelete(JSContext *ctx, JSValueConst this_val,
 static JSValue js_regexp_test(JSContext *ctx, JSValueConst this_val,
                               int argc, JSValueConst *argv)
 {
-    JSValue val;
+    JSValue val, method;
     BOOL ret;
 
-    val = JS_RegExpExec(ctx, this_val, argv[0]);
+    method = JS_GetProperty(ctx, this_val, JS_ATOM_exec);
+    if (JS_IsException(method))
+        return JS_EXCEPTION;
+    if (js_get_regexp(ctx, this_val, FALSE) &&
+        JS_IsCFunction(ctx, method, js_regexp_exec, 0)) {
+        /* the match result is not observable */
+        JS_FreeValue(ctx, method);
+        return js_regexp_exec_internal(ctx, this_val, argv[0], TRUE);
+    }
+    val = JS_RegExpExecMethod(ctx, this_val, argv[0], method);
     if (JS_IsException(val))
         return JS_EXCEPTION;
     ret = !JS_IsNull(val);
@@ -45725,6 +49476,7 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
         if (JS_IsFunction(ctx, val))
             break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
     case JS_TAG_INT:
     case JS_TAG_FLOAT64:
     case JS_TAG_BOOL:
@@ -45747,16 +49499,68 @@ exception:
     return JS_EXCEPTION;
 }
 
+/* FALSE if js_json_check() does not use the key of 'val', so that it
+   can be omitted */
+static inline BOOL js_json_need_key(JSONStringifyContext *jsc,
+                                    JSValueConst val)
+{
+    if (!JS_IsUndefined(jsc->replacer_func))
+        return TRUE;
+    switch (JS_VALUE_GET_NORM_TAG(val)) {
+    case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
+    case JS_TAG_INT:
+    case JS_TAG_FLOAT64:
+    case JS_TAG_BOOL:
+    case JS_TAG_NULL:
+    case JS_TAG_UNDEFINED:
+    case JS_TAG_SYMBOL:
+        return FALSE;
+    default:
+        return TRUE;
+    }
+}
+
+/* TRUE if the enumerable own properties of 'p' are data properties
+   which can be read in order from its shape. */
+static BOOL js_json_is_plain_object(JSContext *ctx, JSObject *p)
+{
+    JSShape *sh;
+    JSShapeProperty *prs;
+    uint32_t idx;
+    int i;
+
+    if (p->class_id != JS_CLASS_OBJECT || p->is_exotic)
+        return FALSE;
+    sh = p->shape;
+    if (sh->has_small_array_index)
+        return FALSE;
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        if (prs->atom == JS_ATOM_NULL || !(prs->flags & JS_PROP_ENUMERABLE))
+            continue;
+        if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
+            return FALSE;
+        /* array indexes are enumerated first */
+        if (JS_AtomIsArrayIndex(ctx, &idx, prs->atom))
+            return FALSE;
+    }
+    return TRUE;
+}
+
 static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
                           JSValueConst holder, JSValue val,
                           JSValueConst indent)
 {
     JSValue indent1, sep, sep1, tab, v, prop;
     JSObject *p;
+    JSShape *sh;
+    JSShapeProperty *prs;
+    JSString *str;
     int64_t i, len;
     int cl, ret;
     BOOL has_content;
 
+    sh = NULL;
     indent1 = JS_UNDEFINED;
     sep = JS_UNDEFINED;
     sep1 = JS_UNDEFINED;
@@ -45822,13 +49626,22 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
                 if (i > 0)
                     string_buffer_putc8(jsc->b, ',');
                 string_buffer_concat_value(jsc->b, sep);
-                v = JS_GetPropertyInt64(ctx, val, i);
-                if (JS_IsException(v))
-                    goto exception;
-                /* XXX: could do this string conversion only when needed */
-                prop = JS_ToStringFree(ctx, JS_NewInt64(ctx, i));
-                if (JS_IsException(prop))
-                    goto exception;
+                /* the array can be modified by toJSON() or the replacer */
+                if (p->class_id == JS_CLASS_ARRAY && p->fast_array &&
+                    i < p->u.array.count) {
+                    v = JS_DupValue(ctx, p->u.array.u.values[i]);
+                } else {
+                    v = JS_GetPropertyInt64(ctx, val, i);
+                    if (JS_IsException(v))
+                        goto exception;
+                }
+                if (js_json_need_key(jsc, v)) {
+                    prop = JS_ToStringFree(ctx, JS_NewInt64(ctx, i));
+                    if (JS_IsException(prop)) {
+                        JS_FreeValue(ctx, v);
+                        goto exception;
+                    }
+                }
                 v = js_json_check(ctx, jsc, val, v, prop);
                 JS_FreeValue(ctx, prop);
                 prop = JS_UNDEFINED;
@@ -45844,6 +49657,60 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
                 string_buffer_concat_value(jsc->b, indent);
             }
             string_buffer_putc8(jsc->b, ']');
+        } else if (JS_IsUndefined(jsc->property_list) &&
+                   js_json_is_plain_object(ctx, p)) {
+            /* Fast path: the keys are taken from the shape. A
+               reference to the shape is kept so that its properties
+               stay unchanged if the object is modified by toJSON() or
+               the replacer. */
+            sh = js_dup_shape(p->shape);
+            string_buffer_putc8(jsc->b, '{');
+            has_content = FALSE;
+            for(i = 0; i < sh->prop_count; i++) {
+                prs = &get_shape_prop(sh)[i];
+                if (prs->atom == JS_ATOM_NULL ||
+                    !(prs->flags & JS_PROP_ENUMERABLE) ||
+                    !JS_AtomIsString(ctx, prs->atom))
+                    continue;
+                if (p->shape == sh) {
+                    v = JS_DupValue(ctx, p->prop[i].u.value);
+                } else {
+                    v = JS_GetProperty(ctx, val, prs->atom);
+                    if (JS_IsException(v))
+                        goto exception;
+                }
+                if (js_json_need_key(jsc, v)) {
+                    prop = JS_AtomToString(ctx, prs->atom);
+                    if (JS_IsException(prop)) {
+                        JS_FreeValue(ctx, v);
+                        goto exception;
+                    }
+                }
+                v = js_json_check(ctx, jsc, val, v, prop);
+                JS_FreeValue(ctx, prop);
+                prop = JS_UNDEFINED;
+                if (JS_IsException(v))
+                    goto exception;
+                if (!JS_IsUndefined(v)) {
+                    if (has_content)
+                        string_buffer_putc8(jsc->b, ',');
+                    string_buffer_concat_value(jsc->b, sep);
+                    string_buffer_put_quoted(jsc->b,
+                                             ctx->rt->atom_array[prs->atom]);
+                    string_buffer_putc8(jsc->b, ':');
+                    string_buffer_concat_value(jsc->b, sep1);
+                    if (js_json_to_str(ctx, jsc, val, v, indent1))
+                        goto exception;
+                    has_content = TRUE;
+                }
+            }
+            js_free_shape(ctx->rt, sh);
+            sh = NULL;
+            if (has_content && !JS_IsEmptyString(jsc->gap)) {
+                string_buffer_putc8(jsc->b, '\n');
+                string_buffer_concat_value(jsc->b, indent);
+            }
+            string_buffer_putc8(jsc->b, '}');
         } else {
             if (!JS_IsUndefined(jsc->property_list))
                 tab = JS_DupValue(ctx, jsc->property_list);
@@ -45902,16 +49769,25 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
  concat_primitive:
     switch (JS_VALUE_GET_NORM_TAG(val)) {
     case JS_TAG_STRING:
-        val = JS_ToQuotedStringFree(ctx, val);
-        if (JS_IsException(val))
+    case JS_TAG_STRING_ROPE:
+        str = js_string_value_get(ctx, val);
+        if (!str)
             goto exception;
-        goto concat_value;
+        ret = string_buffer_put_quoted(jsc->b, str);
+        JS_FreeValue(ctx, val);
+        return ret;
     case JS_TAG_FLOAT64:
         if (!isfinite(JS_VALUE_GET_FLOAT64(val))) {
             val = JS_NULL;
         }
         goto concat_value;
     case JS_TAG_INT:
+        {
+            char buf[16];
+            return string_buffer_puts8(jsc->b,
+                                       i64toa(buf + sizeof(buf),
+                                              JS_VALUE_GET_INT(val), 10));
+        }
     case JS_TAG_BOOL:
     case JS_TAG_NULL:
     concat_value:
@@ -45930,6 +49806,8 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
     }
 
 exception:
+    if (sh)
+        js_free_shape(ctx->rt, sh);
     JS_FreeValue(ctx, val);
     JS_FreeValue(ctx, tab);
     JS_FreeValue(ctx, sep);
@@ -46031,8 +49909,11 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
             goto exception;
         jsc->gap = JS_NewStringLen(ctx, "          ", n);
     } else if (JS_IsString(space)) {
-        JSString *p = JS_VALUE_GET_STRING(space);
-        jsc->gap = js_sub_string(ctx, p, 0, min_int(p->len, 10));
+        JSString *p = js_string_value_get(ctx, space);
+        if (p)
+            jsc->gap = js_sub_string(ctx, p, 0, min_int(p->len, 10));
+        else
+            jsc->gap = JS_EXCEPTION;
     } else {
         jsc->gap = JS_DupValue(ctx, jsc->empty);
     }
@@ -47335,27 +51216,43 @@ static const JSCFunctionListEntry js_symbol_funcs[] = {
 
 /* Set/Map/WeakSet/WeakMap */
 
+/* The records are stored in insertion order in a dense array indexed
+   by an open addressing hash table. A deleted record stays in place
+   with key = JS_UNINITIALIZED until the array is compacted, so the
+   iterators only need the index of their next record. The iterators
+   are linked to the map so that their index is updated when the array
+   is compacted. */
 typedef struct JSMapRecord {
-    int ref_count; /* used during enumeration to avoid freeing the record */
-    BOOL empty; /* TRUE if the record is deleted */
-    struct JSMapState *map;
-    struct JSMapRecord *next_weak_ref;
-    struct list_head link;
-    struct list_head hash_link;
-    JSValue key;
+    JSValue key; /* JS_UNINITIALIZED if the record is deleted */
     JSValue value;
+    uint32_t hash;
 } JSMapRecord;
 
+/* reference from an object to a WeakMap/WeakSet where it is a key */
+typedef struct JSMapWeakRef {
+    struct JSMapWeakRef *next;
+    struct JSMapState *map;
+    JSValue value; /* only used in reset_weak_ref() */
+} JSMapWeakRef;
+
 typedef struct JSMapState {
     BOOL is_weak; /* TRUE if WeakSet/WeakMap */
-    struct list_head records; /* list of JSMapRecord.link */
-    uint32_t record_count;
-    struct list_head *hash_table;
-    uint32_t hash_size; /* must be a power of two */
-    uint32_t record_count_threshold; /* count at which a hash table
-                                        resize is needed */
+    uint32_t record_count; /* number of live records */
+    uint32_t record_end; /* number of used records, including the deleted ones */
+    uint32_t record_size; /* allocated records */
+    JSMapRecord *records;
+    uint32_t *hash_table; /* 0 = free slot, otherwise record index + 1 */
+    uint32_t hash_mask; /* hash table size - 1 */
+    struct list_head iterators; /* list of JSMapIteratorData.link */
 } JSMapState;
 
+typedef struct JSMapIteratorData {
+    JSValue obj;
+    JSIteratorKindEnum kind;
+    uint32_t idx; /* index of the next record */
+    struct list_head link; /* in JSMapState.iterators while obj is a map */
+} JSMapIteratorData;
+
 #define MAGIC_SET (1 << 0)
 #define MAGIC_WEAK (1 << 1)
 
@@ -47375,15 +51272,9 @@ static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
     s = js_mallocz(ctx, sizeof(*s));
     if (!s)
         goto fail;
-    init_list_head(&s->records);
+    init_list_head(&s->iterators);
     s->is_weak = is_weak;
     JS_SetOpaque(obj, s);
-    s->hash_size = 1;
-    s->hash_table = js_malloc(ctx, sizeof(s->hash_table[0]) * s->hash_size);
-    if (!s->hash_table)
-        goto fail;
-    init_list_head(&s->hash_table[0]);
-    s->record_count_threshold = 4;
 
     arr = JS_UNDEFINED;
     if (argc > 0)
@@ -47470,17 +51361,23 @@ static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
 }
 
 /* XXX: could normalize strings to speed up comparison */
+/* the result is not duplicated. Return JS_EXCEPTION in case of error */
 static JSValueConst map_normalize_key(JSContext *ctx, JSValueConst key)
 {
     uint32_t tag = JS_VALUE_GET_TAG(key);
     /* convert -0.0 to +0.0 */
     if (JS_TAG_IS_FLOAT64(tag) && JS_VALUE_GET_FLOAT64(key) == 0.0) {
         key = JS_NewInt32(ctx, 0);
+    } else if (tag == JS_TAG_STRING_ROPE) {
+        /* the flat string is kept by the rope */
+        JSString *p = js_string_value_get(ctx, key);
+        if (!p)
+            return JS_EXCEPTION;
+        key = JS_MKPTR(JS_TAG_STRING, p);
     }
     return key;
 }
 
-/* XXX: better hash ? */
 static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
 {
     uint32_t tag = JS_VALUE_GET_NORM_TAG(key);
@@ -47510,169 +51407,270 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
     hash_float64:
         u.d = d;
         h = (u.u32[0] ^ u.u32[1]) * 3163;
-        return h ^= JS_TAG_FLOAT64;
+        tag = JS_TAG_FLOAT64;
+        break;
     default:
         h = 0; /* XXX: bignum support */
         break;
     }
     h ^= tag;
+    /* mix the bits: the low bits select the hash table slot */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
     return h;
 }
 
+static inline BOOL map_record_is_deleted(const JSMapRecord *mr)
+{
+    return JS_IsUninitialized(mr->key);
+}
+
+static inline BOOL map_key_equal(JSContext *ctx, JSValueConst key1,
+                                 JSValueConst key2)
+{
+    uint32_t tag = JS_VALUE_GET_TAG(key1);
+    if (tag == JS_VALUE_GET_TAG(key2)) {
+        switch(tag) {
+        case JS_TAG_OBJECT:
+        case JS_TAG_SYMBOL:
+            return JS_VALUE_GET_PTR(key1) == JS_VALUE_GET_PTR(key2);
+        case JS_TAG_INT:
+        case JS_TAG_BOOL:
+            return JS_VALUE_GET_INT(key1) == JS_VALUE_GET_INT(key2);
+        case JS_TAG_STRING:
+            if (JS_VALUE_GET_PTR(key1) == JS_VALUE_GET_PTR(key2))
+                return TRUE;
+            break;
+        default:
+            break;
+        }
+    } else if (tag == JS_TAG_OBJECT || tag == JS_TAG_SYMBOL ||
+               JS_VALUE_GET_TAG(key2) == JS_TAG_OBJECT ||
+               JS_VALUE_GET_TAG(key2) == JS_TAG_SYMBOL) {
+        /* no context is needed to compare the WeakMap keys */
+        return FALSE;
+    }
+    return js_same_value_zero(ctx, key1, key2);
+}
+
 static JSMapRecord *map_find_record(JSContext *ctx, JSMapState *s,
                                     JSValueConst key)
 {
-    struct list_head *el;
     JSMapRecord *mr;
-    uint32_t h;
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_for_each(el, &s->hash_table[h]) {
-        mr = list_entry(el, JSMapRecord, hash_link);
-        if (js_same_value_zero(ctx, mr->key, key))
+    uint32_t h, i, idx, perturb;
+
+    if (s->record_count == 0)
+        return NULL;
+    h = map_hash_key(ctx, key);
+    i = h & s->hash_mask;
+    perturb = h;
+    for(;;) {
+        idx = s->hash_table[i];
+        if (idx == 0)
+            return NULL;
+        mr = &s->records[idx - 1];
+        /* the deleted records keep their hash until the next resize */
+        if (mr->hash == h && !map_record_is_deleted(mr) &&
+            map_key_equal(ctx, mr->key, key))
             return mr;
+        perturb >>= 5;
+        i = (i * 5 + perturb + 1) & s->hash_mask;
     }
-    return NULL;
 }
 
-static void map_hash_resize(JSContext *ctx, JSMapState *s)
+static void map_hash_insert(JSMapState *s, uint32_t h, uint32_t idx)
 {
-    uint32_t new_hash_size, i, h;
-    size_t slack;
-    struct list_head *new_hash_table, *el;
-    JSMapRecord *mr;
+    uint32_t i, perturb;
 
-    /* XXX: no reporting of memory allocation failure */
-    if (s->hash_size == 1)
-        new_hash_size = 4;
-    else
-        new_hash_size = s->hash_size * 2;
-    new_hash_table = js_realloc2(ctx, s->hash_table,
-                                 sizeof(new_hash_table[0]) * new_hash_size, &slack);
-    if (!new_hash_table)
-        return;
-    new_hash_size += slack / sizeof(*new_hash_table);
+    i = h & s->hash_mask;
+    perturb = h;
+    while (s->hash_table[i] != 0) {
+        perturb >>= 5;
+        i = (i * 5 + perturb + 1) & s->hash_mask;
+    }
+    s->hash_table[i] = idx + 1;
+}
 
-    for(i = 0; i < new_hash_size; i++)
-        init_list_head(&new_hash_table[i]);
+/* remove the deleted records and update the iterator indexes */
+static void map_compact(JSMapState *s)
+{
+    struct list_head *el;
+    JSMapIteratorData *it;
+    uint32_t i, j, n;
 
-    list_for_each(el, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            h = map_hash_key(ctx, mr->key) & (new_hash_size - 1);
-            list_add_tail(&mr->hash_link, &new_hash_table[h]);
+    list_for_each(el, &s->iterators) {
+        it = list_entry(el, JSMapIteratorData, link);
+        n = 0;
+        for(i = 0; i < it->idx; i++) {
+            if (!map_record_is_deleted(&s->records[i]))
+                n++;
         }
+        it->idx = n;
     }
-    s->hash_table = new_hash_table;
-    s->hash_size = new_hash_size;
-    s->record_count_threshold = new_hash_size * 2;
+    j = 0;
+    for(i = 0; i < s->record_end; i++) {
+        if (!map_record_is_deleted(&s->records[i])) {
+            if (i != j)
+                s->records[j] = s->records[i];
+            j++;
+        }
+    }
+    s->record_end = j;
+}
+
+/* Compact the records and resize the record array to 'new_size'
+   records. Return -1 if memory allocation failed. The map stays
+   consistent in all cases. */
+static int map_resize(JSRuntime *rt, JSMapState *s, uint32_t new_size)
+{
+    JSMapRecord *new_records;
+    uint32_t *new_hash_table;
+    uint32_t i, hash_size;
+
+    map_compact(s);
+    assert(new_size >= s->record_end);
+    /* at most half of the hash table is used */
+    hash_size = 4;
+    while (hash_size < 2 * new_size)
+        hash_size *= 2;
+    if (hash_size != s->hash_mask + 1 || !s->hash_table) {
+        new_hash_table = js_malloc_rt(rt, sizeof(new_hash_table[0]) * hash_size);
+        if (!new_hash_table)
+            goto fail;
+        js_free_rt(rt, s->hash_table);
+        s->hash_table = new_hash_table;
+        s->hash_mask = hash_size - 1;
+    }
+    if (new_size != s->record_size) {
+        new_records = js_realloc_rt(rt, s->records,
+                                    sizeof(new_records[0]) * new_size);
+        if (!new_records && new_size != 0)
+            goto fail;
+        s->records = new_records;
+        s->record_size = new_size;
+    }
+    memset(s->hash_table, 0, sizeof(s->hash_table[0]) * (s->hash_mask + 1));
+    for(i = 0; i < s->record_end; i++)
+        map_hash_insert(s, s->records[i].hash, i);
+    return 0;
+ fail:
+    if (s->hash_table) {
+        /* the compaction invalidated the hash table */
+        memset(s->hash_table, 0, sizeof(s->hash_table[0]) * (s->hash_mask + 1));
+        for(i = 0; i < s->record_end; i++)
+            map_hash_insert(s, s->records[i].hash, i);
+    }
+    return -1;
 }
 
 static JSMapRecord *map_add_record(JSContext *ctx, JSMapState *s,
                                    JSValueConst key)
 {
-    uint32_t h;
     JSMapRecord *mr;
+    JSMapWeakRef *wr;
+    uint32_t new_size;
 
-    mr = js_malloc(ctx, sizeof(*mr));
-    if (!mr)
-        return NULL;
-    mr->ref_count = 1;
-    mr->map = s;
-    mr->empty = FALSE;
+    if (s->record_end >= s->record_size) {
+        /* compact in place if enough records are deleted */
+        new_size = s->record_size;
+        if (s->record_count >= s->record_size / 2)
+            new_size = max_int(4, s->record_size + s->record_size / 2);
+        if (map_resize(ctx->rt, s, new_size)) {
+            JS_ThrowOutOfMemory(ctx);
+            return NULL;
+        }
+    }
     if (s->is_weak) {
         JSObject *p = JS_VALUE_GET_OBJ(key);
         /* Add the weak reference */
-        mr->next_weak_ref = p->first_weak_ref;
-        p->first_weak_ref = mr;
+        wr = js_malloc(ctx, sizeof(*wr));
+        if (!wr)
+            return NULL;
+        wr->map = s;
+        wr->next = p->first_weak_ref;
+        p->first_weak_ref = wr;
     } else {
         JS_DupValue(ctx, key);
     }
+    mr = &s->records[s->record_end];
     mr->key = key;
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_add_tail(&mr->hash_link, &s->hash_table[h]);
-    list_add_tail(&mr->link, &s->records);
+    mr->value = JS_UNDEFINED;
+    mr->hash = map_hash_key(ctx, key);
+    map_hash_insert(s, mr->hash, s->record_end);
+    s->record_end++;
     s->record_count++;
-    if (s->record_count >= s->record_count_threshold) {
-        map_hash_resize(ctx, s);
-    }
     return mr;
 }
 
-/* Remove the weak reference from the object weak
-   reference list. we don't use a doubly linked list to
-   save space, assuming a given object has few weak
-       references to it */
-static void delete_weak_ref(JSRuntime *rt, JSMapRecord *mr)
+/* Remove the weak reference from the object weak reference list. we
+   don't use a doubly linked list to save space, assuming a given
+   object has few weak references to it */
+static void delete_weak_ref(JSRuntime *rt, JSMapState *s, JSValueConst key)
 {
-    JSMapRecord **pmr, *mr1;
+    JSMapWeakRef **pwr, *wr;
     JSObject *p;
 
-    p = JS_VALUE_GET_OBJ(mr->key);
-    pmr = &p->first_weak_ref;
+    p = JS_VALUE_GET_OBJ(key);
+    pwr = &p->first_weak_ref;
     for(;;) {
-        mr1 = *pmr;
-        assert(mr1 != NULL);
-        if (mr1 == mr)
+        wr = *pwr;
+        assert(wr != NULL);
+        if (wr->map == s)
             break;
-        pmr = &mr1->next_weak_ref;
+        pwr = &wr->next;
     }
-    *pmr = mr1->next_weak_ref;
+    *pwr = wr->next;
+    js_free_rt(rt, wr);
 }
 
 static void map_delete_record(JSRuntime *rt, JSMapState *s, JSMapRecord *mr)
 {
-    if (mr->empty)
-        return;
-    list_del(&mr->hash_link);
-    if (s->is_weak) {
-        delete_weak_ref(rt, mr);
-    } else {
-        JS_FreeValueRT(rt, mr->key);
-    }
-    JS_FreeValueRT(rt, mr->value);
-    if (--mr->ref_count == 0) {
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
-    } else {
-        /* keep a zombie record for iterators */
-        mr->empty = TRUE;
-        mr->key = JS_UNDEFINED;
-        mr->value = JS_UNDEFINED;
-    }
-    s->record_count--;
-}
+    JSValue key, value;
 
-static void map_decref_record(JSRuntime *rt, JSMapRecord *mr)
-{
-    if (--mr->ref_count == 0) {
-        /* the record can be safely removed */
-        assert(mr->empty);
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
-    }
+    key = mr->key;
+    value = mr->value;
+    mr->key = JS_UNINITIALIZED;
+    mr->value = JS_UNDEFINED;
+    s->record_count--;
+    /* free the memory when most of the records are deleted */
+    if (s->record_count < s->record_size / 4 && s->record_size > 16)
+        map_resize(rt, s, max_int(8, s->record_count * 2));
+    if (s->is_weak)
+        delete_weak_ref(rt, s, key);
+    else
+        JS_FreeValueRT(rt, key);
+    JS_FreeValueRT(rt, value);
 }
 
 static void reset_weak_ref(JSRuntime *rt, JSObject *p)
 {
-    JSMapRecord *mr, *mr_next;
+    JSMapWeakRef *wr, *wr_next;
+    JSMapRecord *mr;
     JSMapState *s;
+    JSValue key;
 
-    /* first pass to remove the records from the WeakMap/WeakSet
-       lists */
-    for(mr = p->first_weak_ref; mr != NULL; mr = mr->next_weak_ref) {
-        s = mr->map;
+    /* first pass to remove the records from the WeakMap/WeakSet. The
+       values are freed afterwards because freeing them may modify the
+       maps. */
+    key = JS_MKPTR(JS_TAG_OBJECT, p);
+    for(wr = p->first_weak_ref; wr != NULL; wr = wr->next) {
+        s = wr->map;
         assert(s->is_weak);
-        assert(!mr->empty); /* no iterator on WeakMap/WeakSet */
-        list_del(&mr->hash_link);
-        list_del(&mr->link);
+        mr = map_find_record(NULL, s, key);
+        assert(mr != NULL);
+        wr->value = mr->value;
+        mr->key = JS_UNINITIALIZED;
+        mr->value = JS_UNDEFINED;
+        s->record_count--;
     }
 
     /* second pass to free the values to avoid modifying the weak
        reference list while traversing it. */
-    for(mr = p->first_weak_ref; mr != NULL; mr = mr_next) {
-        mr_next = mr->next_weak_ref;
-        JS_FreeValueRT(rt, mr->value);
-        js_free_rt(rt, mr);
+    for(wr = p->first_weak_ref; wr != NULL; wr = wr_next) {
+        wr_next = wr->next;
+        JS_FreeValueRT(rt, wr->value);
+        js_free_rt(rt, wr);
     }
 
     p->first_weak_ref = NULL; /* fail safe */
@@ -47688,6 +51686,8 @@ static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
+    if (JS_IsException(key))
+        return JS_EXCEPTION;
     if (s->is_weak && !JS_IsObject(key))
         return JS_ThrowTypeErrorNotAnObject(ctx);
     if (magic & MAGIC_SET)
@@ -47696,13 +51696,15 @@ static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
         value = argv[1];
     mr = map_find_record(ctx, s, key);
     if (mr) {
-        JS_FreeValue(ctx, mr->value);
+        JSValue old_value = mr->value;
+        mr->value = JS_DupValue(ctx, value);
+        JS_FreeValue(ctx, old_value);
     } else {
         mr = map_add_record(ctx, s, key);
         if (!mr)
             return JS_EXCEPTION;
+        mr->value = JS_DupValue(ctx, value);
     }
-    mr->value = JS_DupValue(ctx, value);
     return JS_DupValue(ctx, this_val);
 }
 
@@ -47716,6 +51718,8 @@ static JSValue js_map_get(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
+    if (JS_IsException(key))
+        return JS_EXCEPTION;
     mr = map_find_record(ctx, s, key);
     if (!mr)
         return JS_UNDEFINED;
@@ -47733,6 +51737,8 @@ static JSValue js_map_has(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
+    if (JS_IsException(key))
+        return JS_EXCEPTION;
     mr = map_find_record(ctx, s, key);
     return JS_NewBool(ctx, mr != NULL);
 }
@@ -47747,6 +51753,8 @@ static JSValue js_map_delete(JSContext *ctx, JSValueConst this_val,
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
+    if (JS_IsException(key))
+        return JS_EXCEPTION;
     mr = map_find_record(ctx, s, key);
     if (!mr)
         return JS_FALSE;
@@ -47758,15 +51766,42 @@ static JSValue js_map_clear(JSContext *ctx, JSValueConst this_val,
                             int argc, JSValueConst *argv, int magic)
 {
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
-    struct list_head *el, *el1;
-    JSMapRecord *mr;
+    struct list_head *el;
+    JSMapIteratorData *it;
+    JSMapRecord *records, *mr;
+    uint32_t i, record_end;
 
     if (!s)
         return JS_EXCEPTION;
-    list_for_each_safe(el, el1, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        map_delete_record(ctx->rt, s, mr);
+    /* detach the records before freeing them because the finalizers
+       may access the map */
+    records = s->records;
+    record_end = s->record_end;
+    s->records = NULL;
+    s->record_count = 0;
+    s->record_end = 0;
+    s->record_size = 0;
+    js_free(ctx, s->hash_table);
+    s->hash_table = NULL;
+    s->hash_mask = 0;
+    list_for_each(el, &s->iterators) {
+        it = list_entry(el, JSMapIteratorData, link);
+        it->idx = 0;
+    }
+    for(i = 0; i < record_end; i++) {
+        mr = &records[i];
+        if (!map_record_is_deleted(mr) && s->is_weak)
+            delete_weak_ref(ctx->rt, s, mr->key);
+    }
+    for(i = 0; i < record_end; i++) {
+        mr = &records[i];
+        if (!map_record_is_deleted(mr)) {
+            if (!s->is_weak)
+                JS_FreeValue(ctx, mr->key);
+            JS_FreeValue(ctx, mr->value);
+        }
     }
+    js_free(ctx, records);
     return JS_UNDEFINED;
 }
 
@@ -47784,7 +51819,7 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
     JSValueConst func, this_arg;
     JSValue ret, args[3];
-    struct list_head *el;
+    JSMapIteratorData it;
     JSMapRecord *mr;
 
     if (!s)
@@ -47796,34 +51831,33 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
         this_arg = JS_UNDEFINED;
     if (check_function(ctx, func))
         return JS_EXCEPTION;
-    /* Note: the list can be modified while traversing it, but the
-       current element is locked */
-    el = s->records.next;
-    while (el != &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            mr->ref_count++;
-            /* must duplicate in case the record is deleted */
-            args[1] = JS_DupValue(ctx, mr->key);
-            if (magic)
-                args[0] = args[1];
-            else
-                args[0] = JS_DupValue(ctx, mr->value);
-            args[2] = this_val;
-            ret = JS_Call(ctx, func, this_arg, 3, (JSValueConst *)args);
-            JS_FreeValue(ctx, args[0]);
-            if (!magic)
-                JS_FreeValue(ctx, args[1]);
-            el = el->next;
-            map_decref_record(ctx->rt, mr);
-            if (JS_IsException(ret))
-                return ret;
-            JS_FreeValue(ctx, ret);
-        } else {
-            el = el->next;
-        }
+    /* Note: the map can be modified while traversing it. The iterator
+       index is updated if the records are compacted. */
+    it.idx = 0;
+    list_add_tail(&it.link, &s->iterators);
+    ret = JS_UNDEFINED;
+    while (it.idx < s->record_end) {
+        mr = &s->records[it.idx++];
+        if (map_record_is_deleted(mr))
+            continue;
+        /* must duplicate in case the record is deleted */
+        args[1] = JS_DupValue(ctx, mr->key);
+        if (magic)
+            args[0] = args[1];
+        else
+            args[0] = JS_DupValue(ctx, mr->value);
+        args[2] = this_val;
+        ret = JS_Call(ctx, func, this_arg, 3, (JSValueConst *)args);
+        JS_FreeValue(ctx, args[0]);
+        if (!magic)
+            JS_FreeValue(ctx, args[1]);
+        if (JS_IsException(ret))
+            break;
+        JS_FreeValue(ctx, ret);
+        ret = JS_UNDEFINED;
     }
-    return JS_UNDEFINED;
+    list_del(&it.link);
+    return ret;
 }
 
 static JSValue js_object_groupBy(JSContext *ctx, JSValueConst this_val,
@@ -47948,24 +51982,37 @@ static void js_map_finalizer(JSRuntime *rt, JSValue val)
     JSObject *p;
     JSMapState *s;
     struct list_head *el, *el1;
+    JSMapIteratorData *it;
     JSMapRecord *mr;
+    uint32_t i;
 
     p = JS_VALUE_GET_OBJ(val);
     s = p->u.map_state;
     if (s) {
-        /* if the object is deleted we are sure that no iterator is
-           using it */
-        list_for_each_safe(el, el1, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
-            if (!mr->empty) {
-                if (s->is_weak)
-                    delete_weak_ref(rt, mr);
-                else
+        /* During the GC sweep phase the iterators may still reference
+           the map: detach them */
+        list_for_each_safe(el, el1, &s->iterators) {
+            it = list_entry(el, JSMapIteratorData, link);
+            init_list_head(&it->link);
+        }
+        /* remove the weak references first so that freeing the
+           values cannot modify the map */
+        if (s->is_weak) {
+            for(i = 0; i < s->record_end; i++) {
+                mr = &s->records[i];
+                if (!map_record_is_deleted(mr))
+                    delete_weak_ref(rt, s, mr->key);
+            }
+        }
+        for(i = 0; i < s->record_end; i++) {
+            mr = &s->records[i];
+            if (!map_record_is_deleted(mr)) {
+                if (!s->is_weak)
                     JS_FreeValueRT(rt, mr->key);
                 JS_FreeValueRT(rt, mr->value);
             }
-            js_free_rt(rt, mr);
         }
+        js_free_rt(rt, s->records);
         js_free_rt(rt, s->hash_table);
         js_free_rt(rt, s);
     }
@@ -47975,13 +52022,15 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 {
     JSObject *p = JS_VALUE_GET_OBJ(val);
     JSMapState *s;
-    struct list_head *el;
     JSMapRecord *mr;
+    uint32_t i;
 
     s = p->u.map_state;
     if (s) {
-        list_for_each(el, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
+        for(i = 0; i < s->record_end; i++) {
+            mr = &s->records[i];
+            if (map_record_is_deleted(mr))
+                continue;
             if (!s->is_weak)
                 JS_MarkValue(rt, mr->key, mark_func);
             JS_MarkValue(rt, mr->value, mark_func);
@@ -47991,12 +52040,6 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 
 /* Map Iterator */
 
-typedef struct JSMapIteratorData {
-    JSValue obj;
-    JSIteratorKindEnum kind;
-    JSMapRecord *cur_record;
-} JSMapIteratorData;
-
 static void js_map_iterator_finalizer(JSRuntime *rt, JSValue val)
 {
     JSObject *p;
@@ -48005,11 +52048,10 @@ static void js_map_iterator_finalizer(JSRuntime *rt, JSValue val)
     p = JS_VALUE_GET_OBJ(val);
     it = p->u.map_iterator_data;
     if (it) {
-        /* During the GC sweep phase the Map finalizer may be
-           called before the Map iterator finalizer */
-        if (JS_IsLiveObject(rt, it->obj) && it->cur_record) {
-            map_decref_record(rt, it->cur_record);
-        }
+        /* the Map finalizer detaches the iterators if it is called
+           first during the GC sweep phase */
+        if (!JS_IsUndefined(it->obj))
+            list_del(&it->link);
         JS_FreeValueRT(rt, it->obj);
         js_free_rt(rt, it);
     }
@@ -48022,7 +52064,7 @@ static void js_map_iterator_mark(JSRuntime *rt, JSValueConst val,
     JSMapIteratorData *it;
     it = p->u.map_iterator_data;
     if (it) {
-        /* the record is already marked by the object */
+        /* the records are already marked by the object */
         JS_MarkValue(rt, it->obj, mark_func);
     }
 }
@@ -48050,7 +52092,8 @@ static JSValue js_create_map_iterator(JSContext *ctx, JSValueConst this_val,
     }
     it->obj = JS_DupValue(ctx, this_val);
     it->kind = kind;
-    it->cur_record = NULL;
+    it->idx = 0;
+    list_add_tail(&it->link, &s->iterators);
     JS_SetOpaque(enum_obj, it);
     return enum_obj;
  fail:
@@ -48064,7 +52107,6 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
     JSMapIteratorData *it;
     JSMapState *s;
     JSMapRecord *mr;
-    struct list_head *el;
 
     it = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP_ITERATOR + magic);
     if (!it) {
@@ -48075,17 +52117,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
         goto done;
     s = JS_GetOpaque(it->obj, JS_CLASS_MAP + magic);
     assert(s != NULL);
-    if (!it->cur_record) {
-        el = s->records.next;
-    } else {
-        mr = it->cur_record;
-        el = mr->link.next;
-        map_decref_record(ctx->rt, mr); /* the record can be freed here */
-    }
     for(;;) {
-        if (el == &s->records) {
+        if (it->idx >= s->record_end) {
             /* no more record  */
-            it->cur_record = NULL;
+            list_del(&it->link);
             JS_FreeValue(ctx, it->obj);
             it->obj = JS_UNDEFINED;
         done:
@@ -48093,16 +52128,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
             *pdone = TRUE;
             return JS_UNDEFINED;
         }
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty)
+        mr = &s->records[it->idx++];
+        if (!map_record_is_deleted(mr))
             break;
-        /* get the next record */
-        el = mr->link.next;
     }
-
-    /* lock the record so that it won't be freed */
-    mr->ref_count++;
-    it->cur_record = mr;
     *pdone = FALSE;
 
     if (it->kind == JS_ITERATOR_KIND_KEY) {
@@ -51361,6 +55390,11 @@ static JSValue JS_ToBigIntCtorFree(JSContext *ctx, JSValue val)
     case JS_TAG_STRING:
         val = JS_StringToBigIntErr(ctx, val);
         break;
+    case JS_TAG_STRING_ROPE:
+        val = js_string_flatten_free(ctx, val);
+        if (JS_IsException(val))
+            break;
+        goto redo;
     case JS_TAG_OBJECT:
         val = JS_ToPrimitiveFree(ctx, val, HINT_NUMBER);
         if (JS_IsException(val))
@@ -51919,6 +55953,7 @@ static JSValue js_bigfloat_constructor(JSContext *ctx,
                 break;
             goto redo;
         case JS_TAG_STRING:
+        case JS_TAG_STRING_ROPE:
             {
                 const char *str, *p;
                 size_t len;
@@ -52607,6 +56642,7 @@ static JSValue JS_ToBigDecimalFree(JSContext *ctx, JSValue val,
             break;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str, *p;
             size_t len;
@@ -53369,6 +57405,23 @@ static JSValue js_array_buffer_constructor3(JSContext *ctx,
             if (!abuf->data)
                 goto fail;
             memset(abuf->data, 0, len);
+        } else if (class_id == JS_CLASS_ARRAY_BUFFER &&
+                   free_func == js_array_buffer_free &&
+                   rt->sab_funcs.sab_alloc && rt->sab_funcs.sab_dup) {
+            /* allocated with sab_alloc() so that a transfer to another
+               runtime does not copy the data */
+            if (js_array_buffer_sab_charge(ctx, len))
+                goto fail;
+            abuf->data = rt->sab_funcs.sab_alloc(rt->sab_funcs.sab_opaque,
+                                                 max_int(len, 1));
+            if (!abuf->data) {
+                js_array_buffer_sab_uncharge(rt, len);
+                JS_ThrowOutOfMemory(ctx);
+                goto fail;
+            }
+            memset(abuf->data, 0, len);
+            free_func = js_array_buffer_sab_free;
+            opaque = (void *)(uintptr_t)len;
         } else {
             /* the allocation must be done after the object creation */
             abuf->data = js_mallocz(ctx, max_int(len, 1));
@@ -53402,6 +57455,77 @@ static void js_array_buffer_free(JSRuntime *rt, void *opaque, void *ptr)
     js_free_rt(rt, ptr);
 }
 
+/* When the SharedArrayBuffer functions are set, the data of the
+   ArrayBuffers is allocated with sab_alloc() so that it can be moved
+   to another runtime without copy. It is accounted in the malloc
+   state of the runtime owning the ArrayBuffer so that the memory
+   limit and the GC take it into account. 'opaque' is the accounted
+   size. */
+static int js_array_buffer_sab_charge(JSContext *ctx, size_t size)
+{
+    JSMallocState *s = &ctx->rt->malloc_state;
+
+    if (unlikely(s->malloc_size + size > s->malloc_limit)) {
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+    s->malloc_count++;
+    s->malloc_size += size;
+    return 0;
+}
+
+static void js_array_buffer_sab_uncharge(JSRuntime *rt, size_t size)
+{
+    rt->malloc_state.malloc_count--;
+    rt->malloc_state.malloc_size -= size;
+}
+
+static void js_array_buffer_sab_free(JSRuntime *rt, void *opaque, void *ptr)
+{
+    /* ptr = NULL if the ArrayBuffer is detached */
+    if (ptr) {
+        js_array_buffer_sab_uncharge(rt, (uintptr_t)opaque);
+        rt->sab_funcs.sab_free(rt->sab_funcs.sab_opaque, ptr);
+    }
+}
+
+/* move the data of 'abuf' to memory allocated with sab_alloc(). Only
+   needed for the ArrayBuffers with external data (JS_NewArrayBuffer()),
+   which are copied. */
+static int js_array_buffer_move_to_sab(JSContext *ctx, JSArrayBuffer *abuf)
+{
+    JSRuntime *rt = ctx->rt;
+    struct list_head *el;
+    JSTypedArray *ta;
+    JSObject *p;
+    uint8_t *data;
+
+    if (js_array_buffer_sab_charge(ctx, abuf->byte_length))
+        return -1;
+    data = rt->sab_funcs.sab_alloc(rt->sab_funcs.sab_opaque,
+                                   max_int(abuf->byte_length, 1));
+    if (!data) {
+        js_array_buffer_sab_uncharge(rt, abuf->byte_length);
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+    memcpy(data, abuf->data, abuf->byte_length);
+    if (abuf->free_func)
+        abuf->free_func(rt, abuf->opaque, abuf->data);
+    abuf->data = data;
+    abuf->free_func = js_array_buffer_sab_free;
+    abuf->opaque = (void *)(uintptr_t)abuf->byte_length;
+
+    /* update the data pointer of the typed arrays */
+    list_for_each(el, &abuf->array_list) {
+        ta = list_entry(el, JSTypedArray, link);
+        p = ta->obj;
+        if (p->class_id != JS_CLASS_DATAVIEW)
+            p->u.array.u.ptr = data + ta->offset;
+    }
+    return 0;
+}
+
 static JSValue js_array_buffer_constructor2(JSContext *ctx,
                                             JSValueConst new_target,
                                             uint64_t len, JSClassID class_id)
@@ -56331,6 +60455,924 @@ void JS_AddIntrinsicTypedArrays(JSContext *ctx)
 #endif
 }
 
+/* Context cloning */
+
+/* JS_CloneContext() copies the objects reachable from the state of a
+   template context (intrinsic objects, global object and the closures
+   created by a bootstrap script) to a new context of the same
+   runtime. The strings, symbols, atoms and big numbers are immutable
+   so they are shared with the template. An object is first allocated
+   as an empty shell when it is referenced and its contents are copied
+   later from a work list, so the recursion depth does not depend on
+   the size of the object graph. No GC can be triggered during the
+   copy. */
+
+typedef enum {
+    JS_CLONE_OBJECT,
+    JS_CLONE_SHAPE,
+    JS_CLONE_VAR_REF,
+    JS_CLONE_FUNCTION_BYTECODE,
+} JSCloneTypeEnum;
+
+typedef struct JSCloneEntry {
+    void *src; /* NULL if free entry */
+    void *dst; /* the table holds a reference to it */
+    JSCloneTypeEnum type;
+} JSCloneEntry;
+
+typedef struct JSCloneState {
+    JSContext *ctx; /* new context */
+    JSContext *src_ctx; /* template context, also used to throw the errors */
+    JSCloneEntry *hash_table; /* source pointer -> copy */
+    uint32_t hash_size; /* must be a power of two */
+    uint32_t hash_count;
+    JSObject **work_list; /* source objects whose contents must be copied */
+    int work_count;
+    int work_size;
+} JSCloneState;
+
+static void *js_clone_malloc(JSCloneState *s, size_t size)
+{
+    void *ptr;
+    ptr = js_malloc_rt(s->ctx->rt, size);
+    if (unlikely(!ptr))
+        JS_ThrowOutOfMemory(s->src_ctx);
+    return ptr;
+}
+
+/* same as js_pool_malloc() but the error is raised in the template */
+static void *js_clone_pool_malloc(JSCloneState *s, size_t size)
+{
+    JSContext *ctx = s->ctx;
+    void *ptr;
+    if (unlikely(ctx->use_arena) && size <= JS_POOL_MAX_SIZE)
+        ptr = js_arena_malloc(ctx, size);
+    else
+        ptr = js_pool_malloc_rt(ctx->rt, size);
+    if (unlikely(!ptr))
+        JS_ThrowOutOfMemory(s->src_ctx);
+    return ptr;
+}
+
+static uint32_t js_clone_hash(const void *ptr)
+{
+    return (uint64_t)(uintptr_t)ptr * 0x9e3779b97f4a7c15 >> 32;
+}
+
+static void *js_clone_find(JSCloneState *s, const void *src)
+{
+    JSCloneEntry *e;
+    uint32_t h;
+
+    h = js_clone_hash(src) & (s->hash_size - 1);
+    for(;;) {
+        e = &s->hash_table[h];
+        if (e->src == src)
+            return e->dst;
+        if (!e->src)
+            return NULL;
+        h = (h + 1) & (s->hash_size - 1);
+    }
+}
+
+static void js_clone_free_ref(JSRuntime *rt, void *ptr, JSCloneTypeEnum type)
+{
+    switch(type) {
+    case JS_CLONE_OBJECT:
+        JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_OBJECT, ptr));
+        break;
+    case JS_CLONE_SHAPE:
+        js_free_shape(rt, ptr);
+        break;
+    case JS_CLONE_VAR_REF:
+        free_var_ref(rt, ptr);
+        break;
+    case JS_CLONE_FUNCTION_BYTECODE:
+        JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, ptr));
+        break;
+    }
+}
+
+static void js_clone_insert(JSCloneEntry *tab, uint32_t hash_size,
+                            void *src, void *dst, JSCloneTypeEnum type)
+{
+    uint32_t h;
+
+    h = js_clone_hash(src) & (hash_size - 1);
+    while (tab[h].src)
+        h = (h + 1) & (hash_size - 1);
+    tab[h].src = src;
+    tab[h].dst = dst;
+    tab[h].type = type;
+}
+
+/* the reference to 'dst' is transferred to the table, even in case
+   of error */
+static int js_clone_add(JSCloneState *s, void *src, void *dst,
+                        JSCloneTypeEnum type)
+{
+    JSCloneEntry *new_tab;
+    uint32_t new_size, i;
+
+    if (2 * (s->hash_count + 1) > s->hash_size) {
+        new_size = s->hash_size * 2;
+        new_tab = js_clone_malloc(s, sizeof(new_tab[0]) * new_size);
+        if (!new_tab)
+            goto fail;
+        memset(new_tab, 0, sizeof(new_tab[0]) * new_size);
+        for(i = 0; i < s->hash_size; i++) {
+            JSCloneEntry *e = &s->hash_table[i];
+            if (e->src)
+                js_clone_insert(new_tab, new_size, e->src, e->dst, e->type);
+        }
+        js_free_rt(s->ctx->rt, s->hash_table);
+        s->hash_table = new_tab;
+        s->hash_size = new_size;
+    }
+    js_clone_insert(s->hash_table, s->hash_size, src, dst, type);
+    s->hash_count++;
+    return 0;
+ fail:
+    js_clone_free_ref(s->ctx->rt, dst, type);
+    return -1;
+}
+
+static void js_clone_free_table(JSCloneState *s)
+{
+    JSRuntime *rt = s->ctx->rt;
+    JSCloneEntry *e;
+    uint32_t i;
+
+    for(i = 0; i < s->hash_size; i++) {
+        e = &s->hash_table[i];
+        if (e->src)
+            js_clone_free_ref(rt, e->dst, e->type);
+    }
+    js_free_rt(rt, s->hash_table);
+    js_free_rt(rt, s->work_list);
+}
+
+static int js_clone_throw_class(JSCloneState *s, JSClassID class_id)
+{
+    char buf[ATOM_GET_STR_BUF_SIZE];
+
+    /* these classes share the name of another class */
+    switch(class_id) {
+    case JS_CLASS_PROXY:
+        JS_ThrowTypeError(s->src_ctx, "cannot clone a Proxy");
+        break;
+    case JS_CLASS_MODULE_NS:
+        JS_ThrowTypeError(s->src_ctx, "cannot clone a module namespace");
+        break;
+    case JS_CLASS_MAPPED_ARGUMENTS:
+        JS_ThrowTypeError(s->src_ctx, "cannot clone a mapped arguments object");
+        break;
+    default:
+        JS_ThrowTypeError(s->src_ctx, "cannot clone %s objects",
+                          JS_AtomGetStr(s->src_ctx, buf, sizeof(buf),
+                                        s->ctx->rt->class_array[class_id].class_name));
+        break;
+    }
+    return -1;
+}
+
+/* same as free_bytecode_atoms() */
+static void js_dup_bytecode_atoms(JSRuntime *rt,
+                                  const uint8_t *bc_buf, int bc_len)
+{
+    int pos, len, op;
+    JSAtom atom;
+    const JSOpCode *oi;
+
+    pos = 0;
+    while (pos < bc_len) {
+        op = bc_buf[pos];
+        oi = &short_opcode_info(op);
+        len = oi->size;
+        switch(oi->fmt) {
+        case OP_FMT_atom:
+        case OP_FMT_atom_u8:
+        case OP_FMT_atom_u16:
+        case OP_FMT_atom_label_u8:
+        case OP_FMT_atom_label_u16:
+            atom = get_u32(bc_buf + pos + 1);
+            JS_DupAtomRT(rt, atom);
+            break;
+        default:
+            break;
+        }
+        pos += len;
+    }
+}
+
+static int js_clone_value(JSCloneState *s, JSValue *pres, JSValueConst val);
+
+static JSObject *js_clone_object(JSCloneState *s, JSObject *p);
+
+/* return a new reference to the copy of 'sh' */
+static JSShape *js_clone_shape1(JSCloneState *s, JSShape *sh)
+{
+    JSRuntime *rt = s->ctx->rt;
+    JSShape *nsh;
+    JSObject *proto;
+    JSShapeProperty *pr;
+    void *sh_alloc;
+    size_t size;
+    uint32_t i, h, hash_size;
+
+    nsh = js_clone_find(s, sh);
+    if (nsh)
+        return js_dup_shape(nsh);
+    proto = NULL;
+    if (sh->proto) {
+        proto = js_clone_object(s, sh->proto);
+        if (!proto)
+            return NULL;
+    }
+    /* resize the shape hash table if necessary */
+    if (sh->is_hashed && 2 * (rt->shape_hash_count + 1) > rt->shape_hash_size) {
+        resize_shape_hash(rt, rt->shape_hash_bits + 1);
+    }
+    hash_size = sh->prop_hash_mask + 1;
+    size = get_shape_size(hash_size, sh->prop_size);
+    sh_alloc = js_clone_pool_malloc(s, size);
+    if (!sh_alloc) {
+        if (proto)
+            JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_OBJECT, proto));
+        return NULL;
+    }
+    memcpy(sh_alloc, get_alloc_from_shape(sh), size);
+    nsh = get_shape_from_alloc(sh_alloc, hash_size);
+    nsh->header.ref_count = 1;
+    add_gc_object(rt, &nsh->header, JS_GC_OBJ_TYPE_SHAPE);
+    nsh->proto = proto;
+    for(i = 0, pr = get_shape_prop(nsh); i < nsh->prop_count; i++, pr++) {
+        JS_DupAtomRT(rt, pr->atom);
+    }
+    if (nsh->is_hashed) {
+        /* the hash depends on the prototype address */
+        h = shape_initial_hash(proto);
+        for(i = 0, pr = get_shape_prop(nsh); i < nsh->prop_count; i++, pr++) {
+            h = shape_hash(shape_hash(h, pr->atom), pr->flags);
+        }
+        nsh->hash = h;
+        js_shape_hash_link(rt, nsh);
+    }
+    if (js_clone_add(s, sh, nsh, JS_CLONE_SHAPE))
+        return NULL;
+    return js_dup_shape(nsh);
+}
+
+/* return a new reference to the copy of 'var_ref' */
+static JSVarRef *js_clone_var_ref(JSCloneState *s, JSVarRef *var_ref)
+{
+    JSVarRef *nvr;
+
+    nvr = js_clone_find(s, var_ref);
+    if (nvr)
+        goto done;
+    if (!var_ref->is_detached) {
+        JS_ThrowTypeError(s->src_ctx, "cannot clone a running function");
+        return NULL;
+    }
+    nvr = js_clone_pool_malloc(s, sizeof(JSVarRef));
+    if (!nvr)
+        return NULL;
+    nvr->header.ref_count = 1;
+    add_gc_object(s->ctx->rt, &nvr->header, JS_GC_OBJ_TYPE_VAR_REF);
+    nvr->is_detached = TRUE;
+    nvr->is_arg = var_ref->is_arg;
+    nvr->var_idx = var_ref->var_idx;
+    nvr->pvalue = &nvr->value;
+    nvr->value = JS_UNDEFINED;
+    if (js_clone_add(s, var_ref, nvr, JS_CLONE_VAR_REF))
+        return NULL;
+    if (js_clone_value(s, &nvr->value, var_ref->value))
+        return NULL;
+ done:
+    nvr->header.ref_count++;
+    return nvr;
+}
+
+/* return a new reference to the copy of 'b' */
+static JSFunctionBytecode *js_clone_function_bytecode(JSCloneState *s,
+                                                      JSFunctionBytecode *b)
+{
+    JSContext *ctx = s->ctx;
+    JSRuntime *rt = ctx->rt;
+    JSFunctionBytecode *nb;
+    JSInlineCache *ic;
+    uint8_t *pc2line_buf;
+    char *source;
+    int function_size, header_size, cpool_offset, vardefs_offset;
+    int closure_var_offset, byte_code_offset, i;
+
+    nb = js_clone_find(s, b);
+    if (nb)
+        goto done;
+    if (b->realm && b->realm != s->src_ctx) {
+        JS_ThrowTypeError(s->src_ctx, "cannot clone a function of another realm");
+        return NULL;
+    }
+    /* the constant pool contains the nested functions */
+    if (js_check_stack_overflow(rt, 0)) {
+        JS_ThrowStackOverflow(s->src_ctx);
+        return NULL;
+    }
+
+    if (b->has_debug) {
+        header_size = sizeof(*b);
+    } else {
+        header_size = offsetof(JSFunctionBytecode, debug);
+    }
+    function_size = header_size;
+    cpool_offset = function_size;
+    function_size += b->cpool_count * sizeof(*b->cpool);
+    vardefs_offset = function_size;
+    if (b->vardefs)
+        function_size += (b->arg_count + b->var_count) * sizeof(*b->vardefs);
+    closure_var_offset = function_size;
+    function_size += b->closure_var_count * sizeof(*b->closure_var);
+    byte_code_offset = function_size;
+    if (!b->read_only_bytecode)
+        function_size += b->byte_code_len;
+
+    ic = NULL;
+    pc2line_buf = NULL;
+    source = NULL;
+    if (b->ic_count != 0) {
+        ic = js_clone_malloc(s, sizeof(ic[0]) * b->ic_count);
+        if (!ic)
+            goto fail;
+        memset(ic, 0, sizeof(ic[0]) * b->ic_count);
+    }
+    if (b->has_debug) {
+        if (b->debug.pc2line_len != 0) {
+            pc2line_buf = js_clone_malloc(s, b->debug.pc2line_len);
+            if (!pc2line_buf)
+                goto fail;
+            memcpy(pc2line_buf, b->debug.pc2line_buf, b->debug.pc2line_len);
+        }
+        if (b->debug.source) {
+            source = js_clone_malloc(s, b->debug.source_len + 1);
+            if (!source)
+                goto fail;
+            memcpy(source, b->debug.source, b->debug.source_len + 1);
+        }
+    }
+    nb = js_clone_malloc(s, function_size);
+    if (!nb)
+        goto fail;
+
+    memcpy(nb, b, header_size);
+    nb->header.ref_count = 1;
+    if (b->cpool_count != 0) {
+        nb->cpool = (void *)((uint8_t*)nb + cpool_offset);
+        for(i = 0; i < b->cpool_count; i++)
+            nb->cpool[i] = JS_UNDEFINED;
+    }
+    if (b->vardefs) {
+        nb->vardefs = (void *)((uint8_t*)nb + vardefs_offset);
+        memcpy(nb->vardefs, b->vardefs,
+               (b->arg_count + b->var_count) * sizeof(*b->vardefs));
+        for(i = 0; i < b->arg_count + b->var_count; i++)
+            JS_DupAtomRT(rt, nb->vardefs[i].var_name);
+    }
+    if (b->closure_var_count != 0) {
+        nb->closure_var = (void *)((uint8_t*)nb + closure_var_offset);
+        memcpy(nb->closure_var, b->closure_var,
+               b->closure_var_count * sizeof(*b->closure_var));
+        for(i = 0; i < b->closure_var_count; i++)
+            JS_DupAtomRT(rt, nb->closure_var[i].var_name);
+    }
+    if (!b->read_only_bytecode) {
+        nb->byte_code_buf = (void *)((uint8_t*)nb + byte_code_offset);
+        memcpy(nb->byte_code_buf, b->byte_code_buf, b->byte_code_len);
+    }
+    js_dup_bytecode_atoms(rt, nb->byte_code_buf, nb->byte_code_len);
+    JS_DupAtomRT(rt, nb->func_name);
+    if (nb->realm)
+        nb->realm = JS_DupContext(ctx);
+    /* the inline caches are empty */
+    nb->ic = ic;
+    for(i = 0; i < b->ic_count; i++)
+        ic[i].atom = JS_DupAtomRT(rt, b->ic[i].atom);
+#ifdef CONFIG_JIT
+    nb->jit_counter = 0;
+    nb->jit = NULL;
+#endif
+    if (b->has_debug) {
+        JS_DupAtomRT(rt, nb->debug.filename);
+        nb->debug.pc2line_buf = pc2line_buf;
+        nb->debug.source = source;
+#ifdef CONFIG_DEBUGGER
+        memset(&nb->debugger, 0, sizeof(nb->debugger));
+#endif
+    }
+    add_gc_object(rt, &nb->header, JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
+    if (js_clone_add(s, b, nb, JS_CLONE_FUNCTION_BYTECODE))
+        return NULL;
+
+    for(i = 0; i < b->cpool_count; i++) {
+        if (js_clone_value(s, &nb->cpool[i], b->cpool[i]))
+            return NULL;
+    }
+ done:
+    nb->header.ref_count++;
+    return nb;
+ fail:
+    js_free_rt(rt, ic);
+    js_free_rt(rt, pc2line_buf);
+    js_free_rt(rt, source);
+    return NULL;
+}
+
+/* Return a new reference to the copy of 'p'. The copy is an empty
+   shell which can be safely freed: its contents are copied by
+   js_clone_object_contents(). */
+static JSObject *js_clone_object(JSCloneState *s, JSObject *p)
+{
+    JSContext *ctx = s->ctx;
+    JSRuntime *rt = ctx->rt;
+    JSObject *np, **new_list;
+    JSShape *sh;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    int i, new_size;
+
+    np = js_clone_find(s, p);
+    if (np)
+        goto done;
+    /* the prototype chain is copied recursively */
+    if (js_check_stack_overflow(rt, 0)) {
+        JS_ThrowStackOverflow(s->src_ctx);
+        return NULL;
+    }
+
+    switch(p->class_id) {
+    case JS_CLASS_OBJECT:
+    case JS_CLASS_ERROR:
+    case JS_CLASS_ARRAY:
+    case JS_CLASS_ARGUMENTS:
+    case JS_CLASS_NUMBER:
+    case JS_CLASS_STRING:
+    case JS_CLASS_BOOLEAN:
+    case JS_CLASS_SYMBOL:
+    case JS_CLASS_DATE:
+    case JS_CLASS_BIG_INT:
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_BIG_FLOAT:
+    case JS_CLASS_BIG_DECIMAL:
+#endif
+    case JS_CLASS_C_FUNCTION:
+    case JS_CLASS_C_FUNCTION_DATA:
+    case JS_CLASS_BOUND_FUNCTION:
+    case JS_CLASS_BYTECODE_FUNCTION:
+    case JS_CLASS_GENERATOR_FUNCTION:
+    case JS_CLASS_ASYNC_FUNCTION:
+    case JS_CLASS_ASYNC_GENERATOR_FUNCTION:
+    case JS_CLASS_REGEXP:
+    case JS_CLASS_MAP:
+    case JS_CLASS_SET:
+        break;
+    default:
+        js_clone_throw_class(s, p->class_id);
+        return NULL;
+    }
+    if (p->class_id == JS_CLASS_C_FUNCTION && p->u.cfunc.realm != s->src_ctx) {
+        JS_ThrowTypeError(s->src_ctx, "cannot clone a function of another realm");
+        return NULL;
+    }
+    for(i = 0, prs = get_shape_prop(p->shape); i < p->shape->prop_count; i++, prs++) {
+        if ((prs->flags & JS_PROP_TMASK) == JS_PROP_AUTOINIT) {
+            pr = &p->prop[i];
+            if (js_autoinit_get_realm(pr) != s->src_ctx ||
+                js_autoinit_get_id(pr) == JS_AUTOINIT_ID_MODULE_NS) {
+                JS_ThrowTypeError(s->src_ctx, "cannot clone a lazy property");
+                return NULL;
+            }
+        }
+    }
+
+    sh = js_clone_shape1(s, p->shape);
+    if (!sh)
+        return NULL;
+    np = js_clone_pool_malloc(s, sizeof(JSObject));
+    if (!np) {
+        js_free_shape(rt, sh);
+        return NULL;
+    }
+    memcpy(np, p, sizeof(*np));
+    np->free_mark = 0;
+    np->tmp_mark = 0;
+    np->first_weak_ref = NULL;
+    np->shape = sh;
+    np->prop = js_clone_malloc(s, sizeof(JSProperty) * sh->prop_size);
+    if (!np->prop) {
+        js_pool_free_rt(rt, np, sizeof(JSObject));
+        js_free_shape(rt, sh);
+        return NULL;
+    }
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        pr = &np->prop[i];
+        switch(prs->flags & JS_PROP_TMASK) {
+        case JS_PROP_GETSET:
+            pr->u.getset.getter = NULL;
+            pr->u.getset.setter = NULL;
+            break;
+        case JS_PROP_VARREF:
+            pr->u.var_ref = NULL;
+            break;
+        case JS_PROP_AUTOINIT:
+            pr->u.init.realm_and_id = (uintptr_t)JS_DupContext(ctx) |
+                js_autoinit_get_id(&p->prop[i]);
+            pr->u.init.opaque = p->prop[i].u.init.opaque;
+            break;
+        default:
+            pr->u.value = JS_UNDEFINED;
+            break;
+        }
+    }
+
+    switch(p->class_id) {
+    case JS_CLASS_ARRAY:
+    case JS_CLASS_ARGUMENTS:
+        np->u.array.u.values = NULL;
+        np->u.array.count = 0;
+        np->u.array.u1.size = 0;
+        break;
+    case JS_CLASS_NUMBER:
+    case JS_CLASS_STRING:
+    case JS_CLASS_BOOLEAN:
+    case JS_CLASS_SYMBOL:
+    case JS_CLASS_DATE:
+    case JS_CLASS_BIG_INT:
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_BIG_FLOAT:
+    case JS_CLASS_BIG_DECIMAL:
+#endif
+        np->u.object_data = JS_UNDEFINED;
+        break;
+    case JS_CLASS_C_FUNCTION:
+        np->u.cfunc.realm = JS_DupContext(ctx);
+        break;
+    case JS_CLASS_C_FUNCTION_DATA:
+        {
+            JSCFunctionDataRecord *d, *d1 = p->u.c_function_data_record;
+            d = js_clone_malloc(s, sizeof(*d) + d1->data_len * sizeof(JSValue));
+            if (!d)
+                goto fail_shell;
+            memcpy(d, d1, sizeof(*d));
+            for(i = 0; i < d->data_len; i++)
+                d->data[i] = JS_UNDEFINED;
+            np->u.c_function_data_record = d;
+        }
+        break;
+    case JS_CLASS_BOUND_FUNCTION:
+        {
+            JSBoundFunction *bf, *bf1 = p->u.bound_function;
+            bf = js_clone_malloc(s, sizeof(*bf) + bf1->argc * sizeof(JSValue));
+            if (!bf)
+                goto fail_shell;
+            bf->func_obj = JS_UNDEFINED;
+            bf->this_val = JS_UNDEFINED;
+            bf->argc = bf1->argc;
+            for(i = 0; i < bf->argc; i++)
+                bf->argv[i] = JS_UNDEFINED;
+            np->u.bound_function = bf;
+        }
+        break;
+    case JS_CLASS_BYTECODE_FUNCTION:
+    case JS_CLASS_GENERATOR_FUNCTION:
+    case JS_CLASS_ASYNC_FUNCTION:
+    case JS_CLASS_ASYNC_GENERATOR_FUNCTION:
+        np->u.func.function_bytecode = NULL;
+        np->u.func.var_refs = NULL;
+        np->u.func.home_object = NULL;
+        break;
+    case JS_CLASS_REGEXP:
+        /* the pattern and the compiled bytecode are immutable */
+        if (np->u.regexp.pattern)
+            JS_DupValueRT(rt, JS_MKPTR(JS_TAG_STRING, np->u.regexp.pattern));
+        if (np->u.regexp.bytecode)
+            JS_DupValueRT(rt, JS_MKPTR(JS_TAG_STRING, np->u.regexp.bytecode));
+        /* the DFA is not shared: the clone builds its own one */
+        np->u.regexp.exec_count = 0;
+        break;
+    case JS_CLASS_MAP:
+    case JS_CLASS_SET:
+        np->u.map_state = NULL;
+        break;
+    default:
+        break;
+    }
+    np->header.ref_count = 1;
+    add_gc_object(rt, &np->header, JS_GC_OBJ_TYPE_JS_OBJECT);
+    if (js_clone_add(s, p, np, JS_CLONE_OBJECT))
+        return NULL;
+
+    if (s->work_count >= s->work_size) {
+        new_size = max_int(s->work_size * 3 / 2, 64);
+        new_list = js_realloc_rt(rt, s->work_list,
+                                 sizeof(s->work_list[0]) * new_size);
+        if (!new_list) {
+            JS_ThrowOutOfMemory(s->src_ctx);
+            return NULL;
+        }
+        s->work_list = new_list;
+        s->work_size = new_size;
+    }
+    s->work_list[s->work_count++] = p;
+ done:
+    np->header.ref_count++;
+    return np;
+ fail_shell:
+    /* the class specific part is not initialized */
+    np->class_id = JS_CLASS_OBJECT;
+    np->header.ref_count = 1;
+    add_gc_object(rt, &np->header, JS_GC_OBJ_TYPE_JS_OBJECT);
+    JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_OBJECT, np));
+    return NULL;
+}
+
+static int js_clone_value(JSCloneState *s, JSValue *pres, JSValueConst val)
+{
+    switch(JS_VALUE_GET_TAG(val)) {
+    case JS_TAG_OBJECT:
+        {
+            JSObject *p;
+            p = js_clone_object(s, JS_VALUE_GET_OBJ(val));
+            if (!p)
+                return -1;
+            *pres = JS_MKPTR(JS_TAG_OBJECT, p);
+        }
+        break;
+    case JS_TAG_FUNCTION_BYTECODE:
+        {
+            JSFunctionBytecode *b;
+            b = js_clone_function_bytecode(s, JS_VALUE_GET_PTR(val));
+            if (!b)
+                return -1;
+            *pres = JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b);
+        }
+        break;
+    case JS_TAG_MODULE:
+        JS_ThrowTypeError(s->src_ctx, "cannot clone a module");
+        return -1;
+    default:
+        /* immutable values are shared */
+        *pres = JS_DupValueRT(s->ctx->rt, val);
+        break;
+    }
+    return 0;
+}
+
+static int js_clone_object_ptr(JSCloneState *s, JSObject **pres, JSObject *p)
+{
+    if (p) {
+        p = js_clone_object(s, p);
+        if (!p)
+            return -1;
+    }
+    *pres = p;
+    return 0;
+}
+
+static int js_clone_object_contents(JSCloneState *s, JSObject *p)
+{
+    JSObject *np;
+    JSShapeProperty *prs;
+    JSProperty *pr, *npr;
+    int i;
+
+    np = js_clone_find(s, p);
+    /* the shapes of the object and of its copy have the same layout */
+    for(i = 0, prs = get_shape_prop(p->shape); i < p->shape->prop_count; i++, prs++) {
+        pr = &p->prop[i];
+        npr = &np->prop[i];
+        switch(prs->flags & JS_PROP_TMASK) {
+        case JS_PROP_GETSET:
+            if (js_clone_object_ptr(s, &npr->u.getset.getter, pr->u.getset.getter) ||
+                js_clone_object_ptr(s, &npr->u.getset.setter, pr->u.getset.setter))
+                return -1;
+            break;
+        case JS_PROP_VARREF:
+            npr->u.var_ref = js_clone_var_ref(s, pr->u.var_ref);
+            if (!npr->u.var_ref)
+                return -1;
+            break;
+        case JS_PROP_AUTOINIT:
+            break;
+        default:
+            if (prs->atom != JS_ATOM_NULL &&
+                js_clone_value(s, &npr->u.value, pr->u.value))
+                return -1;
+            break;
+        }
+    }
+
+    switch(p->class_id) {
+    case JS_CLASS_ARRAY:
+    case JS_CLASS_ARGUMENTS:
+        if (p->fast_array && p->u.array.count != 0) {
+            uint32_t len = p->u.array.count, k;
+            np->u.array.u.values = js_clone_malloc(s, sizeof(JSValue) * len);
+            if (!np->u.array.u.values)
+                return -1;
+            np->u.array.u1.size = len;
+            for(k = 0; k < len; k++) {
+                if (js_clone_value(s, &np->u.array.u.values[k],
+                                   p->u.array.u.values[k]))
+                    return -1;
+                np->u.array.count = k + 1;
+            }
+        }
+        break;
+    case JS_CLASS_NUMBER:
+    case JS_CLASS_STRING:
+    case JS_CLASS_BOOLEAN:
+    case JS_CLASS_SYMBOL:
+    case JS_CLASS_DATE:
+    case JS_CLASS_BIG_INT:
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_BIG_FLOAT:
+    case JS_CLASS_BIG_DECIMAL:
+#endif
+        return js_clone_value(s, &np->u.object_data, p->u.object_data);
+    case JS_CLASS_C_FUNCTION_DATA:
+        {
+            JSCFunctionDataRecord *d = np->u.c_function_data_record;
+            for(i = 0; i < d->data_len; i++) {
+                if (js_clone_value(s, &d->data[i],
+                                   p->u.c_function_data_record->data[i]))
+                    return -1;
+            }
+        }
+        break;
+    case JS_CLASS_BOUND_FUNCTION:
+        {
+            JSBoundFunction *bf = np->u.bound_function;
+            JSBoundFunction *bf1 = p->u.bound_function;
+            if (js_clone_value(s, &bf->func_obj, bf1->func_obj) ||
+                js_clone_value(s, &bf->this_val, bf1->this_val))
+                return -1;
+            for(i = 0; i < bf->argc; i++) {
+                if (js_clone_value(s, &bf->argv[i], bf1->argv[i]))
+                    return -1;
+            }
+        }
+        break;
+    case JS_CLASS_BYTECODE_FUNCTION:
+    case JS_CLASS_GENERATOR_FUNCTION:
+    case JS_CLASS_ASYNC_FUNCTION:
+    case JS_CLASS_ASYNC_GENERATOR_FUNCTION:
+        {
+            JSFunctionBytecode *b = p->u.func.function_bytecode;
+            JSVarRef **var_refs;
+
+            if (js_clone_object_ptr(s, &np->u.func.home_object,
+                                    p->u.func.home_object))
+                return -1;
+            np->u.func.function_bytecode = js_clone_function_bytecode(s, b);
+            if (!np->u.func.function_bytecode)
+                return -1;
+            if (p->u.func.var_refs) {
+                var_refs = js_clone_malloc(s, sizeof(var_refs[0]) *
+                                           max_int(b->closure_var_count, 1));
+                if (!var_refs)
+                    return -1;
+                memset(var_refs, 0, sizeof(var_refs[0]) *
+                       max_int(b->closure_var_count, 1));
+                np->u.func.var_refs = var_refs;
+                for(i = 0; i < b->closure_var_count; i++) {
+                    if (p->u.func.var_refs[i]) {
+                        var_refs[i] = js_clone_var_ref(s, p->u.func.var_refs[i]);
+                        if (!var_refs[i])
+                            return -1;
+                    }
+                }
+            }
+        }
+        break;
+    case JS_CLASS_MAP:
+    case JS_CLASS_SET:
+        {
+            JSMapState *ms, *ms1 = p->u.map_state;
+            JSMapRecord *mr, *mr1;
+            JSValue key;
+            uint32_t i;
+
+            ms = js_clone_malloc(s, sizeof(*ms));
+            if (!ms)
+                return -1;
+            memset(ms, 0, sizeof(*ms));
+            init_list_head(&ms->iterators);
+            ms->is_weak = FALSE;
+            np->u.map_state = ms;
+            if (ms1->record_count != 0 &&
+                map_resize(s->ctx->rt, ms, ms1->record_count)) {
+                JS_ThrowOutOfMemory(s->src_ctx);
+                return -1;
+            }
+
+            for(i = 0; i < ms1->record_end; i++) {
+                mr1 = &ms1->records[i];
+                if (map_record_is_deleted(mr1))
+                    continue;
+                if (js_clone_value(s, &key, mr1->key))
+                    return -1;
+                mr = map_add_record(s->src_ctx, ms, key);
+                JS_FreeValueRT(s->ctx->rt, key);
+                if (!mr)
+                    return -1;
+                mr->value = JS_UNDEFINED;
+                if (js_clone_value(s, &mr->value, mr1->value))
+                    return -1;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+JSContext *JS_CloneContext(JSContext *src_ctx)
+{
+    JSRuntime *rt = src_ctx->rt;
+    JSCloneState s_s, *s = &s_s;
+    JSContext *ctx;
+    int i;
+
+    ctx = js_new_context(rt);
+    if (!ctx) {
+        JS_ThrowOutOfMemory(src_ctx);
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->src_ctx = src_ctx;
+    s->hash_size = 256;
+    s->hash_table = js_clone_malloc(s, sizeof(s->hash_table[0]) * s->hash_size);
+    if (!s->hash_table) {
+        JS_FreeContext(ctx);
+        return NULL;
+    }
+    memset(s->hash_table, 0, sizeof(s->hash_table[0]) * s->hash_size);
+
+    for(i = 0; i < rt->class_count; i++) {
+        if (js_clone_value(s, &ctx->class_proto[i], src_ctx->class_proto[i]))
+            goto fail;
+    }
+#define CLONE_FIELD(field) \
+    if (js_clone_value(s, &ctx->field, src_ctx->field)) goto fail
+    CLONE_FIELD(function_proto);
+    CLONE_FIELD(function_ctor);
+    CLONE_FIELD(array_ctor);
+    CLONE_FIELD(regexp_ctor);
+    CLONE_FIELD(promise_ctor);
+    for(i = 0; i < JS_NATIVE_ERROR_COUNT; i++) {
+        CLONE_FIELD(native_error_proto[i]);
+    }
+    CLONE_FIELD(iterator_proto);
+    CLONE_FIELD(async_iterator_proto);
+    CLONE_FIELD(array_proto_values);
+    CLONE_FIELD(throw_type_error);
+    CLONE_FIELD(eval_obj);
+    CLONE_FIELD(global_obj);
+    CLONE_FIELD(global_var_obj);
+#undef CLONE_FIELD
+    if (src_ctx->array_shape) {
+        ctx->array_shape = js_clone_shape1(s, src_ctx->array_shape);
+        if (!ctx->array_shape)
+            goto fail;
+    }
+
+    while (s->work_count > 0) {
+        if (js_clone_object_contents(s, s->work_list[--s->work_count]))
+            goto fail;
+    }
+    js_clone_free_table(s);
+
+    js_random_init(ctx);
+#ifdef CONFIG_BIGNUM
+    ctx->fp_env = src_ctx->fp_env;
+    ctx->bignum_ext = src_ctx->bignum_ext;
+    ctx->allow_operator_overloading = src_ctx->allow_operator_overloading;
+#endif
+    ctx->compile_regexp = src_ctx->compile_regexp;
+    ctx->eval_internal = src_ctx->eval_internal;
+    ctx->user_opaque = src_ctx->user_opaque;
+#ifdef CONFIG_DEBUGGER
+    js_debugger_new_context(ctx);
+#endif
+    return ctx;
+ fail:
+    js_clone_free_table(s);
+    JS_FreeContext(ctx);
+    return NULL;
+}
+
 #ifdef CONFIG_DEBUGGER
 
 JSDebuggerLocation js_debugger_current_location(JSContext *ctx, const uint8_t *cur_pc) {
@@ -84,6 +84,9 @@ enum {
     JS_TAG_BIG_FLOAT   = -9,
     JS_TAG_SYMBOL      = -8,
     JS_TAG_STRING      = -7,
+    /* lazy concatenation. Strings may have this tag or JS_TAG_STRING,
+       so JS_IsString() must be used to test for strings. */
+    JS_TAG_STRING_ROPE = -6,
     JS_TAG_MODULE      = -3, /* used internally */
     JS_TAG_FUNCTION_BYTECODE = -2, /* used internally */
     JS_TAG_OBJECT      = -1,
@@ -361,6 +364,51 @@ typedef void JS_MarkFunc(JSRuntime *rt, JSGCObjectHeader *gp);
 void JS_MarkValue(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func);
 void JS_RunGC(JSRuntime *rt);
 JS_BOOL JS_IsLiveObject(JSRuntime *rt, JSValueConst obj);
+/* if enable is TRUE, the automatic GC normally only collects the
+   cycles of the objects allocated since the previous collection. A
+   full collection is done when the memory usage grows too much. */
+void JS_EnableGenerationalGC(JSRuntime *rt, JS_BOOL enable);
+/* Incremental collection: run one step of a collection pass scanning
+   a part of the objects in about budget_us microseconds (the pause
+   budget of the runtime if budget_us <= 0). Return TRUE if the pass
+   is not finished. A pass frees the garbage cycles which existed at
+   its start, except the ones too large to fit in a step. The
+   children of a single object are always scanned in the same step. */
+JS_BOOL JS_RunGCStep(JSRuntime *rt, int64_t budget_us);
+/* return TRUE if an incremental collection pass is in progress */
+JS_BOOL JS_IsGCPending(JSRuntime *rt);
+/* if budget_us > 0, the automatic GC runs steps of about budget_us
+   microseconds instead of full collections. The steps run more often
+   when the memory usage grows. A full collection is still done when
+   the memory usage reaches three times the live size estimated by the
+   previous pass, e.g. if the garbage contains cycles larger than a
+   step. Its pause is not bounded by budget_us. */
+void JS_SetGCPauseBudget(JSRuntime *rt, int64_t budget_us);
+
+#define JS_GC_PAUSE_HISTOGRAM_SIZE 20
+
+typedef struct JSGCStats {
+    int64_t young_count; /* number of young generation collections */
+    int64_t full_count; /* number of full collections */
+    int64_t step_count; /* number of incremental collection steps */
+    /* number of full collections done by the automatic GC in
+       incremental mode (also counted in full_count) */
+    int64_t fallback_count;
+    int64_t total_pause_us; /* total time spent in the collections */
+    int64_t max_pause_us;
+    /* pause_histogram[0] counts the pauses < 1 us and pause_histogram[i]
+       the pauses in [2^(i-1), 2^i[ us. The last entry also counts the
+       longer pauses. */
+    int64_t pause_histogram[JS_GC_PAUSE_HISTOGRAM_SIZE];
+} JSGCStats;
+
+void JS_GetGCStats(JSRuntime *rt, JSGCStats *s);
+
+/* if enable is TRUE, the contexts created after this call allocate
+   their objects, shapes and closure variables from arena chunks which
+   are released in bulk once all their objects are freed. It is
+   intended for short-lived contexts. */
+void JS_EnableContextArena(JSRuntime *rt, JS_BOOL enable);
 
 JSContext *JS_NewContext(JSRuntime *rt);
 void JS_FreeContext(JSContext *s);
@@ -370,6 +418,15 @@ void JS_SetContextOpaque(JSContext *ctx, void *opaque);
 JSRuntime *JS_GetRuntime(JSContext *ctx);
 void JS_SetClassProto(JSContext *ctx, JSClassID class_id, JSValue obj);
 JSValue JS_GetClassProto(JSContext *ctx, JSClassID class_id);
+/* Create a new context of the same runtime by copying the state of
+   'ctx' (intrinsic objects, global variables and the functions
+   defined by the scripts evaluated in it). Intended to start contexts
+   from a pre-initialized template without running the initialization
+   again. The modules are not copied. Objects of other classes than
+   the plain objects, arrays, functions, primitive wrappers, regexps,
+   Map and Set cannot be copied. Return NULL with an exception raised
+   in 'ctx' if the copy fails. */
+JSContext *JS_CloneContext(JSContext *ctx);
 
 /* the following functions are used to select the intrinsic object to
    save memory */
@@ -635,7 +692,8 @@ static inline JS_BOOL JS_IsUninitialized(JSValueConst v)
 
 static inline JS_BOOL JS_IsString(JSValueConst v)
 {
-    return JS_VALUE_GET_TAG(v) == JS_TAG_STRING;
+    return JS_VALUE_GET_TAG(v) == JS_TAG_STRING ||
+        JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE;
 }
 
 static inline JS_BOOL JS_IsSymbol(JSValueConst v)
@@ -875,6 +933,9 @@ typedef int JSInterruptHandler(JSRuntime *rt, void *opaque);
 void JS_SetInterruptHandler(JSRuntime *rt, JSInterruptHandler *cb, void *opaque);
 /* if can_block is TRUE, Atomics.wait() can be used */
 void JS_SetCanBlock(JSRuntime *rt, JS_BOOL can_block);
+/* if enable is TRUE, the hot loops are compiled to native code. No
+   effect if the JIT is not available on the target. */
+void JS_EnableJIT(JSRuntime *rt, JS_BOOL enable);
 /* set the [IsHTMLDDA] internal slot */
 void JS_SetIsHTMLDDA(JSContext *ctx, JSValueConst obj);
 
@@ -917,6 +978,18 @@ uint8_t *JS_WriteObject(JSContext *ctx, size_t *psize, JSValueConst obj,
                         int flags);
 uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
                          int flags, uint8_t ***psab_tab, size_t *psab_tab_len);
+/* Same as JS_WriteObject2() but the data of the ArrayBuffers in
+   'transfer_list' is written by reference and added to 'sab_tab'. The
+   ArrayBuffers created by the runtime already use sab_alloc() memory
+   and are not copied. The ones with external data (JS_NewArrayBuffer())
+   are copied to sab_alloc() memory the first time. The caller
+   must take a reference to the 'sab_tab' data and then detach the
+   transferred ArrayBuffers with JS_DetachArrayBuffer(). Requires
+   JS_WRITE_OBJ_SAB and the SharedArrayBuffer functions, otherwise the
+   ArrayBuffers are copied. */
+uint8_t *JS_WriteObject3(JSContext *ctx, size_t *psize, JSValueConst obj,
+                         int flags, uint8_t ***psab_tab, size_t *psab_tab_len,
+                         JSValueConst *transfer_list, int transfer_len);
 
 #define JS_READ_OBJ_BYTECODE  (1 << 0) /* allow function/module */
 #define JS_READ_OBJ_ROM_DATA  (1 << 1) /* avoid duplicating 'buf' data */
@@ -0,0 +1,44 @@
+/* template evaluated by "qjs --clone-template" before the context used
+   by test_clone.js is cloned from it */
+"use strict";
+
+/* RegExp objects whose DFA is already built */
+var tpl_re = /a+b/;
+var tpl_re_count = 0;
+(function () {
+    var i;
+    for(i = 0; i < 20; i++) {
+        if (tpl_re.test("xxaab"))
+            tpl_re_count++;
+    }
+})();
+
+/* Map and Set with deleted records */
+var tpl_map = new Map();
+var tpl_set = new Set();
+(function () {
+    var i;
+    for(i = 0; i < 100; i++) {
+        tpl_map.set("k" + i, i);
+        tpl_set.add(i);
+    }
+    for(i = 0; i < 100; i += 2) {
+        tpl_map.delete("k" + i);
+        tpl_set.delete(i);
+    }
+})();
+
+/* closures sharing a variable */
+var tpl_counter = (function () {
+    var n = 0;
+    return {
+        inc: function () { return ++n; },
+        get: function () { return n; },
+    };
+})();
+tpl_counter.inc();
+
+/* fast and sparse arrays */
+var tpl_arr = [1, 2, 3, { a: [4, 5] }];
+var tpl_sparse = [];
+tpl_sparse[1000] = "x";
@@ -1,3 +1,4 @@
+import * as std from 'std';
 import * as os from 'os';
 
 var status = 0;
@@ -340,6 +341,96 @@ function test_string()
     assert("abc".padStart(Infinity, ""), "abc");
 }
 
+function test_string_concat()
+{
+    var a, b, c, i, m, o;
+
+    /* long concatenations are represented as ropes */
+    a = "";
+    for(i = 0; i < 10000; i++)
+        a += "ab";
+    assert(a.length, 20000);
+    assert(a === "ab".repeat(10000), true);
+    assert(a[19999], "b");
+    assert(a.charCodeAt(10000), 97);
+
+    b = "";
+    for(i = 0; i < 10000; i++)
+        b = String.fromCharCode(0x100 + (i & 0xff)) + b;
+    assert(b.length, 10000);
+    assert(b.charCodeAt(0), 0x10f);
+    assert(b.charCodeAt(9999), 0x100);
+
+    /* a shared rope is not modified by the next concatenation */
+    c = a;
+    a += "z";
+    assert(c.length, 20000);
+    assert(a.length, 20001);
+    assert(a > c, true);
+    assert(c + "z" === a, true);
+
+    assert(typeof a, "string");
+    assert(!!a, true);
+    assert(a == "ab".repeat(10000) + "z", true);
+    assert(+("0".repeat(1000) + "12"), 12);
+    assert(new String(a).length, 20001);
+
+    m = new Map();
+    m.set(c, 1);
+    assert(m.get("ab".repeat(10000)), 1);
+    o = {};
+    o[c] = 2;
+    assert(o["ab".repeat(10000)], 2);
+    assert(JSON.stringify(c + "\n").length, 20004);
+    assert(eval("/*" + c + "*/ 1 + 2"), 3);
+}
+
+function test_string_search()
+{
+    var a, n, w, i;
+
+    /* the match is found in the vectorized part and in the tail */
+    a = "x".repeat(1000);
+    for(i = 995; i < 1000; i++) {
+        assert((a.substring(0, i) + "yz" + a).indexOf("yz"), i);
+        assert((a.substring(0, i) + "yz").indexOf("yz"), i);
+    }
+    assert(a.indexOf("xy"), -1);
+    assert(a.includes("xx", 998), true);
+    assert(a.includes("xx", 999), false);
+
+    /* long needles */
+    n = "abcdefghij".repeat(4);
+    a = "abcdefghij".repeat(100) + "abcdefghiX" + n;
+    assert(a.indexOf(n), 0);
+    assert(a.indexOf(n, 1), 10);
+    assert(a.indexOf(n, 961), a.length - n.length);
+    assert(a.indexOf(n + "!"), -1);
+    assert(a.includes("j" + n), true);
+
+    /* wide strings and characters whose low bytes collide */
+    w = "š".repeat(100) + "šĀa" + "š".repeat(100);
+    assert(w.indexOf("šĀa"), 100);
+    assert(w.indexOf("Āa"), 101);
+    assert(w.indexOf("Ā"), 101);
+    assert(w.indexOf("Ȁ"), -1);
+    assert(w.indexOf("ša"), -1);
+    assert(w.indexOf("\x61"), 102);
+    assert(w.includes("šāa"), false);
+    n = "Ā".repeat(40);
+    assert(("Ȁ".repeat(100) + n).indexOf(n), 100);
+    assert(("\x00".repeat(100) + "Ā").indexOf(n), -1);
+    assert("abc".repeat(50).indexOf("šb"), -1);
+    assert(("abc".repeat(50) + "\xe9š").indexOf("\xe9š"), 150);
+
+    a = [];
+    for(i = 0; i < 1000; i++)
+        a.push("field" + i);
+    assert("š,".concat(a.join(",")).split(",").length, 1001);
+    assert(a.join(", ").split(", "), a);
+    assert(a.join(", ").replace("field999", "x").endsWith(", x"), true);
+}
+
 function test_math()
 {
     var a;
@@ -526,6 +617,26 @@ function test_json()
   3
  ]
 ]`);
+
+    /* long strings mixing plain runs, escapes and non-ASCII characters */
+    s = "0123456789abcdef0123456789".repeat(3);
+    a = JSON.parse('["' + s + '","' + s + '\\n' + s + '","' + s + '\u00e9' + s +
+                   '",   \t  "\\u0041' + s + '\\""]');
+    assert(a.length, 4);
+    assert(a[0], s);
+    assert(a[1], s + "\n" + s);
+    assert(a[2], s + "\u00e9" + s);
+    assert(a[3], "A" + s + '"');
+    assert_throws(SyntaxError, () => JSON.parse('"' + s + '\x01"'));
+    assert_throws(SyntaxError, () => JSON.parse('"' + s));
+
+    assert(JSON.stringify([s + '"\\\n\x01\u00e9' + s, "\ud800"]),
+           '["' + s + '\\"\\\\\\n\\u0001\u00e9' + s + '","\\ud800"]');
+    assert(JSON.stringify({ b: 1, a: [1, , 3], 2: 0, [Symbol()]: 1, u: undefined }),
+           '{"2":0,"b":1,"a":[1,null,3]}');
+    /* object modified by a toJSON method during its serialization */
+    a = { x: 1, y: { toJSON() { delete a.z; a.w = 2; return "y"; } }, z: 3 };
+    assert(JSON.stringify(a), '{"x":1,"y":"y"}');
 }
 
 function test_date()
@@ -633,7 +744,7 @@ function test_date()
 
 function test_regexp()
 {
-    var a, str;
+    var a, str, i;
     str = "abbbbbc";
     a = /(b+)c/.exec(str);
     assert(a[0], "bbbbbc");
@@ -677,6 +788,70 @@ function test_regexp()
     assert(a, ["a", undefined]);
     a = /(?:|[\w])+([0-9])/.exec("123a23");
     assert(a, ["123a23", "3"]);
+
+    /* literal prefix and anchor */
+    a = /ab(c)?d/.exec("xabxabdx");
+    assert(a, ["abd", undefined]);
+    assert(a.index, 4);
+    a = /ab(c)?d/.exec("xabx\u20acabcd");
+    assert(a, ["abcd", "c"]);
+    assert(a.index, 5);
+    assert(/\u20acx/.exec("abc"), null);
+    assert("ab ab\nab".replace(/ab/g, "c"), "c c\nc");
+    a = /^ab/g;
+    a.lastIndex = 2;
+    assert(a.exec("abab"), null);
+    assert("ab\nab".replace(/^ab/gm, "c"), "c\nc");
+
+    /* exponential backtracking: switches to the linear time matcher */
+    str = "a".repeat(40);
+    assert(/(a+)+b/.exec(str), null);
+    a = /(a|aa)*c|(a+)+$/.exec(str);
+    assert(a, [str, undefined, str]);
+    a = /^(\w+\s?)*$/i.exec("ab ".repeat(1000) + "!");
+    assert(a, null);
+    a = /(x+x+)+(y)?/.exec("x".repeat(5000));
+    assert(a[0].length, 5000);
+    assert(a[2], undefined);
+
+    /* the DFA is used after a few calls on the same object */
+    a = /^[a-z]+(-[0-9]{2,3})?$/i;
+    str = ["", "abc", "Abc-12", "abc-1", "abc-1234", "ab c", "abc-123"];
+    for(i = 0; i < 4; i++) {
+        assert(str.map((s) => a.test(s)).join(),
+               "false,true,true,false,false,false,true");
+    }
+    a = /b*$/y;
+    for(i = 0; i < 10; i++) {
+        a.lastIndex = i & 3;
+        assert(a.test("abb"), (i & 3) != 0);
+        assert(a.lastIndex, (i & 3) != 0 ? 3 : 0);
+    }
+    a = /x\d/g;
+    for(i = 0; i < 10; i++) {
+        a.lastIndex = 2;
+        assert(a.test("x1 x2"), true);
+        assert(a.lastIndex, 5);
+        assert(a.test("x1 x2"), false);
+        assert(a.lastIndex, 0);
+    }
+    assert("a1b22c333d".split(/\d+/).join(), "a,b,c,d");
+
+    /* exec() result layout and lastIndex */
+    a = /(a)(?<n>b)?/d.exec("xab");
+    assert(Object.keys(a).join(), "0,1,2,index,input,groups,indices");
+    assert(a.index, 1);
+    assert(a.input, "xab");
+    assert(a.groups.n, "b");
+    a.push("c");
+    assert(a.length, 4);
+    a = /a/g;
+    a.lastIndex = { valueOf() { return 1; } };
+    assert(a.exec("aa").index, 1);
+    assert(a.lastIndex, 2);
+    Object.defineProperty(a, "lastIndex", { writable: false });
+    assert_throws(TypeError, () => a.exec("a"));
+    assert_throws(TypeError, () => a.exec("b"));
 }
 
 function test_symbol()
@@ -754,6 +929,87 @@ function test_map()
     assert(a.size, 0);
 }
 
+function test_map_order()
+{
+    var a, b, i, n, r, it;
+
+    /* insertion order, NaN and -0 keys */
+    a = new Map([[NaN, 1], [-0, 2], ["x", 3]]);
+    assert(a.get(NaN), 1);
+    assert(a.get(0), 2);
+    assert(a.get(0.0 * -1), 2);
+    a.set(2.0, 4);
+    assert(a.get(2), 4);
+    assert(Array.from(a.values()).join(), "1,2,3,4");
+    a.delete(NaN);
+    a.set(NaN, 5);
+    assert(Array.from(a.values()).join(), "2,3,4,5");
+
+    /* deletion and insertion during iteration */
+    n = 100;
+    a = new Set();
+    for(i = 0; i < n; i++)
+        a.add(i);
+    r = [];
+    for(var v of a) {
+        r.push(v);
+        if (v < n)
+            a.delete(v + 1);
+        if (v == 10)
+            a.add(n);
+    }
+    assert(r.length, n / 2 + 1);
+    assert(r[r.length - 1], n);
+
+    /* the records are compacted while an iterator is active */
+    a = new Set();
+    for(i = 0; i < 1000; i++)
+        a.add(i);
+    it = a.values();
+    assert(it.next().value, 0);
+    assert(it.next().value, 1);
+    for(i = 0; i < 990; i++)
+        a.delete(i);
+    for(i = 0; i < 1000; i++)
+        a.add(1000 + i);
+    r = Array.from(it);
+    assert(r.length, 1010);
+    assert(r[0], 990);
+    assert(r[r.length - 1], 1999);
+
+    /* clear during iteration */
+    a = new Map([[1, 1], [2, 2], [3, 3]]);
+    r = [];
+    a.forEach(function (v, k) {
+        r.push(k);
+        if (k == 1) {
+            a.clear();
+            a.set(4, 4);
+        }
+    });
+    assert(r.join(), "1,4");
+
+    /* many keys of mixed types */
+    a = new Map();
+    b = [];
+    for(i = 0; i < 10000; i++) {
+        b.push({});
+        a.set(b[i], i);
+        a.set("k" + i, i);
+        a.set(i + 0.5, i);
+    }
+    assert(a.size, 30000);
+    for(i = 0; i < 10000; i += 7) {
+        assert(a.get(b[i]), i);
+        assert(a.get("k" + i), i);
+        assert(a.get(i + 0.5), i);
+    }
+    for(i = 0; i < 10000; i++)
+        a.delete(b[i]);
+    assert(a.size, 20000);
+    assert(a.get("k9999"), 9999);
+}
+
 function test_weak_map()
 {
     var a, i, n, tab, o, v, n2;
@@ -778,6 +1034,61 @@ function test_weak_map()
     /* the WeakMap should be empty here */
 }
 
+/* the dead keys leave deleted records whose hash may match a new
+   object allocated at the same address */
+function test_weak_map_reuse()
+{
+    var wm, i, k;
+    wm = new WeakMap();
+    for(i = 0; i < 100000; i++) {
+        k = {};
+        wm.set(k, 1);
+    }
+    assert(wm.get(k), 1);
+}
+
+/* with --generational-gc, an old object only referenced by a young
+   cycle must be freed by the young collection freeing the cycle. The
+   finalizer of a std FILE object flushes its buffer, so it can be seen
+   in the file size. */
+function test_gc_young_cycle()
+{
+    var fname = "/tmp/test_builtin_gc.txt";
+    var holder, a, i, size;
+
+    function make_garbage(n)
+    {
+        var i, x;
+        for(i = 0; i < n; i++) {
+            x = { v: i };
+            x.self = x;
+        }
+    }
+
+    function file_size()
+    {
+        var [st, err] = os.stat(fname);
+        assert(err, 0);
+        return st.size;
+    }
+
+    holder = { f: std.open(fname, "w") };
+    holder.f.puts("abc");
+    /* promote the file object to the old generation */
+    make_garbage(100000);
+    a = { f: holder.f };
+    a.self = a;
+    holder.f = null;
+    a = null;
+    assert(file_size(), 0);
+    /* with --gc-pause-budget alone, the objects are only freed once
+       the incremental pass reaches them */
+    for(i = 0; i < 20 && file_size() != 3; i++)
+        make_garbage(100000);
+    assert(file_size(), 3);
+    os.remove(fname);
+}
+
 function test_generator()
 {
     function *f() {
@@ -842,6 +1153,8 @@ test_function();
 test_enum();
 test_array();
 test_string();
+test_string_concat();
+test_string_search();
 test_math();
 test_number();
 test_eval();
@@ -851,5 +1164,8 @@ test_date();
 test_regexp();
 test_symbol();
 test_map();
+test_map_order();
 test_weak_map();
+test_weak_map_reuse();
 test_generator();
+test_gc_young_cycle();
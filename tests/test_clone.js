@@ -0,0 +1,154 @@
+/* run with "qjs --clone-template clone_template.js": the global
+   variables are copied from the template context */
+"use strict";
+
+function assert(actual, expected, message) {
+    if (arguments.length == 1)
+        expected = true;
+
+    if (actual === expected)
+        return;
+
+    if (actual !== null && expected !== null
+    &&  typeof actual == 'object' && typeof expected == 'object'
+    &&  actual.toString() === expected.toString())
+        return;
+
+    throw Error("assertion failed: got |" + actual + "|" +
+                ", expected |" + expected + "|" +
+                (message ? " (" + message + ")" : ""));
+}
+
+function test_regexp()
+{
+    var i, n;
+    assert(tpl_re_count, 20);
+    n = 0;
+    for(i = 0; i < 20; i++) {
+        if (tpl_re.test("xxaab"))
+            n++;
+        if (tpl_re.test("xxacb"))
+            n--;
+    }
+    assert(n, 20);
+    assert(tpl_re.exec("xaaab")[0], "aaab");
+}
+
+function test_map_set()
+{
+    var i, keys;
+    assert(tpl_map.size, 50);
+    assert(tpl_set.size, 50);
+    for(i = 0; i < 100; i++) {
+        assert(tpl_map.get("k" + i), (i & 1) ? i : undefined);
+        assert(tpl_set.has(i), (i & 1) != 0);
+    }
+    /* the insertion order is kept */
+    keys = [];
+    tpl_map.forEach(function (v, k) { keys.push(v); });
+    assert(keys.length, 50);
+    assert(keys[0], 1);
+    assert(keys[49], 99);
+    for(i = 0; i < 100; i++) {
+        tpl_map.set("n" + i, i);
+        tpl_set.delete(i);
+    }
+    assert(tpl_map.size, 150);
+    assert(tpl_set.size, 0);
+}
+
+function test_closure()
+{
+    assert(tpl_counter.get(), 1);
+    assert(tpl_counter.inc(), 2);
+    assert(tpl_counter.get(), 2);
+}
+
+function test_array()
+{
+    assert(tpl_arr.length, 4);
+    assert(tpl_arr[3].a[1], 5);
+    tpl_arr.push(6);
+    assert(tpl_arr.toString(), "1,2,3,[object Object],6");
+    assert(tpl_sparse.length, 1001);
+    assert(tpl_sparse[1000], "x");
+    assert(0 in tpl_sparse, false);
+}
+
+/* the template and its clone do not share any mutable state */
+function test_isolation()
+{
+    var r, tpl, clone;
+    r = cloneContext('var arr = [1, { x: 2 }];' +
+                     'var map = new Map([["k", 1]]);' +
+                     'var obj = { p: 1 };' +
+                     'var counter = (function () {' +
+                     '    var n = 0;' +
+                     '    return function () { return ++n; };' +
+                     '})();');
+    tpl = r[0];
+    clone = r[1];
+    assert(clone.arr !== tpl.arr);
+    clone.arr.push(3);
+    clone.arr[1].x = 5;
+    clone.map.set("k", 2);
+    clone.map.set("k2", 3);
+    clone.obj.q = 2;
+    delete clone.obj.p;
+    clone.Array.prototype.extra = 1;
+    assert(clone.counter(), 1);
+    assert(clone.counter(), 2);
+
+    assert(tpl.arr.length, 2);
+    assert(tpl.arr[1].x, 2);
+    assert(tpl.map.size, 1);
+    assert(tpl.map.get("k"), 1);
+    assert(tpl.obj.p, 1);
+    assert("q" in tpl.obj, false);
+    assert("extra" in tpl.Array.prototype, false);
+    assert(tpl.counter(), 1);
+
+    /* and the other way */
+    tpl.arr.length = 0;
+    assert(clone.arr.length, 3);
+    assert(clone.counter(), 3);
+}
+
+function assert_clone_throws(script, message)
+{
+    var err = null;
+    try {
+        cloneContext(script);
+    } catch(e) {
+        err = e;
+    }
+    assert(err !== null, true, "no exception: " + script);
+    /* the error comes from the template realm */
+    assert(err.name, "TypeError");
+    if (message)
+        assert(err.message, message);
+}
+
+function test_errors()
+{
+    assert_clone_throws("var p = new Proxy({}, {});", "cannot clone a Proxy");
+    assert_clone_throws("var o = { a: [new Proxy([], {})] };",
+                        "cannot clone a Proxy");
+    assert_clone_throws("var ta = (function () {" +
+                        "    var ab = new ArrayBuffer(8);" +
+                        "    var ta = new Uint8Array(ab);" +
+                        "    detachArrayBuffer(ab);" +
+                        "    return ta;" +
+                        "})();", "cannot clone Uint8Array objects");
+    assert_clone_throws("var ta = new Int32Array(new SharedArrayBuffer(8));",
+                        "cannot clone Int32Array objects");
+    /* the runtime is still usable after the failed clones */
+    assert(cloneContext("var x = 1;")[1].x, 1);
+}
+
+test_regexp();
+test_map_set();
+test_closure();
+test_array();
+test_isolation();
+test_errors();
@@ -596,6 +596,124 @@ function test_optional_chaining()
     assert((a?.["b"])().c, 42);
 }
 
+function test_inline_cache()
+{
+    var a, b, c, i, r, proto;
+
+    function get_x(o) { return o.x; }
+    function set_x(o, v) { o.x = v; }
+
+    /* own properties, polymorphic site */
+    a = { x: 1 };
+    b = { y: 0, x: 2 };
+    c = { z: 0, y: 0, x: 3 };
+    r = 0;
+    for(i = 0; i < 10; i++)
+        r += get_x(a) + get_x(b) + get_x(c) + get_x({ w: 0, v: 0, x: 4 }) +
+            get_x({ x: 5, u: 0 });
+    assert(r, 150);
+    for(i = 0; i < 10; i++) {
+        set_x(a, i);
+        set_x(b, i + 1);
+    }
+    assert(a.x + b.x, 19);
+
+    /* shape modifications */
+    delete a.x;
+    assert(get_x(a), undefined);
+    a.x = 7;
+    assert(get_x(a), 7);
+    Object.defineProperty(b, "x", { get: function() { return 8; } });
+    assert(get_x(b), 8);
+    Object.freeze(c);
+    set_x(c, 10);
+    assert(get_x(c), 3);
+    assert_throws(TypeError, function() { "use strict"; c.x = 10; });
+
+    /* prototype properties */
+    proto = { x: 1 };
+    a = Object.create(proto);
+    for(i = 0; i < 3; i++)
+        assert(get_x(a), 1);
+    proto.x = 2;
+    assert(get_x(a), 2);
+    proto.y = 3;
+    assert(get_x(a), 2);
+    a.x = 4;
+    assert(get_x(a), 4);
+    b = Object.create(proto);
+    assert(get_x(b), 2);
+    Object.setPrototypeOf(b, { x: 5 });
+    assert(get_x(b), 5);
+    Object.defineProperty(proto, "x", { get: function() { return 6; } });
+    assert(get_x(Object.create(proto)), 6);
+
+    /* arrays */
+    a = [1, 2];
+    for(i = 0; i < 3; i++)
+        a.push(i);
+    assert(a.length, 5);
+    a.push = function() { return 0; };
+    assert(a.push(1), 0);
+    assert(a.length, 5);
+}
+
+let cache_l = 0;
+const cache_c = 1;
+
+function test_global_var_cache()
+{
+    var i, r;
+
+    function get_g() { return cache_g; }
+    function set_g(v) { cache_g = v; }
+
+    globalThis.cache_g = 1;
+    r = 0;
+    for(i = 0; i < 10; i++)
+        r += get_g();
+    assert(r, 10);
+    set_g(2);
+    assert(globalThis.cache_g, 2);
+    assert(get_g(), 2);
+
+    /* lexical variables */
+    function get_l() { return cache_l; }
+    function set_l(v) { cache_l = v; }
+    for(i = 0; i < 10; i++)
+        set_l(get_l() + 1);
+    assert(cache_l, 10);
+
+    /* deleted and redefined as a getter */
+    globalThis.cache_h = 1;
+    function get_h() { return cache_h; }
+    assert(get_h(), 1);
+    delete globalThis.cache_h;
+    assert_throws(ReferenceError, get_h);
+    Object.defineProperty(globalThis, "cache_h",
+                          { get: function() { return 5; }, configurable: true });
+    assert(get_h(), 5);
+
+    /* read-only variables */
+    function set_c(v) { cache_c = v; }
+    assert_throws(TypeError, function() { set_c(2); });
+    globalThis.cache_w = 1;
+    function set_w(v) { cache_w = v; }
+    set_w(2);
+    Object.defineProperty(globalThis, "cache_w", { writable: false });
+    set_w(3);
+    assert(globalThis.cache_w, 2);
+
+    /* globals created while they are read */
+    r = 0;
+    for(i = 0; i < 100; i++) {
+        globalThis["cache_v" + i] = i;
+        r += get_g();
+    }
+    assert(r, 200);
+    assert(globalThis.cache_v99, 99);
+}
+
 test_op1();
 test_cvt();
 test_eq();
@@ -618,3 +736,5 @@ test_function_expr_name();
 test_parse_semicolon();
 test_optional_chaining();
 test_parse_arrow_function();
+test_inline_cache();
+test_global_var_cache();
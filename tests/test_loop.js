@@ -74,6 +74,50 @@ function test_for()
     assert(c === 3 && j === 3);
 }
 
+function test_for_types()
+{
+    var i, c, n;
+
+    /* non int32 loop counters and bounds */
+    c = 0;
+    for(i = 0.5; i < 3; i++) {
+        c++;
+    }
+    assert(c === 3 && i === 3.5);
+
+    c = 0;
+    for(i = 0x7ffffffe; i < 0x80000001; i++) {
+        c++;
+    }
+    assert(c === 3 && i === 0x80000001);
+
+    c = 0;
+    for(i = "a"; i < "aaa"; i += "a") {
+        c++;
+    }
+    assert(c === 2);
+
+    c = 0;
+    for(i = 0; i < NaN; i++) {
+        c++;
+    }
+    assert(c === 0);
+
+    n = { valueOf() { c++; return 2; } };
+    c = 0;
+    for(i = 0; i < n; i++) {
+    }
+    assert(c === 3 && i === 2);
+
+    c = 0;
+    for(i = 0; i < 3; i++) {
+        if (i === 1)
+            i = "1";
+        c++;
+    }
+    assert(c === 3 && i === 3);
+}
+
 function test_for_in()
 {
     var i, tab, a, b;
@@ -371,10 +415,57 @@ function test_try_catch8()
     assert(s === "xafyaf");
 }
 
+function test_hot_loop()
+{
+    var i, s, f, b, n;
+
+    /* int32 overflow to float64 */
+    s = 0;
+    for(i = 0; i < 5000; i++) {
+        s = s + 0x7fffffff;
+    }
+    assert(s, 5000 * 0x7fffffff);
+
+    /* mixed int32 and float64 operands */
+    s = 0;
+    f = 0.5;
+    for(i = 0; i < 5000; i++) {
+        s = (s + i * 3) | 0;
+        f = f * 1.5 - i;
+        if (f > 1e10)
+            f = 0.25;
+    }
+    assert(s, 37492500);
+    assert(typeof f, "number");
+
+    /* -0, NaN and integer operators */
+    n = 0;
+    for(i = 0; i < 5000; i++) {
+        f = -i * 0;
+        if (1 / f < 0)
+            n++;
+        if (NaN < i || NaN >= i || NaN == NaN)
+            n = -1;
+        b = (i % -7) ^ (i << 3) ^ (i >> 1) ^ (-i >>> 28);
+    }
+    assert(n, 5000);
+    assert(b, (4999 % -7) ^ (4999 << 3) ^ (4999 >> 1) ^ (-4999 >>> 28));
+
+    /* type change in the middle of the loop */
+    s = 0;
+    for(i = 0; i < 5000; i++) {
+        if (i == 4000)
+            s = s + "";
+        s = s + 1;
+    }
+    assert(s, "40001" + "1".repeat(999));
+}
+
 test_while();
 test_while_break();
 test_do_while();
 test_for();
+test_for_types();
 test_for_break();
 test_switch1();
 test_switch2();
@@ -390,3 +481,4 @@ test_try_catch5();
 test_try_catch6();
 test_try_catch7();
 test_try_catch8();
+test_hot_loop();
@@ -22,6 +22,19 @@ function assert(actual, expected, message) {
 // load more elaborate version of assert if available
 try { std.loadScript("test_assert.js"); } catch(e) {}
 
+/* wrap a function called from the event loop: an exception there is
+   only printed, so exit with an error instead */
+function checked(f) {
+    return function () {
+        try {
+            return f.apply(this, arguments);
+        } catch(e) {
+            std.err.puts(e + "\n" + e.stack);
+            std.exit(1);
+        }
+    };
+}
+
 /*----------------*/
 
 function test_printf()
@@ -144,6 +157,73 @@ function test_ext_json()
     assert(JSON.stringify(obj), expected);
 }
 
+function test_json_parser()
+{
+    var p, out, str, i, buf, err;
+
+    /* chunked input with several top level values */
+    out = [];
+    p = new std.JSONParser((v) => out.push(v));
+    str = '{"a":[1,2.5,-1e3,"x\\u00e9\\ud83d\\ude00"],"b":{"c":null,"d":true}}\n[]\n"s" 12';
+    for(i = 0; i < str.length; i += 3)
+        p.write(str.slice(i, i + 3));
+    p.end();
+    assert(JSON.stringify(out),
+           '[{"a":[1,2.5,-1000,"x\u00e9\ud83d\ude00"],"b":{"c":null,"d":true}},[],"s",12]');
+
+    /* only the selected values are built */
+    out = [];
+    p = new std.JSONParser((v) => out.push(v), { select: ["items", "*", "name"] });
+    str = JSON.stringify({ x: [1, { name: 0 }], items: [{ name: "a", y: [1, 2] },
+                                                       { name: { n: 1 } }, { z: 1 }] });
+    buf = new Uint8Array(str.length);
+    for(i = 0; i < str.length; i++)
+        buf[i] = str.charCodeAt(i);
+    p.write(buf.subarray(0, 20));
+    p.write(buf.buffer.slice(20));
+    p.end();
+    assert(JSON.stringify(out), '["a",{"n":1}]');
+
+    /* events */
+    out = [];
+    p = new std.JSONParser((e, v) => out.push(v === undefined ? e : e + ":" + v),
+                           { events: true });
+    p.write('{"k":[1,"s",{}]}');
+    p.end();
+    assert(out.join(" "), "startObject key:k startArray value:1 value:s " +
+           "startObject endObject endArray endObject");
+
+    /* empty keys and strings */
+    out = [];
+    p = new std.JSONParser((v) => out.push(v));
+    p.write('{"":1,"a":{"":""}}');
+    p.end();
+    assert(JSON.stringify(out), '[{"":1,"a":{"":""}}]');
+    out = [];
+    p = new std.JSONParser((v) => out.push(v), { select: ["", "*"] });
+    p.write('{"":[2],"b":[3]}');
+    p.end();
+    assert(JSON.stringify(out), '[2]');
+    out = [];
+    p = new std.JSONParser((e, v) => out.push(e + ":" + v), { events: true });
+    p.write('{"":""}');
+    p.end();
+    assert(out.join(" "), "startObject:undefined key: value: endObject:undefined");
+
+    /* errors */
+    for(str of ['{"a":1,}', '[1 2]', '"\x01"', '01', '{"a"', '[1}', '"\\x"']) {
+        err = null;
+        p = new std.JSONParser((v) => {});
+        try {
+            p.write(str);
+            p.end();
+        } catch(e) {
+            err = e;
+        }
+        assert(err instanceof SyntaxError, true, str);
+    }
+}
+
 function test_os()
 {
     var fd, fpath, fname, fdir, buf, buf2, i, files, err, fdate, st, link_path;
@@ -286,6 +366,284 @@ function test_timer()
         os.clearTimeout(th[i]);
 }
 
+function test_timer_order()
+{
+    var th, i, res;
+
+    /* the timers are called by timeout, then in creation order */
+    res = [];
+    os.setTimeout(function () { res.push(3); }, 20);
+    for(i = 0; i < 3; i++) {
+        os.setTimeout(function (i) { res.push(i); }.bind(null, i), 0);
+    }
+    th = [];
+    for(i = 0; i < 1000; i++)
+        th[i] = os.setTimeout(function () { res.push(-1); }, 10 + (i % 7));
+    for(i = 0; i < 1000; i += 2)
+        os.clearTimeout(th[i]);
+    for(i = 1; i < 1000; i += 2)
+        os.clearTimeout(th[i]);
+    os.setTimeout(checked(function () {
+        assert(res.join(), "0,1,2,3");
+    }), 30);
+}
+
+function test_socket()
+{
+    var srv, cli, conn, ret, addr, err, buf, msg, received, done;
+
+    /* TCP echo over the loopback interface, driven by the event loop */
+    srv = os.socket(os.AF_INET, os.SOCK_STREAM);
+    assert(srv >= 0);
+    assert(os.setsockopt(srv, os.SOL_SOCKET, os.SO_REUSEADDR, 1), 0);
+    assert(os.bind(srv, { addr: "127.0.0.1", port: 0 }), 0);
+    assert(os.listen(srv), 0);
+    [addr, err] = os.getsockname(srv);
+    assert(err, 0);
+    assert(addr.family, os.AF_INET);
+    assert(addr.addr, "127.0.0.1");
+    assert(addr.port > 0);
+    assert(os.accept(srv), -std.Error.EAGAIN);
+
+    cli = os.socket(os.AF_INET, os.SOCK_STREAM);
+    ret = os.connect(cli, addr);
+    assert(ret === 0 || ret === -std.Error.EINPROGRESS);
+
+    msg = "hello socket";
+    buf = new ArrayBuffer(64);
+    received = "";
+    done = false;
+    os.setReadHandler(srv, checked(function () {
+        conn = os.accept(srv);
+        assert(conn >= 0);
+        os.setReadHandler(srv, null);
+        os.close(srv);
+        os.setReadHandler(conn, checked(function () {
+            var b = new ArrayBuffer(64);
+            var n = os.recv(conn, b, 0, b.byteLength);
+            if (n > 0) {
+                assert(os.send(conn, b, 0, n), n);
+            } else {
+                assert(n, 0);
+                os.setReadHandler(conn, null);
+                os.close(conn);
+            }
+        }));
+    }));
+    os.setWriteHandler(cli, checked(function () {
+        var e;
+        os.setWriteHandler(cli, null);
+        [e] = os.getsockopt(cli, os.SOL_SOCKET, os.SO_ERROR);
+        assert(e, 0);
+        assert(os.getpeername(cli)[0].port, addr.port);
+        new Uint8Array(buf).set(msg.split("").map((c) => c.charCodeAt(0)));
+        assert(os.send(cli, buf, 0, msg.length), msg.length);
+    }));
+    os.setReadHandler(cli, checked(function () {
+        var n = os.recv(cli, buf, 16, 32);
+        assert(n > 0);
+        received += String.fromCharCode.apply(null, new Uint8Array(buf, 16, n));
+        if (received.length === msg.length) {
+            os.setReadHandler(cli, null);
+            assert(os.shutdown(cli, os.SHUT_RDWR), 0);
+            os.close(cli);
+            done = true;
+        }
+    }));
+
+    /* UDP datagrams keep the sender address */
+    var s1, s2, a1, a2, n;
+    s1 = os.socket(os.AF_INET, os.SOCK_DGRAM);
+    s2 = os.socket(os.AF_INET, os.SOCK_DGRAM);
+    assert(os.bind(s1, { addr: "127.0.0.1" }), 0);
+    assert(os.bind(s2, { addr: "127.0.0.1" }), 0);
+    a1 = os.getsockname(s1)[0];
+    a2 = os.getsockname(s2)[0];
+    assert(os.recvfrom(s2, buf, 0, 8)[1], -std.Error.EAGAIN);
+    assert(os.sendto(s1, new Uint8Array([1, 2, 3]).buffer, 1, 2, a2), 2);
+    os.setReadHandler(s2, checked(function () {
+        [addr, n] = os.recvfrom(s2, buf, 0, 8);
+        assert(n, 2);
+        assert(new Uint8Array(buf, 0, 2).join(), "2,3");
+        assert(addr.port, a1.port);
+        os.setReadHandler(s2, null);
+        os.close(s1);
+        os.close(s2);
+    }));
+
+    os.setTimeout(checked(function () {
+        assert(done, true, "TCP echo did not complete");
+    }), 500);
+}
+
+function test_read_handler_fd_reuse()
+{
+    var fds, fds2, done;
+
+    /* the fd is closed while its read handler is still set */
+    fds = os.pipe();
+    os.setReadHandler(fds[0], function () { });
+    os.close(fds[0]);
+    os.close(fds[1]);
+
+    /* the new pipe reuses the same fd numbers */
+    fds2 = os.pipe();
+    assert(fds2[0], fds[0]);
+    done = false;
+    os.setReadHandler(fds2[0], function () {
+        var b = new ArrayBuffer(4);
+        assert(os.read(fds2[0], b, 0, 4), 1);
+        os.setReadHandler(fds2[0], null);
+        os.close(fds2[0]);
+        os.close(fds2[1]);
+        done = true;
+    });
+    os.write(fds2[1], new Uint8Array([1]).buffer, 0, 1);
+    os.setTimeout(function () {
+        if (!done) {
+            std.err.puts("read handler of a reused fd not called\n");
+            std.exit(1);
+        }
+    }, 500);
+}
+
+function test_read_handler_regular_file()
+{
+    var fname, fd, fds, file_count, pipe_done;
+
+    /* epoll rejects the regular files: they are always ready and the
+       other descriptors must still be polled */
+    fname = "test_read_handler.tmp";
+    fd = os.open(fname, os.O_RDWR | os.O_CREAT | os.O_TRUNC);
+    assert(fd >= 0);
+    file_count = 0;
+    os.setReadHandler(fd, function () {
+        if (++file_count == 3) {
+            os.setReadHandler(fd, null);
+            os.close(fd);
+            os.remove(fname);
+        }
+    });
+    fds = os.pipe();
+    /* select() cannot poll a descriptor >= FD_SETSIZE (usually 1024),
+       so use one if the limits allow it */
+    if (os.dup2(fds[0], 1500) == 1500) {
+        os.close(fds[0]);
+        fds[0] = 1500;
+    }
+    pipe_done = false;
+    os.setReadHandler(fds[0], function () {
+        var b = new ArrayBuffer(1);
+        assert(os.read(fds[0], b, 0, 1), 1);
+        os.setReadHandler(fds[0], null);
+        os.close(fds[0]);
+        os.close(fds[1]);
+        pipe_done = true;
+    });
+    os.setTimeout(function () {
+        os.write(fds[1], new Uint8Array([1]).buffer, 0, 1);
+    }, 10);
+    os.setTimeout(function () {
+        if (file_count != 3 || !pipe_done) {
+            std.err.puts("read handlers of a regular file and a pipe not called\n");
+            std.exit(1);
+        }
+    }, 500);
+}
+
+async function test_io_async()
+{
+    var fname, fd, buf, rbuf, res, fds, p, i, n;
+
+    fname = "test_io_async.tmp";
+    fd = os.open(fname, os.O_RDWR | os.O_CREAT | os.O_TRUNC);
+    assert(fd >= 0);
+    buf = new Uint8Array(4096);
+    for(i = 0; i < buf.length; i++)
+        buf[i] = i & 0xff;
+    assert(await os.writeAsync(fd, buf.buffer, 0, buf.length, 0), buf.length);
+
+    /* many small reads submitted in the same tick */
+    rbuf = new Uint8Array(buf.length);
+    p = [];
+    for(i = 0; i < 64; i++)
+        p.push(os.readAsync(fd, rbuf.buffer, i * 64, 64, i * 64));
+    res = await Promise.all(p);
+    assert(res.every((n) => n === 64), true);
+    assert(rbuf.join(), buf.join());
+    /* end of file */
+    assert(await os.readAsync(fd, rbuf.buffer, 0, 16, buf.length), 0);
+    os.close(fd);
+    os.remove(fname);
+    assert(await os.readAsync(fd, rbuf.buffer, 0, 16), -std.Error.EBADF);
+
+    /* the read waits until the pipe is readable */
+    fds = os.pipe();
+    rbuf = new Uint8Array(16);
+    p = os.readAsync(fds[0], rbuf.buffer, 4, 8);
+    os.setTimeout(function () {
+        os.write(fds[1], new Uint8Array([1, 2, 3]).buffer, 0, 3);
+    }, 10);
+    n = await p;
+    assert(n, 3);
+    assert(rbuf.slice(4, 7).join(), "1,2,3");
+    assert(await os.writeAsync(fds[1], buf.buffer, 0, 2), 2);
+    assert(await os.readAsync(fds[0], rbuf.buffer, 0, 16), 2);
+    os.close(fds[1]);
+    assert(await os.readAsync(fds[0], rbuf.buffer, 0, 16), 0);
+    os.close(fds[0]);
+}
+
+function test_mmap()
+{
+    var fname, fd, buf, ab, ab2, err;
+
+    fname = "test_mmap.tmp";
+    fd = os.open(fname, os.O_RDWR | os.O_CREAT | os.O_TRUNC);
+    assert(fd >= 0);
+    buf = new Uint8Array(10000);
+    for(var i = 0; i < buf.length; i++)
+        buf[i] = i & 0xff;
+    assert(os.write(fd, buf.buffer, 0, buf.length), buf.length);
+
+    /* whole file */
+    [ab, err] = os.mmap(fd);
+    assert(err, 0);
+    assert(ab.byteLength, buf.length);
+    assert(new Uint8Array(ab).join(), buf.join());
+
+    /* unaligned offset, private copy on write */
+    [ab, err] = os.mmap(fd, 5000, 16);
+    assert(err, 0);
+    assert(new Uint8Array(ab).join(), buf.subarray(5000, 5016).join());
+    new Uint8Array(ab)[0] = 42;
+    [ab2] = os.mmap(fd, 5000, 16);
+    assert(new Uint8Array(ab2)[0], 5000 & 0xff);
+
+    /* shared writable mapping */
+    [ab, err] = os.mmap(fd, 0, 4, os.PROT_READ | os.PROT_WRITE);
+    assert(err, 0);
+    new Uint8Array(ab)[1] = 99;
+    assert(os.seek(fd, 1, std.SEEK_SET), 1);
+    assert(os.read(fd, buf.buffer, 0, 1), 1);
+    assert(buf[0], 99);
+
+    assert(os.mmap(fd, 20000)[0].byteLength, 0);
+    /* the mapping cannot go past the end of file */
+    [ab, err] = os.mmap(fd, 0, 100000);
+    assert(ab, null);
+    assert(err, std.Error.EINVAL);
+    [ab, err] = os.mmap(fd, 9990, 11);
+    assert(ab, null);
+    assert(err, std.Error.EINVAL);
+    assert(os.mmap(fd, 9990, 10)[0].byteLength, 10);
+    os.close(fd);
+    os.remove(fname);
+    [ab, err] = os.mmap(fd);
+    assert(ab, null);
+    assert(err, std.Error.EBADF);
+}
+
 /* test closure variable handling when freeing asynchronous
    function */
 function test_async_gc()
@@ -314,8 +672,18 @@ test_popen();
 test_os();
 if (os.platform !== 'win32') {
     test_os_exec();
+    test_socket();
+    test_read_handler_fd_reuse();
+    test_read_handler_regular_file();
+    test_mmap();
+    test_io_async().catch((e) => {
+        std.err.puts(e + "\n" + e.stack);
+        std.exit(1);
+    });
 }
 test_timer();
+test_timer_order();
 test_ext_json();
+test_json_parser();
 test_async_gc();
 
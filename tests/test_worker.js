@@ -19,6 +19,22 @@ function assert(actual, expected, message) {
                 (message ? " (" + message + ")" : ""));
 }
 
+function assert_throws(expected_error, func)
+{
+    var err = false;
+    try {
+        func();
+    } catch(e) {
+        err = true;
+        if (!(e instanceof expected_error)) {
+            throw Error("unexpected exception type");
+        }
+    }
+    if (!err) {
+        throw Error("expected exception");
+    }
+}
+
 var worker;
 
 function test_worker()
@@ -47,6 +63,21 @@ function test_worker()
                 let buf = ev.buf;
                 /* check that the SharedArrayBuffer was modified */
                 assert(buf[2], 10);
+                /* test ArrayBuffer transfer */
+                let ab = new ArrayBuffer(16);
+                let ta = new Uint8Array(ab);
+                ta[0] = 1;
+                worker.postMessage({ type: "transfer", buf: ta }, [ ab ]);
+                assert(ab.byteLength, 0);
+                assert(ta.length, 0);
+            }
+            break;
+        case "transfer_done":
+            {
+                let buf = ev.buf;
+                assert(buf.length, 16);
+                assert(buf[0], 1);
+                assert(buf[1], 2);
                 worker.postMessage({ type: "abort" });
             }
             break;
@@ -58,5 +89,25 @@ function test_worker()
     };
 }
 
+function test_transfer_errors()
+{
+    var ab, ab2;
+
+    ab = new ArrayBuffer(8);
+    assert_throws(TypeError, () => worker.postMessage({}, [ {} ]));
+    assert_throws(TypeError, () => worker.postMessage({}, [ new Uint8Array(4) ]));
+    assert_throws(TypeError, () => worker.postMessage({}, [ new SharedArrayBuffer(4) ]));
+    assert_throws(TypeError, () => worker.postMessage({}, [ ab, ab ]));
+    assert_throws(TypeError, () => worker.postMessage({}, [ ab, {} ]));
+    /* a failed transfer does not detach the ArrayBuffers */
+    assert(ab.byteLength, 8);
+
+    /* the message is ignored by the worker */
+    ab2 = new ArrayBuffer(8);
+    worker.postMessage({ type: "ignored" }, [ ab2 ]);
+    assert(ab2.byteLength, 0);
+    assert_throws(TypeError, () => worker.postMessage({}, [ ab2 ]));
+}
 
 test_worker();
+test_transfer_errors();
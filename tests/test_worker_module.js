@@ -17,6 +17,12 @@ function handle_msg(e) {
         ev.buf[2] = 10;
         parent.postMessage({ type: "sab_done", buf: ev.buf });
         break;
+    case "transfer":
+        /* modify the transferred ArrayBuffer and send it back */
+        ev.buf[1] = ev.buf[0] + 1;
+        parent.postMessage({ type: "transfer_done", buf: ev.buf },
+                           [ ev.buf.buffer ]);
+        break;
     }
 }
 
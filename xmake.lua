@@ -17,6 +17,11 @@ option("mimalloc")
     set_showmenu(true)
 option_end()
 
+option("jit")
+    set_default(false)
+    set_showmenu(true)
+option_end()
+
 set_rundir("$(projectdir)")
 add_includedirs("src")
 add_repositories("zeromake https://github.com/zeromake/xrepo.git")
@@ -121,6 +126,9 @@ local function use_packages()
     if get_config("js-debugger") then
         add_defines("CONFIG_DEBUGGER=1")
     end
+    if get_config("jit") then
+        add_defines("CONFIG_JIT=1")
+    end
 end
 
 target("quickjs")